@@ -99,7 +99,9 @@ struct match_backend {
 	/** Function to update an existing table */
 	int (*update_table)(struct net_mat_tbl *);
 
-	/* Generate a  port list and hold reference */
+	/* Generate a port list terminated by NET_MAT_PORT_ID_UNSPEC, the
+	 * list is allocated by the backend and freed by the caller
+	 */
 	int (*get_ports)(struct net_mat_port **ports);
 
 	/* Release reference to ports */
@@ -182,6 +184,37 @@ struct match_backend *match_backend_open(const char *name, void *init_arg);
  */
 void match_backend_close(struct match_backend *backend);
 
+/**
+ * Prototype of the handler notified of asynchronous port changes.
+ */
+typedef void (*match_backend_port_event_fn)(uint32_t port_id,
+					    enum port_state state);
+
+/**
+ * Install the handler notified of asynchronous port changes.
+ *
+ * matchd installs a handler which forwards the change to the clients
+ * subscribed to port events.
+ *
+ * @param handler
+ *   The handler to call, or NULL to stop notifications.
+ */
+void match_backend_set_port_event_handler(match_backend_port_event_fn handler);
+
+/**
+ * Report an asynchronous port change, such as a link transition.
+ *
+ * Backends call this from their event context when the state of a port
+ * changes without a request from a client. It may be called from a
+ * thread other than the one running the matchd receive loop.
+ *
+ * @param port_id
+ *   The port which changed.
+ * @param state
+ *   The new state of the port.
+ */
+void match_backend_port_event(uint32_t port_id, enum port_state state);
+
 /**
  * Print names of all available backends.
  */
@@ -34,6 +34,7 @@
 #include <linux/in6.h>
 
 #define MATCHLIB_PID_FILE "/var/run/matchd.pid"
+#define MATCHLIB_CACHE_FILE "/var/run/matchlib.cache"
 #define NET_MAT_DFLT_FAMILY 555
 
 /**
@@ -281,6 +282,74 @@ struct net_mat_rule {
 	struct net_mat_action *actions;
 };
 
+/**
+ * @struct net_mat_rule_filter
+ * @brief rules returned by a get rules request
+ *
+ * @matches null terminated set of field references, the value of the rule
+ *	    under the mask of the reference must equal the value of the
+ *	    reference under the same mask
+ * @action uid of an action the rule must apply, 0 for any
+ * @min_packets count of packets the rule must have matched at least
+ * @top if not 0, only the @top rules passing the filter with the highest
+ *	@top_key are returned, highest first
+ * @top_key one of NET_MAT_RULES_TOP_*
+ *
+ * rules must pass all of the above.
+ */
+struct net_mat_rule_filter {
+	struct net_mat_field_ref *matches;
+	__u32 action;
+	__u64 min_packets;
+	__u32 top;
+	__u32 top_key;
+};
+
+/**
+ * Compact rule encoding
+ *
+ * With NET_MAT_RULES_ENC_COMPACT rules are carried in a single
+ * NET_MAT_RULES_COMPACT attribute instead of a NET_MAT_RULES nest. The
+ * attribute holds a packed sequence of fixed size records in host byte
+ * order, each rule being a net_mat_compact_rule followed by @nmatches
+ * net_mat_compact_field records and @nactions net_mat_compact_action
+ * records, each action followed by its @nargs net_mat_compact_arg
+ * records. Names are not carried, they are resolved from the uids.
+ * Every record is a multiple of 8 bytes so records stay aligned.
+ */
+struct net_mat_compact_rule {
+	__u32 table_id;
+	__u32 uid;
+	__u32 priority;
+	__u16 nmatches;
+	__u16 nactions;
+	__u64 bytes;
+	__u64 packets;
+};
+
+struct net_mat_compact_field {
+	__u32 instance;
+	__u32 header;
+	__u32 field;
+	__u8 mask_type;
+	__u8 type;
+	__u16 reserved;
+	__u8 value[16];
+	__u8 mask[16];
+};
+
+struct net_mat_compact_action {
+	__u32 uid;
+	__u16 nargs;
+	__u16 reserved;
+};
+
+struct net_mat_compact_arg {
+	__u32 type;
+	__u32 reserved;
+	__u8 value[16];
+};
+
 /**
  * @struct net_mat_port_stats
  * @brief per port statsistics strucutre
@@ -414,6 +483,7 @@ enum {
 	NET_MAT_FIELD_REF_ATTR_TYPE_U32,
 	NET_MAT_FIELD_REF_ATTR_TYPE_U64,
 	NET_MAT_FIELD_REF_ATTR_TYPE_IN6,
+	__NET_MAT_FIELD_REF_ATTR_TYPE_VAL_MAX,
 };
 
 enum {
@@ -588,10 +658,36 @@ enum {
 	NET_MAT_TABLE_RULES_MINPRIO,
 	NET_MAT_TABLE_RULES_MAXPRIO,
 	NET_MAT_TABLE_RULES_RULES,
+	NET_MAT_TABLE_RULES_ENCODING,
+	NET_MAT_TABLE_RULES_FILTER,
 	__NET_MAT_TABLE_RULES_MAX,
 };
 #define NET_MAT_TABLE_RULES_MAX (__NET_MAT_TABLE_RULES_MAX - 1)
 
+/* NET_MAT_TABLE_RULES_FILTER nest, see struct net_mat_rule_filter */
+enum {
+	NET_MAT_RULES_FILTER_UNSPEC,
+	NET_MAT_RULES_FILTER_MATCHES,
+	NET_MAT_RULES_FILTER_ACTION,
+	NET_MAT_RULES_FILTER_MIN_PACKETS,
+	NET_MAT_RULES_FILTER_TOP,
+	NET_MAT_RULES_FILTER_TOP_KEY,
+	__NET_MAT_RULES_FILTER_MAX,
+};
+#define NET_MAT_RULES_FILTER_MAX (__NET_MAT_RULES_FILTER_MAX - 1)
+
+/* Ranking of NET_MAT_RULES_FILTER_TOP. The rate is in packets per second,
+ * measured by the daemon over a window of at least a second ending with
+ * the request, or since the rule was installed.
+ */
+enum {
+	NET_MAT_RULES_TOP_PACKETS,
+	NET_MAT_RULES_TOP_BYTES,
+	NET_MAT_RULES_TOP_RATE,
+	__NET_MAT_RULES_TOP_MAX,
+};
+#define NET_MAT_RULES_TOP_MAX (__NET_MAT_RULES_TOP_MAX - 1)
+
 enum {
 	/* Abort with normal errmsg */
 	NET_MAT_RULES_ERROR_ABORT,
@@ -605,6 +701,20 @@ enum {
 };
 #define NET_MAT_RULES_ERROR_MAX (__NET_MAT_RULES_ERROR_MAX - 1)
 
+enum {
+	/* NET_MAT_RULES nest of NET_MAT_RULE attributes */
+	NET_MAT_RULES_ENC_NLA,
+	/* NET_MAT_RULES_COMPACT packed records */
+	NET_MAT_RULES_ENC_COMPACT,
+	__NET_MAT_RULES_ENC_MAX,
+};
+#define NET_MAT_RULES_ENC_MAX (__NET_MAT_RULES_ENC_MAX - 1)
+
+/* Optional features advertised in NET_MAT_FEATURES */
+#define NET_MAT_FEATURE_RULES_COMPACT	(1 << 0)
+#define NET_MAT_FEATURE_RULES_FILTER	(1 << 1)
+#define NET_MAT_FEATURE_RULES_TOP	(1 << 2)
+
 enum {
 	NET_MAT_ATTR_UNSPEC,
 	NET_MAT_ATTR_ERROR,
@@ -799,6 +909,138 @@ enum {
 	NET_MAT_IDENTIFIER_IFINDEX, /* net_device ifindex */
 };
 
+/* Change events sent by matchd to the clients subscribed to them */
+enum net_mat_event_type {
+	NET_MAT_EVENT_T_UNSPEC,
+	NET_MAT_EVENT_T_RULE_ADD,
+	NET_MAT_EVENT_T_RULE_DEL,
+	NET_MAT_EVENT_T_RULE_UPDATE,
+	NET_MAT_EVENT_T_TABLE_CREATE,
+	NET_MAT_EVENT_T_TABLE_DESTROY,
+	NET_MAT_EVENT_T_TABLE_UPDATE,
+	NET_MAT_EVENT_T_PORT_CHANGE,
+	__NET_MAT_EVENT_T_MAX,
+};
+#define NET_MAT_EVENT_T_MAX (__NET_MAT_EVENT_T_MAX - 1)
+
+static const char *__event_type_str[] =
+{
+	[NET_MAT_EVENT_T_UNSPEC] =		"",
+	[NET_MAT_EVENT_T_RULE_ADD] =		"rule_add",
+	[NET_MAT_EVENT_T_RULE_DEL] =		"rule_del",
+	[NET_MAT_EVENT_T_RULE_UPDATE] =	"rule_update",
+	[NET_MAT_EVENT_T_TABLE_CREATE] =	"table_create",
+	[NET_MAT_EVENT_T_TABLE_DESTROY] =	"table_destroy",
+	[NET_MAT_EVENT_T_TABLE_UPDATE] =	"table_update",
+	[NET_MAT_EVENT_T_PORT_CHANGE] =	"port_change",
+};
+
+static inline const char *event_type_str(__u32 i) {
+	return i < __NET_MAT_EVENT_T_MAX ? __event_type_str[i] : "";
+}
+
+/* Subscription mask, one bit per class of events */
+#define NET_MAT_EVENT_F_RULES	(1 << 0)
+#define NET_MAT_EVENT_F_TABLES	(1 << 1)
+#define NET_MAT_EVENT_F_PORTS	(1 << 2)
+#define NET_MAT_EVENT_F_ALL	(NET_MAT_EVENT_F_RULES | \
+				 NET_MAT_EVENT_F_TABLES | \
+				 NET_MAT_EVENT_F_PORTS)
+
+struct net_mat_event {
+	enum net_mat_event_type type;
+	__u32 table_id;
+	__u32 uid;
+	__u32 port_id;
+	enum port_state state;
+};
+
+enum {
+	NET_MAT_EVENT_ATTR_UNSPEC,
+	NET_MAT_EVENT_ATTR_TYPE,
+	NET_MAT_EVENT_ATTR_TABLE,
+	NET_MAT_EVENT_ATTR_UID,
+	NET_MAT_EVENT_ATTR_PORT,
+	NET_MAT_EVENT_ATTR_STATE,
+	__NET_MAT_EVENT_ATTR_MAX,
+};
+#define NET_MAT_EVENT_ATTR_MAX (__NET_MAT_EVENT_ATTR_MAX - 1)
+
+enum {
+	NET_MAT_EVENT_UNSPEC,
+	NET_MAT_EVENT,
+	__NET_MAT_EVENT_MAX,
+};
+#define NET_MAT_EVENT_MAX (__NET_MAT_EVENT_MAX - 1)
+
+/* Latency histogram of a command, bucket 0 counts the requests answered in
+ * less than 1us, bucket i those answered in [2^(i-1), 2^i) us and the last
+ * bucket everything slower.
+ */
+#define NET_MAT_STATS_LATENCY_BUCKETS 24
+
+/* Counters kept by matchd for each command it answers */
+struct net_mat_cmd_stats {
+	__u32 cmd;
+	__u64 requests;
+	__u64 errors;
+	__u64 rx_bytes;		/* request bytes */
+	__u64 tx_bytes;		/* reply bytes, including errors and NLMSG_DONE */
+	__u64 multipart;	/* replies sent as multipart messages */
+	__u64 latency_ns;	/* total time from receive to reply */
+	__u64 latency[NET_MAT_STATS_LATENCY_BUCKETS];
+};
+
+/* Occupancy of the rule store of a table */
+struct net_mat_table_stats {
+	__u32 table_id;
+	__u32 size;
+	__u32 rules;
+};
+
+/* Reply to NET_MAT_DAEMON_CMD_GET_STATS, cmds is terminated by an entry
+ * without requests and tables by an entry with table_id 0.
+ */
+struct net_mat_stats {
+	__u64 rx_drops;		/* receive queue overruns (ENOBUFS) */
+	__u64 event_drops;	/* events not delivered to a subscriber */
+	struct net_mat_cmd_stats *cmds;
+	struct net_mat_table_stats *tables;
+};
+
+enum {
+	NET_MAT_STATS_CMD_ATTR_UNSPEC,
+	NET_MAT_STATS_CMD_ATTR_CMD,
+	NET_MAT_STATS_CMD_ATTR_REQUESTS,
+	NET_MAT_STATS_CMD_ATTR_ERRORS,
+	NET_MAT_STATS_CMD_ATTR_RX_BYTES,
+	NET_MAT_STATS_CMD_ATTR_TX_BYTES,
+	NET_MAT_STATS_CMD_ATTR_MULTIPART,
+	NET_MAT_STATS_CMD_ATTR_LATENCY_NS,
+	NET_MAT_STATS_CMD_ATTR_LATENCY,	/* array of __u64 buckets */
+	__NET_MAT_STATS_CMD_ATTR_MAX,
+};
+#define NET_MAT_STATS_CMD_ATTR_MAX (__NET_MAT_STATS_CMD_ATTR_MAX - 1)
+
+enum {
+	NET_MAT_STATS_TABLE_ATTR_UNSPEC,
+	NET_MAT_STATS_TABLE_ATTR_ID,
+	NET_MAT_STATS_TABLE_ATTR_SIZE,
+	NET_MAT_STATS_TABLE_ATTR_RULES,
+	__NET_MAT_STATS_TABLE_ATTR_MAX,
+};
+#define NET_MAT_STATS_TABLE_ATTR_MAX (__NET_MAT_STATS_TABLE_ATTR_MAX - 1)
+
+enum {
+	NET_MAT_STATS_UNSPEC,
+	NET_MAT_STATS_RX_DROPS,
+	NET_MAT_STATS_CMD,
+	NET_MAT_STATS_TABLE,
+	NET_MAT_STATS_EVENT_DROPS,
+	__NET_MAT_STATS_MAX,
+};
+#define NET_MAT_STATS_MAX (__NET_MAT_STATS_MAX - 1)
+
 enum {
 	NET_MAT_UNSPEC,
 	NET_MAT_IDENTIFIER_TYPE,
@@ -815,6 +1057,17 @@ enum {
 
 	NET_MAT_PORTS,
 
+	NET_MAT_GENERATION,
+
+	NET_MAT_EVENT_MASK,
+	NET_MAT_EVENTS,
+
+	NET_MAT_FEATURES,
+	NET_MAT_RULES_COMPACT,
+
+	NET_MAT_FLIGHT,		/* packed struct mat_flight_event records */
+	NET_MAT_STATS,
+
 	__NET_MAT_MAX,
 	NET_MAT_MAX = (__NET_MAT_MAX - 1),
 };
@@ -840,6 +1093,14 @@ enum {
 	NET_MAT_PORT_CMD_GET_PHYS_PORT,
 	NET_MAT_PORT_CMD_SET_PORTS,
 
+	NET_MAT_TABLE_CMD_GET_GENERATION,
+
+	NET_MAT_EVENT_CMD_SUBSCRIBE,
+	NET_MAT_EVENT_CMD_NOTIFY,
+
+	NET_MAT_DAEMON_CMD_GET_FLIGHT,
+	NET_MAT_DAEMON_CMD_GET_STATS,
+
 	__NET_MAT_CMD_MAX,
 	NET_MAT_CMD_MAX = (__NET_MAT_CMD_MAX - 1),
 };
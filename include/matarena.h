@@ -0,0 +1,58 @@
+/*******************************************************************************
+
+  MATCH Library - Region allocator for decoded MATCH objects
+  Copyright (c) <2015>, Intel Corporation
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+#ifndef _MATARENA_H
+#define _MATARENA_H
+
+#include <stddef.h>
+
+/* Default size of each arena chunk, large enough to hold a full
+ * NET_MAT_RULES reply without spilling into a second chunk.
+ */
+#define MAT_ARENA_DEFAULT_CHUNK 65536
+
+struct mat_arena;
+
+struct mat_arena_stats {
+	size_t used;		/* bytes handed out since the last reset */
+	size_t reserved;	/* bytes currently held in chunks */
+	unsigned int chunks;	/* number of chunks currently held */
+	unsigned int allocs;	/* allocations since the last reset */
+};
+
+struct mat_arena *mat_arena_create(size_t chunk_size);
+void mat_arena_destroy(struct mat_arena *arena);
+void mat_arena_reset(struct mat_arena *arena);
+
+void *mat_arena_calloc(struct mat_arena *arena, size_t nmemb, size_t size);
+char *mat_arena_strdup(struct mat_arena *arena, const char *s);
+
+void mat_arena_get_stats(struct mat_arena *arena,
+			 struct mat_arena_stats *stats);
+
+#endif	/* _MATARENA_H */
@@ -33,8 +33,18 @@
 int matchd_init(struct nl_sock *sock, int family_id, const char *backend_name,
                void *init_arg);
 int matchd_uninit(void);
+void matchd_set_verbose(int verbose);
 int matchd_rx_process(struct nlmsghdr *nlh);
 
+/* Replies and events are sent on the socket passed to matchd_init() unless
+ * a send hook is installed. The hook returns the number of bytes sent or a
+ * negative error and must not free the message.
+ */
+typedef int (*matchd_send_fn_t)(struct nl_msg *msg, void *arg);
+void matchd_set_send(matchd_send_fn_t fn, void *arg);
+
 int matchd_receive_loop(struct nl_sock *sock);
 
+int matchd_shm_enable(const char *path, unsigned int interval_ms);
+
 #endif /* __MATCHD_LIB_H__ */
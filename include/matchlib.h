@@ -30,8 +30,11 @@
 #ifndef _MATCHLIB_H
 #define _MATCHLIB_H
 
+#include <stdint.h>
+#include <stdbool.h>
 #include <linux/netlink.h>
 #include "matstream.h"
+#include "matarena.h"
 
 #define PRINT_GRAPHVIZ 2
 #define MAX_VLAN 4096
@@ -57,9 +60,21 @@ int match_get_headers(struct mat_stream *matsp, struct nlattr *nl,
 
 int match_get_rules(struct mat_stream *matsp, struct nlattr *attr,
 		struct net_mat_rule **f);
+void match_free_rules(struct net_mat_rule *rules, unsigned int count);
+
+struct match_decode_stats {
+	unsigned int rules;	/* rules decoded */
+	size_t bytes;		/* arena bytes used by the decoded rules */
+	uint64_t nsecs;		/* time spent decoding */
+};
+
+int match_get_rules_arena(struct mat_stream *matsp, struct nlattr *attr,
+		struct mat_arena *arena, struct net_mat_rule **f,
+		struct match_decode_stats *stats);
 
 int match_get_table(struct mat_stream *matsp, struct nlattr *nl,
 		struct net_mat_tbl *t);
+void match_free_tables(struct net_mat_tbl *tables);
 
 int match_get_tables(struct mat_stream *matsp, struct nlattr *nl,
 		struct net_mat_tbl **t);
@@ -76,11 +91,32 @@ int match_get_ports(struct mat_stream *matsp, struct nlattr *nl,
 		struct net_mat_port **ports);
 int match_get_port(struct mat_stream *matsp, struct nlattr *nl,
 		  struct net_mat_port *ports);
+int match_get_events(struct mat_stream *matsp, struct nlattr *nl,
+		struct net_mat_event **events);
+int match_get_event(struct mat_stream *matsp, struct nlattr *nl,
+		  struct net_mat_event *event);
+int match_get_stats(struct mat_stream *matsp, struct nlattr *nl,
+		struct net_mat_stats *stats);
+void match_free_stats(struct net_mat_stats *stats);
+unsigned long long match_stats_latency_bound(unsigned int bucket);
 
 unsigned int match_get_rule_errors(struct nlattr *nl);
+int match_get_rule_filter(struct nlattr *nl, struct net_mat_rule_filter *filter);
+void match_free_rule_filter(struct net_mat_rule_filter *filter);
 
 int match_put_field_ref(struct nl_msg *nlbuf, struct net_mat_field_ref *ref);
 
+int match_field_ref_cmp(const struct net_mat_field_ref *a,
+			const struct net_mat_field_ref *b);
+void match_field_ref_mask(struct net_mat_field_ref *ref);
+int match_rule_cmp(const struct net_mat_rule *a, const struct net_mat_rule *b);
+bool match_field_ref_exact(const struct net_mat_field_ref *ref);
+uint32_t match_field_ref_hash(const struct net_mat_field_ref *ref);
+bool match_field_ref_filter(const struct net_mat_field_ref *ref,
+			    const struct net_mat_field_ref *filter);
+bool match_rule_filter(const struct net_mat_rule *rule,
+		       const struct net_mat_rule_filter *filter);
+
 int match_put_matches(struct nl_msg *nlbuf,
 		struct net_mat_field_ref *ref, int type);
 
@@ -89,19 +125,30 @@ int match_put_actions(struct nl_msg *nlbuf, struct net_mat_action **actions);
 int match_put_headers(struct nl_msg *nlbuf, struct net_mat_hdr **header);
 int match_put_rules(struct nl_msg *nlbuf, struct net_mat_rule *rule);
 int match_put_rule(struct nl_msg *nlbuf, struct net_mat_rule *ref);
+struct nlattr *match_put_rules_compact_start(struct nl_msg *nlbuf);
+void match_put_rules_compact_end(struct nl_msg *nlbuf, struct nlattr *rules);
+int match_put_rule_compact(struct nl_msg *nlbuf, struct nlattr *rules,
+		struct net_mat_rule *ref);
+int match_put_rules_compact(struct nl_msg *nlbuf, struct net_mat_rule *ref);
 int match_put_rule_error(struct nl_msg *nlbuf, __u32 err);
+int match_put_rule_filter(struct nl_msg *nlbuf,
+		struct net_mat_rule_filter *filter);
 int match_put_table(struct nl_msg *nlbuf, struct net_mat_tbl *t);
 int match_put_tables(struct nl_msg *nlbuf, struct net_mat_tbl *t);
 int match_put_table_graph(struct nl_msg *nlbuf, struct net_mat_tbl_node **ref);
 int match_put_header_graph(struct nl_msg *nlbuf, struct net_mat_hdr_node **g);
 int match_put_ports(struct nl_msg *nlbuf, struct net_mat_port *ports);
 int match_put_port(struct nl_msg *nlbuf, struct net_mat_port *p);
+int match_put_event(struct nl_msg *nlbuf, struct net_mat_event *e);
+int match_put_stats_cmd(struct nl_msg *nlbuf, struct net_mat_cmd_stats *s);
+int match_put_stats_table(struct nl_msg *nlbuf, struct net_mat_table_stats *t);
 
 void match_push_headers(struct net_mat_hdr **h);
 void match_push_actions(struct net_mat_action **a);
 void match_push_actions_ary(struct net_mat_action *a);
 void match_push_tables(struct net_mat_tbl **t);
 void match_push_tables_a(struct net_mat_tbl *t);
+void match_pop_tables_a(struct net_mat_tbl *t);
 void match_push_header_fields(struct net_mat_hdr **h);
 void match_push_graph_nodes(struct net_mat_hdr_node **n);
 
@@ -123,6 +170,9 @@ void pp_rule(struct mat_stream *matsp, struct net_mat_rule *ref);
 void pp_table_graph(struct mat_stream *matsp, struct net_mat_tbl_node *nodes);
 void pp_ports(struct mat_stream *matsp, struct net_mat_port *port);
 void pp_port(struct mat_stream *matsp, struct net_mat_port *port);
+void pp_events(struct mat_stream *matsp, struct net_mat_event *events);
+void pp_event(struct mat_stream *matsp, struct net_mat_event *event);
+void pp_stats(struct mat_stream *matsp, struct net_mat_stats *stats);
 void pp_header_graph(struct mat_stream *matsp,
                 struct net_mat_hdr_node *nodes);
 
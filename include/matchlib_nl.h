@@ -31,6 +31,7 @@
 #define _MATCHLIB_NL_H
 #include "if_match.h"
 #include "matstream.h"
+#include "matflight.h"
 
 
 void match_nl_set_verbose(int new_verbose);
@@ -40,6 +41,35 @@ struct nl_sock *match_nl_get_socket(void);
 
 uint32_t match_pid_lookup(void);
 
+int match_nl_cache_enable(const char *path);
+void match_nl_cache_disable(void);
+void match_nl_cache_invalidate(void);
+int match_nl_get_generation(struct nl_sock *nsd, uint32_t pid,
+			    unsigned int ifindex, int family,
+			    uint32_t *generation);
+int match_nl_get_features(struct nl_sock *nsd, uint32_t pid,
+			  unsigned int ifindex, int family,
+			  uint32_t *features);
+
+int match_nl_get_flight(struct nl_sock *nsd, uint32_t pid,
+			unsigned int ifindex, int family,
+			struct mat_flight_event **events, unsigned int *count);
+int match_nl_get_stats(struct nl_sock *nsd, uint32_t pid,
+		       unsigned int ifindex, int family,
+		       struct net_mat_stats *stats);
+
+int match_nl_set_rules_encoding(struct nl_sock *nsd, uint32_t pid,
+				unsigned int ifindex, int family,
+				unsigned int encoding);
+unsigned int match_nl_get_rules_encoding(void);
+
+typedef void (*match_nl_event_fn_t)(struct net_mat_event *event, void *arg);
+
+int match_nl_subscribe(struct nl_sock *nsd, uint32_t pid,
+		       unsigned int ifindex, int family, uint32_t mask);
+int match_nl_recv_events(struct nl_sock *nsd, int family,
+			 match_nl_event_fn_t cb, void *cb_arg);
+
 struct net_mat_hdr *match_nl_get_headers(struct nl_sock *nsd, uint32_t pid,
 					 unsigned int ifindex, int family);
 struct net_mat_action *match_nl_get_actions(struct nl_sock *nsd, uint32_t pid,
@@ -58,13 +88,58 @@ struct net_mat_tbl_node *match_nl_get_tbl_graph(struct nl_sock *nsd,
 int match_nl_set_del_rules(struct nl_sock *nsd, uint32_t pid,
 		      unsigned int ifindex, int family,
 		      struct net_mat_rule *rule, uint8_t cmd);
+int match_nl_set_del_rules_bulk(struct nl_sock *nsd, uint32_t pid,
+		      unsigned int ifindex, int family,
+		      struct net_mat_rule *rules, unsigned int count,
+		      uint8_t cmd, int *errs);
 struct net_mat_rule *match_nl_get_rules(struct nl_sock *nsd, uint32_t pid,
                       unsigned int ifindex, int family,
                       uint32_t tableid, uint32_t min, uint32_t max);
+int match_nl_read_rules(struct nl_sock *nsd, uint32_t pid,
+			unsigned int ifindex, int family, uint32_t tableid,
+			uint32_t min, uint32_t max,
+			struct net_mat_rule **rules, unsigned int *count);
+struct net_mat_rule *match_nl_get_rules_filter(struct nl_sock *nsd,
+					uint32_t pid, unsigned int ifindex,
+					int family, uint32_t tableid,
+					uint32_t min, uint32_t max,
+					struct net_mat_rule_filter *filter);
+
+/* Changes computed by match_nl_apply_rules() */
+enum match_nl_apply_op {
+	MATCH_NL_APPLY_ADD,
+	MATCH_NL_APPLY_UPDATE,
+	MATCH_NL_APPLY_DELETE,
+};
+
+/* Compute the changes without sending them */
+#define MATCH_NL_APPLY_DRY_RUN	0x01
+
+struct match_nl_apply_stats {
+	unsigned int unchanged;	/* rules already installed as desired */
+	unsigned int added;
+	unsigned int updated;
+	unsigned int deleted;
+	unsigned int failed;	/* changes rejected by the daemon */
+};
+
+typedef void (*match_nl_apply_fn_t)(enum match_nl_apply_op op,
+				    struct net_mat_rule *rule, int err,
+				    void *arg);
+
+int match_nl_apply_rules(struct nl_sock *nsd, uint32_t pid,
+			 unsigned int ifindex, int family,
+			 struct net_mat_rule *rules, unsigned int count,
+			 const uint32_t *tables, unsigned int flags,
+			 match_nl_apply_fn_t cb, void *cb_arg,
+			 struct match_nl_apply_stats *stats);
 int match_nl_set_port(struct nl_sock *nsd, uint32_t pid,
                       unsigned int ifindex, int family, struct net_mat_port *port);
 struct net_mat_port *match_nl_get_ports(struct nl_sock *nsd, uint32_t pid,
                       unsigned int ifindex, int family, uint32_t min, uint32_t max);
+int match_nl_read_ports(struct nl_sock *nsd, uint32_t pid,
+			unsigned int ifindex, int family,
+			uint32_t min, uint32_t max, struct net_mat_port **ports);
 int match_nl_create_update_destroy_table(struct nl_sock *nsd, uint32_t pid,
 				unsigned int ifindex, int family,
 				struct net_mat_tbl *table, uint8_t cmd);
@@ -96,6 +171,28 @@ match_nl_del_rules(struct nl_sock *nsd, uint32_t pid,
                                            NET_MAT_TABLE_CMD_DEL_RULES);
 }
 
+static inline int
+match_nl_set_rules_bulk(struct nl_sock *nsd, uint32_t pid,
+                     unsigned int ifindex, int family,
+                     struct net_mat_rule *rules, unsigned int count,
+                     int *errs)
+{
+        return match_nl_set_del_rules_bulk(nsd, pid, ifindex, family, rules,
+                                           count, NET_MAT_TABLE_CMD_SET_RULES,
+                                           errs);
+}
+
+static inline int
+match_nl_del_rules_bulk(struct nl_sock *nsd, uint32_t pid,
+                     unsigned int ifindex, int family,
+                     struct net_mat_rule *rules, unsigned int count,
+                     int *errs)
+{
+        return match_nl_set_del_rules_bulk(nsd, pid, ifindex, family, rules,
+                                           count, NET_MAT_TABLE_CMD_DEL_RULES,
+                                           errs);
+}
+
 
 static inline int
 match_nl_update_table(struct nl_sock *nsd, uint32_t pid,
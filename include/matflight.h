@@ -0,0 +1,105 @@
+/*******************************************************************************
+
+  MATCH Library - Flight recorder of recent daemon operations
+  Copyright (c) <2015>, Intel Corporation
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+#ifndef _MATFLIGHT_H
+#define _MATFLIGHT_H
+
+#include <stdint.h>
+#include <linux/types.h>
+
+/*
+ * The flight recorder keeps the most recent operations of the daemon in
+ * a fixed size ring per thread. Recording an event is a couple of clock
+ * reads and a 32 byte store, so the recorder is always on. The rings can
+ * be dumped to a file, matchd does so on SIGUSR1, or fetched with
+ * NET_MAT_DAEMON_CMD_GET_FLIGHT.
+ *
+ * A dump file is a struct mat_flight_header followed by the events of
+ * each thread, oldest first. Values are in host byte order.
+ */
+#define MAT_FLIGHT_MAGIC	"MATFLT"
+#define MAT_FLIGHT_VERSION	1
+#define MAT_FLIGHT_BYTE_ORDER	0x01020304
+#define MAT_FLIGHT_FILE		"/var/run/matchd.flight"
+
+/* Default number of events kept per thread, a power of 2 */
+#define MAT_FLIGHT_DEFAULT_EVENTS	4096
+
+/* Backend hook run by a recorded operation */
+enum mat_flight_hook {
+	MAT_FLIGHT_HOOK_NONE,		/* a whole netlink command */
+	MAT_FLIGHT_HOOK_SET_RULES,
+	MAT_FLIGHT_HOOK_DEL_RULES,
+	MAT_FLIGHT_HOOK_CREATE_TABLE,
+	MAT_FLIGHT_HOOK_DESTROY_TABLE,
+	MAT_FLIGHT_HOOK_UPDATE_TABLE,
+	MAT_FLIGHT_HOOK_GET_PORTS,
+	MAT_FLIGHT_HOOK_SET_PORTS,
+	MAT_FLIGHT_HOOK_GET_LPORT,
+	MAT_FLIGHT_HOOK_GET_PHYS_PORT,
+	MAT_FLIGHT_HOOK_GET_RULE_COUNTERS,
+	__MAT_FLIGHT_HOOK_MAX,
+};
+
+struct mat_flight_event {
+	__u64 time;		/* CLOCK_MONOTONIC start in ns */
+	__u32 duration;		/* in ns, saturated at UINT32_MAX */
+	__u32 table;
+	__u32 uid;		/* rule or port, 0 if none */
+	__s32 err;		/* 0 or a negative error code */
+	__u8 cmd;		/* NET_MAT_*_CMD_* being processed */
+	__u8 hook;		/* enum mat_flight_hook */
+	__u16 thread;		/* recording thread, in ring creation order */
+	__u32 reserved;
+};
+
+struct mat_flight_header {
+	char magic[8];
+	__u32 version;
+	__u32 byte_order;
+	__u32 header_len;
+	__u32 event_len;
+	__u64 count;		/* events following the header */
+	__u64 time;		/* CLOCK_MONOTONIC of the dump in ns */
+};
+
+int mat_flight_init(unsigned int events);
+uint64_t mat_flight_now(void);
+void mat_flight_record(uint8_t cmd, uint8_t hook, uint32_t table,
+		       uint32_t uid, int err, uint64_t start);
+
+int mat_flight_dump_fd(int fd);
+int mat_flight_snapshot(struct mat_flight_event **events, unsigned int *count);
+int mat_flight_read(const char *path, struct mat_flight_event **events,
+		    unsigned int *count, uint64_t *dump_time);
+void mat_flight_sort(struct mat_flight_event *events, unsigned int count);
+
+const char *mat_flight_cmd_str(uint8_t cmd);
+const char *mat_flight_hook_str(uint8_t hook);
+
+#endif	/* _MATFLIGHT_H */
@@ -2,6 +2,7 @@
 #define _MATLOG_H
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <syslog.h>
 
@@ -16,7 +17,10 @@
 
 #define MAT_LOG_UPTO(upto) LOG_UPTO((upto))
 
-/* Remove, at compile-time, MAT_LOG messages above MAT_LOG_LEVEL */
+/*
+ * Remove, at compile-time, MAT_LOG messages above MAT_LOG_LEVEL. The
+ * level can be set for the whole tree with ./configure --with-log-level.
+ */
 #ifndef MAT_LOG_LEVEL
 #define MAT_LOG_LEVEL MAT_LOG_DEBUG
 #endif
@@ -49,6 +53,20 @@
 #endif	/* MAT_LOG_WITH_LOCATION */
 #endif	/* MAT_LOG_FUNC_ARGS */
 
+/* Rate limiting state of one MAT_LOG() call site */
+struct mat_log_site {
+	uint64_t stamp;		/* start of the current interval in ms */
+	int tokens;		/* messages left in the current interval */
+	unsigned int missed;	/* messages suppressed in the current interval */
+};
+
+/* Levels enabled at run-time, a copy of the mask set by mat_setlogmask() */
+extern unsigned int mat_log_mask;
+
+int mat_log_site_allow(struct mat_log_site *site, int level,
+		       const char *file, const char *line);
+void mat_log_set_ratelimit(unsigned int burst, unsigned int interval_ms);
+
 /**
  * Macro for logging messages.
  *
@@ -71,6 +89,9 @@
  * Applications could have full control of logging including
  * augmentation of the formatting string and its arguments
  * by defining MAT_LOG_FUNC and MAT_LOG_FUNC_ARGS.
+ * The log mask is tested before the arguments are evaluated, so a
+ * message masked at run-time costs a load and a test. Each call site
+ * keeps its own rate limiting state, see mat_log_set_ratelimit().
  * To offer such flexibility, a level of indirection is needed.
  * An internal _MAT_LOG() macro is used for isolating the
  * formatting string and separating it from its variable
@@ -79,7 +100,12 @@
  */
 #define _MAT_LOG(level, fmt, ...)					\
 	do {								\
-		if (level <= MAT_LOG_LEVEL)	{			\
+		static struct mat_log_site _mat_log_site;		\
+									\
+		if (level <= MAT_LOG_LEVEL &&				\
+		    ((1U << level) & mat_log_mask) &&			\
+		    mat_log_site_allow(&_mat_log_site, level, __FILE__,	\
+				       MATLOG_STRINGIFY(__LINE__))) {	\
 			MAT_LOG_FUNC(					\
 				MAT_LOG_FUNC_ARGS(level,		\
 						  __FILE__, MATLOG_STRINGIFY(__LINE__), __func__, \
@@ -157,6 +183,21 @@ void mat_syslog_with_location_nop(int level,
 				  const char *file, const char *line, const char *func,
 				  const char *format, va_list args);
 
+void mat_syslog_async(int level, const char *format, va_list args);
+void mat_syslog_with_location_async(int level,
+				    const char *file, const char *line, const char *func,
+				    const char *format, va_list args);
+
+struct mat_log_async_stats {
+	uint64_t queued;	/* messages queued by producers */
+	uint64_t dropped;	/* messages dropped, ring full or too long */
+	uint64_t written;	/* messages written by the logging thread */
+};
+
+int mat_log_async_start(unsigned int slots);
+void mat_log_async_stop(void);
+void mat_log_async_get_stats(struct mat_log_async_stats *stats);
+
 struct mat_logger {
 	mat_closelog_func_t closelog;
 	mat_openlog_func_t openlog;
@@ -0,0 +1,72 @@
+/*******************************************************************************
+
+  MATCH Library - USDT probes of the MATCH daemon
+  Copyright (c) <2015>, Intel Corporation
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+#ifndef _MATPROBE_H
+#define _MATPROBE_H
+
+/*
+ * Static probes at the hot points of matchd, for perf, bpftrace or
+ * systemtap. A probe is a nop until a tracer attaches to it, and the probes
+ * are compiled out when sys/sdt.h is not available or --disable-usdt is
+ * given to configure.
+ *
+ * All probes of the matchd provider take the same arguments:
+ *   arg0  command, NET_MAT_*_CMD_*
+ *   arg1  backend hook, enum mat_flight_hook
+ *   arg2  table id, 0 if none
+ *   arg3  rule or port uid, 0 if none
+ *   arg4  error, 0 or a negative error code
+ *
+ * The probes are:
+ *   cmd__receive     a request was received
+ *   cmd__dispatch    the request is handed to its command handler
+ *   cmd__done        the request was answered, arg4 is its result
+ *   rule__validate   a rule was checked against its table
+ *   backend__entry   a backend hook is called
+ *   backend__exit    a backend hook returned
+ *   reply__send      a message was sent, arg4 is the number of bytes or an
+ *                    error, commands are NET_MAT_EVENT_CMD_NOTIFY for events
+ *   multipart__flush a multipart reply was sent, arg3 is its number of parts
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define MAT_PROBE(name, cmd, hook, table, uid, err)			\
+	DTRACE_PROBE5(matchd, name, (unsigned int)(cmd),		\
+		      (unsigned int)(hook), (unsigned int)(table),	\
+		      (unsigned int)(uid), (int)(err))
+#else
+/* probe arguments have no side effects, referencing them avoids unused warnings */
+#define MAT_PROBE(name, cmd, hook, table, uid, err)			\
+	do {								\
+		(void)(cmd); (void)(hook); (void)(table);		\
+		(void)(uid); (void)(err);				\
+	} while (0)
+#endif
+
+#endif	/* _MATPROBE_H */
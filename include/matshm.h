@@ -0,0 +1,145 @@
+/*******************************************************************************
+
+  MATCH Library - Shared memory mirror of the MATCH daemon state
+  Copyright (c) <2015>, Intel Corporation
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+#ifndef _MATSHM_H
+#define _MATSHM_H
+
+#include <stdint.h>
+#include <linux/types.h>
+
+#include "if_match.h"
+
+/*
+ * matchd can publish its state in a shared memory file so that monitoring
+ * agents read tables, rule counters and port statistics without a netlink
+ * round trip and without costing the daemon any work per read.
+ *
+ * The file starts with a struct mat_shm_header locating three arrays of
+ * fixed size records:
+ *
+ *   tables  indexed by table uid
+ *   rules   indexed by the rule_base of their table plus the rule uid
+ *   ports   in the order reported by the backend
+ *
+ * Every record starts with a sequence count, odd while matchd updates the
+ * record. A reader copies the record and retries when the count was odd
+ * or changed during the copy, see mat_shm_read_table(). Counters are
+ * refreshed by matchd periodically, at the time given in the header.
+ *
+ * Values are in host byte order. When matchd exits it marks the file
+ * closed, a reader must then reopen it.
+ */
+#define MAT_SHM_MAGIC		"MATSHM"
+#define MAT_SHM_VERSION		1
+#define MAT_SHM_BYTE_ORDER	0x01020304
+#define MAT_SHM_FILE		"/dev/shm/matchd.state"
+
+/* Table whose rules did not fit in the rule records */
+#define MAT_SHM_NO_RULES	(~0U)
+
+struct mat_shm_header {
+	char magic[8];
+	__u32 version;
+	__u32 byte_order;
+	__u32 header_len;
+	__u32 table_len;	/* size of a table record */
+	__u32 rule_len;
+	__u32 port_len;
+	__u32 max_tables;
+	__u32 max_rules;
+	__u32 max_ports;
+	__u32 pid;		/* of the daemon */
+	__u64 table_off;	/* from the start of the file */
+	__u64 rule_off;
+	__u64 port_off;
+	__u32 seq;		/* protects the fields below */
+	__u32 closed;		/* set when the daemon exits */
+	__u32 generation;	/* pipeline generation */
+	__u32 reserved;
+	__u64 updated;		/* CLOCK_MONOTONIC of the last refresh in ns */
+};
+
+struct mat_shm_table {
+	__u32 seq;
+	__u32 uid;		/* 0 if the slot is free */
+	__u32 size;
+	__u32 rules;		/* rules installed */
+	__u32 rule_base;	/* index of rule uid 0, or MAT_SHM_NO_RULES */
+	__u32 reserved;
+	char name[32];
+};
+
+struct mat_shm_rule {
+	__u32 seq;
+	__u32 table_id;
+	__u32 uid;		/* 0 if no rule is installed */
+	__u32 priority;
+	__u32 hw_ruleid;
+	__u32 reserved;
+	__u64 packets;
+	__u64 bytes;
+};
+
+struct mat_shm_port {
+	__u32 seq;
+	__u32 port_id;		/* NET_MAT_PORT_ID_UNSPEC if the slot is free */
+	__u32 state;		/* enum port_state */
+	__u32 speed;		/* enum port_speed */
+	struct net_mat_port_stats stats;
+};
+
+struct mat_shm;
+
+/* Writer, used by matchd */
+int mat_shm_create(const char *path, unsigned int max_tables,
+		   unsigned int max_rules, unsigned int max_ports,
+		   struct mat_shm **shm);
+void mat_shm_destroy(struct mat_shm *shm);
+void mat_shm_set_table(struct mat_shm *shm, struct net_mat_tbl *table);
+void mat_shm_del_table(struct mat_shm *shm, __u32 uid);
+void mat_shm_set_rule(struct mat_shm *shm, struct net_mat_rule *rule);
+void mat_shm_del_rule(struct mat_shm *shm, __u32 table, __u32 uid);
+void mat_shm_set_port(struct mat_shm *shm, unsigned int slot,
+		      struct net_mat_port *port);
+void mat_shm_set_generation(struct mat_shm *shm, __u32 generation);
+void mat_shm_touch(struct mat_shm *shm);
+
+/* Reader */
+int mat_shm_open(const char *path, struct mat_shm **shm);
+void mat_shm_close(struct mat_shm *shm);
+const struct mat_shm_header *mat_shm_header(struct mat_shm *shm);
+int mat_shm_read_header(struct mat_shm *shm, __u32 *generation,
+			__u64 *updated);
+int mat_shm_read_table(struct mat_shm *shm, __u32 uid,
+		       struct mat_shm_table *table);
+int mat_shm_read_rule(struct mat_shm *shm, __u32 table, __u32 uid,
+		      struct mat_shm_rule *rule);
+int mat_shm_read_port(struct mat_shm *shm, unsigned int slot,
+		      struct mat_shm_port *port);
+
+#endif	/* _MATSHM_H */
@@ -0,0 +1,105 @@
+/*******************************************************************************
+
+  MATCH Library - Binary snapshots of a MATCH pipeline
+  Copyright (c) <2015>, Intel Corporation
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+#ifndef _MATSNAP_H
+#define _MATSNAP_H
+
+#include <stdint.h>
+#include <linux/types.h>
+
+#include "if_match.h"
+#include "matarena.h"
+
+/*
+ * A snapshot file holds the dynamic state of a pipeline: its tables, the
+ * rules installed in them and the port configuration. The file starts
+ * with a struct mat_snap_header locating one section per object type.
+ * Each section is a sequence of netlink attributes in the same encoding
+ * used on the wire, so a snapshot can be mapped and decoded in place:
+ *
+ *   MAT_SNAP_SEC_TABLES  NET_MAT_TABLE nests, one per table
+ *   MAT_SNAP_SEC_RULES   NET_MAT_RULES_COMPACT attributes, each packing
+ *                        as many compact rule records as fit
+ *   MAT_SNAP_SEC_PORTS   NET_MAT_PORT nests, one per port
+ *
+ * All values are in host byte order, a snapshot taken on a host of the
+ * other endianness is rejected.
+ */
+#define MAT_SNAP_MAGIC		"MATSNAP"
+#define MAT_SNAP_VERSION	1
+#define MAT_SNAP_BYTE_ORDER	0x01020304
+
+enum mat_snap_section_type {
+	MAT_SNAP_SEC_TABLES,
+	MAT_SNAP_SEC_RULES,
+	MAT_SNAP_SEC_PORTS,
+	__MAT_SNAP_SEC_MAX,
+};
+
+struct mat_snap_section {
+	__u64 offset;		/* from the start of the file */
+	__u64 length;		/* bytes of attributes in the section */
+	__u32 count;		/* objects in the section */
+	__u32 reserved;
+};
+
+struct mat_snap_header {
+	char magic[8];
+	__u32 version;
+	__u32 byte_order;
+	__u32 header_len;
+	__u32 nsections;
+	struct mat_snap_section sections[__MAT_SNAP_SEC_MAX];
+};
+
+struct mat_snap_writer;
+struct mat_snap;
+
+typedef int (*mat_snap_rules_fn_t)(struct net_mat_rule *rules,
+				   unsigned int count, void *arg);
+
+int mat_snap_writer_open(const char *path, struct mat_snap_writer **writer);
+int mat_snap_write_tables(struct mat_snap_writer *writer,
+			  struct net_mat_tbl *tables);
+int mat_snap_write_rules(struct mat_snap_writer *writer,
+			 struct net_mat_rule *rules, unsigned int count);
+int mat_snap_write_ports(struct mat_snap_writer *writer,
+			 struct net_mat_port *ports);
+int mat_snap_writer_close(struct mat_snap_writer *writer);
+void mat_snap_writer_abort(struct mat_snap_writer *writer);
+
+int mat_snap_open(const char *path, struct mat_snap **snap);
+void mat_snap_close(struct mat_snap *snap);
+unsigned int mat_snap_count(struct mat_snap *snap,
+			    enum mat_snap_section_type type);
+int mat_snap_get_tables(struct mat_snap *snap, struct net_mat_tbl **tables);
+int mat_snap_get_ports(struct mat_snap *snap, struct net_mat_port **ports);
+int mat_snap_get_rules(struct mat_snap *snap, struct mat_arena *arena,
+		       unsigned int batch, mat_snap_rules_fn_t fn, void *arg);
+
+#endif	/* _MATSNAP_H */
@@ -3,6 +3,8 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 struct mat_stream;
 
@@ -10,10 +12,25 @@ struct mat_stream *mat_stream_stdout(void);
 struct mat_stream *mat_stream_stderr(void);
 struct mat_stream *mat_stream_logger(void);
 struct mat_stream *mat_stream_file(FILE *fp);
+struct mat_stream *mat_stream_json(FILE *fp);
+bool mat_stream_is_json(struct mat_stream *matsp);
+void mat_stream_delete(struct mat_stream *matsp);
 
 void mat_stream_printf(struct mat_stream *matsp, const char *format, ...);
 void mat_stream_vprintf(struct mat_stream *matsp, const char *format, va_list args);
 FILE *mat_stream_get_fp(struct mat_stream *matsp);
 void mat_stream_flush(struct mat_stream *matsp);
 
+/* Structured output for JSON streams, a no-op on any other stream. A NULL
+ * key is used for array elements and top-level values.
+ */
+void mat_json_object_start(struct mat_stream *matsp, const char *key);
+void mat_json_object_end(struct mat_stream *matsp);
+void mat_json_array_start(struct mat_stream *matsp, const char *key);
+void mat_json_array_end(struct mat_stream *matsp);
+void mat_json_string(struct mat_stream *matsp, const char *key,
+		     const char *value);
+void mat_json_uint(struct mat_stream *matsp, const char *key, uint64_t value);
+void mat_json_bool(struct mat_stream *matsp, const char *key, bool value);
+
 #endif	/* _MATSTREAM_H */
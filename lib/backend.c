@@ -49,6 +49,9 @@ TAILQ_HEAD(match_backend_head, match_backend);
 static struct match_backend_head backend_list =
 		TAILQ_HEAD_INITIALIZER(backend_list);
 
+/** handler notified of asynchronous port changes */
+static match_backend_port_event_fn port_event_handler;
+
 void match_backend_register(struct match_backend *backend)
 {
 	TAILQ_INSERT_TAIL(&backend_list, backend, next);
@@ -156,6 +159,17 @@ struct match_backend *match_backend_open(const char *name, void *init_arg)
 	return backend;
 }
 
+void match_backend_set_port_event_handler(match_backend_port_event_fn handler)
+{
+	port_event_handler = handler;
+}
+
+void match_backend_port_event(uint32_t port_id, enum port_state state)
+{
+	if (port_event_handler)
+		port_event_handler(port_id, state);
+}
+
 void match_backend_close(struct match_backend *backend)
 {
 	if (backend) {
@@ -1572,6 +1572,10 @@ static void eventHandler(fm_int event, fm_int sw, void *ptr)
 
 	case FM_EVENT_PORT:
 		MAT_LOG(INFO, "port event: port %d is %s\n", portEvent->port, (portEvent->linkStatus ? "up" : "down"));
+		match_backend_port_event((uint32_t)portEvent->port,
+					 portEvent->linkStatus ?
+					 NET_MAT_PORT_T_STATE_UP :
+					 NET_MAT_PORT_T_STATE_DOWN);
 		break;
 
 	case FM_EVENT_PKT_RECV:
@@ -0,0 +1,241 @@
+/*******************************************************************************
+
+  MATCH Library - Region allocator for decoded MATCH objects
+  Copyright (c) <2015>, Intel Corporation
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "matarena.h"
+
+/* Every allocation is rounded up to this so that u64 and in6_addr
+ * members of decoded objects are naturally aligned.
+ */
+#define MAT_ARENA_ALIGN 16
+#define MAT_ARENA_ROUND(x) (((x) + MAT_ARENA_ALIGN - 1) & ~((size_t)MAT_ARENA_ALIGN - 1))
+
+struct mat_arena_chunk {
+	struct mat_arena_chunk *next;
+	size_t size;
+	size_t used;
+};
+
+#define MAT_ARENA_CHUNK_HDR MAT_ARENA_ROUND(sizeof(struct mat_arena_chunk))
+
+struct mat_arena {
+	struct mat_arena_chunk *head;	/* chunk small allocations come from */
+	size_t chunk_size;
+	struct mat_arena_stats stats;
+};
+
+static struct mat_arena_chunk *mat_arena_chunk_alloc(size_t size)
+{
+	struct mat_arena_chunk *chunk;
+
+	if (size > SIZE_MAX - MAT_ARENA_CHUNK_HDR)
+		return NULL;
+
+	chunk = malloc(MAT_ARENA_CHUNK_HDR + size);
+	if (!chunk)
+		return NULL;
+
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+
+	return chunk;
+}
+
+static void *mat_arena_chunk_data(struct mat_arena_chunk *chunk)
+{
+	return (char *)chunk + MAT_ARENA_CHUNK_HDR;
+}
+
+/*
+ * mat_arena_create() - create an empty arena
+ * @chunk_size: size of each chunk, 0 selects MAT_ARENA_DEFAULT_CHUNK
+ *
+ * Memory is only reserved on the first allocation.
+ *
+ * Return: the new arena or NULL on allocation failure
+ */
+struct mat_arena *mat_arena_create(size_t chunk_size)
+{
+	struct mat_arena *arena;
+
+	arena = calloc(1, sizeof(*arena));
+	if (!arena)
+		return NULL;
+
+	if (!chunk_size)
+		chunk_size = MAT_ARENA_DEFAULT_CHUNK;
+	arena->chunk_size = MAT_ARENA_ROUND(chunk_size);
+
+	return arena;
+}
+
+/*
+ * mat_arena_destroy() - release an arena and everything allocated from it
+ * @arena: the arena, may be NULL
+ */
+void mat_arena_destroy(struct mat_arena *arena)
+{
+	struct mat_arena_chunk *chunk, *next;
+
+	if (!arena)
+		return;
+
+	for (chunk = arena->head; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	free(arena);
+}
+
+/*
+ * mat_arena_reset() - release everything allocated from an arena
+ * @arena: the arena
+ *
+ * One regular sized chunk is kept so that an arena reused for every
+ * message does not go back to malloc() once it has warmed up.
+ */
+void mat_arena_reset(struct mat_arena *arena)
+{
+	struct mat_arena_chunk *chunk, *next, *keep = NULL;
+
+	if (!arena)
+		return;
+
+	for (chunk = arena->head; chunk; chunk = next) {
+		next = chunk->next;
+		if (!keep && chunk->size == arena->chunk_size) {
+			keep = chunk;
+			continue;
+		}
+		free(chunk);
+	}
+
+	arena->head = keep;
+	memset(&arena->stats, 0, sizeof(arena->stats));
+	if (keep) {
+		keep->next = NULL;
+		keep->used = 0;
+		arena->stats.reserved = keep->size;
+		arena->stats.chunks = 1;
+	}
+}
+
+/*
+ * mat_arena_calloc() - allocate zeroed memory from an arena
+ * @arena: the arena
+ * @nmemb: number of elements
+ * @size: size of each element
+ *
+ * Requests larger than a quarter of the chunk size get a chunk of
+ * their own so they do not waste the tail of the current chunk.
+ *
+ * Return: pointer to the memory or NULL on overflow or allocation failure
+ */
+void *mat_arena_calloc(struct mat_arena *arena, size_t nmemb, size_t size)
+{
+	struct mat_arena_chunk *chunk;
+	size_t len;
+	void *p;
+
+	if (!arena || (size && nmemb > SIZE_MAX / size))
+		return NULL;
+
+	len = nmemb * size;
+	if (len > SIZE_MAX - MAT_ARENA_ALIGN)
+		return NULL;
+	len = MAT_ARENA_ROUND(len ? len : 1);
+
+	chunk = arena->head;
+	if (!chunk || chunk->size - chunk->used < len) {
+		if (len > arena->chunk_size / 4) {
+			chunk = mat_arena_chunk_alloc(len);
+			if (!chunk)
+				return NULL;
+			if (arena->head) {
+				chunk->next = arena->head->next;
+				arena->head->next = chunk;
+			} else {
+				arena->head = chunk;
+			}
+		} else {
+			chunk = mat_arena_chunk_alloc(arena->chunk_size);
+			if (!chunk)
+				return NULL;
+			chunk->next = arena->head;
+			arena->head = chunk;
+		}
+		arena->stats.reserved += chunk->size;
+		arena->stats.chunks++;
+	}
+
+	p = (char *)mat_arena_chunk_data(chunk) + chunk->used;
+	chunk->used += len;
+	arena->stats.used += len;
+	arena->stats.allocs++;
+
+	memset(p, 0, len);
+	return p;
+}
+
+/*
+ * mat_arena_strdup() - copy a string into an arena
+ * @arena: the arena
+ * @s: the string to copy
+ *
+ * Return: the copy or NULL on allocation failure
+ */
+char *mat_arena_strdup(struct mat_arena *arena, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *p;
+
+	p = mat_arena_calloc(arena, 1, len);
+	if (p)
+		memcpy(p, s, len);
+
+	return p;
+}
+
+/*
+ * mat_arena_get_stats() - report arena usage
+ * @arena: the arena
+ * @stats: filled in with the usage since the last reset
+ */
+void mat_arena_get_stats(struct mat_arena *arena,
+			 struct mat_arena_stats *stats)
+{
+	if (!arena || !stats)
+		return;
+
+	*stats = arena->stats;
+}
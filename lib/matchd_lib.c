@@ -37,6 +37,9 @@
 #include <sys/queue.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 
 #include <getopt.h>
 
@@ -46,10 +49,14 @@
 #include <libnl3/netlink/genl/ctrl.h>
 
 #include <unistd.h>
+#include <time.h>
 
 #include "matlog.h"
 #include "if_match.h"
 #include "matchlib.h"
+#include "matflight.h"
+#include "matprobe.h"
+#include "matshm.h"
 #ifdef DEBUG
 #include "models/ies_pipeline.h" /* Pipeline model */
 #include "ieslib.h" /* ies interface */
@@ -67,13 +74,108 @@ extern struct net_mat_tbl_node *my_tbl_nodes[] __attribute__((unused));
 
 #ifdef MATCHD_MOCK_SUPPORT
 /* Allocate a software cache of the match action tables so we can
- * get and set rule entries in software only mode.
+ * get and set rule entries in software only mode. The per table arrays
+ * are indexed by table uid and grown together by matchd_tables_grow() as
+ * tables are created, up to MATCHD_MAX_TABLES uids.
  */
-#define MAX_MOCK_TABLES	100
-struct net_mat_rule *matchd_mock_tables[MAX_MOCK_TABLES + 1];
+#define MATCHD_MAX_TABLES	(1 << 16)
+#define MATCHD_TABLES_MIN_SIZE	128
+static unsigned int matchd_tables_size;
+struct net_mat_rule **matchd_mock_tables;
 
 /* Used as a hook for software cache of match action tables */
-struct net_mat_tbl my_dyn_table_list[MAX_MOCK_TABLES];
+struct net_mat_tbl *my_dyn_table_list;
+
+/* Per table index of the installed rules by field value, so that a get
+ * rules filter with an exact field is served without a table scan. Every
+ * field of a rule is indexed under match_field_ref_hash(), whatever its
+ * mask, and candidates are checked against the whole filter. An index
+ * that failed to allocate is stale and the table is scanned instead.
+ */
+#define MATCHD_RULE_INDEX_MIN_SIZE 64
+
+struct matchd_rule_key {
+	struct matchd_rule_key *next;
+	uint32_t hash;
+	uint32_t uid;
+};
+
+struct matchd_rule_index {
+	struct matchd_rule_key **buckets;
+	unsigned int size;
+	unsigned int count;
+	bool stale;
+};
+
+static struct matchd_rule_index *matchd_rule_index;
+
+/* Packet counts of each rule sampled by get rules requests ranking by
+ * rate, allocated per table by the first of them. A new sample is taken
+ * once the last one is a second old and rates are measured from the one
+ * before, so that requests close together all see a window of at least a
+ * second. The unused entry 0 holds the time the table was first sampled.
+ */
+#define MATCHD_RATE_WINDOW_NS	1000000000ULL
+
+struct matchd_rule_sample {
+	uint64_t prev_packets;
+	uint64_t prev_ns;	/* 0 if there is a single sample */
+	uint64_t packets;
+	uint64_t ns;		/* 0 if the rule was never sampled */
+};
+
+static struct matchd_rule_sample **matchd_rule_samples;
+
+/* Grow one per table array from old to new entries, zeroing the tail */
+static int matchd_tables_realloc(void *array, size_t elem, unsigned int old,
+				 unsigned int new)
+{
+	void **p = array;
+	char *a;
+
+	a = realloc(*p, new * elem);
+	if (!a)
+		return -ENOMEM;
+
+	memset(a + old * elem, 0, (new - old) * elem);
+	*p = a;
+	return 0;
+}
+
+/*
+ * matchd_tables_grow() - make room for a table uid
+ * @uid: the table uid
+ *
+ * Return: 0 on success, -ERANGE if @uid is above MATCHD_MAX_TABLES or
+ *         -ENOMEM
+ */
+static int matchd_tables_grow(uint32_t uid)
+{
+	unsigned int size, old = matchd_tables_size;
+
+	if (uid < old)
+		return 0;
+	if (uid >= MATCHD_MAX_TABLES)
+		return -ERANGE;
+
+	size = old ? old : MATCHD_TABLES_MIN_SIZE;
+	while (size <= uid)
+		size *= 2;
+
+	/* arrays grown before a failure are simply larger than needed */
+	if (matchd_tables_realloc(&matchd_mock_tables,
+				  sizeof(*matchd_mock_tables), old, size) ||
+	    matchd_tables_realloc(&my_dyn_table_list,
+				  sizeof(*my_dyn_table_list), old, size) ||
+	    matchd_tables_realloc(&matchd_rule_index,
+				  sizeof(*matchd_rule_index), old, size) ||
+	    matchd_tables_realloc(&matchd_rule_samples,
+				  sizeof(*matchd_rule_samples), old, size))
+		return -ENOMEM;
+
+	matchd_tables_size = size;
+	return 0;
+}
 #endif
 
 #define MATCH_NLMSG_DEFAULT_SIZE 8192
@@ -84,8 +186,57 @@ struct net_mat_tbl my_dyn_table_list[MAX_MOCK_TABLES];
 static int family = -1;
 static struct nl_sock *nsd;
 
+/* Replies and events go out on nsd unless a send hook is installed */
+static matchd_send_fn_t matchd_send_fn;
+static void *matchd_send_arg;
+
 static struct match_backend *backend = NULL;
 
+/* Decoded requests are only printed when running verbose, formatting every
+ * field of every rule is a significant part of the cost of a rule install.
+ */
+static int matchd_verbose;
+
+/* Pipeline generation, bumped whenever the table layout changes so that
+ * clients caching pipeline metadata know when to refresh. Seeded from the
+ * start time so a restarted daemon does not reuse an older generation.
+ */
+static uint32_t pipeline_generation;
+
+/* Counters reported by NET_MAT_DAEMON_CMD_GET_STATS. They are only updated
+ * by the receive loop, replies sent while a command is processed are
+ * accounted to it through matchd_stats_cur.
+ */
+static struct net_mat_cmd_stats matchd_stats[NET_MAT_CMD_MAX+1];
+static __thread struct net_mat_cmd_stats *matchd_stats_cur;
+static uint64_t matchd_rx_drops;
+
+/* Counter reads of one request or shm sweep, recorded as a single event */
+struct matchd_counter_reads {
+	uint64_t start;		/* start of the first read */
+	uint32_t table;		/* table of the reads, 0 if several */
+	uint32_t count;
+};
+
+/* Shared memory mirror of the tables, rules and ports, see matshm.h. It is
+ * written from the receive loop only, which also refreshes the counters
+ * every matchd_shm_interval ns. A refresh sweeps the rules at most
+ * MATCHD_SHM_SWEEP at a time between requests, from the cursor
+ * matchd_shm_table and matchd_shm_uid, table 0 when no sweep is running.
+ */
+#define MATCHD_SHM_TABLES	(1 << 12)
+#define MATCHD_SHM_RULES	(1 << 17)
+#define MATCHD_SHM_PORTS	256
+#define MATCHD_SHM_SWEEP	1024
+static struct mat_shm *matchd_shm;
+static uint64_t matchd_shm_interval;
+static uint64_t matchd_shm_next;
+static uint32_t matchd_shm_table;
+static uint32_t matchd_shm_uid;
+#ifdef MATCHD_MOCK_SUPPORT
+static struct matchd_counter_reads matchd_shm_reads;
+#endif
+
 static struct nla_policy match_get_tables_policy[NET_MAT_MAX+1] = {
 	[NET_MAT_IDENTIFIER_TYPE]	= { .type = NLA_U32 },
 	[NET_MAT_IDENTIFIER]		= { .type = NLA_U32 },
@@ -97,8 +248,85 @@ static struct nla_policy match_get_tables_policy[NET_MAT_MAX+1] = {
 	[NET_MAT_RULES]			= { .type = NLA_NESTED },
 	[NET_MAT_RULES_ERROR]		= { .type = NLA_U32 },
 	[NET_MAT_PORTS]			= { .type = NLA_NESTED },
+	[NET_MAT_GENERATION]		= { .type = NLA_U32 },
+	[NET_MAT_EVENT_MASK]		= { .type = NLA_U32 },
+	[NET_MAT_EVENTS]		= { .type = NLA_NESTED },
+	[NET_MAT_FEATURES]		= { .type = NLA_U32 },
+	[NET_MAT_RULES_COMPACT]		= { .type = NLA_UNSPEC },
+	[NET_MAT_FLIGHT]		= { .type = NLA_UNSPEC },
+	[NET_MAT_STATS]			= { .type = NLA_NESTED },
 };
 
+/*
+ * matchd_sendto() - send a reply or an event
+ * @nlbuf: the message, its destination set for events
+ * @flags: sendmsg() flags, MSG_DONTWAIT for events
+ *
+ * Return: bytes sent or a negative libnl error code
+ */
+static int matchd_sendto(struct nl_msg *nlbuf, int flags)
+{
+	struct sockaddr_nl *dst;
+	struct nlmsghdr *nlh;
+	int err;
+
+	if (matchd_send_fn) {
+		err = matchd_send_fn(nlbuf, matchd_send_arg);
+	} else if (!flags) {
+		err = nl_send_auto(nsd, nlbuf);
+	} else {
+		nl_complete_msg(nsd, nlbuf);
+		nlh = nlmsg_hdr(nlbuf);
+		dst = nlmsg_get_dst(nlbuf);
+		err = (int)sendto(nl_socket_get_fd(nsd), nlh, nlh->nlmsg_len,
+				  flags, (struct sockaddr *)dst, sizeof(*dst));
+		if (err < 0)
+			err = -nl_syserr2nlerr(errno);
+	}
+
+	/* only events are sent outside of a command */
+	MAT_PROBE(reply__send, matchd_stats_cur ? matchd_stats_cur->cmd :
+		  NET_MAT_EVENT_CMD_NOTIFY, MAT_FLIGHT_HOOK_NONE, 0, 0, err);
+
+	if (err >= 0 && matchd_stats_cur)
+		matchd_stats_cur->tx_bytes += nlmsg_hdr(nlbuf)->nlmsg_len;
+	return err;
+}
+
+static int matchd_send(struct nl_msg *nlbuf)
+{
+	return matchd_sendto(nlbuf, 0);
+}
+
+/*
+ * matchd_hook_start() - trace the call of a backend hook
+ * @cmd: command being processed
+ * @hook: backend hook called, enum mat_flight_hook
+ * @table: table id, 0 if none
+ * @uid: rule or port uid, 0 if none
+ *
+ * Return: start time to pass to matchd_hook_end()
+ */
+static uint64_t matchd_hook_start(uint8_t cmd, uint8_t hook, uint32_t table,
+				  uint32_t uid)
+{
+	MAT_PROBE(backend__entry, cmd, hook, table, uid, 0);
+	return mat_flight_now();
+}
+
+/* Record the return of a backend hook started by matchd_hook_start() */
+static void matchd_hook_end(uint8_t cmd, uint8_t hook, uint32_t table,
+			    uint32_t uid, int err, uint64_t start)
+{
+	mat_flight_record(cmd, hook, table, uid, err, start);
+	MAT_PROBE(backend__exit, cmd, hook, table, uid, err);
+}
+
+static struct mat_stream *matchd_stream(void)
+{
+	return matchd_verbose ? mat_stream_stdout() : NULL;
+}
+
 static struct nl_msg *match_alloc_msg(struct nlmsghdr *nlh, uint8_t type, uint16_t flags, int size)
 {
 	unsigned int seq = nlh->nlmsg_seq;
@@ -173,7 +401,7 @@ static inline void free_multipart_msg(struct multipart_head *head)
 {
 	struct multipart_node *node;
 
-	TAILQ_FOREACH(node, head, entries) {
+	while ((node = TAILQ_FIRST(head))) {
 		if (node->nlbuf)
 			nlmsg_free(node->nlbuf);
 		TAILQ_REMOVE(head, node, entries);
@@ -217,7 +445,7 @@ static int send_done(struct nlmsghdr *nlh)
 
 	nlmsg_set_dst(nlbuf, &nladdr);
 
-	ret = nl_send_auto(nsd, nlbuf);
+	ret = matchd_send(nlbuf);
 	nlmsg_free(nlbuf);
 
 	return ret;
@@ -239,18 +467,26 @@ send_multipart_msg(struct nlmsghdr *nlh, struct multipart_head *head,
 	int err;
 	int ret = 0;
 
+	unsigned int parts = 0;
+
 	TAILQ_FOREACH(node, head, entries) {
-		err = nl_send_auto(nsd, node->nlbuf);
+		err = matchd_send(node->nlbuf);
 		if (err < 0) {
 			free_multipart_msg(head);
 			return err;
 		}
 		ret += err;
+		parts++;
 	}
 
 	if (multipart) {
+		if (matchd_stats_cur)
+			matchd_stats_cur->multipart++;
 		err = send_done(nlh);
 		ret = (err < 0) ? err : ret + err;
+		MAT_PROBE(multipart__flush, matchd_stats_cur ?
+			  matchd_stats_cur->cmd : NET_MAT_EVENT_CMD_NOTIFY,
+			  MAT_FLIGHT_HOOK_NONE, 0, parts, ret < 0 ? ret : 0);
 	}
 
 	free_multipart_msg(head);
@@ -265,7 +501,8 @@ static int match_cmd_get_tables(struct nlmsghdr *nlh)
 	struct nlmsghdr *nlh_multi;
 	unsigned int ifindex = 0;
 	struct nl_msg *nlbuf = NULL;
-	int i, err = -ENOMSG;
+	unsigned int i;
+	int err = -ENOMSG;
 	bool multipart = false;
 
 	err = genlmsg_parse(nlh, 0, tb, NET_MAT_MAX,
@@ -278,7 +515,7 @@ static int match_cmd_get_tables(struct nlmsghdr *nlh)
 
 #ifdef MATCHD_MOCK_SUPPORT
 	TAILQ_INIT(&head);
-	for (i = 0; i < MAX_MOCK_TABLES;) {
+	for (i = 0; i < matchd_tables_size;) {
 		/* allocate storage for nlbuf node */
 		node = malloc(sizeof(*node));
 		if (!node) {
@@ -327,7 +564,7 @@ static int match_cmd_get_tables(struct nlmsghdr *nlh)
 			goto nla_put_failure;
 		}
 
-		for (; i < MAX_MOCK_TABLES; i++) {
+		for (; i < matchd_tables_size; i++) {
 			if (my_dyn_table_list[i].uid < 1)
 				continue;
 
@@ -386,7 +623,7 @@ static int match_cmd_get_headers(struct nlmsghdr *nlh)
 		MAT_LOG(ERR, "Warning failed to pack headers.\n");
 		goto nla_put_failure;
 	}
-	return nl_send_auto(nsd, nlbuf);
+	err = matchd_send(nlbuf);
 
 nla_put_failure:
 	if (nlbuf)
@@ -434,7 +671,7 @@ static int match_cmd_get_actions(struct nlmsghdr *nlh)
 		}
 	}
 	nla_nest_end(nlbuf, actions);
-	return nl_send_auto(nsd, nlbuf);
+	err = matchd_send(nlbuf);
 
 nla_put_failure:
 	if (nlbuf)
@@ -470,7 +707,7 @@ static int match_cmd_get_header_graph(struct nlmsghdr *nlh)
 
 	match_put_header_graph(nlbuf, backend->hdr_nodes);
 
-	return nl_send_auto(nsd, nlbuf);
+	err = matchd_send(nlbuf);
 
 nla_put_failure:
 	if (nlbuf)
@@ -504,7 +741,7 @@ static int match_cmd_get_table_graph(struct nlmsghdr *nlh)
 
 	match_put_table_graph(nlbuf, backend->tbl_nodes);
 
-	return nl_send_auto(nsd, nlbuf);
+	err = matchd_send(nlbuf);
 
 nla_put_failure:
 	if (nlbuf)
@@ -517,8 +754,480 @@ static struct nla_policy match_table_rules_policy[NET_MAT_TABLE_RULES_MAX + 1] =
 	[NET_MAT_TABLE_RULES_MINPRIO] = { .type = NLA_U32,},
 	[NET_MAT_TABLE_RULES_MAXPRIO] = { .type = NLA_U32,},
 	[NET_MAT_TABLE_RULES_RULES]   = { .type = NLA_NESTED,},
+	[NET_MAT_TABLE_RULES_ENCODING] = { .type = NLA_U32,},
+	[NET_MAT_TABLE_RULES_FILTER] = { .type = NLA_NESTED,},
+};
+
+#ifdef MATCHD_MOCK_SUPPORT
+static int matchd_rule_index_grow(struct matchd_rule_index *idx)
+{
+	struct matchd_rule_key **buckets, *k, *next;
+	unsigned int size, i;
+
+	size = idx->size ? idx->size * 2 : MATCHD_RULE_INDEX_MIN_SIZE;
+	buckets = calloc(size, sizeof(*buckets));
+	if (!buckets)
+		return -ENOMEM;
+
+	for (i = 0; i < idx->size; i++) {
+		for (k = idx->buckets[i]; k; k = next) {
+			next = k->next;
+			k->next = buckets[k->hash & (size - 1)];
+			buckets[k->hash & (size - 1)] = k;
+		}
+	}
+
+	free(idx->buckets);
+	idx->buckets = buckets;
+	idx->size = size;
+	return 0;
+}
+
+static void matchd_rule_index_add(uint32_t table, struct net_mat_rule *rule)
+{
+	struct matchd_rule_index *idx = &matchd_rule_index[table];
+	struct net_mat_field_ref *m;
+	struct matchd_rule_key *k;
+
+	for (m = rule->matches; m && m->header && !idx->stale; m++) {
+		/* keep the load factor below 3/4 */
+		if ((idx->count + 1) * 4 > idx->size * 3 &&
+		    matchd_rule_index_grow(idx)) {
+			idx->stale = true;
+			break;
+		}
+
+		k = malloc(sizeof(*k));
+		if (!k) {
+			idx->stale = true;
+			break;
+		}
+
+		k->hash = match_field_ref_hash(m);
+		k->uid = rule->uid;
+		k->next = idx->buckets[k->hash & (idx->size - 1)];
+		idx->buckets[k->hash & (idx->size - 1)] = k;
+		idx->count++;
+	}
+
+	if (idx->stale)
+		MAT_LOG(ERR, "Warning: rule index of table %u disabled\n",
+			table);
+}
+
+static void matchd_rule_index_del(uint32_t table, struct net_mat_rule *rule)
+{
+	struct matchd_rule_index *idx = &matchd_rule_index[table];
+	struct matchd_rule_key **pk, *k;
+	struct net_mat_field_ref *m;
+	uint32_t hash;
+
+	if (!idx->size)
+		return;
+
+	for (m = rule->matches; m && m->header; m++) {
+		hash = match_field_ref_hash(m);
+		for (pk = &idx->buckets[hash & (idx->size - 1)]; *pk;
+		     pk = &(*pk)->next) {
+			k = *pk;
+			if (k->hash == hash && k->uid == rule->uid) {
+				*pk = k->next;
+				free(k);
+				idx->count--;
+				break;
+			}
+		}
+	}
+}
+
+static void matchd_rule_index_free(uint32_t table)
+{
+	struct matchd_rule_index *idx = &matchd_rule_index[table];
+	struct matchd_rule_key *k, *next;
+	unsigned int i;
+
+	for (i = 0; i < idx->size; i++) {
+		for (k = idx->buckets[i]; k; k = next) {
+			next = k->next;
+			free(k);
+		}
+	}
+
+	free(idx->buckets);
+	memset(idx, 0, sizeof(*idx));
+}
+
+static int matchd_uid_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * matchd_rule_index_find() - list the candidates of a get rules filter
+ * @table: the table
+ * @filter: the filter
+ * @min: lowest rule uid
+ * @max: highest rule uid
+ * @uids: set to the sorted uids of the candidates, free with free()
+ * @count: set to the number of candidates
+ *
+ * Return: 0 on success, -ENOENT if the filter has no exact field or the
+ *         index cannot be used, the table is then scanned, or -ENOMEM
+ */
+static int matchd_rule_index_find(uint32_t table,
+				  struct net_mat_rule_filter *filter,
+				  uint32_t min, uint32_t max,
+				  uint32_t **uids, uint32_t *count)
+{
+	struct matchd_rule_index *idx = &matchd_rule_index[table];
+	struct net_mat_field_ref *f;
+	struct matchd_rule_key *k;
+	uint32_t hash, n = 0, i, j;
+	uint32_t *u;
+
+	if (idx->stale)
+		return -ENOENT;
+
+	for (f = filter->matches; f && f->header; f++) {
+		if (match_field_ref_exact(f))
+			break;
+	}
+	if (!f || !f->header)
+		return -ENOENT;
+
+	hash = match_field_ref_hash(f);
+	if (idx->size) {
+		for (k = idx->buckets[hash & (idx->size - 1)]; k; k = k->next)
+			n += k->hash == hash;
+	}
+
+	u = malloc((n + 1) * sizeof(*u));
+	if (!u)
+		return -ENOMEM;
+
+	n = 0;
+	if (idx->size) {
+		for (k = idx->buckets[hash & (idx->size - 1)]; k; k = k->next) {
+			if (k->hash == hash && k->uid >= min && k->uid <= max)
+				u[n++] = k->uid;
+		}
+	}
+
+	/* rules are returned in uid order, once each */
+	qsort(u, n, sizeof(*u), matchd_uid_cmp);
+	for (i = 0, j = 0; i < n; i++) {
+		if (!j || u[j - 1] != u[i])
+			u[j++] = u[i];
+	}
+
+	*uids = u;
+	*count = j;
+	return 0;
+}
+
+/*
+ * matchd_get_rule_counters() - read the counters of a rule
+ * @reads: the reads of the request or sweep, closed by
+ *	   matchd_counter_reads_end()
+ * @cmd: command being processed
+ * @rule: the rule
+ *
+ * Every read is traced by the backend probes, but a request may read the
+ * counters of a whole table so reads only add up to a flight event
+ * recorded once they are over.
+ */
+static void matchd_get_rule_counters(struct matchd_counter_reads *reads,
+				     uint8_t cmd, struct net_mat_rule *rule)
+{
+	if (!backend->get_rule_counters)
+		return;
+
+	if (!reads->count++) {
+		reads->start = mat_flight_now();
+		reads->table = rule->table_id;
+	} else if (reads->table != rule->table_id) {
+		reads->table = 0;
+	}
+
+	MAT_PROBE(backend__entry, cmd, MAT_FLIGHT_HOOK_GET_RULE_COUNTERS,
+		  rule->table_id, rule->uid, 0);
+	(backend->get_rule_counters)(rule);
+	MAT_PROBE(backend__exit, cmd, MAT_FLIGHT_HOOK_GET_RULE_COUNTERS,
+		  rule->table_id, rule->uid, 0);
+}
+
+/* Record the counter reads done so far as one flight event */
+static void matchd_counter_reads_end(struct matchd_counter_reads *reads,
+				     uint8_t cmd)
+{
+	if (!reads->count)
+		return;
+
+	mat_flight_record(cmd, MAT_FLIGHT_HOOK_GET_RULE_COUNTERS, reads->table,
+			  0, 0, reads->start);
+	reads->count = 0;
+}
+
+/* Walk over the rules of a get rules request which pass its filter */
+struct matchd_rules_iter {
+	struct net_mat_rule *rules;
+	struct net_mat_rule_filter *filter;	/* NULL for all rules */
+	uint32_t *uids;		/* candidates, NULL to scan pos to end */
+	uint32_t pos;
+	uint32_t end;
+	bool counted;		/* counters read for each rule returned */
+	struct matchd_counter_reads reads;
+};
+
+/* Return the uid of the current or next rule, 0 once done */
+static uint32_t matchd_rules_seek(struct matchd_rules_iter *it)
+{
+	struct net_mat_rule *r;
+
+	for (; it->pos < it->end; it->pos++) {
+		r = &it->rules[it->uids ? it->uids[it->pos] : it->pos];
+		if (!r->uid)
+			continue;
+		if (!it->filter)
+			return r->uid;
+
+		if (it->filter->min_packets)
+			matchd_get_rule_counters(&it->reads,
+						 NET_MAT_TABLE_CMD_GET_RULES, r);
+		if (match_rule_filter(r, it->filter))
+			return r->uid;
+	}
+
+	return 0;
+}
+
+struct matchd_top {
+	uint64_t key;
+	uint32_t uid;
 };
 
+/* Rank of a below b, ties go to the lowest uid */
+static bool matchd_top_below(const struct matchd_top *a,
+			     const struct matchd_top *b)
+{
+	return a->key < b->key || (a->key == b->key && a->uid > b->uid);
+}
+
+/* Min-heap of the @max highest ranked rules seen so far */
+static void matchd_top_push(struct matchd_top *heap, uint32_t *count,
+			    uint32_t max, const struct matchd_top *e)
+{
+	struct matchd_top tmp;
+	uint32_t i, c;
+
+	if (*count < max) {
+		/* sift up */
+		i = (*count)++;
+		heap[i] = *e;
+		while (i && matchd_top_below(&heap[i], &heap[(i - 1) / 2])) {
+			tmp = heap[i];
+			heap[i] = heap[(i - 1) / 2];
+			heap[(i - 1) / 2] = tmp;
+			i = (i - 1) / 2;
+		}
+		return;
+	}
+
+	if (!matchd_top_below(&heap[0], e))
+		return;
+
+	/* replace the lowest entry and sift down */
+	heap[0] = *e;
+	for (i = 0; (c = 2 * i + 1) < *count; i = c) {
+		if (c + 1 < *count && matchd_top_below(&heap[c + 1], &heap[c]))
+			c++;
+		if (!matchd_top_below(&heap[c], &heap[i]))
+			break;
+		tmp = heap[i];
+		heap[i] = heap[c];
+		heap[c] = tmp;
+	}
+}
+
+static int matchd_top_cmp(const void *a, const void *b)
+{
+	const struct matchd_top *x = a, *y = b;
+
+	return matchd_top_below(x, y) ? 1 : matchd_top_below(y, x) ? -1 : 0;
+}
+
+/* Packets per second of a rule since its oldest sample */
+static uint64_t matchd_rule_rate(struct matchd_rule_sample *s,
+				 struct net_mat_rule *rule, uint64_t now)
+{
+	uint64_t packets, ns;
+
+	if (!s->ns || now - s->ns >= MATCHD_RATE_WINDOW_NS) {
+		s->prev_packets = s->packets;
+		s->prev_ns = s->ns;
+		s->packets = rule->packets;
+		s->ns = now;
+	}
+
+	packets = s->prev_ns ? s->prev_packets : s->packets;
+	ns = s->prev_ns ? s->prev_ns : s->ns;
+
+	/* counters that went backwards were reset */
+	if (now <= ns || rule->packets < packets)
+		return 0;
+
+	return (uint64_t)((double)(rule->packets - packets) * 1e9 /
+			  (double)(now - ns));
+}
+
+/*
+ * Allocate the samples of a table and take a first sample of all of its
+ * rules, so that the window of the first rates starts with the request
+ * asking for them rather than with the one after.
+ */
+static struct matchd_rule_sample *
+matchd_rule_samples_seed(struct matchd_rules_iter *it, uint32_t table,
+			 uint64_t now)
+{
+	struct matchd_rule_sample *samples;
+	struct net_mat_rule *r;
+	uint32_t uid;
+
+	samples = calloc(my_dyn_table_list[table].size + 1, sizeof(*samples));
+	if (!samples)
+		return NULL;
+
+	for (uid = 1; uid <= my_dyn_table_list[table].size; uid++) {
+		r = &it->rules[uid];
+		if (!r->uid)
+			continue;
+		if (!it->counted)
+			matchd_get_rule_counters(&it->reads,
+						 NET_MAT_TABLE_CMD_GET_RULES, r);
+		samples[uid].packets = r->packets;
+		samples[uid].ns = now;
+	}
+	samples[0].ns = now;
+
+	matchd_rule_samples[table] = samples;
+	return samples;
+}
+
+/*
+ * matchd_rules_top() - narrow a get rules walk to its top rules
+ * @it: the walk, positioned on its first rule
+ * @table: the table
+ * @filter: the filter of the request, with a non zero top
+ *
+ * The counters of every rule passing the filter are read once and the
+ * rules are ranked with a heap bounded by the number of rules asked for.
+ * The walk is then replaced by the top rules, highest first. Ranking by
+ * rate fails with -EAGAIN for a second after the table is first sampled.
+ *
+ * Return: 0 on success or a negative error code
+ */
+static int matchd_rules_top(struct matchd_rules_iter *it, uint32_t table,
+			    struct net_mat_rule_filter *filter)
+{
+	struct matchd_rule_sample *samples = NULL;
+	uint32_t max, count = 0, i, uid;
+	struct matchd_top *heap, e;
+	struct net_mat_rule *r;
+	uint64_t now = 0;
+	uint32_t *uids;
+
+	if (filter->top_key > NET_MAT_RULES_TOP_MAX)
+		return -EINVAL;
+
+	max = filter->top;
+	if (max > my_dyn_table_list[table].size)
+		max = my_dyn_table_list[table].size;
+
+	if (filter->top_key == NET_MAT_RULES_TOP_RATE) {
+		now = mat_flight_now();
+		samples = matchd_rule_samples[table];
+		if (!samples) {
+			samples = matchd_rule_samples_seed(it, table, now);
+			if (!samples)
+				return -ENOMEM;
+		}
+		/* no rate until a full window since the first sample */
+		if (now - samples[0].ns < MATCHD_RATE_WINDOW_NS)
+			return -EAGAIN;
+	}
+
+	heap = calloc(max + 1, sizeof(*heap));
+	uids = calloc(max + 1, sizeof(*uids));
+	if (!heap || !uids) {
+		free(heap);
+		free(uids);
+		return -ENOMEM;
+	}
+
+	while ((uid = matchd_rules_seek(it))) {
+		r = &it->rules[uid];
+		if (!it->counted)
+			matchd_get_rule_counters(&it->reads,
+						 NET_MAT_TABLE_CMD_GET_RULES, r);
+
+		switch (filter->top_key) {
+		case NET_MAT_RULES_TOP_BYTES:
+			e.key = r->bytes;
+			break;
+		case NET_MAT_RULES_TOP_RATE:
+			e.key = matchd_rule_rate(&samples[uid], r, now);
+			break;
+		default:
+			e.key = r->packets;
+			break;
+		}
+		e.uid = uid;
+		matchd_top_push(heap, &count, max, &e);
+		it->pos++;
+	}
+
+	qsort(heap, count, sizeof(*heap), matchd_top_cmp);
+	for (i = 0; i < count; i++)
+		uids[i] = heap[i].uid;
+	free(heap);
+
+	free(it->uids);
+	it->uids = uids;
+	it->pos = 0;
+	it->end = count;
+	it->filter = NULL;
+	it->counted = true;
+	return 0;
+}
+#endif /* MATCHD_MOCK_SUPPORT */
+
+static struct nlattr *match_rules_start(struct nl_msg *nlbuf,
+					unsigned int encoding)
+{
+	if (encoding == NET_MAT_RULES_ENC_COMPACT)
+		return match_put_rules_compact_start(nlbuf);
+	return nla_nest_start(nlbuf, NET_MAT_RULES);
+}
+
+static int match_rules_put(struct nl_msg *nlbuf, struct nlattr *nest,
+			   unsigned int encoding, struct net_mat_rule *rule)
+{
+	if (encoding == NET_MAT_RULES_ENC_COMPACT)
+		return match_put_rule_compact(nlbuf, nest, rule);
+	return match_put_rule(nlbuf, rule);
+}
+
+static void match_rules_end(struct nl_msg *nlbuf, struct nlattr *nest,
+			    unsigned int encoding)
+{
+	if (encoding == NET_MAT_RULES_ENC_COMPACT)
+		match_put_rules_compact_end(nlbuf, nest);
+	else
+		nla_nest_end(nlbuf, nest);
+}
+
 static int match_cmd_get_rules(struct nlmsghdr *nlh)
 {
 	struct multipart_head head;
@@ -526,13 +1235,18 @@ static int match_cmd_get_rules(struct nlmsghdr *nlh)
 	bool multipart = false;
 	struct nlmsghdr *nlh_multi;
 	unsigned int table = 0, min = 0, max = 0, ifindex = 0;
+	unsigned int encoding = NET_MAT_RULES_ENC_NLA;
 	struct nlattr *tb[NET_MAT_MAX+1];
 	int err = -ENOMSG;
 	struct nl_msg *nlbuf = NULL;
 #ifdef MATCHD_MOCK_SUPPORT
-	struct net_mat_rule *rules;
+	struct net_mat_rule_filter filter;
+	struct matchd_rules_iter it;
 	struct nlattr *nest;
 	unsigned int i;
+
+	memset(&filter, 0, sizeof(filter));
+	memset(&it, 0, sizeof(it));
 #endif
 
 	err = genlmsg_parse(nlh, 0, tb, NET_MAT_MAX, match_get_tables_policy);
@@ -565,8 +1279,16 @@ static int match_cmd_get_rules(struct nlmsghdr *nlh)
 	if (tb[NET_MAT_TABLE_RULES_MAXPRIO])
 		max = nla_get_u32(tb[NET_MAT_TABLE_RULES_MAXPRIO]);
 
+	if (tb[NET_MAT_TABLE_RULES_ENCODING])
+		encoding = nla_get_u32(tb[NET_MAT_TABLE_RULES_ENCODING]);
+
+	if (encoding > NET_MAT_RULES_ENC_MAX) {
+		MAT_LOG(ERR, "Error: unknown rules encoding %u\n", encoding);
+		return -EINVAL;
+	}
+
 #ifdef MATCHD_MOCK_SUPPORT
-	if (table > MAX_MOCK_TABLES - 1 || table < 1) {
+	if (table >= matchd_tables_size || table < 1) {
 		MAT_LOG(ERR, "Error: Table id is out of range\n");
 		return -ERANGE;
 	}
@@ -583,18 +1305,64 @@ static int match_cmd_get_rules(struct nlmsghdr *nlh)
 		MAT_LOG(ERR, "Error: rule id min/max is out of range\n");
 		return -ERANGE;
 	}
-#endif
 
-	/* continue until the last rule is processed */
-	TAILQ_INIT(&head);
-	for (;;) {
-		/* allocate storage for nlbuf node */
-		node = malloc(sizeof(*node));
-		if (!node) {
-			MAT_LOG(ERR, "Error: Cannot allocate node\n");
-			free_multipart_msg(&head);
-			return -ENOMEM;
-		}
+	it.rules = matchd_mock_tables[table];
+	it.pos = min;
+	it.end = max + 1;
+
+	if (tb[NET_MAT_TABLE_RULES_FILTER]) {
+		err = match_get_rule_filter(tb[NET_MAT_TABLE_RULES_FILTER],
+					    &filter);
+		if (err) {
+			MAT_LOG(ERR, "Error: Cannot parse get rules filter\n");
+			match_free_rule_filter(&filter);
+			return -EINVAL;
+		}
+		it.filter = &filter;
+		/* min_packets reads the counters of each rule it tests */
+		it.counted = filter.min_packets && backend->get_rule_counters;
+
+		err = matchd_rule_index_find(table, &filter, min, max,
+					     &it.uids, &it.end);
+		if (err == -ENOMEM) {
+			match_free_rule_filter(&filter);
+			return err;
+		}
+		if (!err)
+			it.pos = 0;
+		else
+			it.end = max + 1;
+
+		if (filter.top) {
+			err = matchd_rules_top(&it, table, &filter);
+			if (err) {
+				if (err == -EAGAIN)
+					MAT_LOG(INFO, "Rates of table %u not sampled for a second yet\n",
+						table);
+				else
+					MAT_LOG(ERR, "Error: Cannot rank rules\n");
+				/* record the counters read before failing */
+				matchd_counter_reads_end(&it.reads,
+					NET_MAT_TABLE_CMD_GET_RULES);
+				match_free_rule_filter(&filter);
+				free(it.uids);
+				return err;
+			}
+		}
+	}
+#endif
+
+	/* continue until the last rule is processed */
+	TAILQ_INIT(&head);
+	for (;;) {
+		/* allocate storage for nlbuf node */
+		node = malloc(sizeof(*node));
+		if (!node) {
+			MAT_LOG(ERR, "Error: Cannot allocate node\n");
+			free_multipart_msg(&head);
+			err = -ENOMEM;
+			goto out;
+		}
 
 		nlbuf = match_alloc_msg(nlh, NET_MAT_TABLE_CMD_GET_RULES,
 				NLM_F_REQUEST|NLM_F_ACK, 0);
@@ -604,7 +1372,8 @@ static int match_cmd_get_rules(struct nlmsghdr *nlh)
 			 * since it has not yet been added to the tailq */
 			free(node);
 			free_multipart_msg(&head);
-			return -ENOMEM;
+			err = -ENOMEM;
+			goto out;
 		}
 
 		node->nlbuf = nlbuf;
@@ -623,24 +1392,27 @@ static int match_cmd_get_rules(struct nlmsghdr *nlh)
 		if (err) {
 			MAT_LOG(ERR, "Error: Cannot put identifier\n");
 			free_multipart_msg(&head);
-			return -EMSGSIZE;
+			err = -EMSGSIZE;
+			goto out;
 		}
 
 		err = nla_put_u32(nlbuf, NET_MAT_IDENTIFIER, ifindex);
 		if (err) {
 			MAT_LOG(ERR, "Error: Cannot put ifindex\n");
 			free_multipart_msg(&head);
-			return -EMSGSIZE;
+			err = -EMSGSIZE;
+			goto out;
 		}
 
 #ifdef MATCHD_MOCK_SUPPORT
 		/* it does not make sense for nla_nest_start to fail
 		 * here, so treat it as a real error. */
-		nest = nla_nest_start(nlbuf, NET_MAT_RULES);
+		nest = match_rules_start(nlbuf, encoding);
 		if (!nest) {
 			MAT_LOG(ERR, "Error: Cannot put rules\n");
 			free_multipart_msg(&head);
-			return -EMSGSIZE;
+			err = -EMSGSIZE;
+			goto out;
 		}
 
 #ifdef DEBUG
@@ -648,26 +1420,24 @@ static int match_cmd_get_rules(struct nlmsghdr *nlh)
 		MAT_LOG(DEBUG, "get_rules: table  %d\n", table);
 #endif /* DEBUG */
 
-		rules = matchd_mock_tables[table];
-		for (i = min; i < max + 1; i++) {
-			if (!rules[i].uid)
-				continue;
-
+		while ((i = matchd_rules_seek(&it))) {
 #ifdef DEBUG
 			if (table >= TABLE_DYN_START) {
 				__u32 switch_table_id;
 				__u64 pkts, octets;
 
-				switch_table_id = rules[i].table_id - TABLE_DYN_START + 1;
+				switch_table_id = it.rules[i].table_id - TABLE_DYN_START + 1;
 
-				switch_get_rule_counters(rules[i].hw_ruleid,
+				switch_get_rule_counters(it.rules[i].hw_ruleid,
 					switch_table_id, &pkts, &octets);
 			}
 #endif /* DEBUG */
 
-			if (backend->get_rule_counters)
-				(backend->get_rule_counters)(&rules[i]);
-			err = match_put_rule(nlbuf, &rules[i]);
+			if (!it.counted)
+				matchd_get_rule_counters(&it.reads,
+						NET_MAT_TABLE_CMD_GET_RULES,
+						&it.rules[i]);
+			err = match_rules_put(nlbuf, nest, encoding, &it.rules[i]);
 			if (err) {
 				/* a multipart message is needed so set the
 				 * NLM_F_MULTI flag, end this nest, and run
@@ -676,15 +1446,15 @@ static int match_cmd_get_rules(struct nlmsghdr *nlh)
 				nlh_multi = nlmsg_hdr(nlbuf);
 				nlh_multi->nlmsg_flags |= NLM_F_MULTI;
 				multipart = true;
-				nla_nest_end(nlbuf, nest);
-				min = i;
+				match_rules_end(nlbuf, nest, encoding);
 				break;
 			}
+			it.pos++;
 		}
 
 		/* break when all rules have been processed */
-		if (i == max + 1) {
-			nla_nest_end(nlbuf, nest);
+		if (!i) {
+			match_rules_end(nlbuf, nest, encoding);
 			break;
 		}
 
@@ -693,7 +1463,14 @@ static int match_cmd_get_rules(struct nlmsghdr *nlh)
 #endif /* MATCHD_MOCK_SUPPORT */
 	}
 
-	return send_multipart_msg(nlh, &head, multipart);
+	err = send_multipart_msg(nlh, &head, multipart);
+out:
+#ifdef MATCHD_MOCK_SUPPORT
+	matchd_counter_reads_end(&it.reads, NET_MAT_TABLE_CMD_GET_RULES);
+	match_free_rule_filter(&filter);
+	free(it.uids);
+#endif
+	return err;
 }
 
 /*
@@ -915,10 +1692,342 @@ done:
 	return err;
 }
 
+/*
+ * Change events
+ *
+ * Clients register their netlink port with NET_MAT_EVENT_CMD_SUBSCRIBE
+ * and a mask of NET_MAT_EVENT_F_* classes. Events raised while a command
+ * is processed are batched into one NET_MAT_EVENT_CMD_NOTIFY message per
+ * class which is unicast to every interested subscriber once the command
+ * completes. Subscribers whose port has gone away are dropped.
+ *
+ * Events are sent without blocking so that a subscriber which stops
+ * reading cannot stall the daemon. An event which does not fit in its
+ * receive buffer is dropped, and a subscriber which overran its buffer
+ * MATCHD_MAX_OVERRUNS times in a row is dropped as well.
+ */
+#define MATCHD_MAX_SUBSCRIBERS 32
+#define MATCHD_MAX_OVERRUNS 8
+
+struct matchd_subscriber {
+	uint32_t pid;
+	uint32_t mask;
+	uint32_t overruns;	/* consecutive events dropped */
+};
+
+static struct matchd_subscriber subscribers[MATCHD_MAX_SUBSCRIBERS];
+static uint64_t matchd_event_drops;
+
+static struct nl_msg *event_buf;
+static struct nlattr *event_nest;
+static uint32_t event_class;
+
+/* Port changes are reported by the backend from its own thread. They are
+ * queued here and sent by the receive loop, which owns the socket and the
+ * subscribers and is woken through fd.
+ */
+#define MATCHD_PORT_EVENTS 64
+
+static struct {
+	pthread_mutex_t lock;
+	struct net_mat_event events[MATCHD_PORT_EVENTS];
+	unsigned int count;
+	uint64_t drops;		/* events lost to a full queue */
+	int fd;			/* eventfd, -1 if not initialized */
+} matchd_port_events = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.fd = -1,
+};
+
+static uint32_t match_event_class(enum net_mat_event_type type)
+{
+	switch (type) {
+	case NET_MAT_EVENT_T_RULE_ADD:
+	case NET_MAT_EVENT_T_RULE_DEL:
+	case NET_MAT_EVENT_T_RULE_UPDATE:
+		return NET_MAT_EVENT_F_RULES;
+	case NET_MAT_EVENT_T_TABLE_CREATE:
+	case NET_MAT_EVENT_T_TABLE_DESTROY:
+	case NET_MAT_EVENT_T_TABLE_UPDATE:
+		return NET_MAT_EVENT_F_TABLES;
+	case NET_MAT_EVENT_T_PORT_CHANGE:
+		return NET_MAT_EVENT_F_PORTS;
+	default:
+		return 0;
+	}
+}
+
+static bool match_event_subscribed(uint32_t class)
+{
+	int i;
+
+	for (i = 0; i < MATCHD_MAX_SUBSCRIBERS; i++) {
+		if (subscribers[i].pid && (subscribers[i].mask & class))
+			return true;
+	}
+
+	return false;
+}
+
+static int match_event_subscribe(uint32_t pid, uint32_t mask)
+{
+	int i, slot = -1;
+
+	if (!pid)
+		return -EINVAL;
+
+	for (i = 0; i < MATCHD_MAX_SUBSCRIBERS; i++) {
+		if (subscribers[i].pid == pid) {
+			slot = i;
+			break;
+		}
+		if (!subscribers[i].pid && slot < 0)
+			slot = i;
+	}
+
+	if (!mask) {
+		if (slot >= 0 && subscribers[slot].pid == pid)
+			subscribers[slot].pid = 0;
+		return 0;
+	}
+
+	if (slot < 0) {
+		MAT_LOG(ERR, "Error: too many event subscribers\n");
+		return -ENOSPC;
+	}
+
+	subscribers[slot].mask = mask;
+	subscribers[slot].pid = pid;
+	subscribers[slot].overruns = 0;
+	return 0;
+}
+
+static struct nl_msg *match_alloc_event_msg(void)
+{
+	struct nl_msg *nlbuf;
+
+	nlbuf = nlmsg_alloc();
+	if (!nlbuf)
+		return NULL;
+
+	if (!genlmsg_put(nlbuf, 0, 0, family, 0, 0, NET_MAT_EVENT_CMD_NOTIFY,
+			 NET_MAT_GENL_VERSION) ||
+	    nla_put_u32(nlbuf, NET_MAT_IDENTIFIER_TYPE,
+			NET_MAT_IDENTIFIER_IFINDEX) ||
+	    nla_put_u32(nlbuf, NET_MAT_IDENTIFIER, 0)) {
+		nlmsg_free(nlbuf);
+		return NULL;
+	}
+
+	return nlbuf;
+}
+
+/*
+ * match_event_send() - unicast an event message to its subscribers
+ * @nlbuf: NET_MAT_EVENT_CMD_NOTIFY message to send
+ * @class: NET_MAT_EVENT_F_* class of the events in @nlbuf
+ */
+static void match_event_send(struct nl_msg *nlbuf, uint32_t class)
+{
+	struct sockaddr_nl nladdr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = 0,
+	};
+	uint32_t pid;
+	int i, err;
+
+	for (i = 0; i < MATCHD_MAX_SUBSCRIBERS; i++) {
+		pid = subscribers[i].pid;
+		if (!pid || !(subscribers[i].mask & class))
+			continue;
+
+		nladdr.nl_pid = pid;
+		nlmsg_set_dst(nlbuf, &nladdr);
+
+		err = matchd_sendto(nlbuf, MSG_DONTWAIT);
+		if (err == -NLE_OBJ_NOTFOUND) {
+			MAT_LOG(INFO, "dropping event subscriber %u\n", pid);
+			subscribers[i].pid = 0;
+		} else if (err == -NLE_AGAIN) {
+			matchd_event_drops++;
+			if (++subscribers[i].overruns < MATCHD_MAX_OVERRUNS)
+				continue;
+			MAT_LOG(ERR, "Warning: dropping event subscriber %u, "
+				"not reading its events\n", pid);
+			subscribers[i].pid = 0;
+		} else if (err < 0) {
+			MAT_LOG(ERR, "Warning: event to %u failed: %s\n",
+				pid, nl_geterror(err));
+		} else {
+			subscribers[i].overruns = 0;
+		}
+	}
+}
+
+static void match_event_flush(void)
+{
+	if (!event_buf)
+		return;
+
+	nla_nest_end(event_buf, event_nest);
+	match_event_send(event_buf, event_class);
+
+	nlmsg_free(event_buf);
+	event_buf = NULL;
+	event_nest = NULL;
+	event_class = 0;
+}
+
+/*
+ * match_event_post() - queue an event for the subscribers of its class
+ * @event: the event to queue
+ *
+ * The event is added to the message being batched for the current
+ * command, which is sent by match_event_flush(). Must only be called
+ * from the receive loop.
+ */
+static void match_event_post(struct net_mat_event *event)
+{
+	uint32_t class = match_event_class(event->type);
+	int tries;
+
+	if (!match_event_subscribed(class))
+		return;
+
+	/* one class per message so subscribers only get what they asked */
+	if (event_buf && event_class != class)
+		match_event_flush();
+
+	for (tries = 0; tries < 2; tries++) {
+		if (!event_buf) {
+			event_buf = match_alloc_event_msg();
+			if (!event_buf)
+				break;
+
+			event_nest = nla_nest_start(event_buf, NET_MAT_EVENTS);
+			if (!event_nest) {
+				nlmsg_free(event_buf);
+				event_buf = NULL;
+				break;
+			}
+			event_class = class;
+		}
+
+		if (!match_put_event(event_buf, event))
+			return;
+
+		/* message is full, send what we have and start over */
+		match_event_flush();
+	}
+
+	MAT_LOG(ERR, "Warning: dropped %s event\n", event_type_str(event->type));
+}
+
+static void match_event_rule(int cmd, struct net_mat_rule *rule)
+{
+	struct net_mat_event event = {
+		.type = (cmd == NET_MAT_TABLE_CMD_SET_RULES) ?
+			NET_MAT_EVENT_T_RULE_ADD : NET_MAT_EVENT_T_RULE_DEL,
+		.table_id = rule->table_id,
+		.uid = rule->uid,
+	};
+
+	match_event_post(&event);
+}
+
+static void match_event_table(uint8_t cmd, struct net_mat_tbl *table)
+{
+	struct net_mat_event event = {
+		.table_id = table->uid,
+	};
+
+	switch (cmd) {
+	case NET_MAT_TABLE_CMD_CREATE_TABLE:
+		event.type = NET_MAT_EVENT_T_TABLE_CREATE;
+		break;
+	case NET_MAT_TABLE_CMD_DESTROY_TABLE:
+		event.type = NET_MAT_EVENT_T_TABLE_DESTROY;
+		break;
+	case NET_MAT_TABLE_CMD_UPDATE_TABLE:
+		event.type = NET_MAT_EVENT_T_TABLE_UPDATE;
+		break;
+	default:
+		return;
+	}
+
+	match_event_post(&event);
+}
+
+/*
+ * match_event_port() - queue a port change for the port subscribers
+ * @port_id: the port which changed
+ * @state: the new port state
+ *
+ * Installed as the backend port event handler, so unlike the other event
+ * helpers it may run outside the receive loop. The event is only queued
+ * and the eventfd signaled, match_event_port_flush() sends it once the
+ * receive loop polls the eventfd readable.
+ */
+static void match_event_port(uint32_t port_id, enum port_state state)
+{
+	struct net_mat_event event = {
+		.type = NET_MAT_EVENT_T_PORT_CHANGE,
+		.port_id = port_id,
+		.state = state,
+	};
+	uint64_t one = 1;
+	ssize_t n;
+
+	pthread_mutex_lock(&matchd_port_events.lock);
+	if (matchd_port_events.count < MATCHD_PORT_EVENTS)
+		matchd_port_events.events[matchd_port_events.count++] = event;
+	else
+		matchd_port_events.drops++;
+	pthread_mutex_unlock(&matchd_port_events.lock);
+
+	if (matchd_port_events.fd >= 0) {
+		n = write(matchd_port_events.fd, &one, sizeof(one));
+		(void)n;	/* the counter saturating still wakes the loop */
+	}
+}
+
+/* Send the port changes queued by match_event_port(), receive loop only */
+static void match_event_port_flush(void)
+{
+	struct net_mat_event events[MATCHD_PORT_EVENTS];
+	unsigned int count, i;
+	uint64_t drops, value;
+	ssize_t n;
+
+	if (matchd_port_events.fd >= 0) {
+		n = read(matchd_port_events.fd, &value, sizeof(value));
+		(void)n;
+	}
+
+	pthread_mutex_lock(&matchd_port_events.lock);
+	count = matchd_port_events.count;
+	memcpy(events, matchd_port_events.events, count * sizeof(events[0]));
+	drops = matchd_port_events.drops;
+	matchd_port_events.count = 0;
+	matchd_port_events.drops = 0;
+	pthread_mutex_unlock(&matchd_port_events.lock);
+
+	if (drops) {
+		matchd_event_drops += drops;
+		MAT_LOG(ERR, "Warning: dropped %llu port events\n",
+			(unsigned long long)drops);
+	}
+
+	for (i = 0; i < count; i++)
+		match_event_post(&events[i]);
+	match_event_flush();
+}
+
 static int match_cmd_resolve_rules(struct net_mat_rule *rule, int cmd,
 				  unsigned int error_method,
 				  struct nl_msg *nlbuf)
 {
+	uint64_t start;
 	int i, err = 0;
 
 	for (i = 0; rule[i].uid; i++) {
@@ -926,7 +2035,7 @@ static int match_cmd_resolve_rules(struct net_mat_rule *rule, int cmd,
 		unsigned int table = rule[i].table_id;
 		struct net_mat_rule *rules;
 
-		if (table >= MAX_MOCK_TABLES) {
+		if (table >= matchd_tables_size) {
 			MAT_LOG(ERR, "Invalid table %i\n", table);
 			err = -EINVAL;
 			goto skip_add;
@@ -963,29 +2072,57 @@ static int match_cmd_resolve_rules(struct net_mat_rule *rule, int cmd,
 				goto skip_add;
 			}
 
-			err = match_is_valid_rule(get_tables(table), rule);
+			err = match_is_valid_rule(get_tables(table), &rule[i]);
+			MAT_PROBE(rule__validate, cmd, MAT_FLIGHT_HOOK_NONE,
+				  table, rule[i].uid, err);
 			if (err) {
 				MAT_LOG(ERR, "Warning, rule invalid\n");
 				goto skip_add;
 			}
 
+			start = matchd_hook_start((uint8_t)cmd,
+						  MAT_FLIGHT_HOOK_SET_RULES,
+						  rule[i].table_id, rule[i].uid);
 			err = (backend->set_rules)(&rule[i]);
+			matchd_hook_end((uint8_t)cmd, MAT_FLIGHT_HOOK_SET_RULES,
+					rule[i].table_id, rule[i].uid, err,
+					start);
 			if(err) {
 				goto skip_add;
 			}
 #ifdef MATCHD_MOCK_SUPPORT
 			rules[rule[i].uid] = rule[i];
+			matchd_rule_index_add(table, &rules[rule[i].uid]);
+			if (matchd_rule_samples[table]) {
+				struct matchd_rule_sample *s;
+
+				s = &matchd_rule_samples[table][rule[i].uid];
+				memset(s, 0, sizeof(*s));
+				s->ns = mat_flight_now();
+			}
+			mat_shm_set_rule(matchd_shm, &rules[rule[i].uid]);
 #endif /* MATCHD_MOCK_SUPPORT */
+			match_event_rule(cmd, &rule[i]);
 			break;
 		case NET_MAT_TABLE_CMD_DEL_RULES:
+			start = matchd_hook_start((uint8_t)cmd,
+						  MAT_FLIGHT_HOOK_DEL_RULES,
+						  rule[i].table_id, rule[i].uid);
 			err = (backend->del_rules)(&rules[rule[i].uid]);
+			matchd_hook_end((uint8_t)cmd, MAT_FLIGHT_HOOK_DEL_RULES,
+					rule[i].table_id, rule[i].uid, err,
+					start);
 			if(err) {
 				goto skip_add;
 			}
 #ifdef MATCHD_MOCK_SUPPORT
+			if (rules[rule[i].uid].uid)
+				matchd_rule_index_del(table, &rules[rule[i].uid]);
 			rules[rule[i].uid].uid = 0;
 			rules[rule[i].uid].hw_ruleid = 0;
+			mat_shm_del_rule(matchd_shm, table, rule[i].uid);
 #endif /* MATCHD_MOCK_SUPPORT */
+			match_event_rule(cmd, &rule[i]);
 			break;
 		default:
 			err = -EINVAL;
@@ -1024,6 +2161,7 @@ static int match_cmd_rules(struct nlmsghdr *nlh)
 	struct net_mat_rule *rule = NULL;
 	unsigned int ifindex = 0;
 	struct nl_msg *nlbuf = NULL;
+	struct nlattr *failed, *rules;
 	int err = -ENOMSG;
 
 	if (glh->cmd > NET_MAT_CMD_MAX) {
@@ -1053,25 +2191,50 @@ static int match_cmd_rules(struct nlmsghdr *nlh)
 	if (tb[NET_MAT_RULES_ERROR])
 		error_method = nla_get_u32(tb[NET_MAT_RULES_ERROR]);
 
+	/* Rules may come in either encoding, compact is used if present */
+	rules = tb[NET_MAT_RULES_COMPACT];
+	if (!rules)
+		rules = tb[NET_MAT_RULES];
+	if (!rules) {
+		MAT_LOG(ERR, "Warning received a rule oper without rules\n");
+		err = -EINVAL;
+		goto nla_put_failure;
+	}
+
 	/* Generates a null terminated list of rules for processing */
-	err = match_get_rules(mat_stream_stdout(), tb[NET_MAT_RULES], &rule);
+	err = match_get_rules(matchd_stream(), rules, &rule);
 	if (err) {
 		MAT_LOG(ERR, "Warning received an invalid set_rule oper\n");
 		goto nla_put_failure;
 	}
 
+	/* Rules logged by the *_LOG error methods are returned in a
+	 * NET_MAT_RULES nest so the client can decode them with
+	 * match_get_rules(). The nest is dropped if every rule succeeded.
+	 */
+	failed = nla_nest_start(nlbuf, NET_MAT_RULES);
+	if (!failed) {
+		err = -EMSGSIZE;
+		goto nla_put_failure;
+	}
+
 	err = match_cmd_resolve_rules(rule, glh->cmd, error_method, nlbuf);
 	if (err && (error_method < NET_MAT_RULES_ERROR_CONTINUE + 1)) {
 		MAT_LOG(ERR, "%s: return err %i\n", __func__, err);
 		goto nla_put_failure;
 	}
 
-	err = nl_send_auto(nsd, nlbuf);
+	nla_nest_end(nlbuf, failed);
+	if (!nla_len(failed))
+		nla_nest_cancel(nlbuf, failed);
+
+	err = matchd_send(nlbuf);
 	if (err < 0) {
-		MAT_LOG(ERR, "%s: nl_send_suto returned err %d\n",
+		MAT_LOG(ERR, "%s: matchd_send returned err %d\n",
 			__func__, err);
 		goto nla_put_failure;
 	}
+	nlmsg_free(nlbuf);
 	return err;
 
 nla_put_failure:
@@ -1291,6 +2454,7 @@ static int match_cmd_table(struct nlmsghdr *nlh)
 	unsigned int ifindex = 0;
 	int i, err = -ENOMSG;
 	struct nl_msg *nlbuf = NULL;
+	uint64_t start;
 
 	nlbuf = match_alloc_msg(nlh, NET_MAT_TABLE_CMD_CREATE_TABLE,
 			       NLM_F_REQUEST|NLM_F_ACK, 0);
@@ -1346,147 +2510,460 @@ static int match_cmd_table(struct nlmsghdr *nlh)
 					__func__, tables[i].uid);
 
 #ifdef MATCHD_MOCK_SUPPORT
+			if (tables[i].uid >= matchd_tables_size) {
+				err = -EINVAL;
+				goto nla_put_failure;
+			}
 			if (my_dyn_table_list[tables[i].uid].uid < 1) {
 				err = -EINVAL;
 				goto nla_put_failure;
 			}
-			if (tables[i].uid > MAX_MOCK_TABLES - 1) {
+#endif /* MATCHD_MOCK_SUPPORT */
+
+			start = matchd_hook_start(glh->cmd,
+						  MAT_FLIGHT_HOOK_DESTROY_TABLE,
+						  tables[i].uid, 0);
+			err = (backend->destroy_table)(&tables[i]);
+			matchd_hook_end(glh->cmd, MAT_FLIGHT_HOOK_DESTROY_TABLE,
+					tables[i].uid, 0, err, start);
+			if(err < 0) {
+				MAT_LOG(ERR, "delete table %d error %d\n", i, err);
+				goto nla_put_failure;
+			}
+
+#ifdef MATCHD_MOCK_SUPPORT
+			mat_shm_del_table(matchd_shm, tables[i].uid);
+			matchd_rule_index_free(tables[i].uid);
+			free(matchd_rule_samples[tables[i].uid]);
+			matchd_rule_samples[tables[i].uid] = NULL;
+			my_dyn_table_list[tables[i].uid].uid = 0;
+			free(matchd_mock_tables[tables[i].uid]);
+			matchd_mock_tables[tables[i].uid] = NULL;
+#endif /* MATCHD_MOCK_SUPPORT */
+			break;
+
+		case NET_MAT_TABLE_CMD_CREATE_TABLE:
+#ifdef MATCHD_MOCK_SUPPORT
+			if(!src) {
+				err = -EINVAL;
+				goto nla_put_failure;
+			}
+			pp_table(mat_stream_stdout(), &tables[i]);
+
+			err = matchd_tables_grow(tables[i].uid);
+			if (err) {
+				MAT_LOG(ERR, "create table request greater "
+						"than max tables abort!\n");
+				if (err == -ERANGE)
+					err = -EINVAL;
+				goto nla_put_failure;
+			}
+
+			if (matchd_mock_tables[tables[i].uid]) {
+				MAT_LOG(ERR, "create table request exists "
+					"in mock tables abort!\n");
+				err = -EEXIST;
+				goto nla_put_failure;
+			}
+
+			if (my_dyn_table_list[tables[i].uid].uid) {
+				MAT_LOG(ERR, "create table request exists "
+					"in dyn tables abort!\n");
+				err = -EEXIST;
+				goto nla_put_failure;
+			}
+#endif /* MATCHD_MOCK_SUPPORT */
+
+			if (match_is_dynamic_table(tables[i].source) == false) {
+				MAT_LOG(ERR, "create table requests require"
+						" dynamic bit\n");
+				err = -EINVAL;
+				goto nla_put_failure;
+			}
+
+			if (src->size < tables[i].size) {
+				MAT_LOG(ERR, "Dynamic table's size must be less than or equal to source table's size\n");
+				err = -EINVAL;
+				goto nla_put_failure;
+			}
+
+			if (match_set_dyn_tbl_matches(src, &tables[i])) {
+				MAT_LOG(ERR, "Dynamic table's matches must be a subset of the source table's matches\n");
+				err = -EINVAL;
+				goto nla_put_failure;
+			}
+
+			if (match_check_field_masks(src, &tables[i])) {
+				MAT_LOG(ERR, "Match mask(s) invalid\n");
 				err = -EINVAL;
 				goto nla_put_failure;
 			}
+
+			if (match_set_dyn_tbl_actions(src, &tables[i])) {
+				MAT_LOG(ERR, "Dynamic table's actions must be a subset of the source table's actions\n");
+				err = -EINVAL;
+				goto nla_put_failure;
+			}
+
+#ifdef MATCHD_MOCK_SUPPORT
+			/* In ENOMEM case leave my_dyn_table_list allocated
+			 * anticipating a retry from agent.
+			 */
+			matchd_mock_tables[tables[i].uid] = calloc(1 +
+				tables[i].size, sizeof(struct net_mat_rule));
+			if (!matchd_mock_tables[tables[i].uid]) {
+				MAT_LOG(ERR, "rule table alloc failed!\n");
+				err = -ENOMEM;
+				goto nla_put_failure;
+			}
+#endif /* MATCHD_MOCK_SUPPORT */
+
+			start = matchd_hook_start(glh->cmd,
+						  MAT_FLIGHT_HOOK_CREATE_TABLE,
+						  tables[i].uid, 0);
+			err = (backend->create_table)(&tables[i]);
+			matchd_hook_end(glh->cmd, MAT_FLIGHT_HOOK_CREATE_TABLE,
+					tables[i].uid, 0, err, start);
+			if(err < 0) {
+				MAT_LOG(ERR, "create table failed err=%d\n", err);
+				free(matchd_mock_tables[tables[i].uid]);
+				matchd_mock_tables[tables[i].uid] = NULL;
+				goto nla_put_failure;
+			}
+
+#ifdef MATCHD_MOCK_SUPPORT
+			my_dyn_table_list[tables[i].uid] = tables[i];
+			mat_shm_set_table(matchd_shm, &tables[i]);
 #endif /* MATCHD_MOCK_SUPPORT */
+			break;
+		case NET_MAT_TABLE_CMD_UPDATE_TABLE:
+			start = matchd_hook_start(glh->cmd,
+						  MAT_FLIGHT_HOOK_UPDATE_TABLE,
+						  tables[i].uid, 0);
+			err = (backend->update_table)(&tables[i]);
+			matchd_hook_end(glh->cmd, MAT_FLIGHT_HOOK_UPDATE_TABLE,
+					tables[i].uid, 0, err, start);
+			if (err < 0) {
+				MAT_LOG(ERR, "update table failed err=%d\n", err);
+				goto nla_put_failure;
+			}
+			break;
+		default:
+			MAT_LOG(ERR, "table cmd error\n");
+			break;
+		}
+
+		match_event_table(glh->cmd, &tables[i]);
+	}
+
+	if (glh->cmd == NET_MAT_TABLE_CMD_DESTROY_TABLE)
+		match_pop_tables_a(tables);
+	else if (glh->cmd == NET_MAT_TABLE_CMD_CREATE_TABLE)
+		match_push_tables_a(tables);
+
+	pipeline_generation++;
+	mat_shm_set_generation(matchd_shm, pipeline_generation);
+
+	err = matchd_send(nlbuf);
+
+	if (err < 0) {
+		MAT_LOG(ERR, "matchd_send returned error %d\n", err);
+		goto nla_put_failure;
+	}
+
+	nlmsg_free(nlbuf);
+	return err;
+
+nla_put_failure:
+	if (tables)
+		free(tables);
+	if (nlbuf)
+		nlmsg_free(nlbuf);
+	return err;
+}
+
+static int match_cmd_get_generation(struct nlmsghdr *nlh)
+{
+	struct nlattr *tb[NET_MAT_MAX+1];
+	unsigned int ifindex = 0;
+	struct nl_msg *nlbuf = NULL;
+	int err = -ENOMSG;
+
+	nlbuf = match_alloc_msg(nlh, NET_MAT_TABLE_CMD_GET_GENERATION,
+				NLM_F_REQUEST|NLM_F_ACK, 0);
+	if (!nlbuf) {
+		MAT_LOG(ERR, "Message allocation failed.\n");
+		err = -ENOMEM;
+		goto nla_put_failure;
+	}
+
+	err = genlmsg_parse(nlh, 0, tb, NET_MAT_MAX, match_get_tables_policy);
+	if (err) {
+		MAT_LOG(ERR, "Warnings genlmsg_parse failed\n");
+		err = -EINVAL;
+		goto nla_put_failure;
+	}
+
+	NLA_PUT_U32(nlbuf, NET_MAT_IDENTIFIER_TYPE,
+			NET_MAT_IDENTIFIER_IFINDEX);
+	NLA_PUT_U32(nlbuf, NET_MAT_IDENTIFIER, ifindex);
+	NLA_PUT_U32(nlbuf, NET_MAT_GENERATION, pipeline_generation);
+	NLA_PUT_U32(nlbuf, NET_MAT_FEATURES, NET_MAT_FEATURE_RULES_COMPACT |
+					     NET_MAT_FEATURE_RULES_FILTER |
+					     NET_MAT_FEATURE_RULES_TOP);
+
+	err = matchd_send(nlbuf);
+
+nla_put_failure:
+	if (nlbuf)
+		nlmsg_free(nlbuf);
+	return err;
+}
+
+static int match_cmd_subscribe(struct nlmsghdr *nlh)
+{
+	struct nlattr *tb[NET_MAT_MAX+1];
+	unsigned int ifindex = 0;
+	struct nl_msg *nlbuf = NULL;
+	uint32_t mask = 0;
+	int err = -ENOMSG;
+
+	err = genlmsg_parse(nlh, 0, tb, NET_MAT_MAX, match_get_tables_policy);
+	if (err) {
+		MAT_LOG(ERR, "Warnings genlmsg_parse failed\n");
+		return -EINVAL;
+	}
+
+	if (tb[NET_MAT_EVENT_MASK])
+		mask = nla_get_u32(tb[NET_MAT_EVENT_MASK]);
+
+	err = match_event_subscribe(nlh->nlmsg_pid, mask);
+	if (err)
+		return err;
+
+	nlbuf = match_alloc_msg(nlh, NET_MAT_EVENT_CMD_SUBSCRIBE,
+				NLM_F_REQUEST|NLM_F_ACK, 0);
+	if (!nlbuf) {
+		MAT_LOG(ERR, "Message allocation failed.\n");
+		err = -ENOMEM;
+		goto nla_put_failure;
+	}
+
+	NLA_PUT_U32(nlbuf, NET_MAT_IDENTIFIER_TYPE,
+			NET_MAT_IDENTIFIER_IFINDEX);
+	NLA_PUT_U32(nlbuf, NET_MAT_IDENTIFIER, ifindex);
+	NLA_PUT_U32(nlbuf, NET_MAT_EVENT_MASK, mask);
+
+	err = matchd_send(nlbuf);
+
+nla_put_failure:
+	if (nlbuf)
+		nlmsg_free(nlbuf);
+	return err;
+}
+
+/* Flight recorder events per reply part, sized to fit the default message */
+#define MATCH_FLIGHT_EVENTS_PER_MSG \
+	((MATCH_NLMSG_DEFAULT_SIZE - 256) / sizeof(struct mat_flight_event))
+
+/*
+ * match_cmd_get_flight() - reply with the flight recorder events
+ * @nlh: the request
+ *
+ * Events are sent unsorted, in as many parts as needed, each holding one
+ * NET_MAT_FLIGHT attribute.
+ *
+ * Return: number of bytes sent on success or a negative error code
+ */
+static int match_cmd_get_flight(struct nlmsghdr *nlh)
+{
+	struct mat_flight_event *events;
+	struct multipart_head head;
+	struct multipart_node *node;
+	struct nl_msg *nlbuf;
+	unsigned int ifindex = 0;
+	unsigned int count, i = 0, n;
+	bool multipart;
+	int err;
+
+	err = mat_flight_snapshot(&events, &count);
+	if (err)
+		return err;
+
+	multipart = count > MATCH_FLIGHT_EVENTS_PER_MSG;
+
+	TAILQ_INIT(&head);
+	do {
+		node = malloc(sizeof(*node));
+		if (!node) {
+			err = -ENOMEM;
+			goto err;
+		}
+
+		nlbuf = match_alloc_msg(nlh, NET_MAT_DAEMON_CMD_GET_FLIGHT,
+					NLM_F_REQUEST|NLM_F_ACK, 0);
+		if (!nlbuf) {
+			free(node);
+			err = -ENOMEM;
+			goto err;
+		}
+
+		node->nlbuf = nlbuf;
+		TAILQ_INSERT_TAIL(&head, node, entries);
+
+		if (multipart)
+			nlmsg_hdr(nlbuf)->nlmsg_flags |= NLM_F_MULTI;
+
+		n = count - i;
+		if (n > MATCH_FLIGHT_EVENTS_PER_MSG)
+			n = MATCH_FLIGHT_EVENTS_PER_MSG;
+
+		if (nla_put_u32(nlbuf, NET_MAT_IDENTIFIER_TYPE,
+				NET_MAT_IDENTIFIER_IFINDEX) ||
+		    nla_put_u32(nlbuf, NET_MAT_IDENTIFIER, ifindex) ||
+		    nla_put(nlbuf, NET_MAT_FLIGHT,
+			    (int)(n * sizeof(*events)), &events[i])) {
+			err = -EMSGSIZE;
+			goto err;
+		}
+		i += n;
+	} while (i < count);
 
-			err = (backend->destroy_table)(&tables[i]);
-			if(err < 0) {
-				MAT_LOG(ERR, "delete table %d error %d\n", i, err);
-				goto nla_put_failure;
-			}
+	free(events);
+	return send_multipart_msg(nlh, &head, multipart);
+
+err:
+	MAT_LOG(ERR, "Error: Cannot build flight recorder reply\n");
+	free_multipart_msg(&head);
+	free(events);
+	return err;
+}
 
 #ifdef MATCHD_MOCK_SUPPORT
-			my_dyn_table_list[tables[i].uid].uid = 0;
-			free(matchd_mock_tables[tables[i].uid]);
-			matchd_mock_tables[tables[i].uid] = NULL;
+#define MATCH_STATS_TABLES	matchd_tables_size
+#else
+#define MATCH_STATS_TABLES	1
 #endif /* MATCHD_MOCK_SUPPORT */
-			break;
 
-		case NET_MAT_TABLE_CMD_CREATE_TABLE:
+/*
+ * match_stats_table() - count the rules installed in a table
+ * @table: table uid
+ * @t: set to the occupancy of the table
+ *
+ * Return: true if the table exists
+ */
+static bool match_stats_table(unsigned int table, struct net_mat_table_stats *t)
+{
 #ifdef MATCHD_MOCK_SUPPORT
-			if(!src) {
-				err = -EINVAL;
-				goto nla_put_failure;
-			}
-			pp_table(mat_stream_stdout(), &tables[i]);
-
-			if (tables[i].uid > MAX_MOCK_TABLES - 1) {
-				MAT_LOG(ERR, "create table request greater "
-						"than max tables abort!\n");
-				err =  -EINVAL;
-				goto nla_put_failure;
-			}
+	struct net_mat_rule *rules = matchd_mock_tables[table];
+	unsigned int i;
 
-			if (matchd_mock_tables[tables[i].uid]) {
-				MAT_LOG(ERR, "create table request exists "
-					"in mock tables abort!\n");
-				err = -EEXIST;
-				goto nla_put_failure;
-			}
+	if (!rules || !my_dyn_table_list[table].uid)
+		return false;
 
-			if (my_dyn_table_list[tables[i].uid].uid) {
-				MAT_LOG(ERR, "create table request exists "
-					"in dyn tables abort!\n");
-				err = -EEXIST;
-				goto nla_put_failure;
-			}
+	t->table_id = table;
+	t->size = my_dyn_table_list[table].size;
+	t->rules = 0;
+	for (i = 1; i <= t->size; i++) {
+		if (rules[i].uid)
+			t->rules++;
+	}
+	return true;
+#else
+	(void)table;
+	(void)t;
+	return false;
 #endif /* MATCHD_MOCK_SUPPORT */
+}
 
-			if (match_is_dynamic_table(tables[i].source) == false) {
-				MAT_LOG(ERR, "create table requests require"
-						" dynamic bit\n");
-				err = -EINVAL;
-				goto nla_put_failure;
-			}
-
-			if (src->size < tables[i].size) {
-				MAT_LOG(ERR, "Dynamic table's size must be less than or equal to source table's size\n");
-				err = -EINVAL;
-				goto nla_put_failure;
-			}
-
-			if (match_set_dyn_tbl_matches(src, &tables[i])) {
-				MAT_LOG(ERR, "Dynamic table's matches must be a subset of the source table's matches\n");
-				err = -EINVAL;
-				goto nla_put_failure;
-			}
+/*
+ * match_cmd_get_stats() - reply with the daemon counters
+ * @nlh: the request
+ *
+ * Each part holds a NET_MAT_STATS attribute with as many command and
+ * table entries as fit, only commands received at least once are sent.
+ *
+ * Return: number of bytes sent on success or a negative error code
+ */
+static int match_cmd_get_stats(struct nlmsghdr *nlh)
+{
+	struct net_mat_table_stats t;
+	struct multipart_head head;
+	struct multipart_node *node;
+	struct nlattr *nest;
+	struct nl_msg *nlbuf;
+	unsigned int ifindex = 0;
+	unsigned int cmd = 0, table = 1, parts = 0, put;
+	int err;
 
-			if (match_check_field_masks(src, &tables[i])) {
-				MAT_LOG(ERR, "Match mask(s) invalid\n");
-				err = -EINVAL;
-				goto nla_put_failure;
-			}
+	TAILQ_INIT(&head);
+	do {
+		node = malloc(sizeof(*node));
+		if (!node) {
+			err = -ENOMEM;
+			goto err;
+		}
 
-			if (match_set_dyn_tbl_actions(src, &tables[i])) {
-				MAT_LOG(ERR, "Dynamic table's actions must be a subset of the source table's actions\n");
-				err = -EINVAL;
-				goto nla_put_failure;
-			}
+		nlbuf = match_alloc_msg(nlh, NET_MAT_DAEMON_CMD_GET_STATS,
+					NLM_F_REQUEST|NLM_F_ACK, 0);
+		if (!nlbuf) {
+			free(node);
+			err = -ENOMEM;
+			goto err;
+		}
 
-#ifdef MATCHD_MOCK_SUPPORT
-			/* In ENOMEM case leave my_dyn_table_list allocated
-			 * anticipating a retry from agent.
-			 */
-			matchd_mock_tables[tables[i].uid] = calloc(1 +
-				tables[i].size, sizeof(struct net_mat_rule));
-			if (!matchd_mock_tables[tables[i].uid]) {
-				MAT_LOG(ERR, "rule table alloc failed!\n");
-				err = -ENOMEM;
-				goto nla_put_failure;
-			}
-#endif /* MATCHD_MOCK_SUPPORT */
+		node->nlbuf = nlbuf;
+		TAILQ_INSERT_TAIL(&head, node, entries);
+		parts++;
 
-			err = (backend->create_table)(&tables[i]);
-			if(err < 0) {
-				MAT_LOG(ERR, "create table failed err=%d\n", err);
-				free(matchd_mock_tables[tables[i].uid]);
-				matchd_mock_tables[tables[i].uid] = NULL;
-				goto nla_put_failure;
-			}
+		err = -EMSGSIZE;
+		if (nla_put_u32(nlbuf, NET_MAT_IDENTIFIER_TYPE,
+				NET_MAT_IDENTIFIER_IFINDEX) ||
+		    nla_put_u32(nlbuf, NET_MAT_IDENTIFIER, ifindex))
+			goto err;
+
+		nest = nla_nest_start(nlbuf, NET_MAT_STATS);
+		if (!nest ||
+		    nla_put_u64(nlbuf, NET_MAT_STATS_RX_DROPS, matchd_rx_drops) ||
+		    nla_put_u64(nlbuf, NET_MAT_STATS_EVENT_DROPS,
+				matchd_event_drops))
+			goto err;
+
+		/* fill the part and continue in a new one once it is full */
+		put = 0;
+		for (; cmd <= NET_MAT_CMD_MAX; cmd++) {
+			if (!matchd_stats[cmd].requests)
+				continue;
+			if (match_put_stats_cmd(nlbuf, &matchd_stats[cmd]))
+				break;
+			put++;
+		}
 
-#ifdef MATCHD_MOCK_SUPPORT
-			my_dyn_table_list[tables[i].uid] = tables[i];
-#endif /* MATCHD_MOCK_SUPPORT */
-			break;
-		case NET_MAT_TABLE_CMD_UPDATE_TABLE:
-			err = (backend->update_table)(&tables[i]);
-			if (err < 0) {
-				MAT_LOG(ERR, "update table failed err=%d\n", err);
-				goto nla_put_failure;
-			}
-			break;
-		default:
-			MAT_LOG(ERR, "table cmd error\n");
-			break;
+		for (; cmd > NET_MAT_CMD_MAX && table < MATCH_STATS_TABLES; table++) {
+			if (!match_stats_table(table, &t))
+				continue;
+			if (match_put_stats_table(nlbuf, &t))
+				break;
+			put++;
 		}
-	}
 
-	if (glh->cmd == NET_MAT_TABLE_CMD_DESTROY_TABLE)
-		match_pop_tables(&tables);
-	else if (glh->cmd == NET_MAT_TABLE_CMD_CREATE_TABLE)
-		match_push_tables_a(tables);
+		/* an entry too large for an empty message */
+		if (!put && (cmd <= NET_MAT_CMD_MAX || table < MATCH_STATS_TABLES))
+			goto err;
 
-	err = nl_send_auto(nsd, nlbuf);
+		nla_nest_end(nlbuf, nest);
+	} while (cmd <= NET_MAT_CMD_MAX || table < MATCH_STATS_TABLES);
 
-	if (err < 0) {
-		MAT_LOG(ERR, "nl_send_auto returned error %d\n", err);
-		goto nla_put_failure;
+	if (parts > 1) {
+		TAILQ_FOREACH(node, &head, entries)
+			nlmsg_hdr(node->nlbuf)->nlmsg_flags |= NLM_F_MULTI;
 	}
 
-	return err;
+	return send_multipart_msg(nlh, &head, parts > 1);
 
-nla_put_failure:
-	if (tables)
-		free(tables);
-	if (nlbuf)
-		nlmsg_free(nlbuf);
+err:
+	MAT_LOG(ERR, "Error: Cannot build stats reply\n");
+	free_multipart_msg(&head);
 	return err;
 }
 
@@ -1510,16 +2987,21 @@ static int match_cmd_get_ports(struct nlmsghdr *nlh)
 	unsigned int ifindex = 0;
 	bool multipart = false;
 	int err = -ENOMSG;
+	uint64_t start;
 
 	if (!backend->get_ports) {
 		MAT_LOG(ERR, "get_ports not supported by backend.\n");
 		return -EOPNOTSUPP;
 	}
 
+	start = matchd_hook_start(NET_MAT_PORT_CMD_GET_PORTS,
+				  MAT_FLIGHT_HOOK_GET_PORTS, 0, 0);
 	err = backend->get_ports(&ports);
+	matchd_hook_end(NET_MAT_PORT_CMD_GET_PORTS, MAT_FLIGHT_HOOK_GET_PORTS,
+			0, 0, err, start);
 	if (err) {
 		MAT_LOG(ERR, "get_ports failed in backend.\n");
-		return -EOPNOTSUPP;
+		return err < 0 ? err : -EIO;
 	}
 
 	for (bmax = 0, i = 0; ports[i].port_id != NET_MAT_PORT_ID_UNSPEC; i++) {
@@ -1530,6 +3012,7 @@ static int match_cmd_get_ports(struct nlmsghdr *nlh)
 	err = genlmsg_parse(nlh, 0, tb, NET_MAT_MAX, match_get_tables_policy);
 	if (err) {
 		MAT_LOG(ERR, "Warnings genlmsg_parse failed\n");
+		free(ports);
 		return -EINVAL;
 	}
 
@@ -1542,6 +3025,7 @@ static int match_cmd_get_ports(struct nlmsghdr *nlh)
 				       match_table_ports_policy);
 		if (err) {
 			MAT_LOG(ERR, "Error: Cannot parse get ports request\n");
+			free(ports);
 			return -EINVAL;
 		}
 
@@ -1599,8 +3083,10 @@ static int match_cmd_get_ports(struct nlmsghdr *nlh)
 		}
 
 		pnest = nla_nest_start(nlbuf, NET_MAT_PORTS);
-		if (!pnest)
+		if (!pnest) {
+			free(ports);
 			return -EMSGSIZE;
+		}
 
 		for (; ports[i].port_id != NET_MAT_PORT_ID_UNSPEC; i++) {
 			if (ports[i].port_id > max ||
@@ -1632,8 +3118,10 @@ static int match_cmd_get_ports(struct nlmsghdr *nlh)
 			break;
 	}
 
+	free(ports);
 	return send_multipart_msg(nlh, &head, multipart);
 nla_failure:
+	free(ports);
 	free(node);
 	free_multipart_msg(&head);
 	nlmsg_free(nlbuf);
@@ -1646,7 +3134,8 @@ static int match_cmd_set_ports(struct nlmsghdr *nlh)
 	struct nl_msg *nlbuf = NULL;
 	struct net_mat_port *p;
 	unsigned int ifindex = 0;
-	int err;
+	uint64_t start;
+	int i, err;
 
 	err = genlmsg_parse(nlh, 0, tb, NET_MAT_MAX, match_get_tables_policy);
 	if (err) {
@@ -1669,13 +3158,27 @@ static int match_cmd_set_ports(struct nlmsghdr *nlh)
 		return -EOPNOTSUPP;
 	}
 
+	start = matchd_hook_start(NET_MAT_PORT_CMD_SET_PORTS,
+				  MAT_FLIGHT_HOOK_SET_PORTS, 0, p[0].port_id);
 	err = backend->set_ports(p);
+	matchd_hook_end(NET_MAT_PORT_CMD_SET_PORTS, MAT_FLIGHT_HOOK_SET_PORTS,
+			0, p[0].port_id, err, start);
 	if (err) {
 		MAT_LOG(ERR, "set_ports failed in backend.\n");
 		free(p);
 		return err;
 	}
 
+	for (i = 0; p[i].port_id != NET_MAT_PORT_ID_UNSPEC; i++) {
+		struct net_mat_event event = {
+			.type = NET_MAT_EVENT_T_PORT_CHANGE,
+			.port_id = p[i].port_id,
+			.state = p[i].state,
+		};
+
+		match_event_post(&event);
+	}
+
 	nlbuf = match_alloc_msg(nlh, NET_MAT_PORT_CMD_SET_PORTS,
 				NLM_F_REQUEST|NLM_F_ACK, 0);
 	if (!nlbuf) {
@@ -1688,7 +3191,7 @@ static int match_cmd_set_ports(struct nlmsghdr *nlh)
 			NET_MAT_IDENTIFIER_IFINDEX);
 	NLA_PUT_U32(nlbuf, NET_MAT_IDENTIFIER, ifindex);
 
-	err = nl_send_auto(nsd, nlbuf);
+	err = matchd_send(nlbuf);
 nla_put_failure:
 	free(p);
 	nlmsg_free(nlbuf);
@@ -1704,6 +3207,8 @@ static int match_cmd_get_port(struct nlmsghdr *nlh, uint8_t cmd)
 	struct nl_msg *nlbuf = NULL;
 	int rem, err = -ENOMSG;
 	unsigned int count = 0;
+	uint64_t start;
+	uint8_t hook;
 
 	if ((cmd == NET_MAT_PORT_CMD_GET_LPORT && !backend->get_lport) ||
 	    (cmd == NET_MAT_PORT_CMD_GET_PHYS_PORT && !backend->get_phys_port)) {
@@ -1753,6 +3258,10 @@ static int match_cmd_get_port(struct nlmsghdr *nlh, uint8_t cmd)
 			return -EINVAL;
 		}
 
+		hook = cmd == NET_MAT_PORT_CMD_GET_LPORT ?
+		       MAT_FLIGHT_HOOK_GET_LPORT :
+		       MAT_FLIGHT_HOOK_GET_PHYS_PORT;
+		start = matchd_hook_start(cmd, hook, 0, ports[count].port_id);
 		if (cmd == NET_MAT_PORT_CMD_GET_LPORT)
 			err = backend->get_lport(&ports[count],
 			                         &ports[count].port_id,
@@ -1761,6 +3270,8 @@ static int match_cmd_get_port(struct nlmsghdr *nlh, uint8_t cmd)
 			err = backend->get_phys_port(&ports[count],
 						&ports[count].port_phys_id,
 						&ports[count].glort);
+		matchd_hook_end(cmd, hook, 0, ports[count].port_id, err,
+				start);
 
 		if (err) {
 			MAT_LOG(ERR, "get port failed in backend.\n");
@@ -1784,7 +3295,7 @@ static int match_cmd_get_port(struct nlmsghdr *nlh, uint8_t cmd)
 		MAT_LOG(ERR, "Warning failed to pack ports.\n");
 		goto nla_put_failure;
 	}
-	err = nl_send_auto(nsd, nlbuf);
+	err = matchd_send(nlbuf);
 nla_put_failure:
 	free(ports);
 	nlmsg_free(nlbuf);
@@ -1847,7 +3358,7 @@ static int send_error(struct nlmsghdr *orighdr, int err)
 
 	nlmsg_set_dst(nlbuf, &nladdr);
 
-	return nl_send_auto(nsd, nlbuf);
+	ret = matchd_send(nlbuf);
 done:
 	if (nlbuf)
 		nlmsg_free(nlbuf);
@@ -1871,13 +3382,36 @@ static int(*type_cb[NET_MAT_CMD_MAX+1])(struct nlmsghdr *nlh) = {
 	[NET_MAT_PORT_CMD_GET_LPORT]	    = match_cmd_get_lport,
 	[NET_MAT_PORT_CMD_GET_PHYS_PORT]    = match_cmd_get_phys_port,
 	[NET_MAT_PORT_CMD_SET_PORTS]	    = match_cmd_set_ports,
+	[NET_MAT_TABLE_CMD_GET_GENERATION]  = match_cmd_get_generation,
+	[NET_MAT_EVENT_CMD_SUBSCRIBE]	    = match_cmd_subscribe,
+	[NET_MAT_DAEMON_CMD_GET_FLIGHT]	    = match_cmd_get_flight,
+	[NET_MAT_DAEMON_CMD_GET_STATS]	    = match_cmd_get_stats,
 };
 
+/* Latency bucket of a request, see NET_MAT_STATS_LATENCY_BUCKETS */
+static unsigned int matchd_stats_bucket(uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	unsigned int bucket = 0;
+
+	while (us && bucket < NET_MAT_STATS_LATENCY_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
 int matchd_rx_process(struct nlmsghdr *nlh)
 {
 	struct genlmsghdr *glh = nlmsg_data(nlh);
+	struct net_mat_cmd_stats *stats = NULL;
+	uint64_t received, start, ns;
+	bool failed;
 	int err;
 
+	received = mat_flight_now();
+	MAT_PROBE(cmd__receive, glh->cmd, MAT_FLIGHT_HOOK_NONE, 0, 0, 0);
+
 	if (nlh->nlmsg_type != family) {
 		err = -EINVAL;
 		goto out;
@@ -1888,26 +3422,76 @@ int matchd_rx_process(struct nlmsghdr *nlh)
 		goto out;
 	}
 
+	stats = &matchd_stats[glh->cmd];
+	stats->cmd = glh->cmd;
+	matchd_stats_cur = stats;
+
 	if (type_cb[glh->cmd] == NULL) {
 		err = -EOPNOTSUPP;
 		goto out;
 	}
 
+	MAT_PROBE(cmd__dispatch, glh->cmd, MAT_FLIGHT_HOOK_NONE, 0, 0, 0);
+	start = mat_flight_now();
 	err = type_cb[glh->cmd](nlh);
+	mat_flight_record(glh->cmd, MAT_FLIGHT_HOOK_NONE, 0, 0,
+			  err < 0 ? err : 0, start);
 out:
-	return (err < 0) ? send_error(nlh, -err) : err;
+	failed = err < 0;
+	MAT_PROBE(cmd__done, glh->cmd, MAT_FLIGHT_HOOK_NONE, 0, 0,
+		  failed ? err : 0);
+	if (failed)
+		err = send_error(nlh, -err);
+
+	/* a request is accounted once answered, so that the histogram
+	 * always adds up to the request count
+	 */
+	if (stats) {
+		ns = mat_flight_now() - received;
+		stats->requests++;
+		stats->rx_bytes += nlh->nlmsg_len;
+		stats->errors += failed;
+		stats->latency_ns += ns;
+		stats->latency[matchd_stats_bucket(ns)]++;
+		matchd_stats_cur = NULL;
+	}
+
+	/* events raised by the command go out after its reply */
+	match_event_flush();
+	return err;
 }
 
 int matchd_uninit(void)
 {
 	/* Free up memory which was allocated using calloc, malloc, etc.. */
 
+	match_backend_set_port_event_handler(NULL);
+
+	if (matchd_port_events.fd >= 0) {
+		close(matchd_port_events.fd);
+		matchd_port_events.fd = -1;
+	}
+
+	mat_shm_destroy(matchd_shm);
+	matchd_shm = NULL;
+
 	if (backend != NULL)
 		match_backend_close(backend);
 
 	return 0;
 }
 
+void matchd_set_verbose(int verbose)
+{
+	matchd_verbose = verbose;
+}
+
+void matchd_set_send(matchd_send_fn_t fn, void *arg)
+{
+	matchd_send_fn = fn;
+	matchd_send_arg = arg;
+}
+
 int matchd_init(struct nl_sock *sock, int family_id,
 	       const char *backend_name, void *init_arg)
 {
@@ -1926,13 +3510,36 @@ int matchd_init(struct nl_sock *sock, int family_id,
 
 	nlmsg_set_default_size(MATCH_NLMSG_DEFAULT_SIZE);
 
+	pipeline_generation = (uint32_t)time(NULL);
+
 	backend = match_backend_open(backend_name, init_arg);
 	if (!backend) {
 		MAT_LOG(ERR, "Error: cannot open backend\n");
 		return -EINVAL;
 	}
 
+	matchd_port_events.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (matchd_port_events.fd < 0) {
+		rc = -errno;
+		MAT_LOG(ERR, "Error: cannot create event fd: %s\n",
+			strerror(-rc));
+		match_backend_close(backend);
+		backend = NULL;
+		return rc;
+	}
+
+	match_backend_set_port_event_handler(match_event_port);
+
 #ifdef MATCHD_MOCK_SUPPORT
+	for (i = 0; backend->tbls[i]; i++) {
+		rc = matchd_tables_grow(backend->tbls[i]->uid > (uint32_t)i + 1 ?
+					backend->tbls[i]->uid : (uint32_t)i + 1);
+		if (rc) {
+			MAT_LOG(ERR, "Error: cannot allocate table %u\n",
+				backend->tbls[i]->uid);
+			return rc;
+		}
+	}
 	for (i = 0; backend->tbls[i]; i++)
 		matchd_mock_tables[i+1] = calloc(1 + backend->tbls[i]->size,
 						sizeof(struct net_mat_rule));
@@ -1944,6 +3551,159 @@ int matchd_init(struct nl_sock *sock, int family_id,
 }
 
 
+/*
+ * matchd_shm_refresh() - republish counters and ports to the mirror
+ *
+ * A sweep starts with the ports and goes on with the rule counters, at
+ * most MATCHD_SHM_SWEEP rules per call.
+ *
+ * Return: true once the sweep is complete, false if it must be resumed
+ */
+static bool matchd_shm_refresh(void)
+{
+	struct net_mat_port *ports;
+	unsigned int i;
+#ifdef MATCHD_MOCK_SUPPORT
+	struct net_mat_rule *rules, *r;
+	struct net_mat_tbl *t;
+	unsigned int n = 0;
+#endif
+
+	if (!matchd_shm_table) {
+		if (backend->get_ports && !backend->get_ports(&ports)) {
+			for (i = 0; i < MATCHD_SHM_PORTS &&
+				    ports[i].port_id != NET_MAT_PORT_ID_UNSPEC;
+			     i++)
+				mat_shm_set_port(matchd_shm, i, &ports[i]);
+			for (; i < MATCHD_SHM_PORTS; i++)
+				mat_shm_set_port(matchd_shm, i, NULL);
+			free(ports);
+		}
+		matchd_shm_table = 1;
+		matchd_shm_uid = 1;
+	}
+
+#ifdef MATCHD_MOCK_SUPPORT
+	/* tables created or destroyed between calls are seen as they are */
+	for (; matchd_shm_table < matchd_tables_size;
+	     matchd_shm_table++, matchd_shm_uid = 1) {
+		rules = matchd_mock_tables[matchd_shm_table];
+		t = &my_dyn_table_list[matchd_shm_table];
+		if (!rules || !t->uid)
+			continue;
+
+		for (; matchd_shm_uid <= t->size; matchd_shm_uid++) {
+			r = &rules[matchd_shm_uid];
+			if (!r->uid)
+				continue;
+			if (n++ == MATCHD_SHM_SWEEP)
+				return false;
+			/* the mirror stands in for get rules, record it as one */
+			matchd_get_rule_counters(&matchd_shm_reads,
+						 NET_MAT_TABLE_CMD_GET_RULES, r);
+			mat_shm_set_rule(matchd_shm, r);
+		}
+	}
+#endif /* MATCHD_MOCK_SUPPORT */
+
+	matchd_shm_table = 0;
+	matchd_counter_reads_end(&matchd_shm_reads, NET_MAT_TABLE_CMD_GET_RULES);
+	mat_shm_touch(matchd_shm);
+	return true;
+}
+
+/*
+ * matchd_shm_enable() - publish the daemon state in shared memory
+ * @path: the file, usually MAT_SHM_FILE
+ * @interval_ms: period of the counter refresh done by matchd_receive_loop()
+ *
+ * Must be called after matchd_init(). Tables and rules are published as
+ * they change, rule counters and ports every @interval_ms. Large tables
+ * have their counters refreshed in slices between requests.
+ *
+ * Return: 0 on success or a negative error code
+ */
+int matchd_shm_enable(const char *path, unsigned int interval_ms)
+{
+	int err;
+#ifdef MATCHD_MOCK_SUPPORT
+	struct net_mat_tbl *t;
+	unsigned int i;
+#endif
+
+	if (!backend || !interval_ms)
+		return -EINVAL;
+
+#ifdef MATCHD_MOCK_SUPPORT
+	err = mat_shm_create(path, MATCHD_SHM_TABLES, MATCHD_SHM_RULES,
+			     MATCHD_SHM_PORTS, &matchd_shm);
+#else
+	err = mat_shm_create(path, 0, 0, MATCHD_SHM_PORTS, &matchd_shm);
+#endif
+	if (err)
+		return err;
+
+#ifdef MATCHD_MOCK_SUPPORT
+	for (i = 1; i < matchd_tables_size; i++) {
+		t = &my_dyn_table_list[i];
+		if (t->uid && matchd_mock_tables[t->uid])
+			mat_shm_set_table(matchd_shm, t);
+	}
+#endif
+	mat_shm_set_generation(matchd_shm, pipeline_generation);
+
+	matchd_shm_interval = (uint64_t)interval_ms * 1000000;
+	while (!matchd_shm_refresh())
+		;
+	matchd_shm_next = mat_flight_now() + matchd_shm_interval;
+	return 0;
+}
+
+/*
+ * matchd_poll() - wait for a request, sending port events and refreshing
+ *		   the mirror when due
+ * @sock: the daemon socket
+ *
+ * Return: 1 when a request can be received, 0 to wait again or a negative
+ *         error code
+ */
+static int matchd_poll(struct nl_sock *sock)
+{
+	struct pollfd pfd[2] = {
+		{ .fd = nl_socket_get_fd(sock), .events = POLLIN },
+		{ .fd = matchd_port_events.fd, .events = POLLIN },
+	};
+	int timeout = -1, n;
+	uint64_t now;
+
+	if (matchd_shm) {
+		now = mat_flight_now();
+		if (matchd_shm_table || now >= matchd_shm_next) {
+			/* the interval runs from the start of a sweep */
+			if (!matchd_shm_table)
+				matchd_shm_next = now + matchd_shm_interval;
+			matchd_shm_refresh();
+			now = mat_flight_now();
+		}
+
+		/* a sweep in progress resumes as soon as no request waits */
+		if (matchd_shm_table || now >= matchd_shm_next)
+			timeout = 0;
+		else
+			timeout = (int)((matchd_shm_next - now) / 1000000) + 1;
+	}
+
+	n = poll(pfd, 2, timeout);
+	if (n < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	if (pfd[1].revents & POLLIN)
+		match_event_port_flush();
+
+	/* errors such as ENOBUFS are reported by the receive */
+	return !!(pfd[0].revents & (POLLIN | POLLERR));
+}
+
 static int matchd_nl_valid_callback(struct nl_msg *msg,
 				    __attribute__((__unused__)) void *arg)
 {
@@ -1977,7 +3737,23 @@ int matchd_receive_loop(struct nl_sock *sock)
 	nl_socket_disable_seq_check(sock);
 
 	while (1) {
+		nlerr = matchd_poll(sock);
+		if (nlerr < 0) {
+			MAT_LOG(ERR, "poll() failed: %s\n", strerror(-nlerr));
+			return -ECOMM;
+		}
+		if (!nlerr)
+			continue;
+
 		nlerr = nl_recvmsgs_default(sock);
+		/* ENOBUFS, the receive queue overflowed and requests were
+		 * lost, the clients time out and the daemon keeps serving.
+		 */
+		if (nlerr == -NLE_NOMEM) {
+			matchd_rx_drops++;
+			MAT_LOG(ERR, "Warning: receive queue overrun\n");
+			continue;
+		}
 		if (nlerr < 0) {
 			MAT_LOG(ERR, "nl_recvmsgs_default() failed: %s\n",
 				nl_geterror(nlerr));
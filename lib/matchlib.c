@@ -39,6 +39,8 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <time.h>
 
 #include <getopt.h>
 
@@ -56,15 +58,11 @@
 #include "matchlib.h"
 #include "matlog.h"
 #include "matstream.h"
+#include "matarena.h"
+#include "matflight.h"
 
 #include <arpa/inet.h>
 
-#define MAX_TABLES 200
-#define MAX_HDRS 200
-#define MAX_FIELDS 200
-#define MAX_ACTIONS 200
-#define MAX_NODES 200
-
 #ifdef PRIx64
 #undef PRIx64
 #define PRIx64 "llx"
@@ -80,200 +78,605 @@ static char LR[] = "LR";
 static char shape[] = "shape";
 static char record[] = "record";
 
-Agnode_t *graphviz_table_nodes[MAX_NODES];
-Agnode_t *graphviz_header_nodes[MAX_NODES];
+/* Model objects are kept in uid indexed registries. A registry is a flat
+ * array of pointers grown on demand to cover the uids registered, so a
+ * lookup stays a bounds check and a load. The array is only grown while
+ * it stays within twice the number of objects registered, uids further
+ * out are kept in a small hash instead so that a single large uid read
+ * from a message cannot make the array huge. header_fields holds one
+ * registry of fields per header uid.
+ */
+#define MATCH_REGISTRY_MIN_SIZE 16
+#define MATCH_REGISTRY_SPARSE_MIN_SIZE 16
+
+struct match_registry_entry {
+	struct match_registry_entry *next;
+	unsigned int uid;
+	void *obj;
+};
+
+struct match_registry {
+	void **slot;
+	unsigned int size;
+	unsigned int count;	/* objects in slot and sparse */
+	struct match_registry_entry **sparse;
+	unsigned int sparse_size;	/* buckets, a power of two */
+	unsigned int sparse_count;
+};
+
+static struct match_registry graphviz_table_nodes;
+static struct match_registry graphviz_header_nodes;
+
+static struct match_registry tables;
+static struct match_registry headers;
+static struct match_registry header_fields;
+static struct match_registry actions;
+static struct match_registry graph_nodes;
+
+/* Name lookups are served from per-object hash indexes kept in sync with
+ * the registries above by the match_set_*() registration helpers. Each
+ * entry maps a (scope, name) pair to a uid, where the scope is the header
+ * uid for fields and 0 for every other object. A hit is only trusted if
+ * the registered object still carries the same name so a replaced or
+ * freed object never resolves through a stale entry.
+ */
+#define MATCH_NAME_INDEX_MIN_SIZE 64
+
+struct match_name_entry {
+	struct match_name_entry *next;
+	char *name;
+	uint32_t hash;
+	unsigned int scope;
+	unsigned int uid;
+};
+
+struct match_name_index {
+	struct match_name_entry **buckets;
+	unsigned int size;
+	unsigned int count;
+};
+
+static struct match_name_index table_index;
+static struct match_name_index header_index;
+static struct match_name_index field_index;
+static struct match_name_index action_index;
+static struct match_name_index graph_index;
+
+/* FNV-1a over the name, seeded with the scope */
+static uint32_t match_name_hash(unsigned int scope, const char *name)
+{
+	uint32_t hash = 2166136261u ^ scope;
+	const unsigned char *c;
+
+	for (c = (const unsigned char *)name; *c; c++) {
+		hash ^= *c;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static int match_name_index_grow(struct match_name_index *idx)
+{
+	struct match_name_entry **buckets, *e, *next;
+	unsigned int size, i;
+
+	size = idx->size ? idx->size * 2 : MATCH_NAME_INDEX_MIN_SIZE;
+	buckets = calloc(size, sizeof(*buckets));
+	if (!buckets)
+		return -ENOMEM;
+
+	for (i = 0; i < idx->size; i++) {
+		for (e = idx->buckets[i]; e; e = next) {
+			next = e->next;
+			e->next = buckets[e->hash & (size - 1)];
+			buckets[e->hash & (size - 1)] = e;
+		}
+	}
+
+	free(idx->buckets);
+	idx->buckets = buckets;
+	idx->size = size;
+	return 0;
+}
+
+static struct match_name_entry *
+match_name_index_lookup(struct match_name_index *idx, unsigned int scope,
+			const char *name, uint32_t hash)
+{
+	struct match_name_entry *e;
+
+	if (!idx->size)
+		return NULL;
+
+	for (e = idx->buckets[hash & (idx->size - 1)]; e; e = e->next) {
+		if (e->hash == hash && e->scope == scope &&
+		    strcmp(e->name, name) == 0)
+			return e;
+	}
 
-struct net_mat_tbl *tables[MAX_TABLES];
-struct net_mat_hdr *headers[MAX_HDRS];
-struct net_mat_field *header_fields[MAX_HDRS][MAX_FIELDS];
-struct net_mat_action *actions[MAX_ACTIONS];
-struct net_mat_hdr_node *graph_nodes[MAX_NODES];
+	return NULL;
+}
+
+static int match_name_index_add(struct match_name_index *idx,
+				unsigned int scope, const char *name,
+				unsigned int uid)
+{
+	struct match_name_entry *e;
+	uint32_t hash;
+	int err;
+
+	if (!name || !uid)
+		return 0;
+
+	hash = match_name_hash(scope, name);
+	e = match_name_index_lookup(idx, scope, name, hash);
+	if (e) {
+		e->uid = uid;
+		return 0;
+	}
+
+	/* keep the load factor below 3/4 */
+	if ((idx->count + 1) * 4 > idx->size * 3) {
+		err = match_name_index_grow(idx);
+		if (err)
+			return err;
+	}
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return -ENOMEM;
+
+	e->name = strdup(name);
+	if (!e->name) {
+		free(e);
+		return -ENOMEM;
+	}
+	e->hash = hash;
+	e->scope = scope;
+	e->uid = uid;
+	e->next = idx->buckets[hash & (idx->size - 1)];
+	idx->buckets[hash & (idx->size - 1)] = e;
+	idx->count++;
+
+	return 0;
+}
+
+static unsigned int match_name_index_find(struct match_name_index *idx,
+					  unsigned int scope, const char *name)
+{
+	struct match_name_entry *e;
+
+	if (!name)
+		return 0;
+
+	e = match_name_index_lookup(idx, scope, name,
+				    match_name_hash(scope, name));
+	return e ? e->uid : 0;
+}
+
+static void match_name_index_warn(int err, const char *name)
+{
+	if (err)
+		MAT_LOG(ERR, "Warning: unable to index %s (%s)\n",
+			name, strerror(-err));
+}
 
 char *graph_names(unsigned int uid);
 char *table_names(unsigned int uid);
 static void ppg_table_graph(struct mat_stream *matsp, struct net_mat_tbl_node *nodes);
 static void ppg_header_graph(struct mat_stream *matsp, struct net_mat_hdr_node *nodes);
 
-char *graph_names(unsigned int uid)
+static struct match_registry_entry **
+match_registry_sparse_find(const struct match_registry *r, unsigned int uid)
 {
-	if (uid < MAX_NODES)
-		return graph_nodes[uid] ? graph_nodes[uid]->name : none;
-	else
+	struct match_registry_entry **e;
+
+	if (!r->sparse_count)
 		return NULL;
+
+	for (e = &r->sparse[uid & (r->sparse_size - 1)]; *e; e = &(*e)->next) {
+		if ((*e)->uid == uid)
+			return e;
+	}
+
+	return NULL;
+}
+
+static void *match_registry_get(const struct match_registry *r,
+				unsigned int uid)
+{
+	struct match_registry_entry **e;
+
+	if (uid < r->size)
+		return r->slot[uid];
+
+	e = match_registry_sparse_find(r, uid);
+	return e ? (*e)->obj : NULL;
+}
+
+static int match_registry_sparse_grow(struct match_registry *r)
+{
+	struct match_registry_entry **sparse, *e, *next;
+	unsigned int size, i;
+
+	size = r->sparse_size ? r->sparse_size * 2 :
+	       MATCH_REGISTRY_SPARSE_MIN_SIZE;
+	sparse = calloc(size, sizeof(*sparse));
+	if (!sparse)
+		return -ENOMEM;
+
+	for (i = 0; i < r->sparse_size; i++) {
+		for (e = r->sparse[i]; e; e = next) {
+			next = e->next;
+			e->next = sparse[e->uid & (size - 1)];
+			sparse[e->uid & (size - 1)] = e;
+		}
+	}
+
+	free(r->sparse);
+	r->sparse = sparse;
+	r->sparse_size = size;
+	return 0;
+}
+
+static int match_registry_sparse_set(struct match_registry *r,
+				     unsigned int uid, void *obj)
+{
+	struct match_registry_entry **e, *n;
+	int err;
+
+	e = match_registry_sparse_find(r, uid);
+	if (e) {
+		if (obj) {
+			(*e)->obj = obj;
+			return 0;
+		}
+		n = *e;
+		*e = n->next;
+		free(n);
+		r->sparse_count--;
+		r->count--;
+		return 0;
+	}
+
+	if (!obj)
+		return 0;
+
+	/* keep the load factor below 3/4 */
+	if ((r->sparse_count + 1) * 4 > r->sparse_size * 3) {
+		err = match_registry_sparse_grow(r);
+		if (err)
+			return err;
+	}
+
+	n = malloc(sizeof(*n));
+	if (!n)
+		return -ENOMEM;
+
+	n->uid = uid;
+	n->obj = obj;
+	n->next = r->sparse[uid & (r->sparse_size - 1)];
+	r->sparse[uid & (r->sparse_size - 1)] = n;
+	r->sparse_count++;
+	r->count++;
+	return 0;
+}
+
+/* Grow the array to cover uid and move in the sparse uids it now covers */
+static int match_registry_grow(struct match_registry *r, unsigned int uid)
+{
+	struct match_registry_entry **e, *n;
+	unsigned int size, i;
+	void **slot;
+
+	size = r->size ? r->size : MATCH_REGISTRY_MIN_SIZE;
+	while (size <= uid)
+		size *= 2;
+
+	slot = realloc(r->slot, size * sizeof(*slot));
+	if (!slot)
+		return -ENOMEM;
+
+	memset(&slot[r->size], 0, (size - r->size) * sizeof(*slot));
+	r->slot = slot;
+	r->size = size;
+
+	for (i = 0; i < r->sparse_size; i++) {
+		for (e = &r->sparse[i]; *e;) {
+			n = *e;
+			if (n->uid >= size) {
+				e = &n->next;
+				continue;
+			}
+			slot[n->uid] = n->obj;
+			*e = n->next;
+			free(n);
+			r->sparse_count--;
+		}
+	}
+
+	return 0;
+}
+
+static int match_registry_set(struct match_registry *r, unsigned int uid,
+			      void *obj)
+{
+	int err;
+
+	if (uid >= r->size) {
+		/* the array covers at most twice the objects registered */
+		if (!obj || uid > UINT_MAX / 2 ||
+		    uid / 2 > r->count + MATCH_REGISTRY_MIN_SIZE)
+			return match_registry_sparse_set(r, uid, obj);
+
+		err = match_registry_grow(r, uid);
+		if (err)
+			return err;
+	}
+
+	if (!r->slot[uid] && obj)
+		r->count++;
+	else if (r->slot[uid] && !obj)
+		r->count--;
+	r->slot[uid] = obj;
+	return 0;
+}
+
+static void match_registry_warn(int err, const char *type, unsigned int uid)
+{
+	if (err)
+		MAT_LOG(ERR, "Warning: unable to register %s %u (%s)\n",
+			type, uid, strerror(-err));
+}
+
+char *graph_names(unsigned int uid)
+{
+	struct net_mat_hdr_node *n = get_graph_node(uid);
+
+	return n ? n->name : none;
 }
 
 struct net_mat_hdr_node *get_graph_node(unsigned int uid)
 {
-	if (uid < MAX_NODES)
-		return graph_nodes[uid];
-	else
-		return NULL;
+	return match_registry_get(&graph_nodes, uid);
 }
 
 char *headers_names(unsigned int uid)
 {
-	if (uid < MAX_HDRS)
-		return headers[uid] ? headers[uid]->name : none;
-	else
-		return NULL;
+	struct net_mat_hdr *h = get_headers(uid);
+
+	return h ? h->name : none;
 }
 
 struct net_mat_hdr *get_headers(unsigned int uid)
 {
-	if (uid < MAX_HDRS)
-		return headers[uid];
-	else
-		return NULL;
+	return match_registry_get(&headers, uid);
 }
 
 char *fields_names(unsigned int hid, unsigned int fid)
 {
-	if (hid < MAX_HDRS && fid < MAX_FIELDS)
-		if (header_fields[hid][fid])
-			return header_fields[hid][fid]->name;
-		else
-			return none;
-	else
-		return none;
+	struct net_mat_field *f = get_fields(hid, fid);
+
+	return f ? f->name : none;
 }
 
 struct net_mat_field *get_fields(unsigned int huid, unsigned int uid)
 {
-	if (huid < MAX_HDRS && uid < MAX_FIELDS)
-		return header_fields[huid][uid];
-	else
-		return NULL;
+	struct match_registry *r = match_registry_get(&header_fields, huid);
+
+	return r ? match_registry_get(r, uid) : NULL;
 }
 
 char *table_names(unsigned int uid)
 {
-	if (uid < MAX_TABLES)
-		return tables[uid] ? tables[uid]->name : none;
-	else
-		return NULL;
+	struct net_mat_tbl *t = get_tables(uid);
+
+	return t ? t->name : none;
 }
 
 struct net_mat_tbl *get_tables(unsigned int uid)
 {
-	if (uid < MAX_TABLES)
-		return tables[uid];
-	else
-		return NULL;
+	return match_registry_get(&tables, uid);
 }
 
-unsigned int get_table_id(char *name)
+static void match_set_table(unsigned int uid, struct net_mat_tbl *t)
 {
-	int i;
+	int err;
 
-	for (i = 0; i < MAX_TABLES; i++) {
-		if (tables[i] && (strcmp(tables[i]->name, name) == 0))
-			return tables[i]->uid;
+	err = match_registry_set(&tables, uid, t);
+	if (err) {
+		match_registry_warn(err, "table", uid);
+		return;
 	}
 
-	return 0;
+	if (t)
+		match_name_index_warn(match_name_index_add(&table_index, 0,
+							   t->name, uid),
+				      t->name);
+}
+
+static void match_set_header(unsigned int uid, struct net_mat_hdr *h)
+{
+	int err;
+
+	err = match_registry_set(&headers, uid, h);
+	if (err) {
+		match_registry_warn(err, "header", uid);
+		return;
+	}
+
+	if (h)
+		match_name_index_warn(match_name_index_add(&header_index, 0,
+							   h->name, uid),
+				      h->name);
+}
+
+static void match_set_field(unsigned int hid, unsigned int uid,
+			    struct net_mat_field *f)
+{
+	struct match_registry *r;
+	int err;
+
+	r = match_registry_get(&header_fields, hid);
+	if (!r) {
+		if (!f)
+			return;
+
+		r = calloc(1, sizeof(*r));
+		if (!r) {
+			match_registry_warn(-ENOMEM, "field", uid);
+			return;
+		}
+
+		err = match_registry_set(&header_fields, hid, r);
+		if (err) {
+			free(r);
+			match_registry_warn(err, "field", uid);
+			return;
+		}
+	}
+
+	err = match_registry_set(r, uid, f);
+	if (err) {
+		match_registry_warn(err, "field", uid);
+		return;
+	}
+
+	if (f)
+		match_name_index_warn(match_name_index_add(&field_index, hid,
+							   f->name, uid),
+				      f->name);
+}
+
+static void match_set_action(unsigned int uid, struct net_mat_action *a)
+{
+	int err;
+
+	err = match_registry_set(&actions, uid, a);
+	if (err) {
+		match_registry_warn(err, "action", uid);
+		return;
+	}
+
+	if (a)
+		match_name_index_warn(match_name_index_add(&action_index, 0,
+							   a->name, uid),
+				      a->name);
+}
+
+static void match_set_graph_node(unsigned int uid, struct net_mat_hdr_node *n)
+{
+	int err;
+
+	err = match_registry_set(&graph_nodes, uid, n);
+	if (err) {
+		match_registry_warn(err, "header node", uid);
+		return;
+	}
+
+	if (n)
+		match_name_index_warn(match_name_index_add(&graph_index, 0,
+							   n->name, uid),
+				      n->name);
+}
+
+unsigned int get_table_id(char *name)
+{
+	return find_table(name);
 }
 
 unsigned int gen_table_id(void)
 {
 	unsigned int i;
 
-	for (i = 1; i < MAX_TABLES; i++) {
-		if (!tables[i])
-			return i;
-	}
-	return 0;
+	for (i = 1; match_registry_get(&tables, i); i++)
+		;
+	return i;
 }
 
 char *action_names(unsigned int uid)
 {
-	if (uid < MAX_ACTIONS)
-		return actions[uid] ? actions[uid]->name : none;
-	else
-		return NULL;
+	struct net_mat_action *a = get_actions(uid);
+
+	return a ? a->name : none;
 }
 
 struct net_mat_action *get_actions(unsigned int uid)
 {
-	if (uid < MAX_ACTIONS)
-		return actions[uid];
-	else
-		return NULL;
+	return match_registry_get(&actions, uid);
 }
 
 unsigned find_table(const char *name)
 {
-	unsigned int i;
+	struct net_mat_tbl *t;
 
-	for (i = 0; i < MAX_TABLES; i++) {
-		if (tables[i] && strcmp(table_names(i), name) == 0)
-			return tables[i]->uid;
-	}
+	t = get_tables(match_name_index_find(&table_index, 0, name));
+	if (t && t->name && strcmp(t->name, name) == 0)
+		return t->uid;
 
 	return 0;
 }
 
 unsigned int find_action(const char *name)
 {
-	unsigned int i;
+	struct net_mat_action *a;
+
+	a = get_actions(match_name_index_find(&action_index, 0, name));
+	if (a && a->name && strcmp(a->name, name) == 0)
+		return a->uid;
 
-	for (i = 0; i < MAX_ACTIONS; i++) {
-		if (actions[i] && strcmp(action_names(i), name) == 0)
-			return actions[i]->uid;
-	}
 	return 0;
 }
 
 unsigned int find_header_node(const char *name)
 {
-	unsigned int i;
+	struct net_mat_hdr_node *n;
+
+	n = get_graph_node(match_name_index_find(&graph_index, 0, name));
+	if (n && n->name && strcmp(n->name, name) == 0)
+		return n->uid;
 
-	for (i = 0; i < MAX_NODES; i++) {
-		if (graph_nodes[i] && strcmp(graph_names(i), name) == 0)
-			return graph_nodes[i]->uid;
-	}
 	return 0;
 }
 
-unsigned int find_field(const char *field, unsigned int hdr)
+static unsigned int find_header(const char *name)
 {
-	struct net_mat_hdr *header;
-	unsigned int i;
+	struct net_mat_hdr *h;
 
-	header = get_headers(hdr);
+	h = get_headers(match_name_index_find(&header_index, 0, name));
+	if (h && h->name && strcmp(h->name, name) == 0)
+		return h->uid;
 
-	if (!header) {
-		MAT_LOG(ERR, "invalid header\n");
-		return 0;
-	}
-	for (i = 0; i < header->field_sz; i++) {
-		if (header->fields[i].uid &&
-		    strcmp(header->fields[i].name, field) == 0)
-			return header->fields[i].uid;
-	}
 	return 0;
 }
 
-int find_match(const char *header, const char *field, unsigned int *hi, unsigned int *li)
+static unsigned int find_header_field(const char *field, unsigned int hdr)
 {
-	unsigned int i;
+	struct net_mat_field *f;
 
-	*hi = *li = 0;
+	f = get_fields(hdr, match_name_index_find(&field_index, hdr, field));
+	if (f && f->name && strcmp(f->name, field) == 0)
+		return f->uid;
 
-	for (i = 0; i < MAX_HDRS; i++) {
-		if (headers[i] && strcmp(headers_names(i), header) == 0) {
-			*hi = headers[i]->uid;
-			break;
-		}
-	}
+	return 0;
+}
 
-	for (i = 0; *hi > 0 && i < MAX_FIELDS; i++) {
-		if (header_fields[*hi][i] &&
-		    strcmp(fields_names(*hi, i), field) == 0) {
-			*li = header_fields[*hi][i]->uid;
-			break;
-		}
+unsigned int find_field(const char *field, unsigned int hdr)
+{
+	if (!get_headers(hdr)) {
+		MAT_LOG(ERR, "invalid header\n");
+		return 0;
 	}
 
+	return find_header_field(field, hdr);
+}
+
+int find_match(const char *header, const char *field, unsigned int *hi, unsigned int *li)
+{
+	*hi = find_header(header);
+	*li = *hi ? find_header_field(field, *hi) : 0;
+
 	if (*hi == 0 || *li == 0)
 		return -EINVAL;
 
@@ -285,7 +688,7 @@ void match_push_headers(struct net_mat_hdr **h)
 	unsigned int i;
 
 	for (i = 0; h[i] && h[i]->uid; i++)
-		headers[h[i]->uid] = h[i];
+		match_set_header(h[i]->uid, h[i]);
 }
 
 void match_push_actions(struct net_mat_action **a)
@@ -293,7 +696,7 @@ void match_push_actions(struct net_mat_action **a)
 	unsigned int i;
 
 	for (i = 0; a[i]; i++)
-		actions[a[i]->uid] = a[i];
+		match_set_action(a[i]->uid, a[i]);
 }
 
 void match_push_actions_ary(struct net_mat_action *a)
@@ -301,7 +704,7 @@ void match_push_actions_ary(struct net_mat_action *a)
 	unsigned int i;
 
 	for (i = 0; a[i].uid; i++)
-		actions[a[i].uid] = &a[i];
+		match_set_action(a[i].uid, &a[i]);
 }
 
 void match_push_tables(struct net_mat_tbl **t)
@@ -309,7 +712,7 @@ void match_push_tables(struct net_mat_tbl **t)
 	unsigned int i;
 
 	for (i = 0; t[i] && t[i]->uid; i++)
-		tables[t[i]->uid] = t[i];
+		match_set_table(t[i]->uid, t[i]);
 }
 
 void match_push_tables_a(struct net_mat_tbl *t)
@@ -317,15 +720,30 @@ void match_push_tables_a(struct net_mat_tbl *t)
 	unsigned int i;
 
 	for (i = 0; t[i].uid; i++)
-		tables[t[i].uid] = &t[i];
+		match_set_table(t[i].uid, &t[i]);
 }
 
 void match_pop_tables(struct net_mat_tbl **t)
 {
 	unsigned int i;
 
-	for (i = 0; t[i] && t[i]->uid; i++)
-		free(tables[t[i]->uid]);
+	for (i = 0; t[i] && t[i]->uid; i++) {
+		unsigned int uid = t[i]->uid;
+
+		free(get_tables(uid));
+		match_set_table(uid, NULL);
+	}
+}
+
+/* Unregister tables registered by match_push_tables_a(), which are owned
+ * by the array they were pushed from and are not freed here.
+ */
+void match_pop_tables_a(struct net_mat_tbl *t)
+{
+	unsigned int i;
+
+	for (i = 0; t[i].uid; i++)
+		match_set_table(t[i].uid, NULL);
 }
 void match_push_header_fields(struct net_mat_hdr **h)
 {
@@ -337,7 +755,7 @@ void match_push_header_fields(struct net_mat_hdr **h)
 		__u32 uid = h[i]->uid;
 
 		for (j = 0; j < h[i]->field_sz; j++)
-			header_fields[uid][f[j].uid] = &f[j];
+			match_set_field(uid, f[j].uid, &f[j]);
 	}
 }
 
@@ -346,7 +764,7 @@ void match_push_graph_nodes(struct net_mat_hdr_node **n)
 	unsigned int i;
 
 	for (i = 0; n[i]; i++)
-		graph_nodes[n[i]->uid] = n[i];
+		match_set_graph_node(n[i]->uid, n[i]);
 }
 
 static void pfprintf(struct mat_stream *matsp, const char *format, ...)
@@ -487,18 +905,495 @@ static struct nla_policy net_mat_port_vlan_policy[NET_MAT_PORT_T_VLAN_MAX+1] = {
 	[NET_MAT_PORT_T_VLAN_MEMBERSHIP]	= { .type = NLA_UNSPEC, .minlen =(MAX_VLAN / 8), },
 };
 
+static struct nla_policy net_mat_event_policy[NET_MAT_EVENT_ATTR_MAX+1] = {
+	[NET_MAT_EVENT_ATTR_TYPE]	= { .type = NLA_U32, },
+	[NET_MAT_EVENT_ATTR_TABLE]	= { .type = NLA_U32, },
+	[NET_MAT_EVENT_ATTR_UID]	= { .type = NLA_U32, },
+	[NET_MAT_EVENT_ATTR_PORT]	= { .type = NLA_U32, },
+	[NET_MAT_EVENT_ATTR_STATE]	= { .type = NLA_U32, },
+};
+
+static struct nla_policy net_mat_stats_policy[NET_MAT_STATS_MAX+1] = {
+	[NET_MAT_STATS_RX_DROPS]	= { .type = NLA_U64, },
+	[NET_MAT_STATS_CMD]		= { .type = NLA_NESTED, },
+	[NET_MAT_STATS_TABLE]		= { .type = NLA_NESTED, },
+	[NET_MAT_STATS_EVENT_DROPS]	= { .type = NLA_U64, },
+};
+
+static struct nla_policy net_mat_stats_cmd_policy[NET_MAT_STATS_CMD_ATTR_MAX+1] = {
+	[NET_MAT_STATS_CMD_ATTR_CMD]		= { .type = NLA_U32, },
+	[NET_MAT_STATS_CMD_ATTR_REQUESTS]	= { .type = NLA_U64, },
+	[NET_MAT_STATS_CMD_ATTR_ERRORS]		= { .type = NLA_U64, },
+	[NET_MAT_STATS_CMD_ATTR_RX_BYTES]	= { .type = NLA_U64, },
+	[NET_MAT_STATS_CMD_ATTR_TX_BYTES]	= { .type = NLA_U64, },
+	[NET_MAT_STATS_CMD_ATTR_MULTIPART]	= { .type = NLA_U64, },
+	[NET_MAT_STATS_CMD_ATTR_LATENCY_NS]	= { .type = NLA_U64, },
+	[NET_MAT_STATS_CMD_ATTR_LATENCY]	= { .type = NLA_UNSPEC, },
+};
+
+static struct nla_policy net_mat_stats_table_policy[NET_MAT_STATS_TABLE_ATTR_MAX+1] = {
+	[NET_MAT_STATS_TABLE_ATTR_ID]		= { .type = NLA_U32, },
+	[NET_MAT_STATS_TABLE_ATTR_SIZE]		= { .type = NLA_U32, },
+	[NET_MAT_STATS_TABLE_ATTR_RULES]	= { .type = NLA_U32, },
+};
+
+static struct nla_policy net_mat_rules_filter_policy[NET_MAT_RULES_FILTER_MAX+1] = {
+	[NET_MAT_RULES_FILTER_MATCHES]		= { .type = NLA_NESTED, },
+	[NET_MAT_RULES_FILTER_ACTION]		= { .type = NLA_U32, },
+	[NET_MAT_RULES_FILTER_MIN_PACKETS]	= { .type = NLA_U64, },
+	[NET_MAT_RULES_FILTER_TOP]		= { .type = NLA_U32, },
+	[NET_MAT_RULES_FILTER_TOP_KEY]		= { .type = NLA_U32, },
+};
+
+static const char match_hex_digits[] = "0123456789abcdef";
+
+/* Dumping large rule sets formats several values per rule, a table driven
+ * conversion is much cheaper than going through snprintf() for each one.
+ */
+static char *match_pp_hex(__u64 value, unsigned int digits, char *buf,
+			  size_t len)
+{
+	unsigned int i;
+
+	if (len <= digits)
+		return NULL;
+
+	for (i = digits; i > 0; i--) {
+		buf[i - 1] = match_hex_digits[value & 0xf];
+		value >>= 4;
+	}
+	buf[digits] = '\0';
+
+	return buf;
+}
+
 static char *
 match_pp_mac_addr(__u64 *addr, char *buf, size_t len)
 {
 	__u8 *tmp = (__u8 *)addr;
+	char *p = buf;
+	int i;
+
+	if (len < sizeof("00:00:00:00:00:00"))
+		return NULL;
+
+	for (i = 5; i >= 0; i--) {
+		*p++ = match_hex_digits[tmp[i] >> 4];
+		*p++ = match_hex_digits[tmp[i] & 0xf];
+		*p++ = i ? ':' : '\0';
+	}
+
+	return buf;
+}
+
+/*
+ * Value types carried by field references and action arguments.
+ *
+ * X(TYPE, m, ctype, fmt) generates the encode, decode, compare and mask
+ * helpers for NET_MAT_FIELD_REF_ATTR_TYPE_TYPE and NET_MAT_ACTION_ARG_TYPE_TYPE
+ * where the value lives in v.m.value_m/v.m.mask_m of a field reference and
+ * in v.value_m of an action argument. fmt formats a single value. Adding a
+ * type only takes a new line here once the enums and unions have it.
+ */
+#define MATCH_VALUE_TYPES(X)						\
+	X(U8,  u8,  __u8,  match_pp_value_u8)				\
+	X(U16, u16, __u16, match_pp_value_u16)				\
+	X(U32, u32, __u32, match_pp_value_u32)				\
+	X(U64, u64, __u64, match_pp_value_mac)				\
+	X(IN6, in6, struct in6_addr, match_pp_value_in6)
+
+struct match_value_type {
+	size_t size;
+	size_t field_value;	/* offset of the value in net_mat_field_ref */
+	size_t field_mask;	/* offset of the mask in net_mat_field_ref */
+	size_t arg_value;	/* offset of the value in net_mat_action_arg */
+	int (*get_field)(struct net_mat_field_ref *ref, struct nlattr *value,
+			 struct nlattr *mask);
+	int (*put_field)(struct nl_msg *nlbuf, struct net_mat_field_ref *ref);
+	int (*get_arg)(struct net_mat_action_arg *arg, struct nlattr *value);
+	int (*put_arg)(struct nl_msg *nlbuf, struct net_mat_action_arg *arg);
+	int (*cmp_field)(const struct net_mat_field_ref *a,
+			 const struct net_mat_field_ref *b);
+	void (*mask_field)(struct net_mat_field_ref *ref);
+	void (*pp)(const void *value, char *buf, size_t len);
+};
+
+static void match_pp_value_u8(const void *value, char *buf, size_t len)
+{
+	match_pp_hex(*(const __u8 *)value, 2, buf, len);
+}
+
+static void match_pp_value_u16(const void *value, char *buf, size_t len)
+{
+	match_pp_hex(*(const __u16 *)value, 4, buf, len);
+}
+
+static void match_pp_value_u32(const void *value, char *buf, size_t len)
+{
+	match_pp_hex(*(const __u32 *)value, 8, buf, len);
+}
+
+static void match_pp_value_mac(const void *value, char *buf, size_t len)
+{
+	__u64 v = *(const __u64 *)value;
+
+	if (!match_pp_mac_addr(&v, buf, len))
+		snprintf(buf, len, "0x%" PRIx64, v);
+}
+
+static void match_pp_value_in6(const void *value, char *buf, size_t len)
+{
+	if (!inet_ntop(AF_INET6, value, buf, (socklen_t)len))
+		snprintf(buf, len, "?");
+}
+
+#define MATCH_VALUE_TYPE_FUNCS(T, m, ctype, fmt)				\
+static int match_get_field_##m(struct net_mat_field_ref *ref,		\
+			       struct nlattr *value, struct nlattr *mask) \
+{									\
+	if (nla_len(value) < (int)sizeof(ctype))			\
+		return -EINVAL;						\
+	memcpy(&ref->v.m.value_##m, nla_data(value), sizeof(ctype));	\
+	if (!mask)							\
+		return 0;						\
+	if (nla_len(mask) < (int)sizeof(ctype))				\
+		return -EINVAL;						\
+	memcpy(&ref->v.m.mask_##m, nla_data(mask), sizeof(ctype));	\
+	return 0;							\
+}									\
+									\
+static int match_put_field_##m(struct nl_msg *nlbuf,			\
+			       struct net_mat_field_ref *ref)		\
+{									\
+	if (nla_put(nlbuf, NET_MAT_FIELD_REF_VALUE, sizeof(ctype),	\
+		    &ref->v.m.value_##m) ||				\
+	    nla_put(nlbuf, NET_MAT_FIELD_REF_MASK, sizeof(ctype),	\
+		    &ref->v.m.mask_##m))				\
+		return -EMSGSIZE;					\
+	return 0;							\
+}									\
+									\
+static int match_get_arg_##m(struct net_mat_action_arg *arg,		\
+			     struct nlattr *value)			\
+{									\
+	if (nla_len(value) < (int)sizeof(ctype))			\
+		return -EINVAL;						\
+	memcpy(&arg->v.value_##m, nla_data(value), sizeof(ctype));	\
+	return 0;							\
+}									\
+									\
+static int match_put_arg_##m(struct nl_msg *nlbuf,			\
+			     struct net_mat_action_arg *arg)		\
+{									\
+	if (nla_put(nlbuf, NET_MAT_ACTION_ARG_VALUE, sizeof(ctype),	\
+		    &arg->v.value_##m))					\
+		return -EMSGSIZE;					\
+	return 0;							\
+}									\
+									\
+static int match_cmp_field_##m(const struct net_mat_field_ref *a,	\
+			       const struct net_mat_field_ref *b)	\
+{									\
+	return memcmp(&a->v.m, &b->v.m, sizeof(a->v.m));		\
+}									\
+									\
+static void match_mask_field_##m(struct net_mat_field_ref *ref)		\
+{									\
+	unsigned char *v = (unsigned char *)&ref->v.m.value_##m;	\
+	const unsigned char *k = (const unsigned char *)&ref->v.m.mask_##m; \
+	size_t i;							\
+									\
+	for (i = 0; i < sizeof(ctype); i++)				\
+		v[i] &= k[i];						\
+}
+
+MATCH_VALUE_TYPES(MATCH_VALUE_TYPE_FUNCS)
+
+#define MATCH_VALUE_TYPE_OPS(T, m, ctype, fmt)				\
+	{								\
+		.size = sizeof(ctype),					\
+		.field_value = offsetof(struct net_mat_field_ref, v.m.value_##m), \
+		.field_mask = offsetof(struct net_mat_field_ref, v.m.mask_##m), \
+		.arg_value = offsetof(struct net_mat_action_arg, v.value_##m), \
+		.get_field = match_get_field_##m,			\
+		.put_field = match_put_field_##m,			\
+		.get_arg = match_get_arg_##m,				\
+		.put_arg = match_put_arg_##m,				\
+		.cmp_field = match_cmp_field_##m,			\
+		.mask_field = match_mask_field_##m,			\
+		.pp = fmt,						\
+	},
+
+#define MATCH_FIELD_TYPE_OPS(T, m, ctype, fmt)				\
+	[NET_MAT_FIELD_REF_ATTR_TYPE_##T] = MATCH_VALUE_TYPE_OPS(T, m, ctype, fmt)
+
+#define MATCH_ARG_TYPE_OPS(T, m, ctype, fmt)				\
+	[NET_MAT_ACTION_ARG_TYPE_##T] = MATCH_VALUE_TYPE_OPS(T, m, ctype, fmt)
+
+static const struct match_value_type
+match_field_types[__NET_MAT_FIELD_REF_ATTR_TYPE_VAL_MAX] = {
+	MATCH_VALUE_TYPES(MATCH_FIELD_TYPE_OPS)
+};
+
+static const struct match_value_type
+match_arg_types[__NET_MAT_ACTION_ARG_TYPE_VAL_MAX] = {
+	MATCH_VALUE_TYPES(MATCH_ARG_TYPE_OPS)
+};
+
+static const struct match_value_type *match_field_type(__u32 type)
+{
+	if (type >= __NET_MAT_FIELD_REF_ATTR_TYPE_VAL_MAX ||
+	    !match_field_types[type].size)
+		return NULL;
+
+	return &match_field_types[type];
+}
+
+static const struct match_value_type *match_arg_type(__u32 type)
+{
+	if (type >= __NET_MAT_ACTION_ARG_TYPE_VAL_MAX ||
+	    !match_arg_types[type].size)
+		return NULL;
+
+	return &match_arg_types[type];
+}
+
+/*
+ * match_field_ref_cmp() - compare the value and mask of two field references
+ * @a: first field reference
+ * @b: second field reference
+ *
+ * Return: 0 if both have the same type, value and mask, non-zero otherwise
+ */
+int match_field_ref_cmp(const struct net_mat_field_ref *a,
+			const struct net_mat_field_ref *b)
+{
+	const struct match_value_type *t = match_field_type(a->type);
+
+	if (a->type != b->type)
+		return (int)a->type - (int)b->type;
+
+	if (!t)
+		return 0;
+
+	return t->cmp_field(a, b);
+}
+
+/*
+ * match_field_ref_mask() - clear the value bits not covered by the mask
+ * @ref: the field reference
+ */
+void match_field_ref_mask(struct net_mat_field_ref *ref)
+{
+	const struct match_value_type *t = match_field_type(ref->type);
+
+	if (t)
+		t->mask_field(ref);
+}
+
+static int match_action_arg_cmp(const struct net_mat_action_arg *a,
+				const struct net_mat_action_arg *b)
+{
+	const struct match_value_type *t = match_arg_type(a->type);
+
+	if (a->type != b->type)
+		return (int)a->type - (int)b->type;
+
+	if (!t)
+		return 0;
+
+	return memcmp((const char *)a + t->arg_value,
+		      (const char *)b + t->arg_value, t->size);
+}
+
+static int match_action_cmp(const struct net_mat_action *a,
+			    const struct net_mat_action *b)
+{
+	const struct net_mat_action_arg *x = a->args, *y = b->args;
 	int err;
 
-	err = snprintf(buf, len, "%02x:%02x:%02x:%02x:%02x:%02x",
-		       tmp[5], tmp[4], tmp[3], tmp[2], tmp[1], tmp[0]);
-	if (err < 0 || err >= (int)len)
-		return NULL;
+	if (a->uid != b->uid)
+		return a->uid < b->uid ? -1 : 1;
+
+	for (; x && x->type && y && y->type; x++, y++) {
+		err = match_action_arg_cmp(x, y);
+		if (err)
+			return err;
+	}
+
+	/* both argument lists must end together */
+	return (x && x->type) - (y && y->type);
+}
+
+/*
+ * match_rule_cmp() - compare what two rules match and do
+ * @a: first rule
+ * @b: second rule
+ *
+ * Rules are equal when they have the same priority and the same matches
+ * and actions in the same order. Argument names, the table, uid, hardware
+ * id and counters of the rules are not compared.
+ *
+ * Return: 0 if both rules are equal, non-zero otherwise
+ */
+int match_rule_cmp(const struct net_mat_rule *a, const struct net_mat_rule *b)
+{
+	const struct net_mat_field_ref *m = a->matches, *n = b->matches;
+	const struct net_mat_action *x = a->actions, *y = b->actions;
+	int err;
+
+	if (a->priority != b->priority)
+		return a->priority < b->priority ? -1 : 1;
+
+	for (; m && m->header && n && n->header; m++, n++) {
+		if (m->instance != n->instance || m->header != n->header ||
+		    m->field != n->field || m->mask_type != n->mask_type)
+			return 1;
+
+		err = match_field_ref_cmp(m, n);
+		if (err)
+			return err;
+	}
+	if ((m && m->header) || (n && n->header))
+		return 1;
+
+	for (; x && x->uid && y && y->uid; x++, y++) {
+		err = match_action_cmp(x, y);
+		if (err)
+			return err;
+	}
+
+	return (x && x->uid) - (y && y->uid);
+}
+
+/*
+ * match_field_ref_exact() - test if a field reference has a full mask
+ * @ref: the field reference
+ *
+ * Return: true if every bit of the value is covered by the mask
+ */
+bool match_field_ref_exact(const struct net_mat_field_ref *ref)
+{
+	const struct match_value_type *t = match_field_type(ref->type);
+	const unsigned char *k;
+	size_t i;
+
+	if (!t)
+		return false;
+
+	k = (const unsigned char *)ref + t->field_mask;
+	for (i = 0; i < t->size; i++) {
+		if (k[i] != 0xff)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * match_field_ref_hash() - hash the field and value of a field reference
+ * @ref: the field reference
+ *
+ * The instance and the mask are not hashed, so a rule field and a filter
+ * on the same field and value hash the same.
+ *
+ * Return: FNV-1a hash of the header, field, type and value
+ */
+uint32_t match_field_ref_hash(const struct net_mat_field_ref *ref)
+{
+	const struct match_value_type *t = match_field_type(ref->type);
+	uint32_t hash = 2166136261u, key[3];
+	const unsigned char *c;
+	size_t i;
+
+	key[0] = ref->header;
+	key[1] = ref->field;
+	key[2] = ref->type;
+	for (c = (const unsigned char *)key, i = 0; i < sizeof(key); i++) {
+		hash ^= c[i];
+		hash *= 16777619u;
+	}
+
+	if (!t)
+		return hash;
+
+	for (c = (const unsigned char *)ref + t->field_value, i = 0;
+	     i < t->size; i++) {
+		hash ^= c[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/*
+ * match_field_ref_filter() - test a rule field against a filter field
+ * @ref: field reference of a rule
+ * @filter: field reference of a filter, an instance of 0 matches any
+ *
+ * Return: true if @ref is on the same field and its value under the mask
+ *         of @filter equals the value of @filter under the same mask
+ */
+bool match_field_ref_filter(const struct net_mat_field_ref *ref,
+			    const struct net_mat_field_ref *filter)
+{
+	const struct match_value_type *t = match_field_type(filter->type);
+	const unsigned char *v, *w, *k;
+	size_t i;
+
+	if (!t || ref->header != filter->header ||
+	    ref->field != filter->field || ref->type != filter->type ||
+	    (filter->instance && ref->instance != filter->instance))
+		return false;
+
+	v = (const unsigned char *)ref + t->field_value;
+	w = (const unsigned char *)filter + t->field_value;
+	k = (const unsigned char *)filter + t->field_mask;
+	for (i = 0; i < t->size; i++) {
+		if ((v[i] ^ w[i]) & k[i])
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * match_rule_filter() - test a rule against a get rules filter
+ * @rule: the rule, with its counters read
+ * @filter: the filter
+ *
+ * The top rules are selected by the daemon among the rules passing the
+ * filter, @filter->top is not tested here.
+ *
+ * Return: true if the rule passes every condition of the filter
+ */
+bool match_rule_filter(const struct net_mat_rule *rule,
+		       const struct net_mat_rule_filter *filter)
+{
+	const struct net_mat_field_ref *f, *m;
+	const struct net_mat_action *a;
+
+	if (rule->packets < filter->min_packets)
+		return false;
+
+	for (f = filter->matches; f && f->header; f++) {
+		for (m = rule->matches; m && m->header; m++) {
+			if (match_field_ref_filter(m, f))
+				break;
+		}
+		if (!m || !m->header)
+			return false;
+	}
+
+	if (!filter->action)
+		return true;
 
-	return buf;
+	for (a = rule->actions; a && a->uid; a++) {
+		if (a->uid == filter->action)
+			return true;
+	}
+
+	return false;
 }
 
 static void pp_field_ref(struct mat_stream *matsp, struct net_mat_field_ref *ref,
@@ -506,11 +1401,15 @@ static void pp_field_ref(struct mat_stream *matsp, struct net_mat_field_ref *ref
 {
 	char fieldstr[1024];
 	size_t fieldlen = sizeof(fieldstr);
-	char valbuf[32], maskbuf[32];
+	char valbuf[INET6_ADDRSTRLEN], maskbuf[INET6_ADDRSTRLEN];
+	const struct match_value_type *t;
 	unsigned int inst = ref->instance;
 	unsigned int hi = ref->header;
 	unsigned int fi = ref->field;
 
+	if (!matsp && !e)
+		return;
+
 	if (!hi) {
 		pfprintf(matsp, "\t *");
 		return;
@@ -548,57 +1447,24 @@ static void pp_field_ref(struct mat_stream *matsp, struct net_mat_field_ref *ref
 		MAT_LOG(ERR,"Invalid header or field\n");
 		return;
 	}
-	switch (ref->type) {
-	case NET_MAT_FIELD_REF_ATTR_TYPE_U8:
-		snprintf(fieldstr, fieldlen, "\t %s.%s = %02x (%02x)",
-			headers_names(hi), fi ? fields_names(hi, fi) : empty,
-			ref->v.u8.value_u8, ref->v.u8.mask_u8);
+	if (!ref->type)
+		return;
 
-		if (e)
-			agsafeset(e, label, fieldstr, empty);
-		break;
-	case NET_MAT_FIELD_REF_ATTR_TYPE_U16:
-		snprintf(fieldstr, fieldlen, "\t %s.%s = %04x (%04x)",
-			headers_names(hi), fi ? fields_names(hi, fi) : empty,
-			ref->v.u16.value_u16, ref->v.u16.mask_u16);
-		if (e)
-			agsafeset(e, label, fieldstr, empty);
-		break;
-	case NET_MAT_FIELD_REF_ATTR_TYPE_U32:
-		snprintf(fieldstr, fieldlen, "\t %s.%s = %08x (%08x)",
-			headers_names(hi), fi ? fields_names(hi, fi) : empty,
-			ref->v.u32.value_u32, ref->v.u32.mask_u32);
-		if (e)
-			agsafeset(e, label, fieldstr, empty);
-		break;
-	case NET_MAT_FIELD_REF_ATTR_TYPE_U64:
-		if (!match_pp_mac_addr(&ref->v.u64.value_u64, valbuf, sizeof(valbuf)))
-			snprintf(valbuf, sizeof(valbuf), "0x%" PRIx64, ref->v.u64.value_u64);
-		if (!match_pp_mac_addr(&ref->v.u64.mask_u64, maskbuf, sizeof(maskbuf)))
-			snprintf(valbuf, sizeof(valbuf), "0x%" PRIx64, ref->v.u64.mask_u64);
-		snprintf(fieldstr, fieldlen, "\t %s.%s = %s (%s)",
-			 headers_names(hi), fi ? fields_names(hi, fi) : empty,
-			 valbuf, maskbuf);
-		if (e)
-			agsafeset(e, label, fieldstr, empty);
-		break;
-	case NET_MAT_FIELD_REF_ATTR_TYPE_IN6:
-		inet_ntop(AF_INET6, ref->v.in6.value_in6.s6_addr32, valbuf, sizeof(valbuf));
-		inet_ntop(AF_INET6, ref->v.in6.mask_in6.s6_addr32, maskbuf, sizeof(maskbuf));
-		snprintf(fieldstr, fieldlen, "\t %s.%s = %s (%s)",
-			 headers_names(hi), fi ? fields_names(hi, fi) : empty,
-			 valbuf, maskbuf);
-		if (e)
-			agsafeset(e, label, fieldstr, empty);
-		break;
-	default:
-		break;
-	}
+	t = match_field_type(ref->type);
+	if (!t)
+		return;
 
-	if (ref->type)
-		pfprintf(matsp, "%s", fieldstr);
+	t->pp((char *)ref + t->field_value, valbuf, sizeof(valbuf));
+	t->pp((char *)ref + t->field_mask, maskbuf, sizeof(maskbuf));
+	snprintf(fieldstr, fieldlen, "\t %s.%s = %s (%s)",
+		 headers_names(hi), fi ? fields_names(hi, fi) : empty,
+		 valbuf, maskbuf);
+	if (e)
+		agsafeset(e, label, fieldstr, empty);
 
-	if (ref->type && nl)
+	pfprintf(matsp, "%s", fieldstr);
+
+	if (nl)
 		pfprintf(matsp, "\n");
 }
 
@@ -620,6 +1486,58 @@ static void pp_fields(struct mat_stream *matsp, struct net_mat_field_ref *ref)
 		pfprintf(matsp, "]\n");
 }
 
+static const char *match_mask_type_str(__u32 mask_type)
+{
+	switch (mask_type) {
+	case NET_MAT_MASK_TYPE_EXACT:
+		return "exact";
+	case NET_MAT_MASK_TYPE_LPM:
+		return "lpm";
+	case NET_MAT_MASK_TYPE_MASK:
+		return "mask";
+	default:
+		return "unspec";
+	}
+}
+
+static void pp_field_ref_json(struct mat_stream *matsp,
+			      struct net_mat_field_ref *ref)
+{
+	const struct match_value_type *t = match_field_type(ref->type);
+	char buf[INET6_ADDRSTRLEN];
+
+	mat_json_object_start(matsp, NULL);
+	mat_json_uint(matsp, "instance", ref->instance);
+	mat_json_string(matsp, "instance_name", graph_names(ref->instance));
+	mat_json_uint(matsp, "header", ref->header);
+	mat_json_string(matsp, "header_name", headers_names(ref->header));
+	mat_json_uint(matsp, "field", ref->field);
+	mat_json_string(matsp, "field_name",
+			fields_names(ref->header, ref->field));
+	mat_json_string(matsp, "mask_type", match_mask_type_str(ref->mask_type));
+
+	if (t) {
+		t->pp((char *)ref + t->field_value, buf, sizeof(buf));
+		mat_json_string(matsp, "value", buf);
+		t->pp((char *)ref + t->field_mask, buf, sizeof(buf));
+		mat_json_string(matsp, "mask", buf);
+	}
+
+	mat_json_object_end(matsp);
+}
+
+static void pp_fields_json(struct mat_stream *matsp, const char *key,
+			   struct net_mat_field_ref *ref)
+{
+	int i;
+
+	mat_json_array_start(matsp, key);
+	for (i = 0; ref && ref[i].header; i++)
+		pp_field_ref_json(matsp, &ref[i]);
+	mat_json_array_end(matsp);
+}
+
+
 const char *match_table_arg_type_str[__NET_MAT_ACTION_ARG_TYPE_VAL_MAX] = {
 	[NET_MAT_ACTION_ARG_TYPE_NULL] = "null",
 	[NET_MAT_ACTION_ARG_TYPE_U8]	= "u8",
@@ -630,6 +1548,57 @@ const char *match_table_arg_type_str[__NET_MAT_ACTION_ARG_TYPE_VAL_MAX] = {
 	[NET_MAT_ACTION_ARG_TYPE_IN6]	= "in6",
 };
 
+static void pp_action_json(struct mat_stream *matsp,
+			   struct net_mat_action *act, bool print_values)
+{
+	struct net_mat_action_arg *arg;
+	char addr[INET6_ADDRSTRLEN];
+	int i;
+
+	mat_json_object_start(matsp, NULL);
+	mat_json_uint(matsp, "uid", act->uid);
+	mat_json_string(matsp, "name", act->name ? act->name : empty);
+
+	mat_json_array_start(matsp, "args");
+	for (i = 0; act->args && act->args[i].type; i++) {
+		arg = &act->args[i];
+
+		mat_json_object_start(matsp, NULL);
+		mat_json_string(matsp, "name", arg->name ? arg->name : empty);
+		mat_json_string(matsp, "type",
+				net_mat_action_arg_type_str(arg->type));
+
+		if (print_values) {
+			switch (arg->type) {
+			case NET_MAT_ACTION_ARG_TYPE_U8:
+				mat_json_uint(matsp, "value", arg->v.value_u8);
+				break;
+			case NET_MAT_ACTION_ARG_TYPE_U16:
+				mat_json_uint(matsp, "value", arg->v.value_u16);
+				break;
+			case NET_MAT_ACTION_ARG_TYPE_U32:
+				mat_json_uint(matsp, "value", arg->v.value_u32);
+				break;
+			case NET_MAT_ACTION_ARG_TYPE_U64:
+				mat_json_uint(matsp, "value", arg->v.value_u64);
+				break;
+			case NET_MAT_ACTION_ARG_TYPE_IN6:
+				mat_json_string(matsp, "value",
+					inet_ntop(AF_INET6, &arg->v.value_in6,
+						  addr, sizeof(addr)));
+				break;
+			default:
+				break;
+			}
+		}
+
+		mat_json_object_end(matsp);
+	}
+	mat_json_array_end(matsp);
+
+	mat_json_object_end(matsp);
+}
+
 void
 pp_action(struct mat_stream *matsp, struct net_mat_action *act, bool print_values)
 {
@@ -637,6 +1606,11 @@ pp_action(struct mat_stream *matsp, struct net_mat_action *act, bool print_value
 	int i;
 	char addr[INET6_ADDRSTRLEN];
 
+	if (mat_stream_is_json(matsp)) {
+		pp_action_json(matsp, act, print_values);
+		return;
+	}
+
 	pfprintf(matsp, "\t   %i: %s ( ", act->uid, act->name ? act->name : empty);
 
 	if (!act->args)
@@ -725,10 +1699,81 @@ static void pp_named_value(struct mat_stream *matsp, struct net_mat_named_value
 	}
 }
 
+static void pp_named_value_json(struct mat_stream *matsp,
+				struct net_mat_named_value *v)
+{
+	char valbuf[32];
+
+	mat_json_object_start(matsp, NULL);
+	mat_json_uint(matsp, "uid", v->uid);
+	if (v->name)
+		mat_json_string(matsp, "name", v->name);
+	mat_json_bool(matsp, "writable",
+		      v->write == NET_MAT_NAMED_VALUE_IS_WRITABLE);
+
+	switch (v->type) {
+	case NET_MAT_NAMED_VALUE_TYPE_U8:
+		mat_json_uint(matsp, "value", v->value.u8);
+		break;
+	case NET_MAT_NAMED_VALUE_TYPE_U16:
+		mat_json_uint(matsp, "value", v->value.u16);
+		break;
+	case NET_MAT_NAMED_VALUE_TYPE_U32:
+		mat_json_uint(matsp, "value", v->value.u32);
+		break;
+	case NET_MAT_NAMED_VALUE_TYPE_U64:
+		match_pp_value_mac(&v->value.u64, valbuf, sizeof(valbuf));
+		mat_json_string(matsp, "value", valbuf);
+		break;
+	case NET_MAT_NAMED_VALUE_TYPE_NULL:
+	default:
+		mat_json_string(matsp, "value", NULL);
+		break;
+	}
+
+	mat_json_object_end(matsp);
+}
+
+static void pp_table_json(struct mat_stream *matsp, struct net_mat_tbl *table)
+{
+	struct net_mat_action *act;
+	int i;
+
+	mat_json_object_start(matsp, NULL);
+	mat_json_string(matsp, "name", table->name);
+	mat_json_uint(matsp, "uid", table->uid);
+	mat_json_uint(matsp, "source", table->source);
+	mat_json_uint(matsp, "apply", table->apply_action);
+	mat_json_uint(matsp, "size", table->size);
+
+	pp_fields_json(matsp, "matches", table->matches);
+
+	mat_json_array_start(matsp, "actions");
+	for (i = 0; table->actions && table->actions[i]; i++) {
+		act = get_actions(table->actions[i]);
+		if (act && act->uid)
+			pp_action_json(matsp, act, false);
+	}
+	mat_json_array_end(matsp);
+
+	mat_json_array_start(matsp, "attributes");
+	for (i = 0; table->attribs && table->attribs[i].uid; i++)
+		pp_named_value_json(matsp, &table->attribs[i]);
+	mat_json_array_end(matsp);
+
+	mat_json_object_end(matsp);
+	mat_stream_flush(matsp);
+}
+
 void pp_table(struct mat_stream *matsp, struct net_mat_tbl *table)
 {
 	int i;
 
+	if (mat_stream_is_json(matsp)) {
+		pp_table_json(matsp, table);
+		return;
+	}
+
 	pfprintf(matsp, "\n%s:%u src %u apply %u size %u\n",
 		 table->name, table->uid, table->source, table->apply_action,
 		 table->size);
@@ -740,7 +1785,7 @@ void pp_table(struct mat_stream *matsp, struct net_mat_tbl *table)
 	pfprintf(matsp, "  actions:\n");
 	if (table->actions) {
 		for (i = 0; table->actions[i]; i++) {
-			struct net_mat_action *act = actions[table->actions[i]];
+			struct net_mat_action *act = get_actions(table->actions[i]);
 
 			if (!act) {
 				MAT_LOG(ERR, "unknown action uid %i\n",
@@ -788,8 +1833,35 @@ void pp_header(struct mat_stream *matsp, struct net_mat_hdr *header)
 	mat_stream_flush(matsp);
 }
 
-void pp_rule(struct mat_stream *matsp, struct net_mat_rule *rule)
+static void pp_rule_json(struct mat_stream *matsp, struct net_mat_rule *rule)
+{
+	int i;
+
+	mat_json_object_start(matsp, NULL);
+	mat_json_uint(matsp, "table", rule->table_id);
+	mat_json_uint(matsp, "uid", rule->uid);
+	mat_json_uint(matsp, "priority", rule->priority);
+	mat_json_uint(matsp, "bytes", rule->bytes);
+	mat_json_uint(matsp, "packets", rule->packets);
+
+	pp_fields_json(matsp, "matches", rule->matches);
+
+	mat_json_array_start(matsp, "actions");
+	for (i = 0; rule->actions && rule->actions[i].uid; i++)
+		pp_action_json(matsp, &rule->actions[i], true);
+	mat_json_array_end(matsp);
+
+	mat_json_object_end(matsp);
+}
+
+/* Rules are formatted back to back and the stream is flushed by the caller */
+static void __pp_rule(struct mat_stream *matsp, struct net_mat_rule *rule)
 {
+	if (mat_stream_is_json(matsp)) {
+		pp_rule_json(matsp, rule);
+		return;
+	}
+
 	pfprintf(matsp, "table : %u  ", rule->table_id);
 	pfprintf(matsp, "uid : %u  ", rule->uid);
 	pfprintf(matsp, "prio : %u  ", rule->priority);
@@ -800,7 +1872,11 @@ void pp_rule(struct mat_stream *matsp, struct net_mat_rule *rule)
 		pp_fields(matsp, rule->matches);
 	if (rule->actions)
 		pp_actions(matsp, rule->actions);
+}
 
+void pp_rule(struct mat_stream *matsp, struct net_mat_rule *rule)
+{
+	__pp_rule(matsp, rule);
 	mat_stream_flush(matsp);
 }
 
@@ -813,7 +1889,9 @@ void pp_rules(struct mat_stream *matsp, struct net_mat_rule *rules)
 		return;
 
 	for (i = 0; rules[i].uid; i++)
-		pp_rule(matsp, &rules[i]);
+		__pp_rule(matsp, &rules[i]);
+
+	mat_stream_flush(matsp);
 }
 
 static void pp_jump_table(struct mat_stream *matsp,
@@ -888,9 +1966,81 @@ static void pp_port_vlan(struct mat_stream *matsp, struct net_mat_port_vlan *v)
 
 }
 
+static void pp_port_json(struct mat_stream *matsp, struct net_mat_port *port)
+{
+	struct net_mat_port_stats *st = &port->stats;
+	struct net_mat_port_vlan *v = &port->vlan;
+	int i;
+
+	mat_json_object_start(matsp, NULL);
+	mat_json_uint(matsp, "port", port->port_id);
+	mat_json_string(matsp, "state", port_state_str(port->state));
+	mat_json_string(matsp, "speed", port_speed_str(port->speed));
+	mat_json_uint(matsp, "phys_id", port->port_phys_id);
+	mat_json_uint(matsp, "max_frame_size", port->max_frame_size);
+	mat_json_string(matsp, "type", port_type_str(port->type));
+	if (port->pci.bus) {
+		mat_json_object_start(matsp, "pci");
+		mat_json_uint(matsp, "bus", port->pci.bus);
+		mat_json_uint(matsp, "device", port->pci.device);
+		mat_json_uint(matsp, "function", port->pci.function);
+		mat_json_object_end(matsp);
+	}
+	mat_json_uint(matsp, "glort", port->glort);
+	mat_json_string(matsp, "loopback", flag_state_str(port->loopback));
+	mat_json_string(matsp, "learning", flag_state_str(port->learning));
+	mat_json_string(matsp, "update_dscp", flag_state_str(port->update_dscp));
+	mat_json_string(matsp, "update_ttl", flag_state_str(port->update_ttl));
+	mat_json_string(matsp, "mcast_flooding",
+			flag_state_str(port->mcast_flooding));
+	mat_json_string(matsp, "update_dmac", flag_state_str(port->update_dmac));
+	mat_json_string(matsp, "update_smac", flag_state_str(port->update_smac));
+	mat_json_string(matsp, "update_vlan", flag_state_str(port->update_vlan));
+
+	mat_json_object_start(matsp, "vlan");
+	mat_json_uint(matsp, "default_vlan", v->def_vlan);
+	if (v->def_priority != NET_MAT_PORT_T_DEF_PRI_UNSPEC)
+		mat_json_uint(matsp, "default_priority", v->def_priority);
+	mat_json_string(matsp, "drop_tagged", flag_state_str(v->drop_tagged));
+	mat_json_string(matsp, "drop_untagged", flag_state_str(v->drop_untagged));
+	mat_json_array_start(matsp, "membership");
+	for (i = 0; i < MAX_VLAN; i++) {
+		if ((v->vlan_membership_bitmask[i / 8] >> (i % 8)) & 0x01)
+			mat_json_uint(matsp, NULL, (uint64_t)i);
+	}
+	mat_json_array_end(matsp);
+	mat_json_object_end(matsp);
+
+	mat_json_object_start(matsp, "stats");
+	mat_json_uint(matsp, "rx_packets", st->rx_packets);
+	mat_json_uint(matsp, "rx_bytes", st->rx_bytes);
+	mat_json_uint(matsp, "rx_unicast_packets", st->rx_unicast_packets);
+	mat_json_uint(matsp, "rx_multicast_packets", st->rx_multicast_packets);
+	mat_json_uint(matsp, "rx_broadcast_packets", st->rx_broadcast_packets);
+	mat_json_uint(matsp, "rx_unicast_bytes", st->rx_unicast_bytes);
+	mat_json_uint(matsp, "rx_multicast_bytes", st->rx_multicast_bytes);
+	mat_json_uint(matsp, "rx_broadcast_bytes", st->rx_broadcast_bytes);
+	mat_json_uint(matsp, "tx_packets", st->tx_packets);
+	mat_json_uint(matsp, "tx_bytes", st->tx_bytes);
+	mat_json_uint(matsp, "tx_unicast_packets", st->tx_unicast_packets);
+	mat_json_uint(matsp, "tx_multicast_packets", st->tx_multicast_packets);
+	mat_json_uint(matsp, "tx_broadcast_packets", st->tx_broadcast_packets);
+	mat_json_uint(matsp, "tx_unicast_bytes", st->tx_unicast_bytes);
+	mat_json_uint(matsp, "tx_multicast_bytes", st->tx_multicast_bytes);
+	mat_json_uint(matsp, "tx_broadcast_bytes", st->tx_broadcast_bytes);
+	mat_json_object_end(matsp);
+
+	mat_json_object_end(matsp);
+}
+
 void pp_port(struct mat_stream *matsp,
 	     struct net_mat_port *port)
 {
+	if (mat_stream_is_json(matsp)) {
+		pp_port_json(matsp, port);
+		return;
+	}
+
 	pfprintf(matsp, " port %u:\n", port->port_id);
 	pfprintf(matsp, "    state: %s\n", port_state_str(port->state));
 	pfprintf(matsp, "    speed: %s\n", port_speed_str(port->speed));
@@ -951,6 +2101,177 @@ void pp_ports(struct mat_stream *matsp, struct net_mat_port *ports)
                 pp_port(matsp, &ports[i]);
 }
 
+void pp_event(struct mat_stream *matsp, struct net_mat_event *event)
+{
+	switch (event->type) {
+	case NET_MAT_EVENT_T_RULE_ADD:
+	case NET_MAT_EVENT_T_RULE_DEL:
+	case NET_MAT_EVENT_T_RULE_UPDATE:
+		pfprintf(matsp, "%s: table %s(%u) rule %u\n",
+			 event_type_str(event->type),
+			 table_names(event->table_id), event->table_id,
+			 event->uid);
+		break;
+	case NET_MAT_EVENT_T_TABLE_CREATE:
+	case NET_MAT_EVENT_T_TABLE_DESTROY:
+	case NET_MAT_EVENT_T_TABLE_UPDATE:
+		pfprintf(matsp, "%s: table %u\n",
+			 event_type_str(event->type), event->table_id);
+		break;
+	case NET_MAT_EVENT_T_PORT_CHANGE:
+		pfprintf(matsp, "%s: port %u state %s\n",
+			 event_type_str(event->type), event->port_id,
+			 port_state_str(event->state));
+		break;
+	default:
+		pfprintf(matsp, "unknown event %u\n", event->type);
+		break;
+	}
+}
+
+void pp_events(struct mat_stream *matsp, struct net_mat_event *events)
+{
+	int i;
+
+	if (!matsp)
+		return;
+
+	for (i = 0; events[i].type; i++)
+		pp_event(matsp, &events[i]);
+}
+
+/*
+ * match_stats_latency_bound() - upper bound of a latency bucket
+ * @bucket: index in struct net_mat_cmd_stats latency
+ *
+ * Return: the bound in us, 0 for the last bucket which is unbounded
+ */
+unsigned long long match_stats_latency_bound(unsigned int bucket)
+{
+	if (bucket >= NET_MAT_STATS_LATENCY_BUCKETS - 1)
+		return 0;
+	return 1ULL << bucket;
+}
+
+/* Bound in us below which at least @pct percent of the requests completed */
+static char *match_stats_percentile(struct net_mat_cmd_stats *s,
+				    unsigned int pct, char *buf, size_t len)
+{
+	__u64 seen = 0, want;
+	unsigned int i;
+
+	want = (s->requests * pct + 99) / 100;
+	for (i = 0; i < NET_MAT_STATS_LATENCY_BUCKETS - 1; i++) {
+		seen += s->latency[i];
+		if (seen >= want)
+			break;
+	}
+
+	if (match_stats_latency_bound(i))
+		snprintf(buf, len, "<%llu", match_stats_latency_bound(i));
+	else
+		snprintf(buf, len, "inf");
+	return buf;
+}
+
+static void pp_stats_json(struct mat_stream *matsp, struct net_mat_stats *stats)
+{
+	struct net_mat_table_stats *t;
+	struct net_mat_cmd_stats *c;
+	unsigned int i;
+
+	mat_json_object_start(matsp, NULL);
+	mat_json_uint(matsp, "rx_drops", stats->rx_drops);
+	mat_json_uint(matsp, "event_drops", stats->event_drops);
+
+	mat_json_array_start(matsp, "commands");
+	for (c = stats->cmds; c && c->requests; c++) {
+		mat_json_object_start(matsp, NULL);
+		mat_json_string(matsp, "cmd", mat_flight_cmd_str((uint8_t)c->cmd));
+		mat_json_uint(matsp, "requests", c->requests);
+		mat_json_uint(matsp, "errors", c->errors);
+		mat_json_uint(matsp, "rx_bytes", c->rx_bytes);
+		mat_json_uint(matsp, "tx_bytes", c->tx_bytes);
+		mat_json_uint(matsp, "multipart", c->multipart);
+		mat_json_uint(matsp, "latency_ns", c->latency_ns);
+		mat_json_array_start(matsp, "latency");
+		for (i = 0; i < NET_MAT_STATS_LATENCY_BUCKETS; i++)
+			mat_json_uint(matsp, NULL, c->latency[i]);
+		mat_json_array_end(matsp);
+		mat_json_object_end(matsp);
+	}
+	mat_json_array_end(matsp);
+
+	mat_json_array_start(matsp, "tables");
+	for (t = stats->tables; t && t->table_id; t++) {
+		mat_json_object_start(matsp, NULL);
+		mat_json_uint(matsp, "table", t->table_id);
+		mat_json_string(matsp, "name", table_names(t->table_id));
+		mat_json_uint(matsp, "size", t->size);
+		mat_json_uint(matsp, "rules", t->rules);
+		mat_json_object_end(matsp);
+	}
+	mat_json_array_end(matsp);
+
+	mat_json_object_end(matsp);
+}
+
+void pp_stats(struct mat_stream *matsp, struct net_mat_stats *stats)
+{
+	struct net_mat_table_stats *t;
+	struct net_mat_cmd_stats *c;
+	char p50[24], p99[24];
+	unsigned int i;
+
+	if (!matsp)
+		return;
+
+	if (mat_stream_is_json(matsp)) {
+		pp_stats_json(matsp, stats);
+		return;
+	}
+
+	pfprintf(matsp, "rx_drops: %llu\n", (unsigned long long)stats->rx_drops);
+	pfprintf(matsp, "event_drops: %llu\n",
+		 (unsigned long long)stats->event_drops);
+
+	pfprintf(matsp, "%-18s %10s %8s %12s %12s %9s %9s %9s %9s\n",
+		 "command", "requests", "errors", "rx_bytes", "tx_bytes",
+		 "multipart", "avg_us", "p50_us", "p99_us");
+	for (c = stats->cmds; c && c->requests; c++)
+		pfprintf(matsp, "%-18s %10llu %8llu %12llu %12llu %9llu %9llu %9s %9s\n",
+			 mat_flight_cmd_str((uint8_t)c->cmd),
+			 (unsigned long long)c->requests,
+			 (unsigned long long)c->errors,
+			 (unsigned long long)c->rx_bytes,
+			 (unsigned long long)c->tx_bytes,
+			 (unsigned long long)c->multipart,
+			 (unsigned long long)(c->latency_ns / c->requests / 1000),
+			 match_stats_percentile(c, 50, p50, sizeof(p50)),
+			 match_stats_percentile(c, 99, p99, sizeof(p99)));
+
+	for (c = stats->cmds; c && c->requests; c++) {
+		pfprintf(matsp, " %s latency:", mat_flight_cmd_str((uint8_t)c->cmd));
+		for (i = 0; i < NET_MAT_STATS_LATENCY_BUCKETS; i++) {
+			if (!c->latency[i])
+				continue;
+			if (match_stats_latency_bound(i))
+				pfprintf(matsp, " <%lluus:%llu",
+					 match_stats_latency_bound(i),
+					 (unsigned long long)c->latency[i]);
+			else
+				pfprintf(matsp, " slower:%llu",
+					 (unsigned long long)c->latency[i]);
+		}
+		pfprintf(matsp, "\n");
+	}
+
+	for (t = stats->tables; t && t->table_id; t++)
+		pfprintf(matsp, "table %s(%u): %u/%u rules\n",
+			 table_names(t->table_id), t->table_id, t->rules,
+			 t->size);
+}
+
 static int match_compar_graph_nodes(const void *a, const void *b)
 {
 	const struct net_mat_tbl_node *g_a, *g_b;
@@ -1038,7 +2359,8 @@ static void ppg_jump_table(struct mat_stream *matsp __unused, struct net_mat_jum
 	Agedge_t *e;
 
 	if (jump->node > 0) {
-		e = agedge(g, n, graphviz_table_nodes[jump->node], 0, 1);
+		e = agedge(g, n, match_registry_get(&graphviz_table_nodes,
+						      jump->node), 0, 1);
 
 		if (jump->field.instance)
 			pp_field_ref(NULL, &jump->field, 0, false, e);
@@ -1076,14 +2398,17 @@ void ppg_table_graph(struct mat_stream *matsp, struct net_mat_tbl_node *nodes)
 		n = agnode(s, table_names(nodes[i].uid), 1);
 
 		agsafeset(n, shape, record, empty); /* use record boxes */
-		graphviz_table_nodes[nodes[i].uid] = n;
+		match_registry_warn(match_registry_set(&graphviz_table_nodes,
+						       nodes[i].uid, n),
+				    "graph node", nodes[i].uid);
 	}
 
 	qsort(nodes, i, sizeof(*nodes), match_compar_graph_nodes);
 	for (i = 0; nodes[i].uid; i++) {
 		for (j = 0; nodes[i].jump && nodes[i].jump[j].node; ++j)
 			ppg_jump_table(matsp, &nodes[i].jump[j], s,
-				       graphviz_table_nodes[nodes[i].uid]);
+				       match_registry_get(&graphviz_table_nodes,
+							  nodes[i].uid));
 	}
 	agwrite(g, fp);
 }
@@ -1099,7 +2424,10 @@ void ppg_header_graph(struct mat_stream *matsp, struct net_mat_hdr_node *nodes)
 		fp = mat_stream_get_fp(matsp);
 
 	for (i = 0; nodes[i].uid; i++)
-		graphviz_header_nodes[nodes[i].uid] = agnode(g, nodes[i].name, 1);
+		match_registry_warn(match_registry_set(&graphviz_header_nodes,
+						       nodes[i].uid,
+						       agnode(g, nodes[i].name, 1)),
+				    "graph node", nodes[i].uid);
 
 #if 0
 		for (j = 0; nodes[i].hdrs[j]; j++)
@@ -1110,8 +2438,11 @@ void ppg_header_graph(struct mat_stream *matsp, struct net_mat_hdr_node *nodes)
 	for (i = 0; nodes[i].uid; i++) {
 		for (j = 0; nodes[i].jump && nodes[i].jump[j].node; ++j) {
 			if (nodes[i].jump[j].node > 0) {
-				e = agedge(g, graphviz_header_nodes[nodes[i].uid],
-					   graphviz_header_nodes[nodes[i].jump[j].node],
+				e = agedge(g,
+					   match_registry_get(&graphviz_header_nodes,
+							      nodes[i].uid),
+					   match_registry_get(&graphviz_header_nodes,
+							      nodes[i].jump[j].node),
 					   0, 1);
 				pp_field_ref(NULL, &nodes[i].jump[j].field,
 					     0, false, e);
@@ -1155,6 +2486,7 @@ int match_get_field(struct mat_stream *matsp, struct nlattr *nla,
 		struct net_mat_field_ref *field)
 {
 	struct nlattr *ref[NET_MAT_FIELD_REF_MAX+1];
+	const struct match_value_type *t;
 	int err;
 
 	err = nla_parse_nested(ref, NET_MAT_FIELD_REF_MAX,
@@ -1178,102 +2510,53 @@ int match_get_field(struct mat_stream *matsp, struct nlattr *nla,
 	if (!ref[NET_MAT_FIELD_REF_VALUE])
 		goto out;
 
-	switch (field->type) {
-	case NET_MAT_FIELD_REF_ATTR_TYPE_U8:
-		if (nla_len(ref[NET_MAT_FIELD_REF_VALUE]) < (int)sizeof(__u8)) {
-			err = -EINVAL;
-			break;
-		}
-		field->v.u8.value_u8 = nla_get_u8(ref[NET_MAT_FIELD_REF_VALUE]);
-
-		if (!ref[NET_MAT_FIELD_REF_MASK])
-			break;
-
-		if (nla_len(ref[NET_MAT_FIELD_REF_MASK]) < (int)sizeof(__u8)) {
-			err = -EINVAL;
-			break;
-		}
-		field->v.u8.mask_u8 = nla_get_u8(ref[NET_MAT_FIELD_REF_MASK]);
-		break;
-	case NET_MAT_FIELD_REF_ATTR_TYPE_U16:
-		if (nla_len(ref[NET_MAT_FIELD_REF_VALUE]) < (int)sizeof(__u16)) {
-			err = -EINVAL;
-			break;
-		}
-		field->v.u16.value_u16 = nla_get_u16(ref[NET_MAT_FIELD_REF_VALUE]);
-
-		if (!ref[NET_MAT_FIELD_REF_MASK])
-			break;
-
-		if (nla_len(ref[NET_MAT_FIELD_REF_MASK]) < (int)sizeof(__u16)) {
-			err = -EINVAL;
-			break;
-		}
-		field->v.u16.mask_u16 = nla_get_u16(ref[NET_MAT_FIELD_REF_MASK]);
-		break;
-	case NET_MAT_FIELD_REF_ATTR_TYPE_U32:
-		if (nla_len(ref[NET_MAT_FIELD_REF_VALUE]) < (int)sizeof(__u32)) {
-			err = -EINVAL;
-			break;
-		}
-		field->v.u32.value_u32 = nla_get_u32(ref[NET_MAT_FIELD_REF_VALUE]);
-
-		if (!ref[NET_MAT_FIELD_REF_MASK])
-			break;
-
-		if (nla_len(ref[NET_MAT_FIELD_REF_MASK]) < (int)sizeof(__u32)) {
-			err = -EINVAL;
-			break;
-		}
-		field->v.u32.mask_u32 = nla_get_u32(ref[NET_MAT_FIELD_REF_MASK]);
-		break;
-	case NET_MAT_FIELD_REF_ATTR_TYPE_U64:
-		if (nla_len(ref[NET_MAT_FIELD_REF_VALUE]) < (int)sizeof(__u64)) {
-			err = -EINVAL;
-			break;
-		}
-		field->v.u64.value_u64 = nla_get_u64(ref[NET_MAT_FIELD_REF_VALUE]);
-
-		if (!ref[NET_MAT_FIELD_REF_MASK])
-			break;
-
-		if (nla_len(ref[NET_MAT_FIELD_REF_MASK]) < (int)sizeof(__u64)) {
-			err = -EINVAL;
-			break;
-		}
-		field->v.u64.mask_u64 = nla_get_u64(ref[NET_MAT_FIELD_REF_MASK]);
-		break;
-	case NET_MAT_FIELD_REF_ATTR_TYPE_IN6:
-		if (nla_len(ref[NET_MAT_FIELD_REF_VALUE]) < (int)sizeof(struct in6_addr)) {
-			err = -EINVAL;
-			break;
-		}
-		field->v.in6.value_in6 = *((struct in6_addr *)nla_data(ref[NET_MAT_FIELD_REF_VALUE]));
-
-		if (!ref[NET_MAT_FIELD_REF_MASK])
-			break;
-
-		if (nla_len(ref[NET_MAT_FIELD_REF_MASK]) < (int)sizeof(struct in6_addr)) {
-			err = -EINVAL;
-			break;
-		}
-		field->v.in6.mask_in6 = *((struct in6_addr *)nla_data(ref[NET_MAT_FIELD_REF_MASK]));
-		break;
-	default:
+	t = match_field_type(field->type);
+	if (!t) {
 		err = -EINVAL;
-		break;
+		goto out;
 	}
 
+	err = t->get_field(field, ref[NET_MAT_FIELD_REF_VALUE],
+			   ref[NET_MAT_FIELD_REF_MASK]);
+
 out:
-	pp_field_ref(matsp, field, -1, true, NULL);
+	/* decoding is on the rule install path, only format when printing */
+	if (matsp)
+		pp_field_ref(matsp, field, -1, true, NULL);
 
 	return err;
 }
 
+/* Decoders take an optional arena. Without one every object is a heap
+ * allocation owned by the caller, with one the objects live in the arena
+ * and are released together by mat_arena_reset() or mat_arena_destroy().
+ */
+static void *match_calloc(struct mat_arena *arena, size_t nmemb, size_t size)
+{
+	if (arena)
+		return mat_arena_calloc(arena, nmemb, size);
+	return calloc(nmemb, size);
+}
+
+static char *match_strdup(struct mat_arena *arena, const char *s)
+{
+	if (arena)
+		return mat_arena_strdup(arena, s);
+	return strdup(s);
+}
+
+static void match_free(struct mat_arena *arena, void *p)
+{
+	if (!arena)
+		free(p);
+}
+
 static int
-match_get_action_arg(struct net_mat_action_arg *arg, struct nlattr *nl)
+match_get_action_arg(struct mat_arena *arena, struct net_mat_action_arg *arg,
+		     struct nlattr *nl)
 {
 	struct nlattr *tb[NET_MAT_ACTION_ARG_MAX+1];
+	const struct match_value_type *t;
 	int err;
 
 	err = nla_parse_nested(tb, NET_MAT_ACTION_ARG_MAX, nl,
@@ -1295,7 +2578,7 @@ match_get_action_arg(struct net_mat_action_arg *arg, struct nlattr *nl)
 		if (max > NET_MAT_MAX_NAME)
 			max = NET_MAT_MAX_NAME;
 
-		arg->name = calloc(1, (unsigned int)max);
+		arg->name = match_calloc(arena, 1, (unsigned int)max);
 		if (!arg->name)
 			return -ENOMEM;
 
@@ -1309,44 +2592,20 @@ match_get_action_arg(struct net_mat_action_arg *arg, struct nlattr *nl)
 
 	if (!tb[NET_MAT_ACTION_ARG_VALUE])
 		return 0;
-
-	switch (arg->type) {
-	case NET_MAT_ACTION_ARG_TYPE_U8:
-		if (nla_len(tb[NET_MAT_ACTION_ARG_VALUE]) < (int)sizeof(__u8))
-			return -EINVAL;
-		arg->v.value_u8 = nla_get_u8(tb[NET_MAT_ACTION_ARG_VALUE]);
-		break;
-	case NET_MAT_ACTION_ARG_TYPE_U16:
-		if (nla_len(tb[NET_MAT_ACTION_ARG_VALUE]) < (int)sizeof(__u16))
-			return -EINVAL;
-		arg->v.value_u16 = nla_get_u16(tb[NET_MAT_ACTION_ARG_VALUE]);
-		break;
-	case NET_MAT_ACTION_ARG_TYPE_U32:
-		if (nla_len(tb[NET_MAT_ACTION_ARG_VALUE]) < (int)sizeof(__u32))
-			return -EINVAL;
-		arg->v.value_u32 = nla_get_u32(tb[NET_MAT_ACTION_ARG_VALUE]);
-		break;
-	case NET_MAT_ACTION_ARG_TYPE_U64:
-		if (nla_len(tb[NET_MAT_ACTION_ARG_VALUE]) < (int)sizeof(__u64))
-			return -EINVAL;
-		arg->v.value_u64 = nla_get_u64(tb[NET_MAT_ACTION_ARG_VALUE]);
-		break;
-	case NET_MAT_ACTION_ARG_TYPE_IN6:
-		if (nla_len(tb[NET_MAT_ACTION_ARG_VALUE]) < (int)sizeof(struct in6_addr))
-			return -EINVAL;
-		arg->v.value_in6 = *((struct in6_addr *)nla_data(tb[NET_MAT_ACTION_ARG_VALUE]));
-		break;
-	case NET_MAT_ACTION_ARG_TYPE_VARIADIC:
-		break;
-	default:
+
+	if (arg->type == NET_MAT_ACTION_ARG_TYPE_VARIADIC)
+		return 0;
+
+	t = match_arg_type(arg->type);
+	if (!t)
 		return -EINVAL;
-	}
 
-	return 0;
+	return t->get_arg(arg, tb[NET_MAT_ACTION_ARG_VALUE]);
 }
 
-int match_get_action(struct mat_stream *matsp, struct nlattr *nl,
-		     struct net_mat_action *a)
+static int
+match_get_action_arena(struct mat_stream *matsp, struct mat_arena *arena,
+		       struct nlattr *nl, struct net_mat_action *a)
 {
 	int rem;
 	struct nlattr *signature, *l;
@@ -1370,7 +2629,7 @@ int match_get_action(struct mat_stream *matsp, struct nlattr *nl,
 	if (a) {
 		act = a;
 	} else {
-		act = calloc(1, sizeof(struct net_mat_action));
+		act = match_calloc(arena, 1, sizeof(struct net_mat_action));
 		if (!act) {
 			err = -ENOMEM;
 			goto out;
@@ -1380,13 +2639,13 @@ int match_get_action(struct mat_stream *matsp, struct nlattr *nl,
 	act->uid = nla_get_u32(action[NET_MAT_ACTION_ATTR_UID]);
 	if (action[NET_MAT_ACTION_ATTR_NAME]) {
 		name = nla_get_string(action[NET_MAT_ACTION_ATTR_NAME]);
-		act->name = strdup(name);
+		act->name = match_strdup(arena, name);
 		if (!act->name) {
 			err = -ENOMEM;
 			goto out;
 		}
 	} else {
-		act->name = strdup(none);
+		act->name = match_strdup(arena, none);
 	}
 
 	if (!action[NET_MAT_ACTION_ATTR_SIGNATURE])
@@ -1398,7 +2657,8 @@ int match_get_action(struct mat_stream *matsp, struct nlattr *nl,
 		count++;
 
 	if (count > 0) {
-		act->args = calloc(count + 1, sizeof(struct net_mat_action_arg));
+		act->args = match_calloc(arena, count + 1,
+				 sizeof(struct net_mat_action_arg));
 		if (!act->args) {
 			err = -ENOMEM;
 			goto out;
@@ -1409,32 +2669,40 @@ int match_get_action(struct mat_stream *matsp, struct nlattr *nl,
 
 	rem = nla_len(signature);
 	for (l = nla_data(signature); nla_ok(l, rem); l = nla_next(l, &rem)) {
-		err = match_get_action_arg(&act->args[count], l);
+		err = match_get_action_arg(arena, &act->args[count], l);
 		if (err)
 			goto out;
 		count++;
 	}
 
 done:
-	pp_action(matsp, act, false);
+	if (matsp)
+		pp_action(matsp, act, false);
 	if (!a) {
-		free(act->args);
-		free(act->name);
-		free(act);
+		match_free(arena, act->args);
+		match_free(arena, act->name);
+		match_free(arena, act);
 	}
 	return err;
 out:
 	if (act) {
-		free(act->args);
-		free(act->name);
+		match_free(arena, act->args);
+		match_free(arena, act->name);
 		if (!a)
-			free(act);
+			match_free(arena, act);
 	}
 	return err;
 }
 
-int match_get_matches(struct mat_stream *matsp, struct nlattr *nl,
-		struct net_mat_field_ref **ref)
+int match_get_action(struct mat_stream *matsp, struct nlattr *nl,
+		     struct net_mat_action *a)
+{
+	return match_get_action_arena(matsp, NULL, nl, a);
+}
+
+static int
+match_get_matches_arena(struct mat_stream *matsp, struct mat_arena *arena,
+			struct nlattr *nl, struct net_mat_field_ref **ref)
 {
 	struct net_mat_field_ref *r;
 	struct nlattr *i;
@@ -1445,7 +2713,7 @@ int match_get_matches(struct mat_stream *matsp, struct nlattr *nl,
 	for (i = nla_data(nl), cnt = 0; nla_ok(i, rem); i = nla_next(i, &rem))
 		cnt++;
 
-	r = calloc(cnt + 1, sizeof(struct net_mat_field_ref));
+	r = match_calloc(arena, cnt + 1, sizeof(struct net_mat_field_ref));
 	if (!r)
 		return -ENOMEM;
 
@@ -1455,11 +2723,20 @@ int match_get_matches(struct mat_stream *matsp, struct nlattr *nl,
 
 	if (ref)
 		*ref = r;
+	else
+		match_free(arena, r);
 	return 0;
 }
 
-int match_get_actions(struct mat_stream *matsp, struct nlattr *nl,
-		struct net_mat_action **actions)
+int match_get_matches(struct mat_stream *matsp, struct nlattr *nl,
+		struct net_mat_field_ref **ref)
+{
+	return match_get_matches_arena(matsp, NULL, nl, ref);
+}
+
+static int
+match_get_actions_arena(struct mat_stream *matsp, struct mat_arena *arena,
+			struct nlattr *nl, struct net_mat_action **actions)
 {
 	struct net_mat_action *acts;
 	unsigned int j = 0;
@@ -1470,22 +2747,28 @@ int match_get_actions(struct mat_stream *matsp, struct nlattr *nl,
 	for (i = nla_data(nl); nla_ok(i, rem); i = nla_next(i, &rem))
 		j++;
 
-	acts = calloc(j + 1, sizeof(struct net_mat_action));
+	acts = match_calloc(arena, j + 1, sizeof(struct net_mat_action));
 	if (!acts)
 		return -ENOMEM;
 
 	rem = nla_len(nl);
 	for (j = 0, i = nla_data(nl); nla_ok(i, rem); i = nla_next(i, &rem), j++)
-		match_get_action(matsp, i, &acts[j]);
+		match_get_action_arena(matsp, arena, i, &acts[j]);
 
 	if (actions)
 		*actions = acts;
 	else
-		free(acts);
+		match_free(arena, acts);
 
 	return 0;
 }
 
+int match_get_actions(struct mat_stream *matsp, struct nlattr *nl,
+		struct net_mat_action **actions)
+{
+	return match_get_actions_arena(matsp, NULL, nl, actions);
+}
+
 static int
 match_get_named_value(struct net_mat_named_value *v, struct nlattr *nl)
 {
@@ -1566,6 +2849,31 @@ out:
 	return -EINVAL;
 }
 
+/*
+ * match_free_tables() - free tables decoded by match_get_table()
+ * @tables: array terminated by a zero uid, freed as well
+ */
+void match_free_tables(struct net_mat_tbl *tables)
+{
+	struct net_mat_named_value *v;
+	unsigned int i;
+
+	if (!tables)
+		return;
+
+	for (i = 0; tables[i].uid; i++) {
+		for (v = tables[i].attribs; v && v->uid; v++) {
+			if (v->name != none)
+				free(v->name);
+		}
+		free(tables[i].name);
+		free(tables[i].matches);
+		free(tables[i].actions);
+		free(tables[i].attribs);
+	}
+	free(tables);
+}
+
 int match_get_table(struct mat_stream *matsp, struct nlattr *nl,
 		   struct net_mat_tbl *t)
 {
@@ -1588,12 +2896,6 @@ int match_get_table(struct mat_stream *matsp, struct nlattr *nl,
 
 	name = table[NET_MAT_TABLE_ATTR_NAME] ? nla_get_string(table[NET_MAT_TABLE_ATTR_NAME]) : none,
 	uid = table[NET_MAT_TABLE_ATTR_UID] ? nla_get_u32(table[NET_MAT_TABLE_ATTR_UID]) : 0;
-	if (uid > MAX_TABLES - 1) {
-		MAT_LOG(ERR, "Error: table id out of range (max=%d)\n",
-			MAX_TABLES - 1);
-		return -ERANGE;
-	}
-
 	src = table[NET_MAT_TABLE_ATTR_SOURCE] ? nla_get_u32(table[NET_MAT_TABLE_ATTR_SOURCE]) : 0;
 	apply = table[NET_MAT_TABLE_ATTR_APPLY] ? nla_get_u32(table[NET_MAT_TABLE_ATTR_APPLY]) : 0;
 	size = table[NET_MAT_TABLE_ATTR_SIZE] ? nla_get_u32(table[NET_MAT_TABLE_ATTR_SIZE]) : 0;
@@ -1700,21 +3002,298 @@ out:
 	return err;
 }
 
-int match_get_rules(struct mat_stream *matsp, struct nlattr *attr,
-		struct net_mat_rule **rules)
+/* Compact records carry a value and mask of the size implied by the type.
+ * In both net_mat_field_ref and net_mat_action_arg the value sits at the
+ * start of the value union and, for fields, the mask follows it at an
+ * offset equal to the value size.
+ */
+static size_t match_compact_field_size(__u32 type)
+{
+	const struct match_value_type *t;
+
+	if (type == NET_MAT_FIELD_REF_ATTR_TYPE_UNSPEC)
+		return 0;
+
+	t = match_field_type(type);
+	return t ? t->size : SIZE_MAX;
+}
+
+static size_t match_compact_arg_size(__u32 type)
+{
+	const struct match_value_type *t;
+
+	if (type == NET_MAT_ACTION_ARG_TYPE_NULL ||
+	    type == NET_MAT_ACTION_ARG_TYPE_VARIADIC)
+		return 0;
+
+	t = match_arg_type(type);
+	return t ? t->size : SIZE_MAX;
+}
+
+/*
+ * match_compact_rule_walk() - validate one compact rule and find its end
+ * @data: start of the rule record
+ * @len: bytes remaining in the attribute
+ * @hdr: filled in with the rule record
+ *
+ * Return: size of the rule including all trailing records, or 0 if the
+ *         records run past @len
+ */
+static size_t match_compact_rule_walk(const char *data, size_t len,
+				      struct net_mat_compact_rule *hdr)
+{
+	struct net_mat_compact_action act;
+	size_t off;
+	unsigned int i;
+
+	if (len < sizeof(*hdr))
+		return 0;
+	memcpy(hdr, data, sizeof(*hdr));
+	off = sizeof(*hdr);
+
+	if ((len - off) / sizeof(struct net_mat_compact_field) < hdr->nmatches)
+		return 0;
+	off += hdr->nmatches * sizeof(struct net_mat_compact_field);
+
+	for (i = 0; i < hdr->nactions; i++) {
+		if (len - off < sizeof(act))
+			return 0;
+		memcpy(&act, data + off, sizeof(act));
+		off += sizeof(act);
+
+		if ((len - off) / sizeof(struct net_mat_compact_arg) < act.nargs)
+			return 0;
+		off += act.nargs * sizeof(struct net_mat_compact_arg);
+	}
+
+	return off;
+}
+
+/*
+ * match_free_rules() - free rules returned by match_get_rules()
+ * @rules: the rule array
+ * @count: number of rules in @rules
+ */
+void match_free_rules(struct net_mat_rule *rules, unsigned int count)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < count; i++) {
+		if (rules[i].actions) {
+			for (j = 0; rules[i].actions[j].uid; j++) {
+				free(rules[i].actions[j].args);
+				free(rules[i].actions[j].name);
+			}
+		}
+		free(rules[i].matches);
+		free(rules[i].actions);
+	}
+	free(rules);
+}
+
+static int match_get_rule_compact(struct mat_arena *arena, const char *data,
+				  struct net_mat_compact_rule *hdr,
+				  struct net_mat_rule *rule)
+{
+	struct net_mat_compact_action act;
+	struct net_mat_compact_field fr;
+	struct net_mat_compact_arg ar;
+	struct net_mat_action *a, *def;
+	size_t off = sizeof(*hdr), sz;
+	unsigned int i, j, ndef;
+
+	rule->table_id = hdr->table_id;
+	rule->uid = hdr->uid;
+	rule->priority = hdr->priority;
+	rule->bytes = hdr->bytes;
+	rule->packets = hdr->packets;
+
+	if (hdr->nmatches) {
+		rule->matches = match_calloc(arena, hdr->nmatches + 1U,
+					     sizeof(*rule->matches));
+		if (!rule->matches)
+			return -ENOMEM;
+	}
+
+	for (i = 0; i < hdr->nmatches; i++) {
+		struct net_mat_field_ref *ref = &rule->matches[i];
+
+		memcpy(&fr, data + off, sizeof(fr));
+		off += sizeof(fr);
+
+		sz = match_compact_field_size(fr.type);
+		if (sz == SIZE_MAX)
+			return -EINVAL;
+
+		ref->instance = fr.instance;
+		ref->header = fr.header;
+		ref->field = fr.field;
+		ref->mask_type = fr.mask_type;
+		ref->type = fr.type;
+		memcpy(&ref->v, fr.value, sz);
+		memcpy((char *)&ref->v + sz, fr.mask, sz);
+	}
+
+	if (hdr->nactions) {
+		rule->actions = match_calloc(arena, hdr->nactions + 1U,
+					     sizeof(*rule->actions));
+		if (!rule->actions)
+			return -ENOMEM;
+	}
+
+	for (i = 0; i < hdr->nactions; i++) {
+		a = &rule->actions[i];
+
+		memcpy(&act, data + off, sizeof(act));
+		off += sizeof(act);
+
+		/* names are not sent, take them from the known actions */
+		a->uid = act.uid;
+		a->name = match_strdup(arena, action_names(act.uid));
+		if (!a->name)
+			return -ENOMEM;
+		def = get_actions(act.uid);
+		for (ndef = 0; def && def->args && def->args[ndef].type; ndef++)
+			;
+
+		if (!act.nargs)
+			continue;
+
+		a->args = match_calloc(arena, act.nargs + 1U, sizeof(*a->args));
+		if (!a->args)
+			return -ENOMEM;
+
+		for (j = 0; j < act.nargs; j++) {
+			memcpy(&ar, data + off, sizeof(ar));
+			off += sizeof(ar);
+
+			sz = match_compact_arg_size(ar.type);
+			if (sz == SIZE_MAX)
+				return -EINVAL;
+
+			a->args[j].name = j < ndef && def->args[j].name ?
+					  def->args[j].name : none;
+			a->args[j].type = ar.type;
+			memcpy(&a->args[j].v, ar.value, sz);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * match_get_rules_compact() - decode a NET_MAT_RULES_COMPACT attribute
+ *
+ * See match_get_rules_arena(), a malformed attribute is rejected as a
+ * whole rather than skipping the offending rule.
+ */
+static int match_get_rules_compact(struct mat_stream *matsp,
+				   struct nlattr *attr,
+				   struct mat_arena *arena,
+				   struct net_mat_rule **rules,
+				   struct match_decode_stats *stats)
+{
+	struct net_mat_compact_rule hdr;
+	struct mat_arena_stats before, after;
+	struct timespec start, end;
+	struct net_mat_rule *f;
+	const char *data = nla_data(attr);
+	size_t len = (size_t)nla_len(attr), off, sz;
+	unsigned int count = 0, i;
+	int err = 0;
+
+	if (stats) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		memset(&before, 0, sizeof(before));
+		mat_arena_get_stats(arena, &before);
+	}
+
+	for (off = 0; off < len; off += sz, count++) {
+		sz = match_compact_rule_walk(data + off, len - off, &hdr);
+		if (!sz) {
+			MAT_LOG(ERR, "Warning: truncated compact rule %u\n", count);
+			return -EINVAL;
+		}
+	}
+
+	f = match_calloc(arena, count + 1, sizeof(struct net_mat_rule));
+	if (!f)
+		return -EMSGSIZE;
+
+	for (off = 0, i = 0; i < count; off += sz, i++) {
+		sz = match_compact_rule_walk(data + off, len - off, &hdr);
+		err = match_get_rule_compact(arena, data + off, &hdr, &f[i]);
+		if (err) {
+			MAT_LOG(ERR, "Warning: invalid compact rule %u\n", hdr.uid);
+			if (!arena)
+				match_free_rules(f, i + 1);
+			return err;
+		}
+	}
+
+	if (stats) {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		after = before;
+		mat_arena_get_stats(arena, &after);
+		stats->rules = count;
+		stats->bytes = after.used - before.used;
+		stats->nsecs = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL +
+			       (uint64_t)end.tv_nsec - (uint64_t)start.tv_nsec;
+	}
+
+	pp_rules(matsp, f);
+	if (rules)
+		*rules = f;
+	else if (!arena)
+		match_free_rules(f, count);
+
+	return 0;
+}
+
+/*
+ * match_get_rules_arena() - decode a NET_MAT_RULES nest or NET_MAT_RULES_COMPACT
+ * @matsp: stream the decoded rules are printed to, may be NULL
+ * @attr: the NET_MAT_RULES or NET_MAT_RULES_COMPACT attribute
+ * @arena: arena to decode into, NULL to use the heap
+ * @rules: set to the null terminated list of decoded rules, may be NULL
+ * @stats: filled in with the rule count, arena bytes and decode time,
+ *         may be NULL
+ *
+ * With an arena the rule array and every match, action, action argument
+ * and name it references are allocated from @arena, so the whole batch is
+ * released with a single mat_arena_reset() or mat_arena_destroy() and must
+ * not be passed to free(). Printing to @matsp is not included in the
+ * decode time, and the bytes are only counted when decoding into an arena.
+ *
+ * Return: 0 on success or a negative error code
+ */
+int match_get_rules_arena(struct mat_stream *matsp, struct nlattr *attr,
+			  struct mat_arena *arena, struct net_mat_rule **rules,
+			  struct match_decode_stats *stats)
 {
 	struct net_mat_field_ref *matches = NULL;
 	struct net_mat_action *actions = NULL;
+	struct mat_arena_stats before, after;
+	struct timespec start, end;
 	struct net_mat_rule  *f;
 	struct nlattr *i;
 	int err, rem;
 	unsigned int count = 0, idx = 0;
 
+	if (nla_type(attr) == NET_MAT_RULES_COMPACT)
+		return match_get_rules_compact(matsp, attr, arena, rules, stats);
+
+	if (stats) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		memset(&before, 0, sizeof(before));
+		mat_arena_get_stats(arena, &before);
+	}
+
 	rem = nla_len(attr);
 	for (i = nla_data(attr);  nla_ok(i, rem); i = nla_next(i, &rem))
 		count++;
 
-	f = calloc(count + 1, sizeof(struct net_mat_rule));
+	f = match_calloc(arena, count + 1, sizeof(struct net_mat_rule));
 	if (!f)
 		return -EMSGSIZE;
 
@@ -1749,9 +3328,9 @@ int match_get_rules(struct mat_stream *matsp, struct nlattr *attr,
 			f[count].packets = nla_get_u64(rule[NET_MAT_ATTR_PACKETS]);
 
 		if (rule[NET_MAT_ATTR_MATCHES]) {
-			err = match_get_matches(NULL,
-					       rule[NET_MAT_ATTR_MATCHES],
-					       &matches);
+			err = match_get_matches_arena(NULL, arena,
+						      rule[NET_MAT_ATTR_MATCHES],
+						      &matches);
 			if (err) {
 				MAT_LOG(ERR, "Warning get_rule matches parse error skipping input.\n");
 				continue;
@@ -1759,9 +3338,9 @@ int match_get_rules(struct mat_stream *matsp, struct nlattr *attr,
 		}
 
 		if (rule[NET_MAT_ATTR_ACTIONS]) {
-			err = match_get_actions(NULL,
-					       rule[NET_MAT_ATTR_ACTIONS],
-					       &actions);
+			err = match_get_actions_arena(NULL, arena,
+						      rule[NET_MAT_ATTR_ACTIONS],
+						      &actions);
 			if (err) {
 				MAT_LOG(ERR, "Warning get_rule actions parse error skipping input.\n");
 				continue;
@@ -1772,10 +3351,20 @@ int match_get_rules(struct mat_stream *matsp, struct nlattr *attr,
 		f[count].actions = actions;
 	}
 
+	if (stats) {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		after = before;
+		mat_arena_get_stats(arena, &after);
+		stats->rules = count;
+		stats->bytes = after.used - before.used;
+		stats->nsecs = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL +
+			       (uint64_t)end.tv_nsec - (uint64_t)start.tv_nsec;
+	}
+
 	pp_rules(matsp, f);
 	if (rules)
 		*rules = f;
-	else {
+	else if (!arena) {
 		for (idx = 0; idx < count; idx++) {
 			free(f[idx].matches);
 			free(f[idx].actions);
@@ -1785,6 +3374,12 @@ int match_get_rules(struct mat_stream *matsp, struct nlattr *attr,
 	return 0;
 }
 
+int match_get_rules(struct mat_stream *matsp, struct nlattr *attr,
+		struct net_mat_rule **rules)
+{
+	return match_get_rules_arena(matsp, attr, NULL, rules, NULL);
+}
+
 unsigned int match_get_rule_errors(struct nlattr *nla)
 {
 	return nla_get_u32(nla);
@@ -1835,7 +3430,7 @@ match_get_table_field(struct mat_stream *matsp __unused, struct nlattr *nl,
 			  nla_get_string(field[NET_MAT_FIELD_ATTR_NAME]) : none));
 		f->bitwidth = field[NET_MAT_FIELD_ATTR_BITWIDTH] ?
 			      nla_get_u32(field[NET_MAT_FIELD_ATTR_BITWIDTH]) : 0;
-		header_fields[hdr->uid][f->uid] = f;
+		match_set_field(hdr->uid, f->uid, f);
 		count++;
 	}
 
@@ -1897,7 +3492,7 @@ int match_get_headers(struct mat_stream *matsp, struct nlattr *nl,
 		match_get_table_field(matsp,
 				     hdr[NET_MAT_HEADER_ATTR_FIELDS],
 				     header);
-		headers[header->uid] = header;
+		match_set_header(header->uid, header);
 		pp_header(matsp, header);
 		h[count] = *header;
 		count++;
@@ -2038,7 +3633,7 @@ int match_get_hdrs_graph(struct mat_stream *matsp, int print, struct nlattr *nl,
 		}
 
 		nodes[j].uid = nla_get_u32(node[NET_MAT_HEADER_NODE_UID]);
-		graph_nodes[nodes[j].uid] = &nodes[j];
+		match_set_graph_node(nodes[j].uid, &nodes[j]);
 
 		if (!node[NET_MAT_HEADER_NODE_HDRS])
 			continue; /* Not requried for terminating nodes */
@@ -2310,95 +3905,391 @@ int match_get_port(struct mat_stream *matsp, struct nlattr *nlattr,
 	if (p[NET_MAT_PORT_T_PCI]) {
 		struct net_mat_port_pci *pci;
 
-		if (nla_len(p[NET_MAT_PORT_T_PCI]) < (int)sizeof(struct net_mat_port_pci))
-			return -EINVAL;
+		if (nla_len(p[NET_MAT_PORT_T_PCI]) < (int)sizeof(struct net_mat_port_pci))
+			return -EINVAL;
+
+		pci = nla_data(p[NET_MAT_PORT_T_PCI]);
+		memcpy(&port->pci, pci, sizeof(struct net_mat_port_pci));
+	}
+
+	if (p[NET_MAT_PORT_T_STATS]) {
+		err = match_get_port_stats(matsp, p[NET_MAT_PORT_T_STATS], &port->stats);
+		if (err)
+			return -EINVAL;
+	}
+
+	if (p[NET_MAT_PORT_T_VLAN]) {
+		err = match_get_port_vlan(matsp, p[NET_MAT_PORT_T_VLAN], &port->vlan);
+		if (err)
+			return -EINVAL;
+	}
+
+	if (p[NET_MAT_PORT_T_LOOPBACK])
+		port->loopback = nla_get_u32(p[NET_MAT_PORT_T_LOOPBACK]);
+
+	if (p[NET_MAT_PORT_T_LEARNING])
+		port->learning = nla_get_u32(p[NET_MAT_PORT_T_LEARNING]);
+
+	if (p[NET_MAT_PORT_T_UPDATE_DSCP])
+		port->update_dscp = nla_get_u32(p[NET_MAT_PORT_T_UPDATE_DSCP]);
+
+	if (p[NET_MAT_PORT_T_UPDATE_TTL])
+		port->update_ttl = nla_get_u32(p[NET_MAT_PORT_T_UPDATE_TTL]);
+
+	if (p[NET_MAT_PORT_T_MCAST_FLOODING])
+		port->mcast_flooding = nla_get_u32(p[NET_MAT_PORT_T_MCAST_FLOODING]);
+
+	if (p[NET_MAT_PORT_T_UPDATE_DMAC])
+		port->update_dmac = nla_get_u32(p[NET_MAT_PORT_T_UPDATE_DMAC]);
+
+	if (p[NET_MAT_PORT_T_UPDATE_SMAC])
+		port->update_smac = nla_get_u32(p[NET_MAT_PORT_T_UPDATE_SMAC]);
+
+	if (p[NET_MAT_PORT_T_UPDATE_VLAN])
+		port->update_vlan = nla_get_u32(p[NET_MAT_PORT_T_UPDATE_VLAN]);
+
+	pp_port(matsp, port);
+	return 0;
+}
+
+int match_get_ports(struct mat_stream *matsp, struct nlattr *nl,
+		   struct net_mat_port **p)
+{
+	struct net_mat_port *ports = NULL;
+	struct nlattr *i;
+	int err, rem;
+	unsigned cnt = 0;
+
+	rem = nla_len(nl);
+	for (cnt = 0, i = nla_data(nl); nla_ok(i, rem); i = nla_next(i, &rem))
+		cnt++;
+
+	ports = calloc(cnt + 1, sizeof(struct net_mat_port));
+	if (!ports)
+		return -ENOMEM;
+
+	rem = nla_len(nl);
+	for (cnt = 0, i = nla_data(nl); nla_ok(i, rem); i = nla_next(i, &rem), cnt++) {
+		ports[cnt].vlan.def_priority = NET_MAT_PORT_T_DEF_PRI_UNSPEC;
+		err = match_get_port(matsp, i, &ports[cnt]);
+		if (err)
+			goto out;
+	}
+
+	/* terminate the list */
+	ports[cnt].port_id = NET_MAT_PORT_ID_UNSPEC;
+
+	if (p)
+		*p = ports;
+	else
+		free(ports);
+
+	return 0;
+out:
+	free(ports);
+	return err;
+
+}
+
+int match_get_event(struct mat_stream *matsp, struct nlattr *nl,
+		    struct net_mat_event *event)
+{
+	struct nlattr *e[NET_MAT_EVENT_ATTR_MAX+1];
+	int err;
+
+	err = nla_parse_nested(e, NET_MAT_EVENT_ATTR_MAX, nl,
+			       net_mat_event_policy);
+	if (err) {
+		MAT_LOG(ERR, "Warning: event parse error\n");
+		return -EINVAL;
+	}
+
+	if (!e[NET_MAT_EVENT_ATTR_TYPE]) {
+		MAT_LOG(ERR, "Warning: event without type\n");
+		return -EINVAL;
+	}
+
+	memset(event, 0, sizeof(*event));
+	event->type = nla_get_u32(e[NET_MAT_EVENT_ATTR_TYPE]);
+
+	if (e[NET_MAT_EVENT_ATTR_TABLE])
+		event->table_id = nla_get_u32(e[NET_MAT_EVENT_ATTR_TABLE]);
+
+	if (e[NET_MAT_EVENT_ATTR_UID])
+		event->uid = nla_get_u32(e[NET_MAT_EVENT_ATTR_UID]);
+
+	if (e[NET_MAT_EVENT_ATTR_PORT])
+		event->port_id = nla_get_u32(e[NET_MAT_EVENT_ATTR_PORT]);
+
+	if (e[NET_MAT_EVENT_ATTR_STATE])
+		event->state = nla_get_u32(e[NET_MAT_EVENT_ATTR_STATE]);
+
+	pp_event(matsp, event);
+	return 0;
+}
+
+int match_get_events(struct mat_stream *matsp, struct nlattr *nl,
+		     struct net_mat_event **e)
+{
+	struct net_mat_event *events = NULL;
+	struct nlattr *i;
+	int err, rem;
+	unsigned int cnt = 0;
+
+	rem = nla_len(nl);
+	for (i = nla_data(nl); nla_ok(i, rem); i = nla_next(i, &rem))
+		cnt++;
+
+	events = calloc(cnt + 1, sizeof(struct net_mat_event));
+	if (!events)
+		return -ENOMEM;
 
-		pci = nla_data(p[NET_MAT_PORT_T_PCI]);
-		memcpy(&port->pci, pci, sizeof(struct net_mat_port_pci));
-	}
+	rem = nla_len(nl);
+	for (cnt = 0, i = nla_data(nl); nla_ok(i, rem); i = nla_next(i, &rem)) {
+		if (nla_type(i) != NET_MAT_EVENT)
+			continue;
 
-	if (p[NET_MAT_PORT_T_STATS]) {
-		err = match_get_port_stats(matsp, p[NET_MAT_PORT_T_STATS], &port->stats);
+		err = match_get_event(matsp, i, &events[cnt]);
 		if (err)
-			return -EINVAL;
+			goto out;
+		cnt++;
 	}
 
-	if (p[NET_MAT_PORT_T_VLAN]) {
-		err = match_get_port_vlan(matsp, p[NET_MAT_PORT_T_VLAN], &port->vlan);
-		if (err)
-			return -EINVAL;
+	/* the list is terminated by an event of type NET_MAT_EVENT_T_UNSPEC */
+	if (e)
+		*e = events;
+	else
+		free(events);
+
+	return 0;
+out:
+	free(events);
+	return err;
+}
+
+static int match_get_stats_cmd(struct nlattr *nl, struct net_mat_cmd_stats *s)
+{
+	struct nlattr *a[NET_MAT_STATS_CMD_ATTR_MAX+1];
+	size_t len;
+	int err;
+
+	err = nla_parse_nested(a, NET_MAT_STATS_CMD_ATTR_MAX, nl,
+			       net_mat_stats_cmd_policy);
+	if (err) {
+		MAT_LOG(ERR, "Warning: command stats parse error\n");
+		return -EINVAL;
 	}
 
-	if (p[NET_MAT_PORT_T_LOOPBACK])
-		port->loopback = nla_get_u32(p[NET_MAT_PORT_T_LOOPBACK]);
+	if (!a[NET_MAT_STATS_CMD_ATTR_CMD] ||
+	    !a[NET_MAT_STATS_CMD_ATTR_REQUESTS]) {
+		MAT_LOG(ERR, "Warning: command stats without command\n");
+		return -EINVAL;
+	}
 
-	if (p[NET_MAT_PORT_T_LEARNING])
-		port->learning = nla_get_u32(p[NET_MAT_PORT_T_LEARNING]);
+	memset(s, 0, sizeof(*s));
+	s->cmd = nla_get_u32(a[NET_MAT_STATS_CMD_ATTR_CMD]);
+	s->requests = nla_get_u64(a[NET_MAT_STATS_CMD_ATTR_REQUESTS]);
+
+	if (a[NET_MAT_STATS_CMD_ATTR_ERRORS])
+		s->errors = nla_get_u64(a[NET_MAT_STATS_CMD_ATTR_ERRORS]);
+	if (a[NET_MAT_STATS_CMD_ATTR_RX_BYTES])
+		s->rx_bytes = nla_get_u64(a[NET_MAT_STATS_CMD_ATTR_RX_BYTES]);
+	if (a[NET_MAT_STATS_CMD_ATTR_TX_BYTES])
+		s->tx_bytes = nla_get_u64(a[NET_MAT_STATS_CMD_ATTR_TX_BYTES]);
+	if (a[NET_MAT_STATS_CMD_ATTR_MULTIPART])
+		s->multipart = nla_get_u64(a[NET_MAT_STATS_CMD_ATTR_MULTIPART]);
+	if (a[NET_MAT_STATS_CMD_ATTR_LATENCY_NS])
+		s->latency_ns = nla_get_u64(a[NET_MAT_STATS_CMD_ATTR_LATENCY_NS]);
+
+	/* a daemon with fewer buckets leaves the slower ones empty */
+	if (a[NET_MAT_STATS_CMD_ATTR_LATENCY]) {
+		len = (size_t)nla_len(a[NET_MAT_STATS_CMD_ATTR_LATENCY]);
+		if (len > sizeof(s->latency))
+			len = sizeof(s->latency);
+		memcpy(s->latency, nla_data(a[NET_MAT_STATS_CMD_ATTR_LATENCY]),
+		       len - len % sizeof(s->latency[0]));
+	}
 
-	if (p[NET_MAT_PORT_T_UPDATE_DSCP])
-		port->update_dscp = nla_get_u32(p[NET_MAT_PORT_T_UPDATE_DSCP]);
+	return 0;
+}
 
-	if (p[NET_MAT_PORT_T_UPDATE_TTL])
-		port->update_ttl = nla_get_u32(p[NET_MAT_PORT_T_UPDATE_TTL]);
+static int match_get_stats_table(struct nlattr *nl,
+				 struct net_mat_table_stats *t)
+{
+	struct nlattr *a[NET_MAT_STATS_TABLE_ATTR_MAX+1];
+	int err;
 
-	if (p[NET_MAT_PORT_T_MCAST_FLOODING])
-		port->mcast_flooding = nla_get_u32(p[NET_MAT_PORT_T_MCAST_FLOODING]);
+	err = nla_parse_nested(a, NET_MAT_STATS_TABLE_ATTR_MAX, nl,
+			       net_mat_stats_table_policy);
+	if (err) {
+		MAT_LOG(ERR, "Warning: table stats parse error\n");
+		return -EINVAL;
+	}
 
-	if (p[NET_MAT_PORT_T_UPDATE_DMAC])
-		port->update_dmac = nla_get_u32(p[NET_MAT_PORT_T_UPDATE_DMAC]);
+	if (!a[NET_MAT_STATS_TABLE_ATTR_ID]) {
+		MAT_LOG(ERR, "Warning: table stats without table\n");
+		return -EINVAL;
+	}
 
-	if (p[NET_MAT_PORT_T_UPDATE_SMAC])
-		port->update_smac = nla_get_u32(p[NET_MAT_PORT_T_UPDATE_SMAC]);
+	memset(t, 0, sizeof(*t));
+	t->table_id = nla_get_u32(a[NET_MAT_STATS_TABLE_ATTR_ID]);
 
-	if (p[NET_MAT_PORT_T_UPDATE_VLAN])
-		port->update_vlan = nla_get_u32(p[NET_MAT_PORT_T_UPDATE_VLAN]);
+	if (a[NET_MAT_STATS_TABLE_ATTR_SIZE])
+		t->size = nla_get_u32(a[NET_MAT_STATS_TABLE_ATTR_SIZE]);
+	if (a[NET_MAT_STATS_TABLE_ATTR_RULES])
+		t->rules = nla_get_u32(a[NET_MAT_STATS_TABLE_ATTR_RULES]);
 
-	pp_port(matsp, port);
 	return 0;
 }
 
-int match_get_ports(struct mat_stream *matsp, struct nlattr *nl,
-		   struct net_mat_port **p)
+/*
+ * match_get_stats() - decode a NET_MAT_STATS attribute
+ * @matsp: unused, the stats are printed whole by pp_stats()
+ * @nl: the NET_MAT_STATS attribute
+ * @stats: stats to append the decoded commands and tables to
+ *
+ * A large reply is split over several messages, so the entries are
+ * appended to the arrays already in @stats, which must be zeroed before
+ * the first call. The arrays stay terminated on error and are released
+ * with match_free_stats().
+ *
+ * Return: 0 on success or a negative error code
+ */
+int match_get_stats(struct mat_stream *matsp __attribute__((unused)),
+		    struct nlattr *nl, struct net_mat_stats *stats)
 {
-	struct net_mat_port *ports = NULL;
+	struct nlattr *s[NET_MAT_STATS_MAX+1];
+	struct net_mat_table_stats *tables;
+	struct net_mat_cmd_stats *cmds;
+	unsigned int ncmds = 0, ntables = 0, c = 0, t = 0;
 	struct nlattr *i;
 	int err, rem;
-	unsigned cnt = 0;
+
+	err = nla_parse_nested(s, NET_MAT_STATS_MAX, nl, net_mat_stats_policy);
+	if (err) {
+		MAT_LOG(ERR, "Warning: stats parse error\n");
+		return -EINVAL;
+	}
+
+	if (s[NET_MAT_STATS_RX_DROPS])
+		stats->rx_drops = nla_get_u64(s[NET_MAT_STATS_RX_DROPS]);
+	if (s[NET_MAT_STATS_EVENT_DROPS])
+		stats->event_drops = nla_get_u64(s[NET_MAT_STATS_EVENT_DROPS]);
 
 	rem = nla_len(nl);
-	for (cnt = 0, i = nla_data(nl); nla_ok(i, rem); i = nla_next(i, &rem))
-		cnt++;
+	for (i = nla_data(nl); nla_ok(i, rem); i = nla_next(i, &rem)) {
+		if (nla_type(i) == NET_MAT_STATS_CMD)
+			ncmds++;
+		else if (nla_type(i) == NET_MAT_STATS_TABLE)
+			ntables++;
+	}
 
-	ports = calloc(cnt + 1, sizeof(struct net_mat_port));
-	if (!ports)
+	while (stats->cmds && stats->cmds[c].requests)
+		c++;
+	while (stats->tables && stats->tables[t].table_id)
+		t++;
+
+	cmds = realloc(stats->cmds, (c + ncmds + 1) * sizeof(*cmds));
+	if (!cmds)
+		return -ENOMEM;
+	memset(&cmds[c], 0, (ncmds + 1) * sizeof(*cmds));
+	stats->cmds = cmds;
+
+	tables = realloc(stats->tables, (t + ntables + 1) * sizeof(*tables));
+	if (!tables)
 		return -ENOMEM;
+	memset(&tables[t], 0, (ntables + 1) * sizeof(*tables));
+	stats->tables = tables;
 
 	rem = nla_len(nl);
-	for (cnt = 0, i = nla_data(nl); nla_ok(i, rem); i = nla_next(i, &rem), cnt++) {
-		ports[cnt].vlan.def_priority = NET_MAT_PORT_T_DEF_PRI_UNSPEC;
-		err = match_get_port(matsp, i, &ports[cnt]);
-		if (err)
-			goto out;
+	for (i = nla_data(nl); nla_ok(i, rem); i = nla_next(i, &rem)) {
+		switch (nla_type(i)) {
+		case NET_MAT_STATS_CMD:
+			err = match_get_stats_cmd(i, &cmds[c]);
+			if (err) {
+				memset(&cmds[c], 0, sizeof(cmds[c]));
+				return err;
+			}
+			/* an idle command would end the list early */
+			if (cmds[c].requests)
+				c++;
+			break;
+		case NET_MAT_STATS_TABLE:
+			err = match_get_stats_table(i, &tables[t]);
+			if (err) {
+				memset(&tables[t], 0, sizeof(tables[t]));
+				return err;
+			}
+			if (tables[t].table_id)
+				t++;
+			break;
+		default:
+			break;
+		}
 	}
 
-	/* terminate the list */
-	ports[cnt].port_id = NET_MAT_PORT_ID_UNSPEC;
+	return 0;
+}
 
-	if (p)
-		*p = ports;
-	else
-		free(ports);
+void match_free_stats(struct net_mat_stats *stats)
+{
+	free(stats->cmds);
+	free(stats->tables);
+	stats->cmds = NULL;
+	stats->tables = NULL;
+}
+
+/*
+ * match_get_rule_filter() - decode a NET_MAT_TABLE_RULES_FILTER nest
+ * @nl: the nest
+ * @filter: the decoded filter, release with match_free_rule_filter()
+ *
+ * Return: 0 on success or a negative error code
+ */
+int match_get_rule_filter(struct nlattr *nl, struct net_mat_rule_filter *filter)
+{
+	struct nlattr *tb[NET_MAT_RULES_FILTER_MAX+1];
+	int err;
+
+	memset(filter, 0, sizeof(*filter));
+
+	err = nla_parse_nested(tb, NET_MAT_RULES_FILTER_MAX, nl,
+			       net_mat_rules_filter_policy);
+	if (err) {
+		MAT_LOG(ERR, "Warning: get rules filter parse error\n");
+		return -EINVAL;
+	}
+
+	if (tb[NET_MAT_RULES_FILTER_MATCHES]) {
+		err = match_get_matches(NULL, tb[NET_MAT_RULES_FILTER_MATCHES],
+					&filter->matches);
+		if (err)
+			return err;
+	}
+
+	if (tb[NET_MAT_RULES_FILTER_ACTION])
+		filter->action = nla_get_u32(tb[NET_MAT_RULES_FILTER_ACTION]);
+	if (tb[NET_MAT_RULES_FILTER_MIN_PACKETS])
+		filter->min_packets =
+			nla_get_u64(tb[NET_MAT_RULES_FILTER_MIN_PACKETS]);
+	if (tb[NET_MAT_RULES_FILTER_TOP])
+		filter->top = nla_get_u32(tb[NET_MAT_RULES_FILTER_TOP]);
+	if (tb[NET_MAT_RULES_FILTER_TOP_KEY])
+		filter->top_key = nla_get_u32(tb[NET_MAT_RULES_FILTER_TOP_KEY]);
 
 	return 0;
-out:
-	free(ports);
-	return err;
+}
 
+void match_free_rule_filter(struct net_mat_rule_filter *filter)
+{
+	free(filter->matches);
+	filter->matches = NULL;
 }
 
 static int match_put_action_args(struct nl_msg *nlbuf,
 		struct net_mat_action_arg *args)
 {
+	const struct match_value_type *t;
 	struct net_mat_action_arg *this;
 	struct nlattr *arg;
 	int i, err, cnt = 0;
@@ -2424,38 +4315,8 @@ static int match_put_action_args(struct nl_msg *nlbuf,
 			return -EMSGSIZE;
 		}
 
-		switch (args[i].type) {
-		case NET_MAT_ACTION_ARG_TYPE_U8:
-			err = nla_put_u8(nlbuf,
-					 NET_MAT_ACTION_ARG_VALUE,
-					 args[i].v.value_u8);
-			break;
-		case NET_MAT_ACTION_ARG_TYPE_U16:
-			err = nla_put_u16(nlbuf,
-					  NET_MAT_ACTION_ARG_VALUE,
-					  args[i].v.value_u16);
-			break;
-		case NET_MAT_ACTION_ARG_TYPE_U32:
-			err = nla_put_u32(nlbuf,
-					  NET_MAT_ACTION_ARG_VALUE,
-					  args[i].v.value_u32);
-			break;
-		case NET_MAT_ACTION_ARG_TYPE_U64:
-			err = nla_put_u64(nlbuf,
-					  NET_MAT_ACTION_ARG_VALUE,
-					  args[i].v.value_u64);
-			break;
-		case NET_MAT_ACTION_ARG_TYPE_IN6:
-			err = nla_put(nlbuf, NET_MAT_ACTION_ARG_VALUE,
-					sizeof(struct in6_addr),
-					&args[i].v.value_in6.s6_addr32[0]);
-			break;
-		case NET_MAT_ACTION_ARG_TYPE_NULL:
-		case NET_MAT_ACTION_ARG_TYPE_VARIADIC:
-		default:
-			err = 0;
-			break;
-		}
+		t = match_arg_type(args[i].type);
+		err = t ? t->put_arg(nlbuf, &args[i]) : 0;
 
 		if (err) {
 			nla_nest_cancel(nlbuf, arg);
@@ -2576,6 +4437,8 @@ int match_put_headers(struct nl_msg *nlbuf, struct net_mat_hdr **ref)
 
 int match_put_field_ref(struct nl_msg *nlbuf, struct net_mat_field_ref *ref)
 {
+	const struct match_value_type *t;
+
 	if (nla_put_u32(nlbuf, NET_MAT_FIELD_REF_INSTANCE, ref->instance) ||
 	    nla_put_u32(nlbuf, NET_MAT_FIELD_REF_HEADER, ref->header) ||
 	    nla_put_u32(nlbuf, NET_MAT_FIELD_REF_FIELD, ref->field) ||
@@ -2586,39 +4449,11 @@ int match_put_field_ref(struct nl_msg *nlbuf, struct net_mat_field_ref *ref)
 	if (!ref->type)
 		return 0;
 
-	switch (ref->type) {
-	case NET_MAT_FIELD_REF_ATTR_TYPE_U8:
-		if (nla_put_u8(nlbuf, NET_MAT_FIELD_REF_VALUE, ref->v.u8.value_u8) ||
-		    nla_put_u8(nlbuf, NET_MAT_FIELD_REF_MASK, ref->v.u8.mask_u8))
-			return -EMSGSIZE;
-		break;
-	case NET_MAT_FIELD_REF_ATTR_TYPE_U16:
-		if (nla_put_u16(nlbuf, NET_MAT_FIELD_REF_VALUE, ref->v.u16.value_u16) ||
-		    nla_put_u16(nlbuf, NET_MAT_FIELD_REF_MASK, ref->v.u16.mask_u16))
-			return -EMSGSIZE;
-		break;
-	case NET_MAT_FIELD_REF_ATTR_TYPE_U32:
-		if (nla_put_u32(nlbuf, NET_MAT_FIELD_REF_VALUE, ref->v.u32.value_u32) ||
-		    nla_put_u32(nlbuf, NET_MAT_FIELD_REF_MASK, ref->v.u32.mask_u32))
-			return -EMSGSIZE;
-		break;
-	case NET_MAT_FIELD_REF_ATTR_TYPE_U64:
-		if (nla_put_u64(nlbuf, NET_MAT_FIELD_REF_VALUE, ref->v.u64.value_u64) ||
-		    nla_put_u64(nlbuf, NET_MAT_FIELD_REF_MASK, ref->v.u64.mask_u64))
-			return -EMSGSIZE;
-		break;
-	case NET_MAT_FIELD_REF_ATTR_TYPE_IN6:
-		if (nla_put(nlbuf, NET_MAT_FIELD_REF_VALUE,
-				sizeof(struct in6_addr), &ref->v.in6.value_in6.s6_addr32[0]) ||
-		    nla_put(nlbuf, NET_MAT_FIELD_REF_MASK,
-				sizeof(struct in6_addr), &ref->v.in6.mask_in6.s6_addr32[0]))
-			return -EMSGSIZE;
-		break;
-	default:
-		break;
-	}
+	t = match_field_type(ref->type);
+	if (!t)
+		return 0;
 
-	return 0;
+	return t->put_field(nlbuf, ref);
 }
 
 int match_put_matches(struct nl_msg *nlbuf, struct net_mat_field_ref *ref,
@@ -2646,6 +4481,41 @@ int match_put_rule_error(struct nl_msg *nlbuf, __u32 err)
 	return nla_put_u32(nlbuf, NET_MAT_RULES_ERROR, err);
 }
 
+/* Put a NET_MAT_TABLE_RULES_FILTER nest, see struct net_mat_rule_filter */
+int match_put_rule_filter(struct nl_msg *nlbuf,
+		struct net_mat_rule_filter *filter)
+{
+	struct nlattr *nest;
+
+	nest = nla_nest_start(nlbuf, NET_MAT_TABLE_RULES_FILTER);
+	if (!nest)
+		return -EMSGSIZE;
+
+	if (filter->matches && filter->matches[0].header &&
+	    match_put_matches(nlbuf, filter->matches,
+			      NET_MAT_RULES_FILTER_MATCHES))
+		goto nla_put_failure;
+	if (filter->action &&
+	    nla_put_u32(nlbuf, NET_MAT_RULES_FILTER_ACTION, filter->action))
+		goto nla_put_failure;
+	if (filter->min_packets &&
+	    nla_put_u64(nlbuf, NET_MAT_RULES_FILTER_MIN_PACKETS,
+			filter->min_packets))
+		goto nla_put_failure;
+	if (filter->top &&
+	    (nla_put_u32(nlbuf, NET_MAT_RULES_FILTER_TOP, filter->top) ||
+	     nla_put_u32(nlbuf, NET_MAT_RULES_FILTER_TOP_KEY,
+			 filter->top_key)))
+		goto nla_put_failure;
+
+	nla_nest_end(nlbuf, nest);
+	return 0;
+
+nla_put_failure:
+	nla_nest_cancel(nlbuf, nest);
+	return -EMSGSIZE;
+}
+
 int match_put_rule(struct nl_msg *nlbuf, struct net_mat_rule *ref)
 {
 	int err;
@@ -2717,6 +4587,158 @@ int match_put_rules(struct nl_msg *nlbuf, struct net_mat_rule *ref)
 	return 0;
 }
 
+/*
+ * match_put_rules_compact_start() - open a NET_MAT_RULES_COMPACT attribute
+ * @nlbuf: the message
+ *
+ * Rules are appended with match_put_rule_compact() and the attribute is
+ * closed with match_put_rules_compact_end().
+ *
+ * Return: the attribute or NULL if the message is full
+ */
+struct nlattr *match_put_rules_compact_start(struct nl_msg *nlbuf)
+{
+	return nla_reserve(nlbuf, NET_MAT_RULES_COMPACT, 0);
+}
+
+void match_put_rules_compact_end(struct nl_msg *nlbuf, struct nlattr *rules)
+{
+	rules->nla_len = (__u16)((char *)nlmsg_tail(nlmsg_hdr(nlbuf)) -
+				 (char *)rules);
+}
+
+/*
+ * match_put_rule_compact() - append one rule to a compact rules attribute
+ * @nlbuf: the message
+ * @rules: the attribute returned by match_put_rules_compact_start()
+ * @ref: the rule
+ *
+ * The message is left untouched if the rule does not fit.
+ *
+ * Return: 0 on success, -EMSGSIZE if the rule does not fit or -EINVAL if
+ *         it can not be represented in the compact encoding
+ */
+int match_put_rule_compact(struct nl_msg *nlbuf, struct nlattr *rules,
+			   struct net_mat_rule *ref)
+{
+	struct net_mat_compact_action act;
+	struct net_mat_compact_field fr;
+	struct net_mat_compact_rule hdr;
+	struct net_mat_compact_arg ar;
+	struct net_mat_action *a;
+	size_t len, off, sz;
+	unsigned int i, j;
+	char *data;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.table_id = ref->table_id;
+	hdr.uid = ref->uid;
+	hdr.priority = ref->priority;
+	hdr.bytes = ref->bytes;
+	hdr.packets = ref->packets;
+
+	len = sizeof(hdr);
+	for (i = 0; ref->matches && ref->matches[i].header; i++) {
+		if (match_compact_field_size(ref->matches[i].type) == SIZE_MAX)
+			return -EINVAL;
+		len += sizeof(fr);
+	}
+	if (i > USHRT_MAX)
+		return -EINVAL;
+	hdr.nmatches = (__u16)i;
+
+	for (i = 0; ref->actions && ref->actions[i].uid; i++) {
+		a = &ref->actions[i];
+		len += sizeof(act);
+		for (j = 0; a->args && a->args[j].type; j++) {
+			if (match_compact_arg_size(a->args[j].type) == SIZE_MAX)
+				return -EINVAL;
+			len += sizeof(ar);
+		}
+		if (j > USHRT_MAX)
+			return -EINVAL;
+	}
+	if (i > USHRT_MAX)
+		return -EINVAL;
+	hdr.nactions = (__u16)i;
+
+	/* the attribute length is only 16 bits wide */
+	if ((size_t)((char *)nlmsg_tail(nlmsg_hdr(nlbuf)) - (char *)rules) + len >
+	    USHRT_MAX)
+		return -EMSGSIZE;
+
+	data = nlmsg_reserve(nlbuf, len, NLA_ALIGNTO);
+	if (!data)
+		return -EMSGSIZE;
+
+	memcpy(data, &hdr, sizeof(hdr));
+	off = sizeof(hdr);
+
+	for (i = 0; i < hdr.nmatches; i++) {
+		struct net_mat_field_ref *f = &ref->matches[i];
+
+		memset(&fr, 0, sizeof(fr));
+		fr.instance = f->instance;
+		fr.header = f->header;
+		fr.field = f->field;
+		fr.mask_type = (__u8)f->mask_type;
+		fr.type = (__u8)f->type;
+
+		sz = match_compact_field_size(f->type);
+		memcpy(fr.value, &f->v, sz);
+		memcpy(fr.mask, (char *)&f->v + sz, sz);
+
+		memcpy(data + off, &fr, sizeof(fr));
+		off += sizeof(fr);
+	}
+
+	for (i = 0; i < hdr.nactions; i++) {
+		a = &ref->actions[i];
+
+		memset(&act, 0, sizeof(act));
+		act.uid = a->uid;
+		for (j = 0; a->args && a->args[j].type; j++)
+			act.nargs++;
+
+		memcpy(data + off, &act, sizeof(act));
+		off += sizeof(act);
+
+		for (j = 0; j < act.nargs; j++) {
+			memset(&ar, 0, sizeof(ar));
+			ar.type = a->args[j].type;
+
+			sz = match_compact_arg_size(ar.type);
+			memcpy(ar.value, &a->args[j].v, sz);
+
+			memcpy(data + off, &ar, sizeof(ar));
+			off += sizeof(ar);
+		}
+	}
+
+	return 0;
+}
+
+int match_put_rules_compact(struct nl_msg *nlbuf, struct net_mat_rule *ref)
+{
+	struct nlattr *rules;
+	int err, i = 0;
+
+	rules = match_put_rules_compact_start(nlbuf);
+	if (!rules)
+		return -EMSGSIZE;
+	for (i = 0; ref[i].uid; i++) {
+		err = match_put_rule_compact(nlbuf, rules, &ref[i]);
+		if (err) {
+			MAT_LOG(ERR, "Warning put rule error aborting\n");
+			return err;
+		}
+	}
+
+	match_put_rules_compact_end(nlbuf, rules);
+
+	return 0;
+}
+
 static int
 match_put_named_value(struct nl_msg *nlbuf, struct net_mat_named_value *ref)
 {
@@ -3113,6 +5135,75 @@ int match_put_ports(struct nl_msg *nlbuf,
 	return 0;
 }
 
+int match_put_event(struct nl_msg *nlbuf, struct net_mat_event *e)
+{
+	struct nlattr *event;
+
+	event = nla_nest_start(nlbuf, NET_MAT_EVENT);
+	if (!event)
+		return -EMSGSIZE;
+
+	if (nla_put_u32(nlbuf, NET_MAT_EVENT_ATTR_TYPE, e->type) ||
+	    (e->table_id &&
+	     nla_put_u32(nlbuf, NET_MAT_EVENT_ATTR_TABLE, e->table_id)) ||
+	    (e->uid &&
+	     nla_put_u32(nlbuf, NET_MAT_EVENT_ATTR_UID, e->uid)) ||
+	    (e->type == NET_MAT_EVENT_T_PORT_CHANGE &&
+	     (nla_put_u32(nlbuf, NET_MAT_EVENT_ATTR_PORT, e->port_id) ||
+	      nla_put_u32(nlbuf, NET_MAT_EVENT_ATTR_STATE, e->state)))) {
+		nla_nest_cancel(nlbuf, event);
+		return -EMSGSIZE;
+	}
+
+	nla_nest_end(nlbuf, event);
+	return 0;
+}
+
+int match_put_stats_cmd(struct nl_msg *nlbuf, struct net_mat_cmd_stats *s)
+{
+	struct nlattr *cmd;
+
+	cmd = nla_nest_start(nlbuf, NET_MAT_STATS_CMD);
+	if (!cmd)
+		return -EMSGSIZE;
+
+	if (nla_put_u32(nlbuf, NET_MAT_STATS_CMD_ATTR_CMD, s->cmd) ||
+	    nla_put_u64(nlbuf, NET_MAT_STATS_CMD_ATTR_REQUESTS, s->requests) ||
+	    nla_put_u64(nlbuf, NET_MAT_STATS_CMD_ATTR_ERRORS, s->errors) ||
+	    nla_put_u64(nlbuf, NET_MAT_STATS_CMD_ATTR_RX_BYTES, s->rx_bytes) ||
+	    nla_put_u64(nlbuf, NET_MAT_STATS_CMD_ATTR_TX_BYTES, s->tx_bytes) ||
+	    nla_put_u64(nlbuf, NET_MAT_STATS_CMD_ATTR_MULTIPART, s->multipart) ||
+	    nla_put_u64(nlbuf, NET_MAT_STATS_CMD_ATTR_LATENCY_NS,
+			s->latency_ns) ||
+	    nla_put(nlbuf, NET_MAT_STATS_CMD_ATTR_LATENCY,
+		    (int)sizeof(s->latency), s->latency)) {
+		nla_nest_cancel(nlbuf, cmd);
+		return -EMSGSIZE;
+	}
+
+	nla_nest_end(nlbuf, cmd);
+	return 0;
+}
+
+int match_put_stats_table(struct nl_msg *nlbuf, struct net_mat_table_stats *t)
+{
+	struct nlattr *table;
+
+	table = nla_nest_start(nlbuf, NET_MAT_STATS_TABLE);
+	if (!table)
+		return -EMSGSIZE;
+
+	if (nla_put_u32(nlbuf, NET_MAT_STATS_TABLE_ATTR_ID, t->table_id) ||
+	    nla_put_u32(nlbuf, NET_MAT_STATS_TABLE_ATTR_SIZE, t->size) ||
+	    nla_put_u32(nlbuf, NET_MAT_STATS_TABLE_ATTR_RULES, t->rules)) {
+		nla_nest_cancel(nlbuf, table);
+		return -EMSGSIZE;
+	}
+
+	nla_nest_end(nlbuf, table);
+	return 0;
+}
+
 #if HAVE_NLA_NEST_CANCEL == 0
 void nla_nest_cancel(struct nl_msg *msg, const struct nlattr *attr)
 {
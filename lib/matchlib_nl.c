@@ -40,6 +40,8 @@
 #include <stdarg.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <time.h>
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -69,6 +71,12 @@ struct match_msg {
 static int verbose = 0;
 static struct mat_stream *matsp = NULL;
 
+/* Encoding used for rules sent to and requested from the daemon, only
+ * switched away from NET_MAT_RULES_ENC_NLA once the daemon advertised
+ * support for it, see match_nl_set_rules_encoding().
+ */
+static unsigned int rules_encoding = NET_MAT_RULES_ENC_NLA;
+
 static struct nla_policy match_get_tables_policy[NET_MAT_MAX+1] = {
 	[NET_MAT_IDENTIFIER_TYPE]	= { .type = NLA_U32 },
 	[NET_MAT_IDENTIFIER]		= { .type = NLA_U32 },
@@ -80,8 +88,60 @@ static struct nla_policy match_get_tables_policy[NET_MAT_MAX+1] = {
 	[NET_MAT_RULES]			= { .type = NLA_NESTED },
 	[NET_MAT_RULES_ERROR]		= { .type = NLA_U32 },
 	[NET_MAT_PORTS]			= { .type = NLA_NESTED },
+	[NET_MAT_GENERATION]		= { .type = NLA_U32 },
+	[NET_MAT_EVENT_MASK]		= { .type = NLA_U32 },
+	[NET_MAT_EVENTS]		= { .type = NLA_NESTED },
+	[NET_MAT_FEATURES]		= { .type = NLA_U32 },
+	[NET_MAT_RULES_COMPACT]		= { .type = NLA_UNSPEC },
+	[NET_MAT_FLIGHT]		= { .type = NLA_UNSPEC },
+	[NET_MAT_STATS]			= { .type = NLA_NESTED },
+};
+
+/*
+ * Pipeline metadata cache
+ *
+ * The replies to the pipeline metadata commands (headers, actions, tables
+ * and graphs) only change when the daemon's pipeline generation changes.
+ * When enabled the raw reply messages are kept per command, optionally
+ * persisted to a file, and replayed through the normal reply handlers
+ * as long as the daemon reports the same generation. A generation read is
+ * trusted for MATCH_NL_CACHE_TTL_NS, long enough to cover the burst of
+ * dumps of a single operation but short enough that long running callers
+ * such as batch mode see changes made by other clients.
+ */
+#define MATCH_NL_CACHE_MAGIC 0x6d6e6c63 /* "mnlc" */
+#define MATCH_NL_CACHE_TTL_NS 1000000000ULL
+
+struct match_nl_cache_entry {
+	void *buf;
+	uint32_t len;
+};
+
+struct match_nl_cache_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t ncmds;
+	uint32_t pid;
+	uint32_t ifindex;
+	int32_t family;
+	uint32_t generation;
+	uint32_t len[NET_MAT_CMD_MAX+1];
+};
+
+struct match_nl_cache {
+	bool enabled;
+	bool valid;
+	char *path;
+	uint64_t checked_ns;	/* when the generation was last read */
+	uint32_t pid;
+	uint32_t ifindex;
+	int family;
+	uint32_t generation;
+	struct match_nl_cache_entry ent[NET_MAT_CMD_MAX+1];
 };
 
+static struct match_nl_cache cache;
+
 void match_nl_set_verbose(int new_verbose)
 {
 	verbose = new_verbose;
@@ -129,8 +189,9 @@ static struct match_msg *match_nl_wrap_nl_msg(struct nl_msg *nlmsg)
 	return msg;
 }
 
-static struct match_msg *match_nl_alloc_msg(uint8_t type, uint32_t pid,
-					    int flags, int size, int family)
+static struct match_msg *match_nl_alloc_msg_sz(uint8_t type, uint32_t pid,
+					       int flags, int size, int family,
+					       size_t max_size)
 {
 	struct match_msg *msg;
 	static uint32_t seq = 1;
@@ -139,7 +200,14 @@ static struct match_msg *match_nl_alloc_msg(uint8_t type, uint32_t pid,
 	if (!msg)
 		return NULL;
 
-	msg->nlbuf = nlmsg_alloc();
+	if (max_size)
+		msg->nlbuf = nlmsg_alloc_size(max_size);
+	else
+		msg->nlbuf = nlmsg_alloc();
+	if (!msg->nlbuf) {
+		free(msg);
+		return NULL;
+	}
 
 	msg->msg = genlmsg_put(msg->nlbuf, 0, seq, family, (int)size, flags,
 			       type, NET_MAT_GENL_VERSION);
@@ -159,6 +227,12 @@ static struct match_msg *match_nl_alloc_msg(uint8_t type, uint32_t pid,
 	return msg;
 }
 
+static struct match_msg *match_nl_alloc_msg(uint8_t type, uint32_t pid,
+					    int flags, int size, int family)
+{
+	return match_nl_alloc_msg_sz(type, pid, flags, size, family, 0);
+}
+
 
 struct nl_sock *match_nl_get_socket(void)
 {
@@ -206,8 +280,150 @@ struct match_nl_recvmsg_msg_cb_adapter_ctxt {
 	match_nl_msg_handler_fn_t handler;
 	void *handler_arg;
 	int handler_err;
+	struct match_nl_cache_entry *record;
 };
 
+static bool match_nl_cmd_is_cacheable(uint8_t cmd)
+{
+	switch (cmd) {
+	case NET_MAT_TABLE_CMD_GET_HEADERS:
+	case NET_MAT_TABLE_CMD_GET_ACTIONS:
+	case NET_MAT_TABLE_CMD_GET_TABLES:
+	case NET_MAT_TABLE_CMD_GET_HDR_GRAPH:
+	case NET_MAT_TABLE_CMD_GET_TABLE_GRAPH:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void match_nl_cache_clear_entries(void)
+{
+	int i;
+
+	for (i = 0; i <= NET_MAT_CMD_MAX; i++) {
+		free(cache.ent[i].buf);
+		cache.ent[i].buf = NULL;
+		cache.ent[i].len = 0;
+	}
+}
+
+/*
+ * match_nl_cache_record() - append a reply message to a cache entry
+ * @ent: the cache entry of the request command
+ * @nlh: the reply message
+ *
+ * Multipart replies are recorded as consecutive netlink messages.
+ */
+static int match_nl_cache_record(struct match_nl_cache_entry *ent,
+				 struct nlmsghdr *nlh)
+{
+	uint32_t len = NLMSG_ALIGN(nlh->nlmsg_len);
+	void *buf;
+
+	buf = realloc(ent->buf, ent->len + len);
+	if (!buf)
+		return -ENOMEM;
+
+	memset((char *)buf + ent->len, 0, len);
+	memcpy((char *)buf + ent->len, nlh, nlh->nlmsg_len);
+	ent->buf = buf;
+	ent->len += len;
+
+	return 0;
+}
+
+static void match_nl_cache_load(void)
+{
+	struct match_nl_cache_hdr hdr;
+	FILE *fp;
+	int i;
+
+	if (!cache.path)
+		return;
+
+	fp = fopen(cache.path, "r");
+	if (!fp)
+		return;
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    hdr.magic != MATCH_NL_CACHE_MAGIC ||
+	    hdr.version != NET_MAT_GENL_VERSION ||
+	    hdr.ncmds != NET_MAT_CMD_MAX + 1 ||
+	    hdr.pid != cache.pid || hdr.ifindex != cache.ifindex ||
+	    hdr.family != cache.family || hdr.generation != cache.generation)
+		goto out;
+
+	for (i = 0; i <= NET_MAT_CMD_MAX; i++) {
+		if (!hdr.len[i])
+			continue;
+
+		cache.ent[i].buf = malloc(hdr.len[i]);
+		if (!cache.ent[i].buf ||
+		    fread(cache.ent[i].buf, hdr.len[i], 1, fp) != 1) {
+			match_nl_cache_clear_entries();
+			goto out;
+		}
+		cache.ent[i].len = hdr.len[i];
+	}
+out:
+	fclose(fp);
+}
+
+static void match_nl_cache_save(void)
+{
+	struct match_nl_cache_hdr hdr;
+	size_t n = 0;
+	char *tmp;
+	FILE *fp;
+	int i;
+
+	if (!cache.path)
+		return;
+
+	n = strlen(cache.path) + sizeof(".tmp");
+	tmp = malloc(n);
+	if (!tmp)
+		return;
+	snprintf(tmp, n, "%s.tmp", cache.path);
+
+	/* The cache is an optimization, failing to persist it is silent */
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		free(tmp);
+		return;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = MATCH_NL_CACHE_MAGIC;
+	hdr.version = NET_MAT_GENL_VERSION;
+	hdr.ncmds = NET_MAT_CMD_MAX + 1;
+	hdr.pid = cache.pid;
+	hdr.ifindex = cache.ifindex;
+	hdr.family = cache.family;
+	hdr.generation = cache.generation;
+	for (i = 0; i <= NET_MAT_CMD_MAX; i++)
+		hdr.len[i] = cache.ent[i].len;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		goto fail;
+
+	for (i = 0; i <= NET_MAT_CMD_MAX; i++) {
+		if (cache.ent[i].len &&
+		    fwrite(cache.ent[i].buf, cache.ent[i].len, 1, fp) != 1)
+			goto fail;
+	}
+
+	if (fclose(fp) || rename(tmp, cache.path))
+		unlink(tmp);
+	free(tmp);
+	return;
+fail:
+	fclose(fp);
+	unlink(tmp);
+	free(tmp);
+}
+
 static int match_nl_recvmsg_msg_cb_adapter(struct nl_msg *nlmsg, void *arg)
 {
 	struct match_nl_recvmsg_msg_cb_adapter_ctxt *ctxt = arg;
@@ -277,6 +493,9 @@ static int match_nl_recvmsg_msg_cb_adapter(struct nl_msg *nlmsg, void *arg)
 	 */
 	nlmsg_get(nlmsg);
 
+	if (ctxt->record && match_nl_cache_record(ctxt->record, nlmsg_hdr(nlmsg)))
+		ctxt->record = NULL;
+
 	err = ctxt->handler(msg, ctxt->handler_arg);
 	ctxt->handler_err = err;
 
@@ -309,6 +528,25 @@ static int match_nl_recvmsg_err_cb(struct sockaddr_nl *nla __unused,
 }
 
 
+static int match_nl_put_identifier(struct match_msg *msg, unsigned int ifindex)
+{
+	if (nla_put_u32(msg->nlbuf,
+			NET_MAT_IDENTIFIER_TYPE,
+			NET_MAT_IDENTIFIER_IFINDEX)
+	    || nla_put_u32(msg->nlbuf, NET_MAT_IDENTIFIER, ifindex)) {
+		MAT_LOG(ERR, "Error: Identifier put failed\n");
+		return -EMSGSIZE;
+	}
+
+	return 0;
+}
+
+
+static int
+match_nl_cache_replay(struct nl_sock *nsd, uint8_t cmd, uint32_t pid,
+		      unsigned int ifindex, int family,
+		      match_nl_msg_handler_fn_t handler, void *handler_arg);
+
 static int
 match_nl_send_and_recv(struct nl_sock *nsd, uint8_t cmd, uint32_t pid,
 		       unsigned int ifindex, int family,
@@ -320,20 +558,28 @@ match_nl_send_and_recv(struct nl_sock *nsd, uint8_t cmd, uint32_t pid,
 	sigset_t bs;
 	int err;
 	struct match_nl_recvmsg_msg_cb_adapter_ctxt adapter_ctxt;
+	struct match_nl_cache_entry *record = NULL;
 	int nlerr;
 
 
+	if (cache.enabled && !composer && match_nl_cmd_is_cacheable(cmd)) {
+		err = match_nl_cache_replay(nsd, cmd, pid, ifindex, family,
+					    handler, handler_arg);
+		if (err != -ENOENT)
+			return err;
+
+		/* cache miss, record the reply if the cache is still valid */
+		if (cache.valid)
+			record = &cache.ent[cmd];
+	}
+
 	msg = match_nl_alloc_msg(cmd, pid, NLM_F_REQUEST|NLM_F_ACK, 0, family);
 	if (!msg) {
 		MAT_LOG(ERR, "Error: Allocation failure\n");
 		return -ENOMEM;
 	}
 
-	if (nla_put_u32(msg->nlbuf,
-			NET_MAT_IDENTIFIER_TYPE,
-			NET_MAT_IDENTIFIER_IFINDEX)
-	    || nla_put_u32(msg->nlbuf, NET_MAT_IDENTIFIER, ifindex)) {
-		MAT_LOG(ERR, "Error: Identifier put failed\n");
+	if (match_nl_put_identifier(msg, ifindex)) {
 		match_nl_free_msg(msg);
 		return -EMSGSIZE;
 	}
@@ -359,6 +605,7 @@ match_nl_send_and_recv(struct nl_sock *nsd, uint8_t cmd, uint32_t pid,
 	adapter_ctxt.handler = handler;
 	adapter_ctxt.handler_arg = handler_arg;
 	adapter_ctxt.handler_err = 0;
+	adapter_ctxt.record = record;
 
 	nlerr = nl_socket_modify_cb(nsd, NL_CB_VALID, NL_CB_CUSTOM,
 				    match_nl_recvmsg_msg_cb_adapter, &adapter_ctxt);
@@ -380,6 +627,18 @@ match_nl_send_and_recv(struct nl_sock *nsd, uint8_t cmd, uint32_t pid,
 
 	sigprocmask(SIG_BLOCK, &bs, NULL);
 
+	if (record) {
+		/* only complete replies are worth keeping */
+		if (NLE_SUCCESS != nlerr || adapter_ctxt.handler_err ||
+		    adapter_ctxt.record != record) {
+			free(record->buf);
+			record->buf = NULL;
+			record->len = 0;
+		} else {
+			match_nl_cache_save();
+		}
+	}
+
 	return adapter_ctxt.handler_err;
 }
 
@@ -424,22 +683,23 @@ static int match_nl_table_cmd_to_type(struct mat_stream *matsp __unused,
 }
 
 
-struct get_headers_handler_args {
-	struct net_mat_hdr *hdrs;
+struct get_generation_handler_args {
+	uint32_t generation;
+	uint32_t features;
+	bool valid;
 };
 
-static int handle_get_headers(struct match_msg *msg, void *handler_arg)
+static int handle_get_generation(struct match_msg *msg, void *handler_arg)
 {
-	struct get_headers_handler_args *args = handler_arg;
+	struct get_generation_handler_args *args = handler_arg;
 	struct nlmsghdr *nlh;
 	struct nlattr *tb[NET_MAT_MAX+1];
-	struct net_mat_hdr *hdrs = NULL;
 	int err;
 
 	if (!handler_arg)
 		return -EINVAL;
 
-	args->hdrs = NULL;
+	args->valid = false;
 
 	if (!msg)
 		return -EINVAL;
@@ -449,241 +709,456 @@ static int handle_get_headers(struct match_msg *msg, void *handler_arg)
 	err = genlmsg_parse(nlh, 0, tb,
 			    NET_MAT_MAX, match_get_tables_policy);
 	if (err < 0) {
-		MAT_LOG(ERR, "Warning: unable to parse get headers msg\n");
+		MAT_LOG(ERR, "Warning: unable to parse get generation msg\n");
 		goto out;
 	}
 
 	if (match_nl_table_cmd_to_type(matsp,
-				       NET_MAT_HEADERS, tb))
+				       NET_MAT_GENERATION, tb))
 		goto out;
 
-	if (tb[NET_MAT_HEADERS])
-		match_get_headers(matsp,
-				  tb[NET_MAT_HEADERS], &hdrs);
-
-	args->hdrs = hdrs;
+	args->generation = nla_get_u32(tb[NET_MAT_GENERATION]);
+	if (tb[NET_MAT_FEATURES])
+		args->features = nla_get_u32(tb[NET_MAT_FEATURES]);
+	args->valid = true;
 out:
 	match_nl_free_msg(msg);
 	return 0;
 }
 
-struct net_mat_hdr *match_nl_get_headers(struct nl_sock *nsd, uint32_t pid,
-					 unsigned int ifindex, int family)
+int match_nl_get_generation(struct nl_sock *nsd, uint32_t pid,
+			    unsigned int ifindex, int family,
+			    uint32_t *generation)
 {
-	uint8_t cmd = NET_MAT_TABLE_CMD_GET_HEADERS;
-	struct get_headers_handler_args args = {.hdrs = NULL};
+	uint8_t cmd = NET_MAT_TABLE_CMD_GET_GENERATION;
+	struct get_generation_handler_args args = {.valid = false};
 	int err;
 
 
 	err = match_nl_send_and_recv(nsd, cmd, pid, ifindex, family,
 				     /*composer*/ NULL, NULL,
-				     handle_get_headers, &args);
-	/* TODO handle error propagated from handler */
-	(void)err;
+				     handle_get_generation, &args);
+	if (err)
+		return -abs(err);
 
-	return args.hdrs;
+	if (!args.valid)
+		return -ENOMSG;
+
+	*generation = args.generation;
+	return 0;
 }
 
+/*
+ * match_nl_get_features() - query the optional features of the daemon
+ * @nsd: netlink socket connected to the daemon
+ * @pid: pid of the daemon
+ * @ifindex: interface identifier
+ * @family: netlink family of the daemon
+ * @features: set to the NET_MAT_FEATURE_* bits the daemon supports
+ *
+ * Features are reported along with the pipeline generation, a daemon
+ * that predates them reports none.
+ *
+ * Return: 0 on success or a negative error code
+ */
+int match_nl_get_features(struct nl_sock *nsd, uint32_t pid,
+			  unsigned int ifindex, int family,
+			  uint32_t *features)
+{
+	uint8_t cmd = NET_MAT_TABLE_CMD_GET_GENERATION;
+	struct get_generation_handler_args args = {.valid = false};
+	int err;
+
 
-struct get_actions_handler_args {
-	struct net_mat_action *actions;
+	err = match_nl_send_and_recv(nsd, cmd, pid, ifindex, family,
+				     /*composer*/ NULL, NULL,
+				     handle_get_generation, &args);
+	if (err)
+		return -abs(err);
+
+	if (!args.valid)
+		return -ENOMSG;
+
+	*features = args.features;
+	return 0;
+}
+
+struct get_flight_handler_args {
+	struct mat_flight_event *events;
+	unsigned int count;
+	int err;
 };
 
-static int handle_get_actions(struct match_msg *msg, void *handler_arg)
+/* A multipart reply carries a slice of the events per part, append them */
+static int handle_get_flight(struct match_msg *msg, void *handler_arg)
 {
-	struct get_actions_handler_args *args = handler_arg;
-	struct nlmsghdr *nlh;
+	struct get_flight_handler_args *args = handler_arg;
+	struct mat_flight_event *events;
 	struct nlattr *tb[NET_MAT_MAX+1];
-	struct net_mat_action *actions = NULL;
+	unsigned int n;
 	int err;
 
-
 	if (!handler_arg)
 		return -EINVAL;
 
-	args->actions = NULL;
-
 	if (!msg)
 		return -EINVAL;
 
-	nlh = msg->msg;
-	err = genlmsg_parse(nlh, 0, tb,
-			    NET_MAT_MAX, match_get_tables_policy);
+	err = genlmsg_parse(msg->msg, 0, tb, NET_MAT_MAX,
+			    match_get_tables_policy);
 	if (err < 0) {
-		MAT_LOG(ERR, "Warning: unable to parse get actions msg\n");
+		MAT_LOG(ERR, "Warning: unable to parse get flight msg\n");
 		goto out;
 	}
 
-	if (match_nl_table_cmd_to_type(matsp,
-				       NET_MAT_ACTIONS, tb))
+	if (match_nl_table_cmd_to_type(matsp, NET_MAT_FLIGHT, tb))
 		goto out;
 
-	if (tb[NET_MAT_ACTIONS])
-		match_get_actions(matsp,
-				  tb[NET_MAT_ACTIONS], &actions);
-	args->actions = actions;
+	n = (unsigned int)nla_len(tb[NET_MAT_FLIGHT]) / sizeof(*events);
+	events = realloc(args->events,
+			 (args->count + n + 1) * sizeof(*events));
+	if (!events) {
+		args->err = -ENOMEM;
+		goto out;
+	}
+
+	memcpy(&events[args->count], nla_data(tb[NET_MAT_FLIGHT]),
+	       n * sizeof(*events));
+	args->events = events;
+	args->count += n;
 out:
 	match_nl_free_msg(msg);
 	return 0;
 }
 
-struct net_mat_action *match_nl_get_actions(struct nl_sock *nsd, uint32_t pid,
-					    unsigned int ifindex, int family)
+/*
+ * match_nl_get_flight() - fetch the flight recorder of the daemon
+ * @nsd: netlink socket connected to the daemon
+ * @pid: pid of the daemon
+ * @ifindex: interface identifier
+ * @family: netlink family of the daemon
+ * @events: set to a malloc'ed array of events, to be freed by the caller
+ * @count: set to the number of events
+ *
+ * Events are returned in no particular order, see mat_flight_sort().
+ *
+ * Return: 0 on success or a negative error code
+ */
+int match_nl_get_flight(struct nl_sock *nsd, uint32_t pid,
+			unsigned int ifindex, int family,
+			struct mat_flight_event **events, unsigned int *count)
 {
-	uint8_t cmd = NET_MAT_TABLE_CMD_GET_ACTIONS;
-	struct get_actions_handler_args args = {.actions = NULL};
+	struct get_flight_handler_args args = {.events = NULL, .count = 0};
 	int err;
 
+	err = match_nl_send_and_recv(nsd, NET_MAT_DAEMON_CMD_GET_FLIGHT, pid,
+				     ifindex, family, NULL, NULL,
+				     handle_get_flight, &args);
+	if (!err)
+		err = args.err;
+	if (!err && !args.events)
+		err = -ENOMSG;
+	if (err) {
+		free(args.events);
+		return -abs(err);
+	}
 
-	err = match_nl_send_and_recv(nsd, cmd, pid, ifindex, family,
-				     /*composer*/ NULL, NULL,
-				     handle_get_actions, &args);
-	/* TODO handle error propagated from handler */
-	(void)err;
-
-	return args.actions;
+	*events = args.events;
+	*count = args.count;
+	return 0;
 }
 
-
-struct get_tables_handler_args {
-	struct net_mat_tbl *tables;
+struct get_stats_handler_args {
+	struct net_mat_stats stats;
+	bool valid;
+	int err;
 };
 
-static int handle_get_tables(struct match_msg *msg, void *handler_arg)
+/* A multipart reply carries a slice of the entries per part, append them */
+static int handle_get_stats(struct match_msg *msg, void *handler_arg)
 {
-	struct get_tables_handler_args *args = handler_arg;
-	struct nlmsghdr *nlh;
+	struct get_stats_handler_args *args = handler_arg;
 	struct nlattr *tb[NET_MAT_MAX+1];
-	struct net_mat_tbl *tables = NULL;
 	int err;
 
 	if (!handler_arg)
 		return -EINVAL;
 
-	args->tables = NULL;
-
 	if (!msg)
 		return -EINVAL;
 
-	nlh = msg->msg;
-
-	err = genlmsg_parse(nlh, 0, tb,
-			    NET_MAT_MAX, match_get_tables_policy);
+	err = genlmsg_parse(msg->msg, 0, tb, NET_MAT_MAX,
+			    match_get_tables_policy);
 	if (err < 0) {
-		MAT_LOG(ERR, "Warning: unable to parse get tables msg\n");
+		MAT_LOG(ERR, "Warning: unable to parse get stats msg\n");
 		goto out;
 	}
 
-	if (match_nl_table_cmd_to_type(matsp,
-				       NET_MAT_TABLES, tb))
+	if (match_nl_table_cmd_to_type(matsp, NET_MAT_STATS, tb))
 		goto out;
 
-	if (tb[NET_MAT_TABLES])
-		match_get_tables(matsp,
-				 tb[NET_MAT_TABLES], &tables);
-	args->tables = tables;
+	err = match_get_stats(matsp, tb[NET_MAT_STATS], &args->stats);
+	if (err && !args->err)
+		args->err = err;
+	args->valid = true;
 out:
 	match_nl_free_msg(msg);
 	return 0;
 }
 
-struct net_mat_tbl *match_nl_get_tables(struct nl_sock *nsd, uint32_t pid,
-					unsigned int ifindex, int family)
+/*
+ * match_nl_get_stats() - fetch the counters of the daemon
+ * @nsd: netlink socket connected to the daemon
+ * @pid: pid of the daemon
+ * @ifindex: interface identifier
+ * @family: netlink family of the daemon
+ * @stats: filled with the counters, to be released by match_free_stats()
+ *
+ * Return: 0 on success or a negative error code
+ */
+int match_nl_get_stats(struct nl_sock *nsd, uint32_t pid,
+		       unsigned int ifindex, int family,
+		       struct net_mat_stats *stats)
 {
-	uint8_t cmd = NET_MAT_TABLE_CMD_GET_TABLES;
-	struct get_tables_handler_args args = {.tables = NULL};
+	struct get_stats_handler_args args;
 	int err;
 
+	memset(&args, 0, sizeof(args));
+	err = match_nl_send_and_recv(nsd, NET_MAT_DAEMON_CMD_GET_STATS, pid,
+				     ifindex, family, NULL, NULL,
+				     handle_get_stats, &args);
+	if (!err)
+		err = args.err;
+	if (!err && !args.valid)
+		err = -ENOMSG;
+	if (err) {
+		match_free_stats(&args.stats);
+		return -abs(err);
+	}
 
-	err = match_nl_send_and_recv(nsd, cmd, pid, ifindex, family,
-				     /*composer*/ NULL, NULL,
-				     handle_get_tables, &args);
-	/* TODO handle error propagated from handler */
-	(void)err;
-
-	return args.tables;
+	*stats = args.stats;
+	return 0;
 }
 
-
-struct get_hdr_graph_handler_args {
-	struct net_mat_hdr_node *hdr_nodes;
-};
-
-static int handle_get_hdr_graph(struct match_msg *msg, void *handler_arg)
+/*
+ * match_nl_set_rules_encoding() - select the encoding used for rules
+ * @nsd: netlink socket connected to the daemon
+ * @pid: pid of the daemon
+ * @ifindex: interface identifier
+ * @family: netlink family of the daemon
+ * @encoding: NET_MAT_RULES_ENC_NLA or NET_MAT_RULES_ENC_COMPACT
+ *
+ * The compact encoding is only selected if the daemon advertises
+ * NET_MAT_FEATURE_RULES_COMPACT, otherwise the current encoding is kept.
+ *
+ * Return: 0 on success, -EOPNOTSUPP if the daemon does not support the
+ *         encoding or another negative error code
+ */
+int match_nl_set_rules_encoding(struct nl_sock *nsd, uint32_t pid,
+				unsigned int ifindex, int family,
+				unsigned int encoding)
 {
-	struct get_hdr_graph_handler_args *args = handler_arg;
-	struct nlmsghdr *nlh;
-	struct nlattr *tb[NET_MAT_MAX+1];
-	struct net_mat_hdr_node *hdr_nodes = NULL;
+	uint32_t features = 0;
 	int err;
 
-	if (!handler_arg)
-		return -EINVAL;
-
-	args->hdr_nodes = NULL;
+	switch (encoding) {
+	case NET_MAT_RULES_ENC_NLA:
+		break;
+	case NET_MAT_RULES_ENC_COMPACT:
+		err = match_nl_get_features(nsd, pid, ifindex, family,
+					    &features);
+		if (err)
+			return err;
 
-	if (!msg)
+		if (!(features & NET_MAT_FEATURE_RULES_COMPACT))
+			return -EOPNOTSUPP;
+		break;
+	default:
 		return -EINVAL;
-
-	nlh = msg->msg;
-
-	err = genlmsg_parse(nlh, 0, tb,
-			    NET_MAT_MAX, match_get_tables_policy);
-	if (err < 0) {
-		MAT_LOG(ERR, "Warning: unable to parse get header graph msg\n");
-		goto out;
 	}
 
-	if (match_nl_table_cmd_to_type(matsp,
-				       NET_MAT_HEADER_GRAPH, tb))
-		goto out;
-
-	if (tb[NET_MAT_HEADER_GRAPH])
-		match_get_hdrs_graph(matsp, verbose,
-				     tb[NET_MAT_HEADER_GRAPH],
-				     &hdr_nodes);
-	args->hdr_nodes = hdr_nodes;
-out:
-	match_nl_free_msg(msg);
+	rules_encoding = encoding;
 	return 0;
 }
 
-struct net_mat_hdr_node *match_nl_get_hdr_graph(struct nl_sock *nsd,
-						uint32_t pid,
-						unsigned int ifindex,
-						int family)
+unsigned int match_nl_get_rules_encoding(void)
 {
-	uint8_t cmd = NET_MAT_TABLE_CMD_GET_HDR_GRAPH;
-	struct get_hdr_graph_handler_args args = {.hdr_nodes = NULL};
-	int err;
+	return rules_encoding;
+}
 
+/*
+ * match_nl_put_rules_start() - open the rules attribute in the current
+ *                              encoding
+ */
+static struct nlattr *match_nl_put_rules_start(struct nl_msg *nlbuf)
+{
+	if (rules_encoding == NET_MAT_RULES_ENC_COMPACT)
+		return match_put_rules_compact_start(nlbuf);
+	return nla_nest_start(nlbuf, NET_MAT_RULES);
+}
 
-	err = match_nl_send_and_recv(nsd, cmd, pid, ifindex, family,
-				     /*composer*/ NULL, NULL,
-				     handle_get_hdr_graph, &args);
-	/* TODO handle error propagated from handler */
-	(void)err;
+static int match_nl_put_rule(struct nl_msg *nlbuf, struct nlattr *rules,
+			     struct net_mat_rule *rule)
+{
+	if (rules_encoding == NET_MAT_RULES_ENC_COMPACT)
+		return match_put_rule_compact(nlbuf, rules, rule);
+	return match_put_rule(nlbuf, rule);
+}
 
-	return args.hdr_nodes;
+static void match_nl_put_rules_end(struct nl_msg *nlbuf, struct nlattr *rules)
+{
+	if (rules_encoding == NET_MAT_RULES_ENC_COMPACT)
+		match_put_rules_compact_end(nlbuf, rules);
+	else
+		nla_nest_end(nlbuf, rules);
 }
 
+static uint64_t match_nl_cache_now(void)
+{
+	struct timespec ts;
 
-struct get_tbl_graph_handler_args {
-	struct net_mat_tbl_node *tbl_nodes;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * match_nl_cache_validate() - check the cache against the daemon generation
+ *
+ * Entries are kept only while the daemon reports the same pipeline
+ * generation they were recorded with. On the first check after the cache
+ * is enabled the persistent file, if any, is loaded. The generation is
+ * read again for another daemon, once the cache was invalidated or once
+ * the last read is older than MATCH_NL_CACHE_TTL_NS, so the burst of
+ * cached requests of one operation costs a single round trip.
+ *
+ * Return: 0 if the cache may be used, or a negative error code if the
+ *         daemon does not report a generation
+ */
+static int match_nl_cache_validate(struct nl_sock *nsd, uint32_t pid,
+				   unsigned int ifindex, int family)
+{
+	uint64_t now = match_nl_cache_now();
+	uint32_t generation;
+	int err;
+
+	if (cache.valid && cache.pid == pid && cache.ifindex == ifindex &&
+	    cache.family == family &&
+	    now - cache.checked_ns < MATCH_NL_CACHE_TTL_NS)
+		return 0;
+
+	err = match_nl_get_generation(nsd, pid, ifindex, family, &generation);
+	if (err) {
+		cache.valid = false;
+		match_nl_cache_clear_entries();
+		return err;
+	}
+
+	cache.checked_ns = now;
+	if (cache.valid && cache.pid == pid && cache.ifindex == ifindex &&
+	    cache.family == family && cache.generation == generation)
+		return 0;
+
+	match_nl_cache_clear_entries();
+	cache.pid = pid;
+	cache.ifindex = ifindex;
+	cache.family = family;
+	cache.generation = generation;
+	cache.valid = true;
+
+	match_nl_cache_load();
+	return 0;
+}
+
+static int
+match_nl_cache_replay(struct nl_sock *nsd, uint8_t cmd, uint32_t pid,
+		      unsigned int ifindex, int family,
+		      match_nl_msg_handler_fn_t handler, void *handler_arg)
+{
+	struct match_nl_cache_entry *ent = &cache.ent[cmd];
+	struct nlmsghdr *nlh;
+	struct nl_msg *nlmsg;
+	struct match_msg *msg;
+	int rem, err = 0;
+
+	/* a daemon without generation support can not be cached */
+	if (match_nl_cache_validate(nsd, pid, ifindex, family)) {
+		match_nl_cache_disable();
+		return -ENOENT;
+	}
+
+	if (!ent->len)
+		return -ENOENT;
+
+	rem = (int)ent->len;
+	for (nlh = ent->buf; nlmsg_ok(nlh, rem); nlh = nlmsg_next(nlh, &rem)) {
+		nlmsg = nlmsg_convert(nlh);
+		if (!nlmsg)
+			return -ENOMEM;
+
+		msg = match_nl_wrap_nl_msg(nlmsg);
+		if (!msg) {
+			nlmsg_free(nlmsg);
+			return -ENOMEM;
+		}
+
+		/* the handler owns msg and frees it */
+		err = handler(msg, handler_arg);
+		if (err)
+			break;
+	}
+
+	return err;
+}
+
+int match_nl_cache_enable(const char *path)
+{
+	match_nl_cache_disable();
+
+	if (path) {
+		cache.path = strdup(path);
+		if (!cache.path)
+			return -ENOMEM;
+	}
+
+	cache.enabled = true;
+	return 0;
+}
+
+void match_nl_cache_disable(void)
+{
+	match_nl_cache_clear_entries();
+	free(cache.path);
+	cache.path = NULL;
+	cache.valid = false;
+	cache.enabled = false;
+}
+
+void match_nl_cache_invalidate(void)
+{
+	match_nl_cache_clear_entries();
+	cache.valid = false;
+
+	if (cache.path)
+		unlink(cache.path);
+}
+
+
+struct get_headers_handler_args {
+	struct net_mat_hdr *hdrs;
 };
 
-static int handle_get_tbl_graph(struct match_msg *msg, void *handler_arg)
+static int handle_get_headers(struct match_msg *msg, void *handler_arg)
 {
-	struct get_tbl_graph_handler_args *args = handler_arg;
+	struct get_headers_handler_args *args = handler_arg;
 	struct nlmsghdr *nlh;
 	struct nlattr *tb[NET_MAT_MAX+1];
-	struct net_mat_tbl_node *tbl_nodes = NULL;
+	struct net_mat_hdr *hdrs = NULL;
 	int err;
 
 	if (!handler_arg)
 		return -EINVAL;
 
-	args->tbl_nodes = NULL;
+	args->hdrs = NULL;
 
 	if (!msg)
 		return -EINVAL;
@@ -693,69 +1168,1356 @@ static int handle_get_tbl_graph(struct match_msg *msg, void *handler_arg)
 	err = genlmsg_parse(nlh, 0, tb,
 			    NET_MAT_MAX, match_get_tables_policy);
 	if (err < 0) {
-		MAT_LOG(ERR, "Warning: unable to parse get table graph msg\n");
+		MAT_LOG(ERR, "Warning: unable to parse get headers msg\n");
 		goto out;
 	}
 
 	if (match_nl_table_cmd_to_type(matsp,
-				       NET_MAT_TABLE_GRAPH, tb))
+				       NET_MAT_HEADERS, tb))
+		goto out;
+
+	if (tb[NET_MAT_HEADERS])
+		match_get_headers(matsp,
+				  tb[NET_MAT_HEADERS], &hdrs);
+
+	args->hdrs = hdrs;
+out:
+	match_nl_free_msg(msg);
+	return 0;
+}
+
+struct net_mat_hdr *match_nl_get_headers(struct nl_sock *nsd, uint32_t pid,
+					 unsigned int ifindex, int family)
+{
+	uint8_t cmd = NET_MAT_TABLE_CMD_GET_HEADERS;
+	struct get_headers_handler_args args = {.hdrs = NULL};
+	int err;
+
+
+	err = match_nl_send_and_recv(nsd, cmd, pid, ifindex, family,
+				     /*composer*/ NULL, NULL,
+				     handle_get_headers, &args);
+	/* TODO handle error propagated from handler */
+	(void)err;
+
+	return args.hdrs;
+}
+
+
+struct get_actions_handler_args {
+	struct net_mat_action *actions;
+};
+
+static int handle_get_actions(struct match_msg *msg, void *handler_arg)
+{
+	struct get_actions_handler_args *args = handler_arg;
+	struct nlmsghdr *nlh;
+	struct nlattr *tb[NET_MAT_MAX+1];
+	struct net_mat_action *actions = NULL;
+	int err;
+
+
+	if (!handler_arg)
+		return -EINVAL;
+
+	args->actions = NULL;
+
+	if (!msg)
+		return -EINVAL;
+
+	nlh = msg->msg;
+	err = genlmsg_parse(nlh, 0, tb,
+			    NET_MAT_MAX, match_get_tables_policy);
+	if (err < 0) {
+		MAT_LOG(ERR, "Warning: unable to parse get actions msg\n");
+		goto out;
+	}
+
+	if (match_nl_table_cmd_to_type(matsp,
+				       NET_MAT_ACTIONS, tb))
+		goto out;
+
+	if (tb[NET_MAT_ACTIONS])
+		match_get_actions(matsp,
+				  tb[NET_MAT_ACTIONS], &actions);
+	args->actions = actions;
+out:
+	match_nl_free_msg(msg);
+	return 0;
+}
+
+struct net_mat_action *match_nl_get_actions(struct nl_sock *nsd, uint32_t pid,
+					    unsigned int ifindex, int family)
+{
+	uint8_t cmd = NET_MAT_TABLE_CMD_GET_ACTIONS;
+	struct get_actions_handler_args args = {.actions = NULL};
+	int err;
+
+
+	err = match_nl_send_and_recv(nsd, cmd, pid, ifindex, family,
+				     /*composer*/ NULL, NULL,
+				     handle_get_actions, &args);
+	/* TODO handle error propagated from handler */
+	(void)err;
+
+	return args.actions;
+}
+
+
+struct get_tables_handler_args {
+	struct net_mat_tbl *tables;
+};
+
+static int handle_get_tables(struct match_msg *msg, void *handler_arg)
+{
+	struct get_tables_handler_args *args = handler_arg;
+	struct nlmsghdr *nlh;
+	struct nlattr *tb[NET_MAT_MAX+1];
+	struct net_mat_tbl *tables = NULL;
+	int err;
+
+	if (!handler_arg)
+		return -EINVAL;
+
+	args->tables = NULL;
+
+	if (!msg)
+		return -EINVAL;
+
+	nlh = msg->msg;
+
+	err = genlmsg_parse(nlh, 0, tb,
+			    NET_MAT_MAX, match_get_tables_policy);
+	if (err < 0) {
+		MAT_LOG(ERR, "Warning: unable to parse get tables msg\n");
+		goto out;
+	}
+
+	if (match_nl_table_cmd_to_type(matsp,
+				       NET_MAT_TABLES, tb))
+		goto out;
+
+	if (tb[NET_MAT_TABLES])
+		match_get_tables(matsp,
+				 tb[NET_MAT_TABLES], &tables);
+	args->tables = tables;
+out:
+	match_nl_free_msg(msg);
+	return 0;
+}
+
+struct net_mat_tbl *match_nl_get_tables(struct nl_sock *nsd, uint32_t pid,
+					unsigned int ifindex, int family)
+{
+	uint8_t cmd = NET_MAT_TABLE_CMD_GET_TABLES;
+	struct get_tables_handler_args args = {.tables = NULL};
+	int err;
+
+
+	err = match_nl_send_and_recv(nsd, cmd, pid, ifindex, family,
+				     /*composer*/ NULL, NULL,
+				     handle_get_tables, &args);
+	/* TODO handle error propagated from handler */
+	(void)err;
+
+	return args.tables;
+}
+
+
+struct get_hdr_graph_handler_args {
+	struct net_mat_hdr_node *hdr_nodes;
+};
+
+static int handle_get_hdr_graph(struct match_msg *msg, void *handler_arg)
+{
+	struct get_hdr_graph_handler_args *args = handler_arg;
+	struct nlmsghdr *nlh;
+	struct nlattr *tb[NET_MAT_MAX+1];
+	struct net_mat_hdr_node *hdr_nodes = NULL;
+	int err;
+
+	if (!handler_arg)
+		return -EINVAL;
+
+	args->hdr_nodes = NULL;
+
+	if (!msg)
+		return -EINVAL;
+
+	nlh = msg->msg;
+
+	err = genlmsg_parse(nlh, 0, tb,
+			    NET_MAT_MAX, match_get_tables_policy);
+	if (err < 0) {
+		MAT_LOG(ERR, "Warning: unable to parse get header graph msg\n");
+		goto out;
+	}
+
+	if (match_nl_table_cmd_to_type(matsp,
+				       NET_MAT_HEADER_GRAPH, tb))
 		goto out;
 
-	if (tb[NET_MAT_TABLE_GRAPH])
-		match_get_tbl_graph(matsp, verbose,
-				    tb[NET_MAT_TABLE_GRAPH], &tbl_nodes);
-	args->tbl_nodes = tbl_nodes;
-out:
-	match_nl_free_msg(msg);
-	return 0;
-}
+	if (tb[NET_MAT_HEADER_GRAPH])
+		match_get_hdrs_graph(matsp, verbose,
+				     tb[NET_MAT_HEADER_GRAPH],
+				     &hdr_nodes);
+	args->hdr_nodes = hdr_nodes;
+out:
+	match_nl_free_msg(msg);
+	return 0;
+}
+
+struct net_mat_hdr_node *match_nl_get_hdr_graph(struct nl_sock *nsd,
+						uint32_t pid,
+						unsigned int ifindex,
+						int family)
+{
+	uint8_t cmd = NET_MAT_TABLE_CMD_GET_HDR_GRAPH;
+	struct get_hdr_graph_handler_args args = {.hdr_nodes = NULL};
+	int err;
+
+
+	err = match_nl_send_and_recv(nsd, cmd, pid, ifindex, family,
+				     /*composer*/ NULL, NULL,
+				     handle_get_hdr_graph, &args);
+	/* TODO handle error propagated from handler */
+	(void)err;
+
+	return args.hdr_nodes;
+}
+
+
+struct get_tbl_graph_handler_args {
+	struct net_mat_tbl_node *tbl_nodes;
+};
+
+static int handle_get_tbl_graph(struct match_msg *msg, void *handler_arg)
+{
+	struct get_tbl_graph_handler_args *args = handler_arg;
+	struct nlmsghdr *nlh;
+	struct nlattr *tb[NET_MAT_MAX+1];
+	struct net_mat_tbl_node *tbl_nodes = NULL;
+	int err;
+
+	if (!handler_arg)
+		return -EINVAL;
+
+	args->tbl_nodes = NULL;
+
+	if (!msg)
+		return -EINVAL;
+
+	nlh = msg->msg;
+
+	err = genlmsg_parse(nlh, 0, tb,
+			    NET_MAT_MAX, match_get_tables_policy);
+	if (err < 0) {
+		MAT_LOG(ERR, "Warning: unable to parse get table graph msg\n");
+		goto out;
+	}
+
+	if (match_nl_table_cmd_to_type(matsp,
+				       NET_MAT_TABLE_GRAPH, tb))
+		goto out;
+
+	if (tb[NET_MAT_TABLE_GRAPH])
+		match_get_tbl_graph(matsp, verbose,
+				    tb[NET_MAT_TABLE_GRAPH], &tbl_nodes);
+	args->tbl_nodes = tbl_nodes;
+out:
+	match_nl_free_msg(msg);
+	return 0;
+}
+
+struct net_mat_tbl_node *match_nl_get_tbl_graph(struct nl_sock *nsd,
+						uint32_t pid,
+						unsigned int ifindex,
+						int family)
+{
+	uint8_t cmd = NET_MAT_TABLE_CMD_GET_TABLE_GRAPH;
+	struct get_tbl_graph_handler_args args = {.tbl_nodes = NULL};
+	int err;
+
+
+	err = match_nl_send_and_recv(nsd, cmd, pid, ifindex, family,
+				     /*composer*/ NULL, NULL,
+				     handle_get_tbl_graph, &args);
+	/* TODO handle error propagated from handler */
+	(void)err;
+
+	return args.tbl_nodes;
+}
+
+
+static int compose_set_del_rules(struct match_msg *msg, void *arg)
+{
+	struct net_mat_rule *rule = arg;
+	int err = 0;
+	struct nlattr *rules;
+
+
+	err = match_put_rule_error(msg->nlbuf, NET_MAT_RULES_ERROR_ABORT);
+	if (err) {
+		return err;
+	}
+
+	rules = match_nl_put_rules_start(msg->nlbuf);
+	if (!rules) {
+		return -EMSGSIZE;
+	}
+	match_nl_put_rule(msg->nlbuf, rules, rule);
+	match_nl_put_rules_end(msg->nlbuf, rules);
+
+	return 0;
+}
+
+static int handle_set_del_rules(struct match_msg *msg, void *handler_arg __unused)
+{
+	struct nlmsghdr *nlh;
+	struct nlattr *tb[NET_MAT_MAX+1];
+	int err = 0;
+
+
+	if (!msg)
+		return -EINVAL;
+
+	nlh = msg->msg;
+	err = genlmsg_parse(nlh, 0, tb, NET_MAT_MAX, match_get_tables_policy);
+	if (err < 0) {
+		MAT_LOG(ERR, "Warning: unable to parse set rules msg\n");
+		match_nl_free_msg(msg);
+		return err;
+	}
+
+	err = match_nl_table_cmd_to_type(matsp, 0, tb);
+	if (err) {
+		match_nl_free_msg(msg);
+		return err;
+	}
+
+	if (tb[NET_MAT_RULES]) {
+		MAT_LOG(ERR, "Failed to set:\n");
+		match_get_rules(matsp, tb[NET_MAT_RULES], NULL);
+		match_nl_free_msg(msg);
+		return -EINVAL;
+	}
+	match_nl_free_msg(msg);
+	return 0;
+}
+
+int match_nl_set_del_rules(struct nl_sock *nsd, uint32_t pid,
+			   unsigned int ifindex, int family,
+			   struct net_mat_rule *rule, uint8_t cmd)
+{
+	int err = 0;
+
+	pp_rule(matsp, rule);
+
+	err = match_nl_send_and_recv(nsd, cmd, pid, ifindex, family,
+				     compose_set_del_rules, rule,
+				     handle_set_del_rules, NULL);
+	return err;
+}
+
+
+/* Bulk rule requests are packed up to the message size matchd uses for
+ * its replies so that every rejected rule of a chunk can be logged back
+ * in a single NET_MAT_RULES_ERROR_CONT_LOG reply.
+ */
+#define MATCH_NL_BULK_MSG_SIZE 8192
+
+struct set_del_rules_bulk_chunk {
+	uint32_t seq;
+	unsigned int first;
+	unsigned int count;
+	bool replied;
+};
+
+struct set_del_rules_bulk_args {
+	struct net_mat_rule *rules;
+	int *errs;
+	struct set_del_rules_bulk_chunk *chunks;
+	unsigned int nchunks;
+	bool rejected;		/* a rule failed, whether or not errs is set */
+};
+
+/*
+ * compose_set_del_rules_bulk() - pack as many rules as fit into one message
+ * @msg: the message to compose
+ * @rules: first rule to pack
+ * @count: number of rules available starting at @rules
+ *
+ * Return: the number of rules packed, or a negative error code if not
+ *         even a single rule fits in the message
+ */
+static int compose_set_del_rules_bulk(struct match_msg *msg,
+				      struct net_mat_rule *rules,
+				      unsigned int count)
+{
+	struct nlattr *nest;
+	unsigned int i;
+	int err;
+
+
+	err = match_put_rule_error(msg->nlbuf, NET_MAT_RULES_ERROR_CONT_LOG);
+	if (err)
+		return err;
+
+	nest = match_nl_put_rules_start(msg->nlbuf);
+	if (!nest)
+		return -EMSGSIZE;
+
+	for (i = 0; i < count; i++) {
+		/* both encodings leave the message untouched when a rule
+		 * does not fit, so the message stays valid up to the last
+		 * rule that fit.
+		 */
+		if (match_nl_put_rule(msg->nlbuf, nest, &rules[i]))
+			break;
+	}
+
+	if (!i) {
+		nla_nest_cancel(msg->nlbuf, nest);
+		return -EMSGSIZE;
+	}
+	match_nl_put_rules_end(msg->nlbuf, nest);
+
+	return (int)i;
+}
+
+static struct set_del_rules_bulk_chunk *
+match_nl_bulk_find_chunk(struct set_del_rules_bulk_args *args, uint32_t seq)
+{
+	unsigned int i;
+
+	for (i = 0; i < args->nchunks; i++) {
+		if (args->chunks[i].seq == seq)
+			return &args->chunks[i];
+	}
+
+	return NULL;
+}
+
+static void match_nl_bulk_set_chunk_err(struct set_del_rules_bulk_args *args,
+					struct set_del_rules_bulk_chunk *chunk,
+					int err)
+{
+	unsigned int i;
+
+	args->rejected = true;
+	if (!args->errs)
+		return;
+
+	for (i = chunk->first; i < chunk->first + chunk->count; i++)
+		args->errs[i] = err;
+}
+
+static int handle_set_del_rules_bulk(struct match_msg *msg, void *handler_arg)
+{
+	struct set_del_rules_bulk_args *args = handler_arg;
+	struct set_del_rules_bulk_chunk *chunk;
+	struct net_mat_rule *failed = NULL;
+	struct nlattr *tb[NET_MAT_MAX+1];
+	struct mat_arena *arena;
+	struct nlmsghdr *nlh;
+	unsigned int i, j;
+	int err = 0;
+
+
+	if (!msg)
+		return -EINVAL;
+
+	if (!handler_arg) {
+		match_nl_free_msg(msg);
+		return -EINVAL;
+	}
+
+	nlh = msg->msg;
+	chunk = match_nl_bulk_find_chunk(args, nlh->nlmsg_seq);
+	if (!chunk) {
+		MAT_LOG(ERR, "Warning: unexpected reply seq %u\n",
+			nlh->nlmsg_seq);
+		match_nl_free_msg(msg);
+		return 0;
+	}
+	chunk->replied = true;
+
+	err = genlmsg_parse(nlh, 0, tb, NET_MAT_MAX, match_get_tables_policy);
+	if (err < 0) {
+		MAT_LOG(ERR, "Warning: unable to parse set rules msg\n");
+		match_nl_bulk_set_chunk_err(args, chunk, err);
+		match_nl_free_msg(msg);
+		return err;
+	}
+
+	err = match_nl_table_cmd_to_type(matsp, 0, tb);
+	if (err) {
+		match_nl_bulk_set_chunk_err(args, chunk, err);
+		match_nl_free_msg(msg);
+		return err;
+	}
+
+	if (!tb[NET_MAT_RULES]) {
+		match_nl_free_msg(msg);
+		return 0;
+	}
+
+	/* the rejected rules are only needed to map them back onto the
+	 * caller's array, decode them into an arena dropped in one go
+	 */
+	arena = mat_arena_create(0);
+	if (!arena) {
+		match_nl_bulk_set_chunk_err(args, chunk, -ENOMEM);
+		match_nl_free_msg(msg);
+		return -ENOMEM;
+	}
+
+	MAT_LOG(ERR, "Failed to set:\n");
+	err = match_get_rules_arena(matsp, tb[NET_MAT_RULES], arena, &failed,
+				    NULL);
+	if (err) {
+		match_nl_bulk_set_chunk_err(args, chunk, err);
+		mat_arena_destroy(arena);
+		match_nl_free_msg(msg);
+		return err;
+	}
+
+	/* The daemon echoes back each rule it rejected, map them onto the
+	 * caller's array by (table, uid) within the range of this chunk.
+	 */
+	args->rejected = true;
+	for (i = 0; failed[i].uid; i++) {
+		for (j = chunk->first; j < chunk->first + chunk->count; j++) {
+			if (args->rules[j].table_id == failed[i].table_id &&
+			    args->rules[j].uid == failed[i].uid) {
+				if (args->errs)
+					args->errs[j] = -EINVAL;
+				break;
+			}
+		}
+	}
+	mat_arena_destroy(arena);
+
+	match_nl_free_msg(msg);
+	return -EINVAL;
+}
+
+static int match_nl_bulk_err_cb(struct sockaddr_nl *nla __unused,
+				struct nlmsgerr *errm, void *arg)
+{
+	struct set_del_rules_bulk_args *args = arg;
+	struct set_del_rules_bulk_chunk *chunk;
+
+
+	if (!arg || !errm)
+		return NL_STOP;
+
+	chunk = match_nl_bulk_find_chunk(args, errm->msg.nlmsg_seq);
+	if (!chunk)
+		return NL_OK;
+
+	chunk->replied = true;
+	if (errm->error) {
+		match_nl_handle_error(errm);
+		match_nl_bulk_set_chunk_err(args, chunk, -abs(errm->error));
+	}
+
+	return NL_OK;
+}
+
+/*
+ * match_nl_set_del_rules_bulk() - set or delete an array of rules
+ * @nsd: netlink socket connected to the daemon
+ * @pid: pid of the daemon
+ * @ifindex: interface identifier
+ * @family: netlink family of the daemon
+ * @rules: rules to set or delete
+ * @count: number of entries in @rules
+ * @cmd: NET_MAT_TABLE_CMD_SET_RULES or NET_MAT_TABLE_CMD_DEL_RULES
+ * @errs: optional array of @count entries receiving the per-rule result
+ *
+ * Rules are packed into as few messages as possible, each holding as many
+ * rules as fit in MATCH_NL_BULK_MSG_SIZE bytes. All messages are sent
+ * back-to-back with NET_MAT_RULES_ERROR_CONT_LOG before any reply is
+ * read, so a failing rule does not stop the rest of the batch. On return
+ * errs[i] is 0 if rules[i] was applied or a negative error code otherwise.
+ *
+ * Return: 0 if every rule was applied, -EINVAL if one or more rules were
+ *         rejected, or another negative error code if the batch could not
+ *         be sent
+ */
+int match_nl_set_del_rules_bulk(struct nl_sock *nsd, uint32_t pid,
+				unsigned int ifindex, int family,
+				struct net_mat_rule *rules, unsigned int count,
+				uint8_t cmd, int *errs)
+{
+	struct match_nl_recvmsg_msg_cb_adapter_ctxt adapter_ctxt;
+	struct set_del_rules_bulk_args args;
+	struct set_del_rules_bulk_chunk *chunk;
+	struct match_msg *msg;
+	unsigned int i, sent = 0;
+	sigset_t bs;
+	int packed;
+	int nlerr;
+	int err = 0;
+
+
+	if (!rules)
+		return -EINVAL;
+
+	if (!count)
+		return 0;
+
+	if (errs)
+		memset(errs, 0, count * sizeof(*errs));
+
+	/* worst case is one rule per message */
+	args.chunks = calloc(count, sizeof(*args.chunks));
+	if (!args.chunks)
+		return -ENOMEM;
+	args.rules = rules;
+	args.errs = errs;
+	args.nchunks = 0;
+	args.rejected = false;
+
+	while (sent < count) {
+		msg = match_nl_alloc_msg_sz(cmd, pid, NLM_F_REQUEST|NLM_F_ACK,
+					    0, family, MATCH_NL_BULK_MSG_SIZE);
+		if (!msg) {
+			MAT_LOG(ERR, "Error: Allocation failure\n");
+			err = -ENOMEM;
+			break;
+		}
+
+		err = match_nl_put_identifier(msg, ifindex);
+		if (err) {
+			match_nl_free_msg(msg);
+			break;
+		}
+
+		packed = compose_set_del_rules_bulk(msg, &rules[sent],
+						    count - sent);
+		if (packed < 0) {
+			MAT_LOG(ERR, "Error: rule %u does not fit in a message\n",
+				rules[sent].uid);
+			match_nl_free_msg(msg);
+			err = packed;
+			break;
+		}
+
+		for (i = sent; i < sent + (unsigned int)packed; i++)
+			pp_rule(matsp, &rules[i]);
+
+		chunk = &args.chunks[args.nchunks];
+		chunk->seq = msg->seq;
+		chunk->first = sent;
+		chunk->count = (unsigned int)packed;
+		chunk->replied = false;
+
+		nlerr = nl_send_auto(nsd, msg->nlbuf);
+		match_nl_free_msg(msg);
+		if (nlerr < 0) {
+			MAT_LOG(ERR, "Error: nl_send_auto() failed(%d)\n", -nlerr);
+			err = -ECOMM;
+			break;
+		}
+
+		args.nchunks++;
+		sent += (unsigned int)packed;
+	}
+
+	/* rules never sent are reported with the error that stopped us */
+	if (errs) {
+		for (i = sent; i < count; i++)
+			errs[i] = err;
+	}
+
+	/* messages sent handle recv, one reply is expected per message */
+	sigemptyset(&bs);
+	sigaddset(&bs, SIGINT);
+	sigprocmask(SIG_UNBLOCK, &bs, NULL);
+
+	adapter_ctxt.handler = handle_set_del_rules_bulk;
+	adapter_ctxt.handler_arg = &args;
+	adapter_ctxt.handler_err = 0;
+	adapter_ctxt.record = NULL;
+
+	nlerr = nl_socket_modify_cb(nsd, NL_CB_VALID, NL_CB_CUSTOM,
+				    match_nl_recvmsg_msg_cb_adapter, &adapter_ctxt);
+	if (NLE_SUCCESS != nlerr) {
+		MAT_LOG(ERR, "Error: nl_socket_modify_cb() failed(%d)\n", -nlerr);
+	}
+
+	nlerr = nl_socket_modify_err_cb(nsd, NL_CB_CUSTOM,
+					match_nl_bulk_err_cb, &args);
+	if (NLE_SUCCESS != nlerr) {
+		MAT_LOG(ERR, "Error: nl_socket_modify_err_cb() failed(%d)\n", -nlerr);
+	}
+
+	nl_socket_disable_seq_check(nsd);
+	for (i = 0; i < args.nchunks; i++) {
+		nlerr = nl_recvmsgs_default(nsd);
+		if (NLE_SUCCESS != nlerr) {
+			MAT_LOG(ERR, "Error: nl_recvmsgs_default() failed(%d)\n", -nlerr);
+			break;
+		}
+	}
+
+	sigprocmask(SIG_BLOCK, &bs, NULL);
+
+	for (i = 0; i < args.nchunks; i++) {
+		if (args.chunks[i].replied)
+			continue;
+		match_nl_bulk_set_chunk_err(&args, &args.chunks[i], -ECOMM);
+		if (!err)
+			err = -ECOMM;
+	}
+
+	if (!err && args.rejected)
+		err = -EINVAL;
+
+	free(args.chunks);
+	return err;
+}
+
+
+struct get_rules_args {
+	uint32_t tableid;
+	uint32_t min;
+	uint32_t max;
+	struct net_mat_rule_filter *filter;
+};
+
+static int compose_get_rules(struct match_msg *msg, void *composer_arg)
+{
+	struct get_rules_args *args = composer_arg;
+	uint32_t tableid = args->tableid;
+	uint32_t min = args->min;
+	uint32_t max = args->max;
+	struct nlattr *rules;
+	int err = 0;
+
+
+	err = match_put_rule_error(msg->nlbuf, NET_MAT_RULES_ERROR_ABORT);
+	if (err)
+		return err;
+
+	rules = nla_nest_start(msg->nlbuf, NET_MAT_RULES);
+	if (!rules) {
+		MAT_LOG(ERR, "Error: get_rules attributes failed\n");
+		return -EMSGSIZE;
+	}
+	err = nla_put_u32(msg->nlbuf, NET_MAT_TABLE_RULES_TABLE, tableid);
+	if (err) {
+		MAT_LOG(ERR, "Error: invalid table\n");
+		return -EMSGSIZE;
+	}
+	if (min > 0) {
+		err = nla_put_u32(msg->nlbuf, NET_MAT_TABLE_RULES_MINPRIO,
+                                min);
+		if (err) {
+			MAT_LOG(ERR, "Error: invalid min parameter\n");
+			return -EMSGSIZE;
+		}
+	}
+	if (max > 0) {
+		err = nla_put_u32(msg->nlbuf, NET_MAT_TABLE_RULES_MAXPRIO,
+                                max);
+		if (err) {
+			MAT_LOG(ERR, "Error: invalid min parameter\n");
+			return -EMSGSIZE;
+		}
+	}
+	if (rules_encoding != NET_MAT_RULES_ENC_NLA) {
+		err = nla_put_u32(msg->nlbuf, NET_MAT_TABLE_RULES_ENCODING,
+				  rules_encoding);
+		if (err) {
+			MAT_LOG(ERR, "Error: invalid encoding parameter\n");
+			return -EMSGSIZE;
+		}
+	}
+	if (args->filter) {
+		err = match_put_rule_filter(msg->nlbuf, args->filter);
+		if (err) {
+			MAT_LOG(ERR, "Error: invalid filter parameter\n");
+			return err;
+		}
+	}
+	nla_nest_end(msg->nlbuf, rules);
+
+	return 0;
+}
+
+struct get_rules_handler_args {
+	struct net_mat_rule *rules;
+	unsigned int count;
+	int err;		/* a part could not be decoded */
+};
+
+/* A multipart reply carries one rule array per part, append them */
+static int match_nl_append_rules(struct get_rules_handler_args *args,
+				 struct net_mat_rule *rule)
+{
+	struct net_mat_rule *rules;
+	unsigned int n;
+
+	if (!args->rules) {
+		args->rules = rule;
+		for (n = 0; rule[n].uid; n++)
+			;
+		args->count = n;
+		return 0;
+	}
+
+	for (n = 0; rule[n].uid; n++)
+		;
+	rules = realloc(args->rules, (args->count + n + 1) * sizeof(*rules));
+	if (!rules)
+		return -ENOMEM;
+
+	memcpy(&rules[args->count], rule, (n + 1) * sizeof(*rules));
+	args->rules = rules;
+	args->count += n;
+	free(rule);
+	return 0;
+}
+
+static int handle_get_rules(struct match_msg *msg, void *handler_arg)
+{
+	struct get_rules_handler_args *args = handler_arg;
+	struct nlmsghdr *nlh;
+	struct nlattr *tb[NET_MAT_MAX+1];
+	struct net_mat_rule *rule = NULL;
+	int err = 0;
+
+	if (!handler_arg)
+		return -EINVAL;
+
+	if (!msg)
+		return -EINVAL;
+
+	nlh = msg->msg;
+	err = genlmsg_parse(nlh, 0, tb, NET_MAT_MAX, match_get_tables_policy);
+	if (err < 0) {
+		MAT_LOG(ERR, "Warning: unable to parse get rules msg\n");
+		args->err = err;
+		goto out;
+	}
+
+	if (match_nl_table_cmd_to_type(matsp,
+				       tb[NET_MAT_RULES_COMPACT] ?
+				       NET_MAT_RULES_COMPACT : NET_MAT_RULES,
+				       tb))
+		goto out;
+
+	if (tb[NET_MAT_RULES_COMPACT]) {
+		err = match_get_rules(matsp, tb[NET_MAT_RULES_COMPACT], &rule);
+		if (err) {
+			args->err = err;
+			goto out;
+		}
+	} else if (tb[NET_MAT_RULES]) {
+		err = match_get_rules(matsp, tb[NET_MAT_RULES], &rule);
+		if (err) {
+			args->err = err;
+			goto out;
+		}
+	}
+	if (rule && match_nl_append_rules(args, rule)) {
+		MAT_LOG(ERR, "Warning: unable to append get rules msg\n");
+		args->err = -ENOMEM;
+		free(rule);
+	}
+out:
+	match_nl_free_msg(msg);
+	return 0;
+}
+
+static int match_nl_fetch_rules(struct nl_sock *nsd, uint32_t pid,
+				unsigned int ifindex, int family,
+				uint32_t tableid, uint32_t min, uint32_t max,
+				struct get_rules_handler_args *handler_args)
+{
+	struct get_rules_args args;
+
+	args.tableid = tableid;
+	args.min = min;
+	args.max = max;
+	args.filter = NULL;
+
+	return match_nl_send_and_recv(nsd, NET_MAT_TABLE_CMD_GET_RULES, pid,
+				      ifindex, family,
+				      compose_get_rules, &args,
+				      handle_get_rules, handler_args);
+}
+
+struct net_mat_rule *match_nl_get_rules(struct nl_sock *nsd, uint32_t pid,
+					unsigned int ifindex, int family,
+					uint32_t tableid, uint32_t min, uint32_t max)
+{
+	int err = 0;
+	struct get_rules_handler_args handler_args = {.rules = NULL, .count = 0};
+
+	err = match_nl_fetch_rules(nsd, pid, ifindex, family, tableid,
+				   min, max, &handler_args);
+	/* TODO handle error propagated from handler */
+	(void)err;
+
+	return handler_args.rules;
+}
+
+/*
+ * match_nl_read_rules() - get the rules of a table
+ * @nsd: netlink socket
+ * @pid: daemon port id
+ * @ifindex: interface index
+ * @family: MATCH netlink family
+ * @tableid: the table
+ * @min: lowest rule uid, 0 for the first
+ * @max: highest rule uid, 0 for the last
+ * @rules: set to an array terminated by a zero uid, NULL if there are none
+ * @count: set to the number of rules
+ *
+ * Unlike match_nl_get_rules() a range without rules is told apart from an
+ * error, the rules are only returned if every part of the reply decoded.
+ *
+ * Return: 0 on success or a negative error code
+ */
+int match_nl_read_rules(struct nl_sock *nsd, uint32_t pid,
+			unsigned int ifindex, int family, uint32_t tableid,
+			uint32_t min, uint32_t max,
+			struct net_mat_rule **rules, unsigned int *count)
+{
+	struct get_rules_handler_args handler_args = {.rules = NULL, .count = 0};
+	int err;
+
+	err = match_nl_fetch_rules(nsd, pid, ifindex, family, tableid,
+				   min, max, &handler_args);
+	if (!err)
+		err = handler_args.err;
+	if (err) {
+		if (handler_args.rules)
+			match_free_rules(handler_args.rules,
+					 handler_args.count);
+		return -abs(err);
+	}
+
+	*rules = handler_args.rules;
+	*count = handler_args.count;
+	return 0;
+}
+
+/*
+ * match_nl_get_rules_filter() - get the rules of a table passing a filter
+ * @nsd: netlink socket
+ * @pid: daemon port id
+ * @ifindex: interface index
+ * @family: MATCH netlink family
+ * @tableid: the table
+ * @min: lowest rule uid, 0 for the first
+ * @max: highest rule uid, 0 for the last
+ * @filter: evaluated by the daemon, see struct net_mat_rule_filter
+ *
+ * Only the rules passing @filter are encoded by the daemon. A filter with
+ * an exact field is served from an index of the table instead of a scan.
+ * Daemons without NET_MAT_FEATURE_RULES_FILTER ignore the filter.
+ *
+ * Return: array of the rules terminated by a zero uid, NULL if there are
+ *         none or on error
+ */
+struct net_mat_rule *match_nl_get_rules_filter(struct nl_sock *nsd,
+					uint32_t pid, unsigned int ifindex,
+					int family, uint32_t tableid,
+					uint32_t min, uint32_t max,
+					struct net_mat_rule_filter *filter)
+{
+	struct get_rules_handler_args handler_args = {.rules = NULL, .count = 0};
+	struct get_rules_args args;
+	int err;
+
+	args.tableid = tableid;
+	args.min = min;
+	args.max = max;
+	args.filter = filter;
+
+	err = match_nl_send_and_recv(nsd, NET_MAT_TABLE_CMD_GET_RULES, pid,
+				     ifindex, family,
+				     compose_get_rules, &args,
+				     handle_get_rules, &handler_args);
+	if (err && handler_args.rules) {
+		match_free_rules(handler_args.rules, handler_args.count);
+		handler_args.rules = NULL;
+	}
+
+	return handler_args.rules;
+}
+
+#define MATCH_NL_APPLY_NONE	UINT_MAX
+
+struct match_nl_apply_table {
+	uint32_t uid;
+	uint32_t size;			/* capacity, 0 if unknown */
+	struct net_mat_rule *rules;	/* installed rules */
+	unsigned int count;
+	unsigned int added;		/* desired rules not installed yet */
+	bool tight;			/* deletes must make room for adds */
+};
+
+struct match_nl_apply_ctx {
+	struct nl_sock *nsd;
+	uint32_t pid;
+	unsigned int ifindex;
+	int family;
+	unsigned int flags;
+	match_nl_apply_fn_t cb;
+	void *cb_arg;
+	struct match_nl_apply_stats *stats;
+
+	struct net_mat_rule *desired;
+	enum match_nl_apply_op *ops;	/* change needed by each desired rule */
+	bool *keep;			/* desired rule installed as is */
+	unsigned int *slots;		/* desired rule index + 1 by table/uid */
+	unsigned int mask;
+
+	struct net_mat_rule *batch;	/* rules of the current request */
+	unsigned int *src;		/* desired index of each batch entry */
+	int *errs;
+	unsigned int n;
+};
+
+static unsigned int match_nl_apply_slot(struct match_nl_apply_ctx *ctx,
+					uint32_t table, uint32_t uid)
+{
+	uint64_t h = ((uint64_t)table << 32 | uid) * 0x9e3779b97f4a7c15ULL;
+	unsigned int i = (unsigned int)(h >> 32) & ctx->mask;
+	struct net_mat_rule *r;
+
+	for (; ctx->slots[i]; i = (i + 1) & ctx->mask) {
+		r = &ctx->desired[ctx->slots[i] - 1];
+		if (r->table_id == table && r->uid == uid)
+			break;
+	}
+
+	return i;
+}
+
+static unsigned int match_nl_apply_find(struct match_nl_apply_ctx *ctx,
+					struct net_mat_rule *rule)
+{
+	unsigned int i = match_nl_apply_slot(ctx, rule->table_id, rule->uid);
+
+	return ctx->slots[i] ? ctx->slots[i] - 1 : MATCH_NL_APPLY_NONE;
+}
+
+static void match_nl_apply_report(struct match_nl_apply_ctx *ctx,
+				  enum match_nl_apply_op op,
+				  struct net_mat_rule *rule, int err)
+{
+	if (err)
+		ctx->stats->failed++;
+	else if (op == MATCH_NL_APPLY_ADD)
+		ctx->stats->added++;
+	else if (op == MATCH_NL_APPLY_UPDATE)
+		ctx->stats->updated++;
+	else
+		ctx->stats->deleted++;
+
+	if (ctx->cb)
+		ctx->cb(op, rule, err, ctx->cb_arg);
+}
+
+/* Send the queued batch as one bulk request, errs[] holds the results */
+static int match_nl_apply_send(struct match_nl_apply_ctx *ctx, uint8_t cmd)
+{
+	unsigned int i;
+	int err = 0;
+
+	memset(ctx->errs, 0, ctx->n * sizeof(*ctx->errs));
+	if (ctx->n && !(ctx->flags & MATCH_NL_APPLY_DRY_RUN))
+		err = match_nl_set_del_rules_bulk(ctx->nsd, ctx->pid,
+						  ctx->ifindex, ctx->family,
+						  ctx->batch, ctx->n, cmd,
+						  ctx->errs);
+	if (err == -EINVAL)
+		return 0;
+
+	for (i = 0; err && i < ctx->n; i++)
+		ctx->errs[i] = err;
+
+	return err;
+}
+
+/*
+ * Delete installed rules, the old version of updated rules when @updates
+ * is set and the rules no longer desired in tables where @tight matches.
+ */
+static int match_nl_apply_del(struct match_nl_apply_ctx *ctx,
+			      struct match_nl_apply_table *tbls,
+			      unsigned int ntbls, bool updates, bool tight)
+{
+	struct net_mat_rule *rule;
+	unsigned int i, j, k;
+	int err;
+
+	ctx->n = 0;
+	for (i = 0; i < ntbls; i++) {
+		for (j = 0; j < tbls[i].count; j++) {
+			rule = &tbls[i].rules[j];
+			k = match_nl_apply_find(ctx, rule);
+			if (k == MATCH_NL_APPLY_NONE ?
+			    tbls[i].tight != tight :
+			    !updates || ctx->keep[k])
+				continue;
+
+			ctx->src[ctx->n] = k;
+			ctx->batch[ctx->n++] = *rule;
+		}
+	}
+
+	err = match_nl_apply_send(ctx, NET_MAT_TABLE_CMD_DEL_RULES);
+
+	for (i = 0; i < ctx->n; i++) {
+		k = ctx->src[i];
+		if (k == MATCH_NL_APPLY_NONE) {
+			match_nl_apply_report(ctx, MATCH_NL_APPLY_DELETE,
+					      &ctx->batch[i], ctx->errs[i]);
+		} else if (ctx->errs[i]) {
+			/* the new version would collide with the old one */
+			ctx->keep[k] = true;
+			match_nl_apply_report(ctx, MATCH_NL_APPLY_UPDATE,
+					      &ctx->desired[k], ctx->errs[i]);
+		}
+	}
+
+	return err;
+}
+
+/* Set the desired rules that are missing or were deleted for an update */
+static int match_nl_apply_set(struct match_nl_apply_ctx *ctx,
+			      unsigned int count)
+{
+	unsigned int i, k;
+	int err;
+
+	ctx->n = 0;
+	for (k = 0; k < count; k++) {
+		if (ctx->keep[k])
+			continue;
+
+		ctx->src[ctx->n] = k;
+		ctx->batch[ctx->n++] = ctx->desired[k];
+	}
+
+	err = match_nl_apply_send(ctx, NET_MAT_TABLE_CMD_SET_RULES);
+
+	for (i = 0; i < ctx->n; i++) {
+		k = ctx->src[i];
+		match_nl_apply_report(ctx, ctx->ops[k], &ctx->desired[k],
+				      ctx->errs[i]);
+	}
+
+	return err;
+}
+
+/*
+ * match_nl_apply_rules() - converge tables to a desired set of rules
+ * @nsd: netlink socket connected to the daemon
+ * @pid: pid of the daemon
+ * @ifindex: interface identifier
+ * @family: netlink family of the daemon
+ * @rules: the desired rules
+ * @count: number of entries in @rules
+ * @tables: tables to converge, terminated by 0, or NULL for every table
+ * @flags: MATCH_NL_APPLY_DRY_RUN to only compute the changes
+ * @cb: optional callback invoked for each change with its result
+ * @cb_arg: argument passed to @cb
+ * @stats: receives the number of changes
+ *
+ * The installed rules of each table are fetched and joined with @rules
+ * through a hash index keyed by table and uid. Desired rules missing
+ * from a table are added, installed rules that match or act differently
+ * are updated and installed rules without a desired rule are deleted.
+ * Rules installed as desired are left alone, so a resync of a mostly
+ * unchanged table costs a handful of changes.
+ *
+ * The daemon has no replace, an update deletes the installed rule before
+ * setting the new one. All deletes and all sets are each sent as one bulk
+ * request. Rules that are no longer desired are deleted before the adds
+ * only in tables where the adds would not fit otherwise, elsewhere they
+ * are deleted last so traffic keeps matching them until the new rules
+ * are in place.
+ *
+ * Return: 0 if every change was applied, -EINVAL if one or more changes
+ *         were rejected or @rules is not a valid desired set, or another
+ *         negative error code if the rules could not be fetched or sent
+ */
+int match_nl_apply_rules(struct nl_sock *nsd, uint32_t pid,
+			 unsigned int ifindex, int family,
+			 struct net_mat_rule *rules, unsigned int count,
+			 const uint32_t *tables, unsigned int flags,
+			 match_nl_apply_fn_t cb, void *cb_arg,
+			 struct match_nl_apply_stats *stats)
+{
+	struct match_nl_apply_ctx ctx = {
+		.nsd = nsd, .pid = pid, .ifindex = ifindex, .family = family,
+		.flags = flags, .cb = cb, .cb_arg = cb_arg, .stats = stats,
+		.desired = rules,
+	};
+	struct match_nl_apply_table *tbls = NULL;
+	struct net_mat_tbl *pipeline;
+	unsigned int i, j, k, ntbls = 0, installed = 0, size = 16;
+	int err = 0;
+
+	if (!stats || (count && !rules))
+		return -EINVAL;
+
+	memset(stats, 0, sizeof(*stats));
+
+	pipeline = match_nl_get_tables(nsd, pid, ifindex, family);
+	if (!pipeline) {
+		MAT_LOG(ERR, "Error: unable to get tables\n");
+		return -ECOMM;
+	}
+
+	for (i = 0; tables ? tables[i] : pipeline[i].uid; i++)
+		ntbls++;
+
+	tbls = calloc(ntbls + 1, sizeof(*tbls));
+	if (!tbls) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < ntbls; i++) {
+		tbls[i].uid = tables ? tables[i] : pipeline[i].uid;
+		for (j = 0; pipeline[j].uid; j++) {
+			if (pipeline[j].uid == tbls[i].uid)
+				tbls[i].size = pipeline[j].size;
+		}
+	}
+
+	while (size < count * 2)
+		size *= 2;
+	ctx.mask = size - 1;
+	ctx.slots = calloc(size, sizeof(*ctx.slots));
+	ctx.ops = calloc(count + 1, sizeof(*ctx.ops));
+	ctx.keep = calloc(count + 1, sizeof(*ctx.keep));
+	if (!ctx.slots || !ctx.ops || !ctx.keep) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (k = 0; k < count; k++) {
+		for (i = 0; i < ntbls && tbls[i].uid != rules[k].table_id; i++)
+			;
+		if (i == ntbls || !rules[k].uid) {
+			MAT_LOG(ERR, "Error: rule %u table %u is not applied\n",
+				rules[k].uid, rules[k].table_id);
+			err = -EINVAL;
+			goto out;
+		}
+
+		j = match_nl_apply_slot(&ctx, rules[k].table_id, rules[k].uid);
+		if (ctx.slots[j]) {
+			MAT_LOG(ERR, "Error: rule %u table %u is listed twice\n",
+				rules[k].uid, rules[k].table_id);
+			err = -EINVAL;
+			goto out;
+		}
+		ctx.slots[j] = k + 1;
+		ctx.ops[k] = MATCH_NL_APPLY_ADD;
+		tbls[i].added++;
+	}
+
+	/* join the installed rules with the desired ones */
+	for (i = 0; i < ntbls; i++) {
+		struct get_rules_handler_args handler_args = {
+			.rules = NULL, .count = 0,
+		};
+
+		err = match_nl_fetch_rules(nsd, pid, ifindex, family,
+					   tbls[i].uid, 0, 0, &handler_args);
+		tbls[i].rules = handler_args.rules;
+		tbls[i].count = handler_args.count;
+		if (err) {
+			MAT_LOG(ERR, "Error: unable to get rules of table %u\n",
+				tbls[i].uid);
+			goto out;
+		}
+
+		for (j = 0; j < tbls[i].count; j++) {
+			k = match_nl_apply_find(&ctx, &tbls[i].rules[j]);
+			if (k == MATCH_NL_APPLY_NONE)
+				continue;
 
-struct net_mat_tbl_node *match_nl_get_tbl_graph(struct nl_sock *nsd,
-						uint32_t pid,
-						unsigned int ifindex,
-						int family)
-{
-	uint8_t cmd = NET_MAT_TABLE_CMD_GET_TABLE_GRAPH;
-	struct get_tbl_graph_handler_args args = {.tbl_nodes = NULL};
-	int err;
+			tbls[i].added--;
+			if (match_rule_cmp(&rules[k], &tbls[i].rules[j])) {
+				ctx.ops[k] = MATCH_NL_APPLY_UPDATE;
+			} else {
+				ctx.keep[k] = true;
+				stats->unchanged++;
+			}
+		}
 
+		tbls[i].tight = tbls[i].size &&
+				tbls[i].count + tbls[i].added > tbls[i].size;
+		installed += tbls[i].count;
+	}
 
-	err = match_nl_send_and_recv(nsd, cmd, pid, ifindex, family,
-				     /*composer*/ NULL, NULL,
-				     handle_get_tbl_graph, &args);
-	/* TODO handle error propagated from handler */
-	(void)err;
+	size = count > installed ? count : installed;
+	ctx.batch = calloc(size + 1, sizeof(*ctx.batch));
+	ctx.src = calloc(size + 1, sizeof(*ctx.src));
+	ctx.errs = calloc(size + 1, sizeof(*ctx.errs));
+	if (!ctx.batch || !ctx.src || !ctx.errs) {
+		err = -ENOMEM;
+		goto out;
+	}
 
-	return args.tbl_nodes;
+	err = match_nl_apply_del(&ctx, tbls, ntbls, true, true);
+	if (!err)
+		err = match_nl_apply_set(&ctx, count);
+	if (!err)
+		err = match_nl_apply_del(&ctx, tbls, ntbls, false, false);
+	if (!err && stats->failed)
+		err = -EINVAL;
+out:
+	free(ctx.errs);
+	free(ctx.src);
+	free(ctx.batch);
+	free(ctx.keep);
+	free(ctx.ops);
+	free(ctx.slots);
+	for (i = 0; tbls && i < ntbls; i++) {
+		if (tbls[i].rules)
+			match_free_rules(tbls[i].rules, tbls[i].count);
+	}
+	free(tbls);
+	free(pipeline);
+	return err;
 }
 
 
-static int compose_set_del_rules(struct match_msg *msg, void *arg)
+static int compose_set_port(struct match_msg *msg, void *arg)
 {
-	struct net_mat_rule *rule = arg;
-	int err = 0;
-	struct nlattr *rules;
-
+	struct net_mat_port *port = arg;
+	struct nlattr *nest, *nest1;
 
-	err = match_put_rule_error(msg->nlbuf, NET_MAT_RULES_ERROR_ABORT);
-	if (err) {
-		return err;
-	}
 
-	rules = nla_nest_start(msg->nlbuf, NET_MAT_RULES);
-	if (!rules) {
+	nest = nla_nest_start(msg->nlbuf, NET_MAT_PORTS);
+	if (!nest) {
 		return -EMSGSIZE;
 	}
-	match_put_rule(msg->nlbuf, rule);
-	nla_nest_end(msg->nlbuf, rules);
-
+	nest1 = nla_nest_start(msg->nlbuf, NET_MAT_PORTS);
+	match_put_port(msg->nlbuf, port);
+	nla_nest_end(msg->nlbuf, nest1);
+	nla_nest_end(msg->nlbuf, nest);
 	return 0;
 }
 
-static int handle_set_del_rules(struct match_msg *msg, void *handler_arg __unused)
+static int handle_set_port(struct match_msg *msg, void *handler_arg __unused)
 {
-	struct nlmsghdr *nlh;
 	struct nlattr *tb[NET_MAT_MAX+1];
+	struct nlmsghdr *nlh;
 	int err = 0;
 
 
@@ -765,7 +2527,7 @@ static int handle_set_del_rules(struct match_msg *msg, void *handler_arg __unuse
 	nlh = msg->msg;
 	err = genlmsg_parse(nlh, 0, tb, NET_MAT_MAX, match_get_tables_policy);
 	if (err < 0) {
-		MAT_LOG(ERR, "Warning: unable to parse set rules msg\n");
+		MAT_LOG(ERR, "Warning: unable to parse set port msg\n");
 		match_nl_free_msg(msg);
 		return err;
 	}
@@ -776,9 +2538,9 @@ static int handle_set_del_rules(struct match_msg *msg, void *handler_arg __unuse
 		return err;
 	}
 
-	if (tb[NET_MAT_RULES]) {
+	if (tb[NET_MAT_PORTS]) {
 		MAT_LOG(ERR, "Failed to set:\n");
-		match_get_rules(matsp, tb[NET_MAT_RULES], NULL);
+		match_get_ports(matsp, tb[NET_MAT_PORTS], NULL);
 		match_nl_free_msg(msg);
 		return -EINVAL;
 	}
@@ -786,88 +2548,36 @@ static int handle_set_del_rules(struct match_msg *msg, void *handler_arg __unuse
 	return 0;
 }
 
-int match_nl_set_del_rules(struct nl_sock *nsd, uint32_t pid,
-			   unsigned int ifindex, int family,
-			   struct net_mat_rule *rule, uint8_t cmd)
+int match_nl_set_port(struct nl_sock *nsd, uint32_t pid,
+		      unsigned int ifindex, int family,
+		      struct net_mat_port *port)
 {
+	uint8_t cmd = NET_MAT_PORT_CMD_SET_PORTS;
 	int err = 0;
 
-	pp_rule(matsp, rule);
 
 	err = match_nl_send_and_recv(nsd, cmd, pid, ifindex, family,
-				     compose_set_del_rules, rule,
-				     handle_set_del_rules, NULL);
+				     compose_set_port, port,
+				     handle_set_port, NULL);
 	return err;
 }
 
-
-struct get_rules_args {
-	uint32_t tableid;
-	uint32_t min;
-	uint32_t max;
-};
-
-static int compose_get_rules(struct match_msg *msg, void *composer_arg)
+static int compose_subscribe(struct match_msg *msg, void *composer_arg)
 {
-	struct get_rules_args *args = composer_arg;
-	uint32_t tableid = args->tableid;
-	uint32_t min = args->min;
-	uint32_t max = args->max;
-	struct nlattr *rules;
-	int err = 0;
-
-
-	err = match_put_rule_error(msg->nlbuf, NET_MAT_RULES_ERROR_ABORT);
-	if (err)
-		return err;
+	uint32_t *mask = composer_arg;
 
-	rules = nla_nest_start(msg->nlbuf, NET_MAT_RULES);
-	if (!rules) {
-		MAT_LOG(ERR, "Error: get_rules attributes failed\n");
-		return -EMSGSIZE;
-	}
-	err = nla_put_u32(msg->nlbuf, NET_MAT_TABLE_RULES_TABLE, tableid);
-	if (err) {
-		MAT_LOG(ERR, "Error: invalid table\n");
+	if (nla_put_u32(msg->nlbuf, NET_MAT_EVENT_MASK, *mask))
 		return -EMSGSIZE;
-	}
-	if (min > 0) {
-		err = nla_put_u32(msg->nlbuf, NET_MAT_TABLE_RULES_MINPRIO,
-                                min);
-		if (err) {
-			MAT_LOG(ERR, "Error: invalid min parameter\n");
-			return -EMSGSIZE;
-		}
-	}
-	if (max > 0) {
-		err = nla_put_u32(msg->nlbuf, NET_MAT_TABLE_RULES_MAXPRIO,
-                                max);
-		if (err) {
-			MAT_LOG(ERR, "Error: invalid min parameter\n");
-			return -EMSGSIZE;
-		}
-	}
-	nla_nest_end(msg->nlbuf, rules);
 
 	return 0;
 }
 
-struct get_rules_handler_args {
-	struct net_mat_rule *rules;
-};
-
-static int handle_get_rules(struct match_msg *msg, void *handler_arg)
+static int handle_subscribe(struct match_msg *msg, void *handler_arg __unused)
 {
-	struct get_rules_handler_args *args = handler_arg;
-	struct nlmsghdr *nlh;
 	struct nlattr *tb[NET_MAT_MAX+1];
-	struct net_mat_rule *rule = NULL;
-	int err = 0;
-
-	if (!handler_arg)
-		return -EINVAL;
+	struct nlmsghdr *nlh;
+	int err;
 
-	args->rules = NULL;
 
 	if (!msg)
 		return -EINVAL;
@@ -875,111 +2585,156 @@ static int handle_get_rules(struct match_msg *msg, void *handler_arg)
 	nlh = msg->msg;
 	err = genlmsg_parse(nlh, 0, tb, NET_MAT_MAX, match_get_tables_policy);
 	if (err < 0) {
-		MAT_LOG(ERR, "Warning: unable to parse get rules msg\n");
-		goto out;
+		MAT_LOG(ERR, "Warning: unable to parse subscribe msg\n");
+		match_nl_free_msg(msg);
+		return err;
 	}
 
-	if (match_nl_table_cmd_to_type(matsp,
-				       NET_MAT_RULES, tb))
-		goto out;
-
-	if (tb[NET_MAT_RULES]) {
-		err = match_get_rules(matsp, tb[NET_MAT_RULES], &rule);
-		if (err)
-			goto out;
-	}
-	args->rules = rule;
-out:
+	err = match_nl_table_cmd_to_type(matsp, NET_MAT_EVENT_MASK, tb);
 	match_nl_free_msg(msg);
-	return 0;
+	return err;
 }
 
-struct net_mat_rule *match_nl_get_rules(struct nl_sock *nsd, uint32_t pid,
-					unsigned int ifindex, int family,
-					uint32_t tableid, uint32_t min, uint32_t max)
+/*
+ * match_nl_subscribe() - subscribe to change events from the daemon
+ * @nsd: netlink socket the events will be received on
+ * @pid: pid of the daemon
+ * @ifindex: interface identifier
+ * @family: netlink family of the daemon
+ * @mask: NET_MAT_EVENT_F_* classes of events to receive, 0 to unsubscribe
+ *
+ * The daemon sends the events to the netlink port of @nsd, which should
+ * be a socket dedicated to events and read with match_nl_recv_events().
+ *
+ * Return: 0 on success or a negative error code
+ */
+int match_nl_subscribe(struct nl_sock *nsd, uint32_t pid,
+		       unsigned int ifindex, int family, uint32_t mask)
 {
-	int err = 0;
-	uint8_t cmd = NET_MAT_TABLE_CMD_GET_RULES;
-	struct get_rules_args args;
-	struct get_rules_handler_args handler_args = {.rules = NULL};
+	uint8_t cmd = NET_MAT_EVENT_CMD_SUBSCRIBE;
+	int err;
 
-	args.tableid = tableid;
-	args.min = min;
-	args.max = max;
 
 	err = match_nl_send_and_recv(nsd, cmd, pid, ifindex, family,
-				     compose_get_rules, &args,
-				     handle_get_rules, &handler_args);
-	/* TODO handle error propagated from handler */
-	(void)err;
-
-	return handler_args.rules;
+				     compose_subscribe, &mask,
+				     handle_subscribe, NULL);
+	return -abs(err);
 }
 
+struct recv_events_args {
+	int family;
+	match_nl_event_fn_t cb;
+	void *cb_arg;
+	int count;
+};
 
-static int compose_set_port(struct match_msg *msg, void *arg)
-{
-	struct net_mat_port *port = arg;
-	struct nlattr *nest, *nest1;
-
-
-	nest = nla_nest_start(msg->nlbuf, NET_MAT_PORTS);
-	if (!nest) {
-		return -EMSGSIZE;
-	}
-	nest1 = nla_nest_start(msg->nlbuf, NET_MAT_PORTS);
-	match_put_port(msg->nlbuf, port);
-	nla_nest_end(msg->nlbuf, nest1);
-	nla_nest_end(msg->nlbuf, nest);
-	return 0;
-}
-
-static int handle_set_port(struct match_msg *msg, void *handler_arg __unused)
+static int handle_events(struct match_msg *msg, void *handler_arg)
 {
+	struct recv_events_args *args = handler_arg;
+	struct net_mat_event *events = NULL;
 	struct nlattr *tb[NET_MAT_MAX+1];
+	struct genlmsghdr *glm;
 	struct nlmsghdr *nlh;
-	int err = 0;
+	int i, err;
 
 
 	if (!msg)
 		return -EINVAL;
 
 	nlh = msg->msg;
+	glm = nlmsg_data(nlh);
+	if (nlh->nlmsg_type != args->family ||
+	    glm->cmd != NET_MAT_EVENT_CMD_NOTIFY) {
+		match_nl_free_msg(msg);
+		return 0;
+	}
+
 	err = genlmsg_parse(nlh, 0, tb, NET_MAT_MAX, match_get_tables_policy);
 	if (err < 0) {
-		MAT_LOG(ERR, "Warning: unable to parse set port msg\n");
+		MAT_LOG(ERR, "Warning: unable to parse event msg\n");
 		match_nl_free_msg(msg);
 		return err;
 	}
 
-	err = match_nl_table_cmd_to_type(matsp, 0, tb);
+	err = match_nl_table_cmd_to_type(matsp, NET_MAT_EVENTS, tb);
 	if (err) {
 		match_nl_free_msg(msg);
 		return err;
 	}
 
-	if (tb[NET_MAT_PORTS]) {
-		MAT_LOG(ERR, "Failed to set:\n");
-		match_get_ports(matsp, tb[NET_MAT_PORTS], NULL);
-		match_nl_free_msg(msg);
-		return -EINVAL;
-	}
+	err = match_get_events(matsp, tb[NET_MAT_EVENTS], &events);
 	match_nl_free_msg(msg);
+	if (err)
+		return err;
+
+	for (i = 0; events[i].type; i++) {
+		if (args->cb)
+			args->cb(&events[i], args->cb_arg);
+		args->count++;
+	}
+	free(events);
+
 	return 0;
 }
 
-int match_nl_set_port(struct nl_sock *nsd, uint32_t pid,
-		      unsigned int ifindex, int family,
-		      struct net_mat_port *port)
+/*
+ * match_nl_recv_events() - receive pending change events
+ * @nsd: netlink socket passed to match_nl_subscribe()
+ * @family: netlink family of the daemon
+ * @cb: called for every event received, may be NULL
+ * @cb_arg: opaque argument passed to @cb
+ *
+ * Blocks until at least one message is available on @nsd unless the
+ * socket is non-blocking. Callers polling several sources can wait on
+ * nl_socket_get_fd(@nsd) first.
+ *
+ * Return: the number of events received or a negative error code
+ */
+int match_nl_recv_events(struct nl_sock *nsd, int family,
+			 match_nl_event_fn_t cb, void *cb_arg)
 {
-	uint8_t cmd = NET_MAT_PORT_CMD_SET_PORTS;
-	int err = 0;
+	struct match_nl_recvmsg_msg_cb_adapter_ctxt adapter_ctxt;
+	struct recv_events_args args = {
+		.family = family,
+		.cb = cb,
+		.cb_arg = cb_arg,
+		.count = 0,
+	};
+	int nlerr;
 
 
-	err = match_nl_send_and_recv(nsd, cmd, pid, ifindex, family,
-				     compose_set_port, port,
-				     handle_set_port, NULL);
-	return err;
+	adapter_ctxt.handler = handle_events;
+	adapter_ctxt.handler_arg = &args;
+	adapter_ctxt.handler_err = 0;
+	adapter_ctxt.record = NULL;
+
+	nlerr = nl_socket_modify_cb(nsd, NL_CB_VALID, NL_CB_CUSTOM,
+				    match_nl_recvmsg_msg_cb_adapter, &adapter_ctxt);
+	if (NLE_SUCCESS != nlerr) {
+		MAT_LOG(ERR, "Error: nl_socket_modify_cb() failed(%d)\n", -nlerr);
+		return -EINVAL;
+	}
+
+	nlerr = nl_socket_modify_err_cb(nsd, NL_CB_CUSTOM,
+					match_nl_recvmsg_err_cb, &adapter_ctxt);
+	if (NLE_SUCCESS != nlerr) {
+		MAT_LOG(ERR, "Error: nl_socket_modify_err_cb() failed(%d)\n", -nlerr);
+		return -EINVAL;
+	}
+
+	nl_socket_disable_seq_check(nsd);
+	nlerr = nl_recvmsgs_default(nsd);
+	if (nlerr < 0) {
+		if (nlerr == -NLE_AGAIN)
+			return -EAGAIN;
+		MAT_LOG(ERR, "Error: nl_recvmsgs_default() failed(%d)\n", -nlerr);
+		return -ECOMM;
+	}
+
+	if (adapter_ctxt.handler_err < 0 && !args.count)
+		return adapter_ctxt.handler_err;
+
+	return args.count;
 }
 
 
@@ -1025,6 +2780,7 @@ static int compose_get_ports(struct match_msg *msg, void *composer_arg)
 
 struct get_ports_handler_args {
 	struct net_mat_port *ports;
+	int err;		/* reply that could not be decoded */
 };
 
 static int handle_get_ports(struct match_msg *msg, void *handler_arg)
@@ -1050,8 +2806,8 @@ static int handle_get_ports(struct match_msg *msg, void *handler_arg)
 		goto out;
 	}
 
-	if (match_nl_table_cmd_to_type(matsp,
-				       NET_MAT_PORTS, tb))
+	err = match_nl_table_cmd_to_type(matsp, NET_MAT_PORTS, tb);
+	if (err)
 		goto out;
 
 	if (tb[NET_MAT_PORTS]) {
@@ -1061,6 +2817,8 @@ static int handle_get_ports(struct match_msg *msg, void *handler_arg)
 	}
 	args->ports = port;
 out:
+	if (err)
+		args->err = err;
 	match_nl_free_msg(msg);
 	return 0;
 }
@@ -1086,6 +2844,46 @@ struct net_mat_port *match_nl_get_ports(struct nl_sock *nsd, uint32_t pid,
 	return handler_args.ports;
 }
 
+/*
+ * match_nl_read_ports() - get the ports in a range
+ * @nsd: netlink socket
+ * @pid: daemon port id
+ * @ifindex: interface index
+ * @family: MATCH netlink family
+ * @min: lowest port id, 0 for the first
+ * @max: highest port id, 0 for the last
+ * @ports: set to an array terminated by NET_MAT_PORT_ID_UNSPEC, NULL if
+ *         there are none
+ *
+ * Unlike match_nl_get_ports() an empty range is told apart from an error.
+ *
+ * Return: 0 on success or a negative error code
+ */
+int match_nl_read_ports(struct nl_sock *nsd, uint32_t pid,
+			unsigned int ifindex, int family,
+			uint32_t min, uint32_t max, struct net_mat_port **ports)
+{
+	struct get_ports_handler_args handler_args = {.ports = NULL};
+	struct get_ports_args args;
+	int err;
+
+	args.min = min;
+	args.max = max;
+
+	err = match_nl_send_and_recv(nsd, NET_MAT_PORT_CMD_GET_PORTS, pid,
+				     ifindex, family, compose_get_ports, &args,
+				     handle_get_ports, &handler_args);
+	if (!err)
+		err = handler_args.err;
+	if (err) {
+		free(handler_args.ports);
+		return -abs(err);
+	}
+
+	*ports = handler_args.ports;
+	return 0;
+}
+
 
 static int compose_create_update_destroy_table(struct match_msg *msg, void *arg)
 {
@@ -1135,6 +2933,11 @@ int match_nl_create_update_destroy_table(struct nl_sock *nsd, uint32_t pid,
 	err = match_nl_send_and_recv(nsd, cmd, pid, ifindex, family,
 				     compose_create_update_destroy_table, table,
 				     handle_create_update_destroy_table, NULL);
+
+	/* the table layout changed, cached pipeline metadata is stale */
+	if (cache.enabled)
+		match_nl_cache_invalidate();
+
 	return err;
 }
 
@@ -0,0 +1,420 @@
+/*******************************************************************************
+
+  MATCH Library - Flight recorder of recent daemon operations
+  Copyright (c) <2015>, Intel Corporation
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "if_match.h"
+#include "matlog.h"
+#include "matflight.h"
+
+/*
+ * Ring of the most recent events of one thread. Only the owner thread
+ * writes to it: an event is stored before head is advanced, readers copy
+ * the head - 1 slots before head. The slot the owner overwrites next is
+ * never read, so a reader racing with the owner sees at worst one event
+ * it recorded while the copy was in progress.
+ */
+struct mat_flight_ring {
+	struct mat_flight_ring *next;
+	uint64_t head;			/* events recorded by the owner */
+	uint16_t thread;
+	struct mat_flight_event events[];
+};
+
+static unsigned int mat_flight_size = MAT_FLIGHT_DEFAULT_EVENTS;
+static struct mat_flight_ring *mat_flight_rings;
+static uint16_t mat_flight_threads;
+static __thread struct mat_flight_ring *mat_flight_self;
+static __thread bool mat_flight_failed;
+
+/*
+ * mat_flight_init() - set the number of events kept per thread
+ * @events: a power of 2, 0 for MAT_FLIGHT_DEFAULT_EVENTS
+ *
+ * Rings are allocated by the first event a thread records, the size can
+ * only be changed before then.
+ *
+ * Return: 0 on success, -EINVAL if @events is not a power of 2 or
+ *         -EBUSY if events were already recorded
+ */
+int mat_flight_init(unsigned int events)
+{
+	if (!events)
+		events = MAT_FLIGHT_DEFAULT_EVENTS;
+
+	if (events < 2 || (events & (events - 1)))
+		return -EINVAL;
+
+	if (__atomic_load_n(&mat_flight_rings, __ATOMIC_ACQUIRE))
+		return -EBUSY;
+
+	mat_flight_size = events;
+	return 0;
+}
+
+uint64_t mat_flight_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static struct mat_flight_ring *mat_flight_ring_get(void)
+{
+	struct mat_flight_ring *ring;
+	size_t len;
+
+	if (mat_flight_failed)
+		return NULL;
+
+	len = sizeof(*ring) + mat_flight_size * sizeof(ring->events[0]);
+	ring = malloc(len);
+	if (!ring) {
+		mat_flight_failed = true;
+		return NULL;
+	}
+
+	/* touch the ring now rather than fault it in while recording */
+	memset(ring, 0, len);
+	ring->thread = __atomic_fetch_add(&mat_flight_threads, 1,
+					  __ATOMIC_RELAXED);
+
+	ring->next = __atomic_load_n(&mat_flight_rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&mat_flight_rings, &ring->next,
+					    ring, true, __ATOMIC_RELEASE,
+					    __ATOMIC_RELAXED))
+		;
+
+	mat_flight_self = ring;
+	return ring;
+}
+
+/*
+ * mat_flight_record() - record an operation in the ring of this thread
+ * @cmd: the netlink command being processed
+ * @hook: the backend hook run, MAT_FLIGHT_HOOK_NONE for the command itself
+ * @table: table operated on, 0 if none
+ * @uid: rule or port operated on, 0 if none
+ * @err: result of the operation, 0 or a negative error code
+ * @start: mat_flight_now() when the operation started
+ */
+void mat_flight_record(uint8_t cmd, uint8_t hook, uint32_t table,
+		       uint32_t uid, int err, uint64_t start)
+{
+	struct mat_flight_ring *ring = mat_flight_self;
+	struct mat_flight_event *ev;
+	uint64_t duration;
+
+	if (!ring) {
+		ring = mat_flight_ring_get();
+		if (!ring)
+			return;
+	}
+
+	duration = mat_flight_now() - start;
+
+	ev = &ring->events[ring->head & (mat_flight_size - 1)];
+	ev->time = start;
+	ev->duration = duration > UINT32_MAX ? UINT32_MAX : (__u32)duration;
+	ev->table = table;
+	ev->uid = uid;
+	ev->err = err;
+	ev->cmd = cmd;
+	ev->hook = hook;
+	ev->thread = ring->thread;
+
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/* Number of events of a ring safe to read, the oldest is at head - count */
+static unsigned int mat_flight_count(uint64_t head)
+{
+	return head < mat_flight_size ? (unsigned int)head : mat_flight_size - 1;
+}
+
+static int mat_flight_write(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+
+	return 0;
+}
+
+/*
+ * mat_flight_dump_fd() - write the events of all threads to a file
+ * @fd: file descriptor to write the dump to
+ *
+ * Only write(2) is used, so the dump can be taken from a signal handler.
+ * Events of each thread are written oldest first, mat_flight_sort()
+ * merges them once read back.
+ *
+ * Return: 0 on success or a negative error code
+ */
+int mat_flight_dump_fd(int fd)
+{
+	struct mat_flight_header hdr;
+	struct mat_flight_ring *ring, *rings;
+	unsigned int n, first, mask = mat_flight_size - 1;
+	uint64_t head;
+	int err;
+
+	rings = __atomic_load_n(&mat_flight_rings, __ATOMIC_ACQUIRE);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, MAT_FLIGHT_MAGIC, sizeof(MAT_FLIGHT_MAGIC));
+	hdr.version = MAT_FLIGHT_VERSION;
+	hdr.byte_order = MAT_FLIGHT_BYTE_ORDER;
+	hdr.header_len = sizeof(hdr);
+	hdr.event_len = sizeof(struct mat_flight_event);
+	hdr.time = mat_flight_now();
+
+	/* events recorded after this point are left out of the dump */
+	for (ring = rings; ring; ring = ring->next) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		hdr.count += mat_flight_count(head);
+	}
+
+	err = mat_flight_write(fd, &hdr, sizeof(hdr));
+	if (err)
+		return err;
+
+	for (ring = rings; ring && hdr.count; ring = ring->next) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		n = mat_flight_count(head);
+		if (n > hdr.count)
+			n = (unsigned int)hdr.count;
+		hdr.count -= n;
+
+		first = (unsigned int)(head - n) & mask;
+		if (first + n > mat_flight_size) {
+			err = mat_flight_write(fd, &ring->events[first],
+					       (mat_flight_size - first) *
+					       sizeof(ring->events[0]));
+			if (err)
+				return err;
+			n -= mat_flight_size - first;
+			first = 0;
+		}
+
+		err = mat_flight_write(fd, &ring->events[first],
+				       n * sizeof(ring->events[0]));
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/*
+ * mat_flight_snapshot() - copy the events of all threads
+ * @events: set to a malloc'ed array of events, to be freed by the caller
+ * @count: set to the number of events
+ *
+ * Return: 0 on success or a negative error code
+ */
+int mat_flight_snapshot(struct mat_flight_event **events, unsigned int *count)
+{
+	struct mat_flight_ring *ring, *rings;
+	unsigned int n, i, total = 0, mask = mat_flight_size - 1;
+	struct mat_flight_event *ev;
+	uint64_t head;
+
+	rings = __atomic_load_n(&mat_flight_rings, __ATOMIC_ACQUIRE);
+
+	for (ring = rings; ring; ring = ring->next) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		total += mat_flight_count(head);
+	}
+
+	ev = malloc((total ? total : 1) * sizeof(*ev));
+	if (!ev)
+		return -ENOMEM;
+
+	*count = 0;
+	for (ring = rings; ring && *count < total; ring = ring->next) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		n = mat_flight_count(head);
+		if (n > total - *count)
+			n = total - *count;
+
+		for (i = 0; i < n; i++)
+			ev[(*count)++] = ring->events[(head - n + i) & mask];
+	}
+
+	*events = ev;
+	return 0;
+}
+
+/*
+ * mat_flight_read() - read the events of a dump file
+ * @path: the dump file
+ * @events: set to a malloc'ed array of events, to be freed by the caller
+ * @count: set to the number of events
+ * @dump_time: set to the time of the dump, may be NULL
+ *
+ * Return: 0 on success or a negative error code
+ */
+int mat_flight_read(const char *path, struct mat_flight_event **events,
+		    unsigned int *count, uint64_t *dump_time)
+{
+	struct mat_flight_header hdr;
+	struct mat_flight_event *ev = NULL;
+	int err = -EINVAL;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		err = -errno;
+		MAT_LOG(ERR, "Error: cannot open %s: %s\n", path, strerror(errno));
+		return err;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    memcmp(hdr.magic, MAT_FLIGHT_MAGIC, sizeof(MAT_FLIGHT_MAGIC)) ||
+	    hdr.version != MAT_FLIGHT_VERSION ||
+	    hdr.byte_order != MAT_FLIGHT_BYTE_ORDER ||
+	    hdr.header_len < sizeof(hdr) ||
+	    hdr.event_len != sizeof(*ev) ||
+	    hdr.count > UINT32_MAX / sizeof(*ev))
+		goto out;
+
+	if (fseek(fp, (long)hdr.header_len, SEEK_SET))
+		goto out;
+
+	ev = malloc(hdr.count ? (size_t)hdr.count * sizeof(*ev) : 1);
+	if (!ev) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	if (fread(ev, sizeof(*ev), (size_t)hdr.count, fp) != hdr.count) {
+		free(ev);
+		goto out;
+	}
+
+	*events = ev;
+	*count = (unsigned int)hdr.count;
+	if (dump_time)
+		*dump_time = hdr.time;
+	err = 0;
+out:
+	if (err == -EINVAL)
+		MAT_LOG(ERR, "Error: %s is not a valid flight recorder dump\n",
+			path);
+	fclose(fp);
+	return err;
+}
+
+static int mat_flight_event_cmp(const void *a, const void *b)
+{
+	const struct mat_flight_event *x = a, *y = b;
+
+	if (x->time != y->time)
+		return x->time < y->time ? -1 : 1;
+	/* a hook starts after its command but may share its timestamp */
+	if (!x->hook != !y->hook)
+		return x->hook ? 1 : -1;
+	return (int)x->thread - (int)y->thread;
+}
+
+/* Order events of all threads by start time */
+void mat_flight_sort(struct mat_flight_event *events, unsigned int count)
+{
+	qsort(events, count, sizeof(*events), mat_flight_event_cmp);
+}
+
+static const char *const mat_flight_cmds[NET_MAT_CMD_MAX + 1] = {
+	[NET_MAT_TABLE_CMD_GET_TABLES]		= "get_tables",
+	[NET_MAT_TABLE_CMD_GET_HEADERS]		= "get_headers",
+	[NET_MAT_TABLE_CMD_GET_ACTIONS]		= "get_actions",
+	[NET_MAT_TABLE_CMD_GET_HDR_GRAPH]	= "get_header_graph",
+	[NET_MAT_TABLE_CMD_GET_TABLE_GRAPH]	= "get_graph",
+	[NET_MAT_TABLE_CMD_GET_RULES]		= "get_rules",
+	[NET_MAT_TABLE_CMD_SET_RULES]		= "set_rule",
+	[NET_MAT_TABLE_CMD_DEL_RULES]		= "del_rule",
+	[NET_MAT_TABLE_CMD_UPDATE_RULES]	= "update_rules",
+	[NET_MAT_TABLE_CMD_CREATE_TABLE]	= "create",
+	[NET_MAT_TABLE_CMD_DESTROY_TABLE]	= "destroy",
+	[NET_MAT_TABLE_CMD_UPDATE_TABLE]	= "update",
+	[NET_MAT_PORT_CMD_GET_PORTS]		= "get_ports",
+	[NET_MAT_PORT_CMD_GET_LPORT]		= "lport_lookup",
+	[NET_MAT_PORT_CMD_GET_PHYS_PORT]	= "phys_port_lookup",
+	[NET_MAT_PORT_CMD_SET_PORTS]		= "set_port",
+	[NET_MAT_TABLE_CMD_GET_GENERATION]	= "get_generation",
+	[NET_MAT_EVENT_CMD_SUBSCRIBE]		= "subscribe",
+	[NET_MAT_EVENT_CMD_NOTIFY]		= "notify",
+	[NET_MAT_DAEMON_CMD_GET_FLIGHT]		= "get_flight",
+	[NET_MAT_DAEMON_CMD_GET_STATS]		= "get_stats",
+};
+
+static const char *const mat_flight_hooks[__MAT_FLIGHT_HOOK_MAX] = {
+	[MAT_FLIGHT_HOOK_NONE]			= "-",
+	[MAT_FLIGHT_HOOK_SET_RULES]		= "set_rules",
+	[MAT_FLIGHT_HOOK_DEL_RULES]		= "del_rules",
+	[MAT_FLIGHT_HOOK_CREATE_TABLE]		= "create_table",
+	[MAT_FLIGHT_HOOK_DESTROY_TABLE]		= "destroy_table",
+	[MAT_FLIGHT_HOOK_UPDATE_TABLE]		= "update_table",
+	[MAT_FLIGHT_HOOK_GET_PORTS]		= "get_ports",
+	[MAT_FLIGHT_HOOK_SET_PORTS]		= "set_ports",
+	[MAT_FLIGHT_HOOK_GET_LPORT]		= "get_lport",
+	[MAT_FLIGHT_HOOK_GET_PHYS_PORT]		= "get_phys_port",
+	[MAT_FLIGHT_HOOK_GET_RULE_COUNTERS]	= "get_rule_counters",
+};
+
+const char *mat_flight_cmd_str(uint8_t cmd)
+{
+	if (cmd > NET_MAT_CMD_MAX || !mat_flight_cmds[cmd])
+		return "unknown";
+	return mat_flight_cmds[cmd];
+}
+
+const char *mat_flight_hook_str(uint8_t hook)
+{
+	if (hook >= __MAT_FLIGHT_HOOK_MAX)
+		return "unknown";
+	return mat_flight_hooks[hook];
+}
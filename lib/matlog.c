@@ -1,3 +1,16 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
 #include <matlog.h>
 
 /* by default, log messages to stdout */
@@ -10,6 +23,12 @@ static struct mat_logger logger = {
 	.stream = NULL, /* stdout setup by constructor... */
 };
 
+unsigned int mat_log_mask = MAT_LOG_UPTO(MAT_LOG_LEVEL);
+
+/* Messages of a MAT_LOG() call site allowed per interval, 0 for no limit */
+static unsigned int mat_log_burst;
+static unsigned int mat_log_interval = 5000;
+
 static void __attribute__((constructor, used)) mat_set_stdout(void)
 {
 	mat_set_log_stream(stdout);
@@ -18,6 +37,71 @@ static void __attribute__((constructor, used)) mat_set_stdout(void)
 void mat_setlogmask(unsigned mask)
 {
 	logger.logmask = mask;
+	mat_log_mask = mask;
+}
+
+/*
+ * mat_log_set_ratelimit() - limit the messages of each MAT_LOG() call site
+ * @burst: messages allowed per interval and call site, 0 for no limit
+ * @interval_ms: length of the interval in milliseconds
+ *
+ * A call site logging more than @burst messages within @interval_ms has
+ * the extra messages suppressed. The number of suppressed messages is
+ * logged before the first message of a later interval. Only warning and
+ * more severe messages are limited: notice and info messages are asked
+ * for explicitly, debug messages are only enabled to trace everything.
+ * Rate limiting is off until this is called with a non zero @burst.
+ */
+void mat_log_set_ratelimit(unsigned int burst, unsigned int interval_ms)
+{
+	mat_log_burst = burst;
+	mat_log_interval = interval_ms;
+}
+
+/*
+ * mat_log_site_allow() - take a token from the bucket of a call site
+ * @site: the call site state
+ * @level: level of the message
+ * @file: file of the call site
+ * @line: line of the call site
+ *
+ * The bucket of a call site is refilled with mat_log_burst tokens at the
+ * start of each interval. Counters are updated atomically, concurrent
+ * callers may at worst let a message more through.
+ *
+ * Return: non-zero if the message is to be logged
+ */
+int mat_log_site_allow(struct mat_log_site *site, int level,
+		       const char *file, const char *line)
+{
+	struct timespec ts;
+	unsigned int missed;
+	uint64_t now, stamp;
+
+	if (!mat_log_burst || level > MAT_LOG_WARNING)
+		return 1;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	now = (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000 + 1;
+
+	stamp = __atomic_load_n(&site->stamp, __ATOMIC_RELAXED);
+	if ((!stamp || now - stamp >= mat_log_interval) &&
+	    __atomic_compare_exchange_n(&site->stamp, &stamp, now, false,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&site->tokens, (int)mat_log_burst,
+				 __ATOMIC_RELAXED);
+		missed = __atomic_exchange_n(&site->missed, 0,
+					     __ATOMIC_RELAXED);
+		if (missed)
+			mat_syslog(level, "%s:%s: %u messages suppressed\n",
+				   file, line, missed);
+	}
+
+	if (__atomic_sub_fetch(&site->tokens, 1, __ATOMIC_RELAXED) >= 0)
+		return 1;
+
+	__atomic_add_fetch(&site->missed, 1, __ATOMIC_RELAXED);
+	return 0;
 }
 
 void mat_set_log_functions(mat_closelog_func_t closelog,
@@ -158,3 +242,627 @@ void mat_vsyslog_with_location(int level,
 	if (level <= MAT_LOG_DEBUG && ((1U << level) & logger.logmask))
 		(*logger.syslog_with_location)(level, file, line, func, format, args);
 }
+
+/*
+ * Asynchronous logging
+ *
+ * Each thread logging through mat_syslog_async() owns a single producer,
+ * single consumer ring of fixed size slots. A slot holds the format
+ * pointer and the raw arguments read from the va_list, strings are copied
+ * into the slot. A logging thread drains every ring, formats the messages
+ * and writes them to the log stream. Producers never block, a message is
+ * dropped and counted when the ring of its thread is full or when its
+ * strings do not fit in a slot. The logging thread sleeps on a futex
+ * once every ring is empty and the first producer queuing a message
+ * after that wakes it up.
+ *
+ * Only the format pointer is kept, formats must be string literals as
+ * passed by MAT_LOG(). Positional arguments and %n are not supported, a
+ * message is formatted up to the first such conversion.
+ */
+#define MAT_LOG_ASYNC_ARGS		15
+#define MAT_LOG_ASYNC_FORMATS		64
+#define MAT_LOG_ASYNC_DEFAULT_SLOTS	1024
+#define MAT_LOG_ASYNC_LINE_SIZE		1024
+
+enum mat_log_arg_kind {
+	MAT_LOG_ARG_INVALID,
+	MAT_LOG_ARG_PERCENT,
+	MAT_LOG_ARG_ERRNO,
+	MAT_LOG_ARG_INT,
+	MAT_LOG_ARG_LONG,
+	MAT_LOG_ARG_LLONG,
+	MAT_LOG_ARG_SIZE,
+	MAT_LOG_ARG_INTMAX,
+	MAT_LOG_ARG_PTRDIFF,
+	MAT_LOG_ARG_DOUBLE,
+	MAT_LOG_ARG_LDOUBLE,
+	MAT_LOG_ARG_STRING,
+	MAT_LOG_ARG_POINTER,
+};
+
+/* One conversion specification of a format string */
+struct mat_log_spec {
+	enum mat_log_arg_kind kind;
+	unsigned int stars;	/* '*' width and precision arguments */
+	size_t len;		/* length of the specification */
+};
+
+union mat_log_arg {
+	long long i;
+	double d;
+	long double ld;
+	const void *p;
+};
+
+struct mat_log_slot {
+	const char *format;
+	unsigned int nargs;	/* arguments stored in args[] */
+	union mat_log_arg args[MAT_LOG_ASYNC_ARGS];
+};
+
+/* Conversions of a format, cached per thread by format pointer */
+struct mat_log_format {
+	const char *format;
+	unsigned char count;	/* conversions taking arguments */
+	unsigned char need;	/* argument slots they use at least */
+	unsigned char specs[MAT_LOG_ASYNC_ARGS];	/* kind | stars << 4 */
+};
+
+struct mat_log_ring {
+	struct mat_log_ring *next;
+	struct mat_log_slot *slots;
+	unsigned int mask;
+	int owned;		/* set while a thread logs into the ring */
+	/* written by the producer only */
+	unsigned int head __attribute__((aligned(64)));
+	uint64_t dropped;
+	struct mat_log_format formats[MAT_LOG_ASYNC_FORMATS];
+	/* written by the logging thread only */
+	unsigned int tail __attribute__((aligned(64)));
+	uint64_t reported;	/* drops already reported */
+};
+
+static struct {
+	struct mat_log_ring *rings;	/* rings are reused, never freed */
+	unsigned int nslots;
+	int stop;
+	bool running;
+	uint64_t written;
+	int wake;		/* futex bumped to wake the logging thread */
+	int sleeping;		/* set while the logging thread may sleep */
+	pthread_t thread;
+	pthread_key_t key;
+	pthread_once_t key_once;
+	bool key_valid;
+} mat_log_async = {
+	.key_once = PTHREAD_ONCE_INIT,
+};
+
+static __thread struct mat_log_ring *mat_log_ring_self;
+
+/* Parse the conversion specification starting at the '%' of @p */
+static void mat_log_spec_parse(const char *p, struct mat_log_spec *spec)
+{
+	const char *s = p + 1;
+	int longs = 0;
+	char mod = 0;
+
+	spec->kind = MAT_LOG_ARG_INVALID;
+	spec->stars = 0;
+
+	while (*s && strchr("-+ #0'", *s))
+		s++;
+	for (; *s == '*' || (*s >= '0' && *s <= '9') || *s == '.'; s++) {
+		if (*s == '*')
+			spec->stars++;
+	}
+	for (; *s && strchr("hlLqjzt", *s); s++) {
+		mod = *s;
+		if (*s == 'l' || *s == 'q')
+			longs += *s == 'q' ? 2 : 1;
+	}
+
+	spec->len = (size_t)(s - p) + (*s ? 1 : 0);
+
+	switch (*s) {
+	case '%':
+		spec->kind = MAT_LOG_ARG_PERCENT;
+		break;
+	case 'm':
+		spec->kind = MAT_LOG_ARG_ERRNO;
+		break;
+	case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+		if (longs >= 2)
+			spec->kind = MAT_LOG_ARG_LLONG;
+		else if (longs)
+			spec->kind = MAT_LOG_ARG_LONG;
+		else if (mod == 'z')
+			spec->kind = MAT_LOG_ARG_SIZE;
+		else if (mod == 'j')
+			spec->kind = MAT_LOG_ARG_INTMAX;
+		else if (mod == 't')
+			spec->kind = MAT_LOG_ARG_PTRDIFF;
+		else
+			spec->kind = MAT_LOG_ARG_INT;
+		break;
+	case 'e': case 'E': case 'f': case 'F': case 'g': case 'G':
+	case 'a': case 'A':
+		spec->kind = mod == 'L' ? MAT_LOG_ARG_LDOUBLE :
+					  MAT_LOG_ARG_DOUBLE;
+		break;
+	case 's':
+		spec->kind = longs ? MAT_LOG_ARG_INVALID : MAT_LOG_ARG_STRING;
+		break;
+	case 'p':
+		spec->kind = MAT_LOG_ARG_POINTER;
+		break;
+	default:
+		break;
+	}
+}
+
+/* Record the conversions of @format that take an argument */
+static void mat_log_format_parse(const char *format, struct mat_log_format *f)
+{
+	struct mat_log_spec spec;
+	const char *p;
+
+	f->format = format;
+	f->count = 0;
+	f->need = 0;
+
+	for (p = strchr(format, '%'); p; p = strchr(p + spec.len, '%')) {
+		mat_log_spec_parse(p, &spec);
+		if (spec.kind == MAT_LOG_ARG_INVALID ||
+		    f->count == MAT_LOG_ASYNC_ARGS)
+			break;
+		if (spec.kind == MAT_LOG_ARG_PERCENT)
+			continue;
+
+		f->specs[f->count++] = (unsigned char)(spec.kind |
+						       spec.stars << 4);
+		/* a string needs a slot for its length and one for its bytes */
+		f->need = (unsigned char)(f->need + spec.stars + 1 +
+					  (spec.kind == MAT_LOG_ARG_STRING));
+	}
+}
+
+/*
+ * Copy the arguments of @f into @slot, strings fill the spare slots.
+ * Return false if a string did not fit.
+ */
+static bool mat_log_slot_fill(struct mat_log_slot *slot,
+			      const struct mat_log_format *f, va_list args)
+{
+	unsigned int n = 0, i, k, need, rest = f->need, avail;
+	enum mat_log_arg_kind kind;
+	union mat_log_arg *a;
+	const char *str;
+	bool fits = true;
+	size_t len;
+
+	for (k = 0; k < f->count; k++) {
+		kind = (enum mat_log_arg_kind)(f->specs[k] & 0xf);
+		need = (f->specs[k] >> 4) + 1u + (kind == MAT_LOG_ARG_STRING);
+		if (n + need > MAT_LOG_ASYNC_ARGS)
+			break;
+		rest -= need;
+
+		for (i = 0; i < (unsigned int)(f->specs[k] >> 4); i++)
+			slot->args[n++].i = va_arg(args, int);
+
+		a = &slot->args[n];
+		switch (kind) {
+		case MAT_LOG_ARG_ERRNO:
+			a->i = errno;
+			break;
+		case MAT_LOG_ARG_INT:
+			a->i = va_arg(args, int);
+			break;
+		case MAT_LOG_ARG_LONG:
+			a->i = va_arg(args, long);
+			break;
+		case MAT_LOG_ARG_LLONG:
+			a->i = va_arg(args, long long);
+			break;
+		case MAT_LOG_ARG_SIZE:
+			a->i = (long long)va_arg(args, size_t);
+			break;
+		case MAT_LOG_ARG_INTMAX:
+			a->i = (long long)va_arg(args, intmax_t);
+			break;
+		case MAT_LOG_ARG_PTRDIFF:
+			a->i = (long long)va_arg(args, ptrdiff_t);
+			break;
+		case MAT_LOG_ARG_DOUBLE:
+			a->d = va_arg(args, double);
+			break;
+		case MAT_LOG_ARG_LDOUBLE:
+			a->ld = va_arg(args, long double);
+			break;
+		case MAT_LOG_ARG_POINTER:
+			a->p = va_arg(args, void *);
+			break;
+		case MAT_LOG_ARG_STRING:
+			/*
+			 * Length in this slot, bytes in the following ones,
+			 * keeping the slots of the arguments after it.
+			 */
+			str = va_arg(args, const char *);
+			if (!str)
+				str = "(null)";
+			avail = MAT_LOG_ASYNC_ARGS - n - 1;
+			avail -= rest < avail ? rest : avail - 1;
+			len = strnlen(str, avail * sizeof(*a) - 1);
+			if (str[len])
+				fits = false;
+			a->i = (long long)len;
+			memcpy(a + 1, str, len);
+			((char *)(a + 1))[len] = '\0';
+			n += (unsigned int)((len + sizeof(*a)) / sizeof(*a));
+			break;
+		default:
+			break;
+		}
+		n++;
+	}
+
+	slot->format = f->format;
+	slot->nargs = n;
+	return fits;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+
+/* Format a slot into @buf, the dual of mat_log_slot_fill() */
+static size_t mat_log_slot_format(struct mat_log_slot *slot, char *buf,
+				  size_t size)
+{
+	const char *format = slot->format, *p = format, *q;
+	struct mat_log_spec spec;
+	union mat_log_arg *a = slot->args, *end = slot->args + slot->nargs;
+	char fmt[64];
+	size_t off = 0, n;
+	int w[2] = { 0, 0 }, len;
+	unsigned int i;
+
+	for (q = strchr(p, '%'); off < size - 1; q = strchr(p, '%')) {
+		n = q ? (size_t)(q - p) : strlen(p);
+		if (n > size - 1 - off)
+			n = size - 1 - off;
+		memcpy(buf + off, p, n);
+		off += n;
+		if (!q || off >= size - 1)
+			break;
+
+		mat_log_spec_parse(q, &spec);
+		if (spec.kind == MAT_LOG_ARG_INVALID ||
+		    spec.len >= sizeof(fmt) ||
+		    a + spec.stars + (spec.kind != MAT_LOG_ARG_PERCENT) > end)
+			break;
+
+		memcpy(fmt, q, spec.len);
+		fmt[spec.len] = '\0';
+		for (i = 0; i < spec.stars; i++)
+			w[i] = (int)(a++)->i;
+
+#define MAT_LOG_PRINT(v)						\
+	(spec.stars == 2 ? snprintf(buf + off, size - off, fmt, w[0], w[1], v) : \
+	 spec.stars == 1 ? snprintf(buf + off, size - off, fmt, w[0], v) :	\
+	 snprintf(buf + off, size - off, fmt, v))
+
+		switch (spec.kind) {
+		case MAT_LOG_ARG_PERCENT:
+			len = snprintf(buf + off, size - off, "%%");
+			a--;
+			break;
+		case MAT_LOG_ARG_ERRNO:
+			len = snprintf(buf + off, size - off, "%s",
+				       strerror((int)a->i));
+			break;
+		case MAT_LOG_ARG_INT:
+			len = MAT_LOG_PRINT((int)a->i);
+			break;
+		case MAT_LOG_ARG_LONG:
+			len = MAT_LOG_PRINT((long)a->i);
+			break;
+		case MAT_LOG_ARG_LLONG:
+			len = MAT_LOG_PRINT(a->i);
+			break;
+		case MAT_LOG_ARG_SIZE:
+			len = MAT_LOG_PRINT((size_t)a->i);
+			break;
+		case MAT_LOG_ARG_INTMAX:
+			len = MAT_LOG_PRINT((intmax_t)a->i);
+			break;
+		case MAT_LOG_ARG_PTRDIFF:
+			len = MAT_LOG_PRINT((ptrdiff_t)a->i);
+			break;
+		case MAT_LOG_ARG_DOUBLE:
+			len = MAT_LOG_PRINT(a->d);
+			break;
+		case MAT_LOG_ARG_LDOUBLE:
+			len = MAT_LOG_PRINT(a->ld);
+			break;
+		case MAT_LOG_ARG_POINTER:
+			len = MAT_LOG_PRINT(a->p);
+			break;
+		case MAT_LOG_ARG_STRING:
+			len = MAT_LOG_PRINT((const char *)(a + 1));
+			a += (a->i + (long long)sizeof(*a)) / (long long)sizeof(*a);
+			break;
+		default:
+			len = 0;
+			break;
+		}
+#undef MAT_LOG_PRINT
+
+		a++;
+		off += len > 0 ? (size_t)len : 0;
+		p = q + spec.len;
+	}
+
+	/* keep one message per line when it was cut short */
+	if (off > size - 2)
+		off = size - 2;
+	n = strlen(format);
+	if (n && format[n - 1] == '\n' && (!off || buf[off - 1] != '\n'))
+		buf[off++] = '\n';
+
+	return off;
+}
+
+#pragma GCC diagnostic pop
+
+static void mat_log_ring_release(void *arg)
+{
+	struct mat_log_ring *ring = arg;
+
+	__atomic_store_n(&ring->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void mat_log_key_create(void)
+{
+	mat_log_async.key_valid = !pthread_key_create(&mat_log_async.key,
+						      mat_log_ring_release);
+}
+
+/* Attach a ring to the calling thread, reusing one of an exited thread */
+static struct mat_log_ring *mat_log_ring_get(void)
+{
+	struct mat_log_ring *ring;
+	int owned = 0;
+
+	if (mat_log_ring_self)
+		return mat_log_ring_self;
+
+	pthread_once(&mat_log_async.key_once, mat_log_key_create);
+
+	ring = __atomic_load_n(&mat_log_async.rings, __ATOMIC_ACQUIRE);
+	for (; ring; ring = ring->next) {
+		if (__atomic_compare_exchange_n(&ring->owned, &owned, 1, false,
+						__ATOMIC_ACQUIRE,
+						__ATOMIC_RELAXED))
+			break;
+		owned = 0;
+	}
+
+	if (!ring) {
+		ring = calloc(1, sizeof(*ring));
+		if (!ring)
+			return NULL;
+
+		ring->slots = malloc(mat_log_async.nslots * sizeof(*ring->slots));
+		if (!ring->slots) {
+			free(ring);
+			return NULL;
+		}
+		/* fault the ring in now rather than on the logging path */
+		memset(ring->slots, 0, mat_log_async.nslots * sizeof(*ring->slots));
+		ring->mask = mat_log_async.nslots - 1;
+		ring->owned = 1;
+
+		ring->next = __atomic_load_n(&mat_log_async.rings,
+					     __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&mat_log_async.rings,
+						    &ring->next, ring, false,
+						    __ATOMIC_RELEASE,
+						    __ATOMIC_RELAXED))
+			;
+	}
+
+	/* hand the ring over to another thread once this one exits */
+	if (mat_log_async.key_valid)
+		pthread_setspecific(mat_log_async.key, ring);
+	mat_log_ring_self = ring;
+	return ring;
+}
+
+static void mat_log_async_wake(void)
+{
+	__atomic_add_fetch(&mat_log_async.wake, 1, __ATOMIC_RELEASE);
+	syscall(SYS_futex, &mat_log_async.wake, FUTEX_WAKE_PRIVATE, 1,
+		NULL, NULL, 0);
+}
+
+void mat_syslog_async(int level, const char *format, va_list args)
+{
+	struct mat_log_ring *ring = mat_log_ring_get();
+	struct mat_log_format *f;
+	unsigned int head, tail;
+
+	if (!ring) {
+		mat_syslog_file(level, format, args);
+		return;
+	}
+
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (head - tail > ring->mask)
+		goto drop;
+
+	f = &ring->formats[((uintptr_t)format >> 3) %
+			   MAT_LOG_ASYNC_FORMATS];
+	if (f->format != format)
+		mat_log_format_parse(format, f);
+
+	/* too long for a slot */
+	if (!mat_log_slot_fill(&ring->slots[head & ring->mask], f, args))
+		goto drop;
+
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	/* pairs with the fence of the logging thread before it sleeps */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&mat_log_async.sleeping, __ATOMIC_RELAXED) &&
+	    __atomic_exchange_n(&mat_log_async.sleeping, 0, __ATOMIC_RELAXED))
+		mat_log_async_wake();
+	return;
+drop:
+	__atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+}
+
+void mat_syslog_with_location_async(int level,
+				    const char *file __attribute__((unused)),
+				    const char *line __attribute__((unused)),
+				    const char *func __attribute__((unused)),
+				    const char *format, va_list args)
+{
+	mat_syslog_async(level, format, args);
+}
+
+/* Format and write the queued messages of every ring */
+static unsigned int mat_log_async_drain(void)
+{
+	char buf[MAT_LOG_ASYNC_LINE_SIZE];
+	struct mat_log_ring *ring;
+	unsigned int head, n = 0;
+	uint64_t dropped;
+	size_t len;
+
+	ring = __atomic_load_n(&mat_log_async.rings, __ATOMIC_ACQUIRE);
+	for (; ring; ring = ring->next) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		for (; ring->tail != head; n++) {
+			len = mat_log_slot_format(&ring->slots[ring->tail &
+							       ring->mask],
+						  buf, sizeof(buf));
+			fwrite(buf, 1, len, logger.stream);
+			__atomic_store_n(&ring->tail, ring->tail + 1,
+					 __ATOMIC_RELEASE);
+		}
+
+		dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+		if (dropped != ring->reported) {
+			fprintf(logger.stream, "matlog: %" PRIu64
+				" messages dropped\n", dropped - ring->reported);
+			ring->reported = dropped;
+		}
+	}
+
+	if (n) {
+		fflush(logger.stream);
+		__atomic_add_fetch(&mat_log_async.written, n, __ATOMIC_RELAXED);
+	}
+
+	return n;
+}
+
+static void *mat_log_async_thread(void *arg __attribute__((unused)))
+{
+	int wake;
+
+	while (!__atomic_load_n(&mat_log_async.stop, __ATOMIC_ACQUIRE)) {
+		if (mat_log_async_drain())
+			continue;
+
+		/* producers queuing from here on wake the thread up */
+		wake = __atomic_load_n(&mat_log_async.wake, __ATOMIC_ACQUIRE);
+		__atomic_store_n(&mat_log_async.sleeping, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (!mat_log_async_drain() &&
+		    !__atomic_load_n(&mat_log_async.stop, __ATOMIC_ACQUIRE))
+			syscall(SYS_futex, &mat_log_async.wake,
+				FUTEX_WAIT_PRIVATE, wake, NULL, NULL, 0);
+		__atomic_store_n(&mat_log_async.sleeping, 0, __ATOMIC_RELAXED);
+	}
+
+	mat_log_async_drain();
+	return NULL;
+}
+
+/*
+ * mat_log_async_start() - log asynchronously to the log stream
+ * @slots: messages buffered per thread, rounded up to a power of two,
+ *         0 for the default
+ *
+ * Installs mat_syslog_async() as the logging function and starts the
+ * thread writing the messages to the stream set by mat_set_log_stream().
+ * The size of the rings is fixed by the first call.
+ *
+ * Return: 0 on success or a negative error code
+ */
+int mat_log_async_start(unsigned int slots)
+{
+	unsigned int n = 1;
+	int err;
+
+	if (mat_log_async.running)
+		return -EALREADY;
+
+	if (!slots)
+		slots = MAT_LOG_ASYNC_DEFAULT_SLOTS;
+	while (n < slots && n < (1U << 30))
+		n <<= 1;
+	if (!mat_log_async.nslots)
+		mat_log_async.nslots = n;
+
+	mat_log_async.stop = 0;
+	err = pthread_create(&mat_log_async.thread, NULL,
+			     mat_log_async_thread, NULL);
+	if (err)
+		return -err;
+
+	mat_log_async.running = true;
+	mat_set_log_functions(mat_closelog_file, mat_openlog_file,
+			      mat_syslog_async, mat_syslog_with_location_async);
+	return 0;
+}
+
+/*
+ * mat_log_async_stop() - write the queued messages and log synchronously
+ */
+void mat_log_async_stop(void)
+{
+	if (!mat_log_async.running)
+		return;
+
+	mat_set_log_functions(mat_closelog_file, mat_openlog_file,
+			      mat_syslog_file, mat_syslog_with_location_file);
+	__atomic_store_n(&mat_log_async.stop, 1, __ATOMIC_RELEASE);
+	mat_log_async_wake();
+	pthread_join(mat_log_async.thread, NULL);
+	mat_log_async.running = false;
+}
+
+/*
+ * mat_log_async_get_stats() - read the asynchronous logging counters
+ * @stats: receives the counters summed over all threads
+ */
+void mat_log_async_get_stats(struct mat_log_async_stats *stats)
+{
+	struct mat_log_ring *ring;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->written = __atomic_load_n(&mat_log_async.written,
+					 __ATOMIC_RELAXED);
+
+	ring = __atomic_load_n(&mat_log_async.rings, __ATOMIC_ACQUIRE);
+	for (; ring; ring = ring->next) {
+		stats->queued += __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+		stats->dropped += __atomic_load_n(&ring->dropped,
+						  __ATOMIC_RELAXED);
+	}
+}
@@ -0,0 +1,796 @@
+/*******************************************************************************
+
+  MATCH Library - Shared memory mirror of the MATCH daemon state
+  Copyright (c) <2015>, Intel Corporation
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "if_match.h"
+#include "matlog.h"
+#include "matshm.h"
+
+/* Arrays start on a cache line so that records do not straddle two */
+#define MAT_SHM_ALIGN(len)	(((len) + 63) & ~(size_t)63)
+
+/* Copies attempted before a reader gives up on a record being written */
+#define MAT_SHM_RETRIES		(1 << 16)
+
+/* Run of rule records, free or owned by a table */
+struct mat_shm_extent {
+	__u32 base;
+	__u32 len;
+};
+
+struct mat_shm {
+	void *base;
+	size_t len;
+	struct mat_shm_header *hdr;
+	struct mat_shm_table *tables;
+	struct mat_shm_rule *rules;
+	struct mat_shm_port *ports;
+	char *path;		/* set for the writer only */
+	__u32 next_rule;	/* first rule record never handed to a table */
+	__u32 *capacity;	/* rule records owned by each table */
+	struct mat_shm_extent *free;	/* released rule records, by base */
+	unsigned int nfree;
+};
+
+static void mat_shm_write_begin(__u32 *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void mat_shm_write_end(__u32 *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * mat_shm_read_record() - copy a record protected by its sequence count
+ * @rec: the record in the mapping, starting with its sequence count
+ * @out: copy of the record
+ * @len: size of the record
+ *
+ * Return: 0 on success or -EBUSY if the record stayed under update, which
+ *         happens when the daemon died while writing it
+ */
+static int mat_shm_read_record(const void *rec, void *out, size_t len)
+{
+	const __u32 *seq = rec;
+	unsigned int i;
+	__u32 start;
+
+	for (i = 0; i < MAT_SHM_RETRIES; i++) {
+		start = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+		if (start & 1) {
+			sched_yield();
+			continue;
+		}
+
+		memcpy(out, rec, len);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(seq, __ATOMIC_RELAXED) == start)
+			return 0;
+	}
+
+	return -EBUSY;
+}
+
+static size_t mat_shm_layout(struct mat_shm_header *hdr)
+{
+	size_t len = MAT_SHM_ALIGN(sizeof(*hdr));
+
+	hdr->table_off = len;
+	len += MAT_SHM_ALIGN((size_t)hdr->max_tables * hdr->table_len);
+	hdr->rule_off = len;
+	len += MAT_SHM_ALIGN((size_t)hdr->max_rules * hdr->rule_len);
+	hdr->port_off = len;
+	len += MAT_SHM_ALIGN((size_t)hdr->max_ports * hdr->port_len);
+
+	return len;
+}
+
+static void mat_shm_map(struct mat_shm *shm)
+{
+	char *base = shm->base;
+
+	shm->hdr = shm->base;
+	shm->tables = (struct mat_shm_table *)(base + shm->hdr->table_off);
+	shm->rules = (struct mat_shm_rule *)(base + shm->hdr->rule_off);
+	shm->ports = (struct mat_shm_port *)(base + shm->hdr->port_off);
+}
+
+/*
+ * mat_shm_create() - create the shared memory mirror
+ * @path: the file, usually MAT_SHM_FILE
+ * @max_tables: table records, tables with a larger uid are not mirrored
+ * @max_rules: rule records shared by all tables
+ * @max_ports: port records
+ * @shm: set to the mirror on success
+ *
+ * The file is built aside and renamed over @path, so readers never map a
+ * partially initialized mirror.
+ *
+ * Return: 0 on success or a negative error code
+ */
+int mat_shm_create(const char *path, unsigned int max_tables,
+		   unsigned int max_rules, unsigned int max_ports,
+		   struct mat_shm **shm)
+{
+	struct mat_shm_header hdr;
+	struct mat_shm *s;
+	char *tmp = NULL;
+	unsigned int i;
+	int fd = -1, err;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, MAT_SHM_MAGIC, sizeof(MAT_SHM_MAGIC));
+	hdr.version = MAT_SHM_VERSION;
+	hdr.byte_order = MAT_SHM_BYTE_ORDER;
+	hdr.header_len = sizeof(hdr);
+	hdr.table_len = sizeof(struct mat_shm_table);
+	hdr.rule_len = sizeof(struct mat_shm_rule);
+	hdr.port_len = sizeof(struct mat_shm_port);
+	hdr.max_tables = max_tables;
+	hdr.max_rules = max_rules;
+	hdr.max_ports = max_ports;
+	hdr.pid = (__u32)getpid();
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return -ENOMEM;
+	s->len = mat_shm_layout(&hdr);
+	s->path = strdup(path);
+	/* tables own disjoint extents, free ones lie between them */
+	s->capacity = calloc(max_tables + 1, sizeof(*s->capacity));
+	s->free = calloc(max_tables + 1, sizeof(*s->free));
+	if (!s->path || !s->capacity || !s->free ||
+	    asprintf(&tmp, "%s.tmp", path) < 0) {
+		tmp = NULL;
+		err = -ENOMEM;
+		goto err;
+	}
+
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+		  S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0 || ftruncate(fd, (off_t)s->len)) {
+		err = -errno;
+		MAT_LOG(ERR, "Error: cannot create %s: %s\n", tmp,
+			strerror(errno));
+		goto err;
+	}
+
+	s->base = mmap(NULL, s->len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (s->base == MAP_FAILED) {
+		err = -errno;
+		s->base = NULL;
+		goto err;
+	}
+	close(fd);
+	fd = -1;
+
+	memcpy(s->base, &hdr, sizeof(hdr));
+	mat_shm_map(s);
+	for (i = 0; i < max_tables; i++)
+		s->tables[i].rule_base = MAT_SHM_NO_RULES;
+	for (i = 0; i < max_ports; i++)
+		s->ports[i].port_id = NET_MAT_PORT_ID_UNSPEC;
+
+	if (rename(tmp, path)) {
+		err = -errno;
+		MAT_LOG(ERR, "Error: cannot create %s: %s\n", path,
+			strerror(errno));
+		goto err;
+	}
+
+	free(tmp);
+	*shm = s;
+	return 0;
+err:
+	if (fd >= 0)
+		close(fd);
+	if (tmp)
+		unlink(tmp);
+	free(tmp);
+	if (s->base)
+		munmap(s->base, s->len);
+	free(s->free);
+	free(s->capacity);
+	free(s->path);
+	free(s);
+	return err;
+}
+
+/*
+ * mat_shm_destroy() - mark the mirror closed and remove it
+ * @shm: the mirror, may be NULL
+ *
+ * Readers still mapping the file get -ESTALE from then on.
+ */
+void mat_shm_destroy(struct mat_shm *shm)
+{
+	if (!shm)
+		return;
+
+	mat_shm_write_begin(&shm->hdr->seq);
+	shm->hdr->closed = 1;
+	mat_shm_write_end(&shm->hdr->seq);
+
+	unlink(shm->path);
+	munmap(shm->base, shm->len);
+	free(shm->free);
+	free(shm->capacity);
+	free(shm->path);
+	free(shm);
+}
+
+/* Take @len rule records from the first free extent large enough */
+static __u32 mat_shm_rules_alloc(struct mat_shm *shm, __u32 len)
+{
+	struct mat_shm_extent *e;
+	unsigned int i;
+	__u32 base;
+
+	for (i = 0; i < shm->nfree; i++) {
+		e = &shm->free[i];
+		if (e->len < len)
+			continue;
+
+		base = e->base;
+		e->base += len;
+		e->len -= len;
+		if (!e->len) {
+			memmove(e, e + 1, (shm->nfree - i - 1) * sizeof(*e));
+			shm->nfree--;
+		}
+		return base;
+	}
+
+	if (len > shm->hdr->max_rules - shm->next_rule)
+		return MAT_SHM_NO_RULES;
+
+	base = shm->next_rule;
+	shm->next_rule += len;
+	return base;
+}
+
+/*
+ * mat_shm_rules_release() - withdraw rule records and free them
+ * @shm: the mirror
+ * @base: first record
+ * @len: number of records
+ *
+ * The extent is merged with its free neighbours, or given back to the
+ * records never handed out when it ends there.
+ */
+static void mat_shm_rules_release(struct mat_shm *shm, __u32 base, __u32 len)
+{
+	struct mat_shm_extent *e;
+	struct mat_shm_rule *r;
+	unsigned int i;
+
+	for (r = &shm->rules[base]; r < &shm->rules[base + len]; r++) {
+		if (!r->uid)
+			continue;
+		mat_shm_write_begin(&r->seq);
+		memset((char *)r + sizeof(r->seq), 0,
+		       sizeof(*r) - sizeof(r->seq));
+		mat_shm_write_end(&r->seq);
+	}
+
+	for (i = 0; i < shm->nfree && shm->free[i].base < base; i++)
+		;
+
+	if (i && shm->free[i - 1].base + shm->free[i - 1].len == base) {
+		e = &shm->free[--i];
+		e->len += len;
+	} else {
+		memmove(&shm->free[i + 1], &shm->free[i],
+			(shm->nfree - i) * sizeof(*e));
+		shm->nfree++;
+		e = &shm->free[i];
+		e->base = base;
+		e->len = len;
+	}
+
+	if (i + 1 < shm->nfree && e->base + e->len == shm->free[i + 1].base) {
+		e->len += shm->free[i + 1].len;
+		memmove(&shm->free[i + 1], &shm->free[i + 2],
+			(shm->nfree - i - 2) * sizeof(*e));
+		shm->nfree--;
+	}
+
+	if (e->base + e->len == shm->next_rule) {
+		shm->next_rule = e->base;
+		shm->nfree--;
+	}
+}
+
+/*
+ * mat_shm_set_table() - publish a created or updated table
+ * @shm: the mirror, may be NULL
+ * @table: the table
+ *
+ * A table owns an extent of rule records, kept as long as it is large
+ * enough for the table. A table outgrowing it moves its rules to a new
+ * extent, taken from the ones released by other tables first. A table
+ * that does not fit in the remaining records is published without its
+ * rules.
+ */
+void mat_shm_set_table(struct mat_shm *shm, struct net_mat_tbl *table)
+{
+	__u32 base, len, old, i, rules = 0;
+	struct mat_shm_rule *src, *dst;
+	struct mat_shm_table *t;
+
+	if (!shm || table->uid >= shm->hdr->max_tables)
+		return;
+
+	t = &shm->tables[table->uid];
+	if (t->uid == table->uid)
+		rules = t->rules;
+
+	base = t->rule_base;
+	len = table->size + 1;
+	if (base == MAT_SHM_NO_RULES || len > shm->capacity[table->uid]) {
+		base = mat_shm_rules_alloc(shm, len);
+		if (base == MAT_SHM_NO_RULES)
+			MAT_LOG(ERR, "Warning: no shared memory left for the rules of table %u\n",
+				table->uid);
+	}
+
+	/* copy the rules to their new records before readers see them */
+	old = t->rule_base;
+	if (old != base && old != MAT_SHM_NO_RULES && base != MAT_SHM_NO_RULES) {
+		for (i = 1; i <= t->size && i < len; i++) {
+			src = &shm->rules[old + i];
+			dst = &shm->rules[base + i];
+			if (!src->uid)
+				continue;
+			mat_shm_write_begin(&dst->seq);
+			memcpy((char *)dst + sizeof(dst->seq),
+			       (char *)src + sizeof(src->seq),
+			       sizeof(*dst) - sizeof(dst->seq));
+			mat_shm_write_end(&dst->seq);
+		}
+	}
+
+	mat_shm_write_begin(&t->seq);
+	t->uid = table->uid;
+	t->size = table->size;
+	t->rules = rules;
+	t->rule_base = base;
+	memset(t->name, 0, sizeof(t->name));
+	if (table->name)
+		strncpy(t->name, table->name, sizeof(t->name) - 1);
+	mat_shm_write_end(&t->seq);
+
+	if (old == base)
+		return;
+	if (old != MAT_SHM_NO_RULES)
+		mat_shm_rules_release(shm, old, shm->capacity[table->uid]);
+	shm->capacity[table->uid] = base == MAT_SHM_NO_RULES ? 0 : len;
+}
+
+/*
+ * mat_shm_del_table() - withdraw a destroyed table and its rules
+ * @shm: the mirror, may be NULL
+ * @uid: the table
+ *
+ * The rule records of the table are released for other tables.
+ */
+void mat_shm_del_table(struct mat_shm *shm, __u32 uid)
+{
+	struct mat_shm_table *t;
+	__u32 base;
+
+	if (!shm || uid >= shm->hdr->max_tables)
+		return;
+
+	t = &shm->tables[uid];
+	if (t->uid != uid)
+		return;
+
+	base = t->rule_base;
+	mat_shm_write_begin(&t->seq);
+	t->uid = 0;
+	t->size = 0;
+	t->rules = 0;
+	t->rule_base = MAT_SHM_NO_RULES;
+	mat_shm_write_end(&t->seq);
+
+	if (base != MAT_SHM_NO_RULES)
+		mat_shm_rules_release(shm, base, shm->capacity[uid]);
+	shm->capacity[uid] = 0;
+}
+
+static struct mat_shm_rule *mat_shm_rule(struct mat_shm *shm, __u32 table,
+					 __u32 uid)
+{
+	struct mat_shm_table *t;
+
+	if (table >= shm->hdr->max_tables)
+		return NULL;
+
+	t = &shm->tables[table];
+	if (t->uid != table || t->rule_base == MAT_SHM_NO_RULES ||
+	    !uid || uid > t->size)
+		return NULL;
+
+	return &shm->rules[t->rule_base + uid];
+}
+
+static void mat_shm_count_rule(struct mat_shm *shm, __u32 table, int n)
+{
+	struct mat_shm_table *t = &shm->tables[table];
+
+	mat_shm_write_begin(&t->seq);
+	t->rules = (__u32)((int)t->rules + n);
+	mat_shm_write_end(&t->seq);
+}
+
+/*
+ * mat_shm_set_rule() - publish an installed rule or its new counters
+ * @shm: the mirror, may be NULL
+ * @rule: the rule
+ */
+void mat_shm_set_rule(struct mat_shm *shm, struct net_mat_rule *rule)
+{
+	struct mat_shm_rule *r;
+	bool added;
+
+	if (!shm)
+		return;
+
+	r = mat_shm_rule(shm, rule->table_id, rule->uid);
+	if (!r)
+		return;
+
+	added = !r->uid;
+	mat_shm_write_begin(&r->seq);
+	r->table_id = rule->table_id;
+	r->uid = rule->uid;
+	r->priority = rule->priority;
+	r->hw_ruleid = rule->hw_ruleid;
+	r->packets = rule->packets;
+	r->bytes = rule->bytes;
+	mat_shm_write_end(&r->seq);
+
+	if (added)
+		mat_shm_count_rule(shm, rule->table_id, 1);
+}
+
+/*
+ * mat_shm_del_rule() - withdraw a deleted rule
+ * @shm: the mirror, may be NULL
+ * @table: table of the rule
+ * @uid: the rule
+ */
+void mat_shm_del_rule(struct mat_shm *shm, __u32 table, __u32 uid)
+{
+	struct mat_shm_rule *r;
+
+	if (!shm)
+		return;
+
+	r = mat_shm_rule(shm, table, uid);
+	if (!r || !r->uid)
+		return;
+
+	mat_shm_write_begin(&r->seq);
+	memset((char *)r + sizeof(r->seq), 0, sizeof(*r) - sizeof(r->seq));
+	mat_shm_write_end(&r->seq);
+
+	mat_shm_count_rule(shm, table, -1);
+}
+
+/*
+ * mat_shm_set_port() - publish the state and statistics of a port
+ * @shm: the mirror, may be NULL
+ * @slot: record of the port
+ * @port: the port, NULL to free the record
+ */
+void mat_shm_set_port(struct mat_shm *shm, unsigned int slot,
+		      struct net_mat_port *port)
+{
+	struct mat_shm_port *p;
+
+	if (!shm || slot >= shm->hdr->max_ports)
+		return;
+
+	p = &shm->ports[slot];
+	mat_shm_write_begin(&p->seq);
+	if (port) {
+		p->port_id = port->port_id;
+		p->state = port->state;
+		p->speed = port->speed;
+		p->stats = port->stats;
+	} else {
+		p->port_id = NET_MAT_PORT_ID_UNSPEC;
+		memset(&p->stats, 0, sizeof(p->stats));
+	}
+	mat_shm_write_end(&p->seq);
+}
+
+void mat_shm_set_generation(struct mat_shm *shm, __u32 generation)
+{
+	if (!shm)
+		return;
+
+	mat_shm_write_begin(&shm->hdr->seq);
+	shm->hdr->generation = generation;
+	mat_shm_write_end(&shm->hdr->seq);
+}
+
+/* Record that the counters were refreshed */
+void mat_shm_touch(struct mat_shm *shm)
+{
+	struct timespec ts;
+
+	if (!shm)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	mat_shm_write_begin(&shm->hdr->seq);
+	shm->hdr->updated = (__u64)ts.tv_sec * 1000000000ULL +
+			    (__u64)ts.tv_nsec;
+	mat_shm_write_end(&shm->hdr->seq);
+}
+
+static int mat_shm_validate(struct mat_shm *shm)
+{
+	struct mat_shm_header hdr;
+
+	if (shm->len < sizeof(hdr))
+		return -EINVAL;
+
+	memcpy(&hdr, shm->base, sizeof(hdr));
+
+	if (memcmp(hdr.magic, MAT_SHM_MAGIC, sizeof(MAT_SHM_MAGIC)) ||
+	    hdr.byte_order != MAT_SHM_BYTE_ORDER)
+		return -EINVAL;
+
+	if (hdr.version != MAT_SHM_VERSION ||
+	    hdr.header_len != sizeof(hdr) ||
+	    hdr.table_len != sizeof(struct mat_shm_table) ||
+	    hdr.rule_len != sizeof(struct mat_shm_rule) ||
+	    hdr.port_len != sizeof(struct mat_shm_port))
+		return -EPROTONOSUPPORT;
+
+	/* the arrays must be where the writer would have put them */
+	if (hdr.table_off != MAT_SHM_ALIGN(sizeof(hdr)) ||
+	    hdr.rule_off != hdr.table_off +
+			    MAT_SHM_ALIGN((size_t)hdr.max_tables * hdr.table_len) ||
+	    hdr.port_off != hdr.rule_off +
+			    MAT_SHM_ALIGN((size_t)hdr.max_rules * hdr.rule_len) ||
+	    hdr.port_off + (size_t)hdr.max_ports * hdr.port_len > shm->len)
+		return -EINVAL;
+
+	return 0;
+}
+
+/*
+ * mat_shm_open() - map the mirror published by matchd
+ * @path: the file, usually MAT_SHM_FILE
+ * @shm: set to the mapped mirror on success
+ *
+ * Return: 0 on success or a negative error code
+ */
+int mat_shm_open(const char *path, struct mat_shm **shm)
+{
+	struct mat_shm *s;
+	struct stat st;
+	int fd, err;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st)) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s) {
+		close(fd);
+		return -ENOMEM;
+	}
+
+	s->len = (size_t)st.st_size;
+	s->base = s->len ? mmap(NULL, s->len, PROT_READ, MAP_SHARED, fd, 0) :
+			   MAP_FAILED;
+	close(fd);
+	if (s->base == MAP_FAILED) {
+		free(s);
+		return -EINVAL;
+	}
+
+	err = mat_shm_validate(s);
+	if (err) {
+		MAT_LOG(ERR, "Error: %s is not a valid state mirror\n", path);
+		munmap(s->base, s->len);
+		free(s);
+		return err;
+	}
+
+	mat_shm_map(s);
+	*shm = s;
+	return 0;
+}
+
+void mat_shm_close(struct mat_shm *shm)
+{
+	if (!shm)
+		return;
+
+	munmap(shm->base, shm->len);
+	free(shm);
+}
+
+/* The sizes and offsets of the header never change once published */
+const struct mat_shm_header *mat_shm_header(struct mat_shm *shm)
+{
+	return shm->hdr;
+}
+
+static bool mat_shm_closed(struct mat_shm *shm)
+{
+	return __atomic_load_n(&shm->hdr->closed, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * mat_shm_read_header() - read the pipeline generation and refresh time
+ * @shm: the mirror
+ * @generation: set to the pipeline generation, may be NULL
+ * @updated: set to the CLOCK_MONOTONIC time of the last counter refresh
+ *           in ns, may be NULL
+ *
+ * Return: 0 on success, -ESTALE once the daemon exited or -EBUSY
+ */
+int mat_shm_read_header(struct mat_shm *shm, __u32 *generation,
+			__u64 *updated)
+{
+	struct mat_shm_header hdr;
+	int err;
+
+	err = mat_shm_read_record(&shm->hdr->seq, &hdr.seq,
+				  sizeof(hdr) - offsetof(struct mat_shm_header,
+							 seq));
+	if (err)
+		return err;
+	if (hdr.closed)
+		return -ESTALE;
+
+	if (generation)
+		*generation = hdr.generation;
+	if (updated)
+		*updated = hdr.updated;
+	return 0;
+}
+
+/*
+ * mat_shm_read_table() - copy a table record
+ * @shm: the mirror
+ * @uid: the table
+ * @table: set to a consistent copy of the record
+ *
+ * Return: 0 on success, -ENOENT if there is no such table, -ESTALE once
+ *         the daemon exited or -EBUSY
+ */
+int mat_shm_read_table(struct mat_shm *shm, __u32 uid,
+		       struct mat_shm_table *table)
+{
+	int err;
+
+	if (mat_shm_closed(shm))
+		return -ESTALE;
+
+	if (uid >= shm->hdr->max_tables)
+		return -ENOENT;
+
+	err = mat_shm_read_record(&shm->tables[uid], table, sizeof(*table));
+	if (err)
+		return err;
+
+	return table->uid == uid && uid ? 0 : -ENOENT;
+}
+
+/*
+ * mat_shm_read_rule() - copy a rule record
+ * @shm: the mirror
+ * @table: table of the rule
+ * @uid: the rule
+ * @rule: set to a consistent copy of the record
+ *
+ * Return: 0 on success, -ENOENT if the rule is not installed or its table
+ *         is mirrored without rules, -ESTALE once the daemon exited or
+ *         -EBUSY
+ */
+int mat_shm_read_rule(struct mat_shm *shm, __u32 table, __u32 uid,
+		      struct mat_shm_rule *rule)
+{
+	struct mat_shm_table t;
+	int err;
+
+	err = mat_shm_read_table(shm, table, &t);
+	if (err)
+		return err;
+
+	if (t.rule_base == MAT_SHM_NO_RULES || !uid || uid > t.size ||
+	    t.rule_base + uid >= shm->hdr->max_rules)
+		return -ENOENT;
+
+	err = mat_shm_read_record(&shm->rules[t.rule_base + uid], rule,
+				  sizeof(*rule));
+	if (err)
+		return err;
+
+	/* the table may have been recreated since it was read */
+	return rule->table_id == table && rule->uid == uid ? 0 : -ENOENT;
+}
+
+/*
+ * mat_shm_read_port() - copy a port record
+ * @shm: the mirror
+ * @slot: the record, from 0 to max_ports - 1
+ * @port: set to a consistent copy of the record
+ *
+ * Return: 0 on success, -ENOENT if the record is free, -ESTALE once the
+ *         daemon exited or -EBUSY
+ */
+int mat_shm_read_port(struct mat_shm *shm, unsigned int slot,
+		      struct mat_shm_port *port)
+{
+	int err;
+
+	if (mat_shm_closed(shm))
+		return -ESTALE;
+
+	if (slot >= shm->hdr->max_ports)
+		return -ENOENT;
+
+	err = mat_shm_read_record(&shm->ports[slot], port, sizeof(*port));
+	if (err)
+		return err;
+
+	return port->port_id != NET_MAT_PORT_ID_UNSPEC ? 0 : -ENOENT;
+}
@@ -0,0 +1,659 @@
+/*******************************************************************************
+
+  MATCH Library - Binary snapshots of a MATCH pipeline
+  Copyright (c) <2015>, Intel Corporation
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <libnl3/netlink/netlink.h>
+#include <libnl3/netlink/attr.h>
+#include <libnl3/netlink/msg.h>
+
+#include "if_match.h"
+#include "matchlib.h"
+#include "matlog.h"
+#include "matsnap.h"
+
+/* Sections start on an 8 byte boundary so compact records stay aligned */
+#define MAT_SNAP_ALIGN(len)	(((len) + 7) & ~(size_t)7)
+
+/* Scratch message used to encode one attribute before it is written */
+#define MAT_SNAP_MSG_SIZE	(2 * 65536)
+
+struct mat_snap_writer {
+	FILE *fp;
+	char *path;
+	char *tmp_path;
+	struct mat_snap_header hdr;
+	int section;		/* section being written, -1 before the first */
+	__u64 offset;		/* current end of file */
+};
+
+struct mat_snap {
+	void *base;
+	size_t len;
+	struct mat_snap_header hdr;
+};
+
+static int mat_snap_pad(struct mat_snap_writer *w)
+{
+	static const char zero[8];
+	size_t pad = MAT_SNAP_ALIGN(w->offset) - w->offset;
+
+	if (pad && fwrite(zero, 1, pad, w->fp) != pad)
+		return -EIO;
+
+	w->offset += pad;
+	return 0;
+}
+
+/* Sections are written in order, each one at most once */
+static int mat_snap_section_begin(struct mat_snap_writer *w,
+				  enum mat_snap_section_type type)
+{
+	int err;
+
+	if ((int)type == w->section)
+		return 0;
+
+	if ((int)type < w->section)
+		return -EINVAL;
+
+	err = mat_snap_pad(w);
+	if (err)
+		return err;
+
+	w->section = (int)type;
+	w->hdr.sections[type].offset = w->offset;
+	return 0;
+}
+
+/* Write the attribute built in @msg after its netlink header */
+static int mat_snap_emit(struct mat_snap_writer *w,
+			 enum mat_snap_section_type type, struct nl_msg *msg)
+{
+	struct nlmsghdr *nlh = nlmsg_hdr(msg);
+	size_t len = nlh->nlmsg_len - NLMSG_HDRLEN;
+
+	if (!len)
+		return 0;
+
+	if (fwrite(nlmsg_data(nlh), 1, len, w->fp) != len)
+		return -EIO;
+
+	w->offset += len;
+	w->hdr.sections[type].length += len;
+	return 0;
+}
+
+static struct nl_msg *mat_snap_msg_alloc(void)
+{
+	struct nl_msg *msg;
+
+	msg = nlmsg_alloc_size(MAT_SNAP_MSG_SIZE);
+	if (!msg)
+		return NULL;
+
+	if (!nlmsg_put(msg, 0, 0, NLMSG_MIN_TYPE, 0, 0)) {
+		nlmsg_free(msg);
+		return NULL;
+	}
+
+	return msg;
+}
+
+/*
+ * mat_snap_writer_open() - start writing a snapshot
+ * @path: the snapshot file
+ * @writer: set to the new writer on success
+ *
+ * The snapshot is written to a temporary file next to @path and only
+ * replaces @path once mat_snap_writer_close() succeeds.
+ *
+ * Return: 0 on success or a negative error code
+ */
+int mat_snap_writer_open(const char *path, struct mat_snap_writer **writer)
+{
+	struct mat_snap_writer *w;
+	size_t len = strlen(path);
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return -ENOMEM;
+
+	w->path = strdup(path);
+	w->tmp_path = malloc(len + sizeof(".tmp"));
+	if (!w->path || !w->tmp_path)
+		goto nomem;
+
+	memcpy(w->tmp_path, path, len);
+	memcpy(w->tmp_path + len, ".tmp", sizeof(".tmp"));
+
+	w->fp = fopen(w->tmp_path, "w");
+	if (!w->fp) {
+		int err = -errno;
+
+		MAT_LOG(ERR, "Error: cannot create %s: %s\n",
+			w->tmp_path, strerror(errno));
+		free(w->tmp_path);
+		free(w->path);
+		free(w);
+		return err;
+	}
+
+	memcpy(w->hdr.magic, MAT_SNAP_MAGIC, sizeof(MAT_SNAP_MAGIC));
+	w->hdr.version = MAT_SNAP_VERSION;
+	w->hdr.byte_order = MAT_SNAP_BYTE_ORDER;
+	w->hdr.header_len = sizeof(w->hdr);
+	w->hdr.nsections = __MAT_SNAP_SEC_MAX;
+	w->section = -1;
+
+	/* the header is rewritten with the section table on close */
+	if (fwrite(&w->hdr, sizeof(w->hdr), 1, w->fp) != 1) {
+		mat_snap_writer_abort(w);
+		return -EIO;
+	}
+	w->offset = sizeof(w->hdr);
+
+	*writer = w;
+	return 0;
+
+nomem:
+	free(w->tmp_path);
+	free(w->path);
+	free(w);
+	return -ENOMEM;
+}
+
+int mat_snap_write_tables(struct mat_snap_writer *w, struct net_mat_tbl *tables)
+{
+	struct nl_msg *msg;
+	struct nlattr *nest;
+	int i, err;
+
+	err = mat_snap_section_begin(w, MAT_SNAP_SEC_TABLES);
+	if (err)
+		return err;
+
+	for (i = 0; tables && tables[i].uid; i++) {
+		msg = mat_snap_msg_alloc();
+		if (!msg)
+			return -ENOMEM;
+
+		nest = nla_nest_start(msg, NET_MAT_TABLE);
+		if (!nest || match_put_table(msg, &tables[i])) {
+			nlmsg_free(msg);
+			return -EMSGSIZE;
+		}
+		nla_nest_end(msg, nest);
+
+		err = mat_snap_emit(w, MAT_SNAP_SEC_TABLES, msg);
+		nlmsg_free(msg);
+		if (err)
+			return err;
+
+		w->hdr.sections[MAT_SNAP_SEC_TABLES].count++;
+	}
+
+	return 0;
+}
+
+/*
+ * mat_snap_write_rules() - append rules to the snapshot
+ * @w: the snapshot writer
+ * @rules: rules to append
+ * @count: number of entries in @rules
+ *
+ * May be called repeatedly, for example once per table, as long as no
+ * ports were written yet. Rules are packed into NET_MAT_RULES_COMPACT
+ * attributes that each hold as many rules as the 16 bit attribute
+ * length allows.
+ *
+ * Return: 0 on success or a negative error code
+ */
+int mat_snap_write_rules(struct mat_snap_writer *w, struct net_mat_rule *rules,
+			 unsigned int count)
+{
+	struct nl_msg *msg = NULL;
+	struct nlattr *attr = NULL;
+	unsigned int i = 0, packed = 0;
+	int err;
+
+	err = mat_snap_section_begin(w, MAT_SNAP_SEC_RULES);
+	if (err)
+		return err;
+
+	while (i < count) {
+		if (!msg) {
+			msg = mat_snap_msg_alloc();
+			if (!msg)
+				return -ENOMEM;
+
+			attr = match_put_rules_compact_start(msg);
+			if (!attr) {
+				nlmsg_free(msg);
+				return -EMSGSIZE;
+			}
+			packed = 0;
+		}
+
+		err = match_put_rule_compact(msg, attr, &rules[i]);
+		if (err == -EMSGSIZE && packed) {
+			/* attribute is full, write it and start another */
+			match_put_rules_compact_end(msg, attr);
+			err = mat_snap_emit(w, MAT_SNAP_SEC_RULES, msg);
+			nlmsg_free(msg);
+			msg = NULL;
+			if (err)
+				return err;
+			continue;
+		}
+		if (err) {
+			MAT_LOG(ERR, "Error: cannot encode rule %u table %u\n",
+				rules[i].uid, rules[i].table_id);
+			nlmsg_free(msg);
+			return err;
+		}
+
+		w->hdr.sections[MAT_SNAP_SEC_RULES].count++;
+		packed++;
+		i++;
+	}
+
+	if (msg) {
+		match_put_rules_compact_end(msg, attr);
+		err = mat_snap_emit(w, MAT_SNAP_SEC_RULES, msg);
+		nlmsg_free(msg);
+	}
+
+	return err;
+}
+
+int mat_snap_write_ports(struct mat_snap_writer *w, struct net_mat_port *ports)
+{
+	struct net_mat_port port;
+	struct nl_msg *msg;
+	struct nlattr *nest;
+	int i, err;
+
+	err = mat_snap_section_begin(w, MAT_SNAP_SEC_PORTS);
+	if (err)
+		return err;
+
+	for (i = 0; ports && ports[i].port_id != NET_MAT_PORT_ID_UNSPEC; i++) {
+		msg = mat_snap_msg_alloc();
+		if (!msg)
+			return -ENOMEM;
+
+		/* counters are state, not configuration */
+		port = ports[i];
+		memset(&port.stats, 0, sizeof(port.stats));
+
+		nest = nla_nest_start(msg, NET_MAT_PORT);
+		if (!nest || match_put_port(msg, &port)) {
+			nlmsg_free(msg);
+			return -EMSGSIZE;
+		}
+		nla_nest_end(msg, nest);
+
+		err = mat_snap_emit(w, MAT_SNAP_SEC_PORTS, msg);
+		nlmsg_free(msg);
+		if (err)
+			return err;
+
+		w->hdr.sections[MAT_SNAP_SEC_PORTS].count++;
+	}
+
+	return 0;
+}
+
+static void mat_snap_writer_free(struct mat_snap_writer *w)
+{
+	free(w->tmp_path);
+	free(w->path);
+	free(w);
+}
+
+/*
+ * mat_snap_writer_close() - finish a snapshot and move it into place
+ * @w: the snapshot writer, freed by this call
+ *
+ * Return: 0 on success or a negative error code, in which case the
+ *         previous file at the snapshot path is left untouched
+ */
+int mat_snap_writer_close(struct mat_snap_writer *w)
+{
+	int err = 0;
+
+	if (fseek(w->fp, 0, SEEK_SET) ||
+	    fwrite(&w->hdr, sizeof(w->hdr), 1, w->fp) != 1 ||
+	    fflush(w->fp) || fsync(fileno(w->fp)))
+		err = -EIO;
+
+	if (fclose(w->fp))
+		err = -EIO;
+
+	if (!err && rename(w->tmp_path, w->path))
+		err = -errno;
+
+	if (err) {
+		MAT_LOG(ERR, "Error: cannot write %s\n", w->path);
+		unlink(w->tmp_path);
+	}
+
+	mat_snap_writer_free(w);
+	return err;
+}
+
+void mat_snap_writer_abort(struct mat_snap_writer *w)
+{
+	if (!w)
+		return;
+
+	fclose(w->fp);
+	unlink(w->tmp_path);
+	mat_snap_writer_free(w);
+}
+
+static int mat_snap_validate(struct mat_snap *snap)
+{
+	struct mat_snap_header *hdr = &snap->hdr;
+	struct mat_snap_section *sec;
+	struct nlattr *attr;
+	unsigned int i;
+	int rem;
+
+	if (snap->len < sizeof(*hdr))
+		return -EINVAL;
+
+	memcpy(hdr, snap->base, sizeof(*hdr));
+
+	if (memcmp(hdr->magic, MAT_SNAP_MAGIC, sizeof(MAT_SNAP_MAGIC))) {
+		MAT_LOG(ERR, "Error: not a snapshot file\n");
+		return -EINVAL;
+	}
+
+	if (hdr->byte_order != MAT_SNAP_BYTE_ORDER) {
+		MAT_LOG(ERR, "Error: snapshot has a foreign byte order\n");
+		return -EINVAL;
+	}
+
+	if (hdr->version != MAT_SNAP_VERSION ||
+	    hdr->header_len != sizeof(*hdr) ||
+	    hdr->nsections != __MAT_SNAP_SEC_MAX) {
+		MAT_LOG(ERR, "Error: unsupported snapshot version %u\n",
+			hdr->version);
+		return -EPROTONOSUPPORT;
+	}
+
+	for (i = 0; i < __MAT_SNAP_SEC_MAX; i++) {
+		sec = &hdr->sections[i];
+
+		if (!sec->length)
+			continue;
+
+		if (sec->offset < sizeof(*hdr) || sec->offset > snap->len ||
+		    sec->length > snap->len - sec->offset ||
+		    sec->length > INT_MAX || sec->offset & 7)
+			return -EINVAL;
+
+		/* every attribute must lie within the section */
+		rem = (int)sec->length;
+		attr = (struct nlattr *)((char *)snap->base + sec->offset);
+		while (nla_ok(attr, rem))
+			attr = nla_next(attr, &rem);
+		if (rem)
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * mat_snap_open() - map a snapshot file
+ * @path: the snapshot file
+ * @snap: set to the mapped snapshot on success
+ *
+ * Return: 0 on success or a negative error code
+ */
+int mat_snap_open(const char *path, struct mat_snap **snap)
+{
+	struct mat_snap *s;
+	struct stat st;
+	int fd, err;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		err = -errno;
+		MAT_LOG(ERR, "Error: cannot open %s: %s\n", path, strerror(errno));
+		return err;
+	}
+
+	if (fstat(fd, &st)) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s) {
+		close(fd);
+		return -ENOMEM;
+	}
+
+	s->len = (size_t)st.st_size;
+	s->base = s->len ? mmap(NULL, s->len, PROT_READ, MAP_PRIVATE, fd, 0) :
+			   MAP_FAILED;
+	close(fd);
+	if (s->base == MAP_FAILED) {
+		free(s);
+		return -EINVAL;
+	}
+
+	err = mat_snap_validate(s);
+	if (err) {
+		MAT_LOG(ERR, "Error: %s is not a valid snapshot\n", path);
+		mat_snap_close(s);
+		return err;
+	}
+
+	*snap = s;
+	return 0;
+}
+
+void mat_snap_close(struct mat_snap *snap)
+{
+	if (!snap)
+		return;
+
+	munmap(snap->base, snap->len);
+	free(snap);
+}
+
+unsigned int mat_snap_count(struct mat_snap *snap,
+			    enum mat_snap_section_type type)
+{
+	if (type >= __MAT_SNAP_SEC_MAX)
+		return 0;
+
+	return snap->hdr.sections[type].count;
+}
+
+static struct nlattr *mat_snap_section(struct mat_snap *snap,
+				       enum mat_snap_section_type type,
+				       int *len)
+{
+	struct mat_snap_section *sec = &snap->hdr.sections[type];
+
+	*len = (int)sec->length;
+	return (struct nlattr *)((char *)snap->base + sec->offset);
+}
+
+/*
+ * mat_snap_get_tables() - decode the tables of a snapshot
+ * @snap: the snapshot
+ * @tables: set to an array terminated by a zero uid, owned by the caller
+ *          and freed with match_free_tables()
+ *
+ * Return: 0 on success or a negative error code
+ */
+int mat_snap_get_tables(struct mat_snap *snap, struct net_mat_tbl **tables)
+{
+	unsigned int count = mat_snap_count(snap, MAT_SNAP_SEC_TABLES), i = 0;
+	struct net_mat_tbl *t;
+	struct nlattr *attr;
+	int rem, err;
+
+	t = calloc(count + 1, sizeof(*t));
+	if (!t)
+		return -ENOMEM;
+
+	attr = mat_snap_section(snap, MAT_SNAP_SEC_TABLES, &rem);
+	for (; nla_ok(attr, rem) && i < count; attr = nla_next(attr, &rem)) {
+		err = match_get_table(NULL, attr, &t[i]);
+		if (err) {
+			/* the failed table is released, t[i] ends the array */
+			match_free_tables(t);
+			return err;
+		}
+		i++;
+	}
+
+	*tables = t;
+	return 0;
+}
+
+/*
+ * mat_snap_get_ports() - decode the ports of a snapshot
+ * @snap: the snapshot
+ * @ports: set to an array terminated by NET_MAT_PORT_ID_UNSPEC, owned by
+ *         the caller
+ *
+ * Return: 0 on success or a negative error code
+ */
+int mat_snap_get_ports(struct mat_snap *snap, struct net_mat_port **ports)
+{
+	unsigned int count = mat_snap_count(snap, MAT_SNAP_SEC_PORTS), i = 0;
+	struct net_mat_port *p;
+	struct nlattr *attr;
+	int rem, err;
+
+	p = calloc(count + 1, sizeof(*p));
+	if (!p)
+		return -ENOMEM;
+
+	attr = mat_snap_section(snap, MAT_SNAP_SEC_PORTS, &rem);
+	for (; nla_ok(attr, rem) && i < count; attr = nla_next(attr, &rem)) {
+		p[i].vlan.def_priority = NET_MAT_PORT_T_DEF_PRI_UNSPEC;
+		err = match_get_port(NULL, attr, &p[i]);
+		if (err) {
+			free(p);
+			return err;
+		}
+		i++;
+	}
+	p[i].port_id = NET_MAT_PORT_ID_UNSPEC;
+
+	*ports = p;
+	return 0;
+}
+
+/*
+ * mat_snap_get_rules() - stream the rules of a snapshot in batches
+ * @snap: the snapshot
+ * @arena: arena the rules are decoded into, reset after each batch
+ * @batch: minimum number of rules handed to @fn at a time, batches are
+ *         cut on attribute boundaries so they may hold a few more
+ * @fn: called with each batch, a non-zero return stops the walk
+ * @arg: passed to @fn
+ *
+ * The rules passed to @fn are only valid for the duration of the call.
+ *
+ * Return: 0 on success, the value returned by @fn or a negative error code
+ */
+int mat_snap_get_rules(struct mat_snap *snap, struct mat_arena *arena,
+		       unsigned int batch, mat_snap_rules_fn_t fn, void *arg)
+{
+	struct net_mat_rule *rules = NULL, *chunk;
+	unsigned int n = 0, size = 0, i;
+	struct nlattr *attr;
+	int rem, err = 0;
+
+	if (!batch)
+		return -EINVAL;
+
+	attr = mat_snap_section(snap, MAT_SNAP_SEC_RULES, &rem);
+	for (; nla_ok(attr, rem); attr = nla_next(attr, &rem)) {
+		err = match_get_rules_arena(NULL, attr, arena, &chunk, NULL);
+		if (err)
+			break;
+
+		for (i = 0; chunk[i].uid; i++) {
+			if (n == size) {
+				struct net_mat_rule *tmp;
+
+				size = size ? size * 2 : batch;
+				tmp = realloc(rules, (size + 1) * sizeof(*rules));
+				if (!tmp) {
+					err = -ENOMEM;
+					goto out;
+				}
+				rules = tmp;
+			}
+			rules[n++] = chunk[i];
+		}
+
+		if (n < batch)
+			continue;
+
+		memset(&rules[n], 0, sizeof(*rules));
+		err = fn(rules, n, arg);
+		if (err)
+			goto out;
+
+		n = 0;
+		mat_arena_reset(arena);
+	}
+
+	if (!err && n) {
+		memset(&rules[n], 0, sizeof(*rules));
+		err = fn(rules, n, arg);
+	}
+
+out:
+	free(rules);
+	mat_arena_reset(arena);
+	return err;
+}
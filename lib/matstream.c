@@ -2,6 +2,8 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 #include <limits.h>
 
 #include <matlog.h>
@@ -376,6 +378,260 @@ static struct mat_stream_logger *mat_stream_logger_new(size_t logger_bufsize, in
 }
 
 
+/*
+ * The JSON stream buffers a document in memory and hands it to the FILE
+ * in large writes. Records are emitted one top-level value per line so
+ * a consumer can process a long dump as it arrives. Free-form text sent
+ * through mat_stream_printf() has no place in the document and is
+ * dropped, only the mat_json_*() emitters produce output.
+ */
+#define MAT_STREAM_JSON_BUFSIZE	65536
+#define MAT_STREAM_JSON_MAX_DEPTH	32
+
+struct mat_stream_json {
+	struct mat_stream base;
+	FILE *fp;
+	char *buf;
+	size_t len;
+	size_t capacity;
+	unsigned int depth;
+	uint32_t started;	/* bit n set once depth n holds a value */
+	unsigned int skipped;	/* scopes opened past the maximum depth */
+};
+
+
+static void mat_stream_json_drain(struct mat_stream_json *matjsp)
+{
+	if (matjsp->fp && matjsp->len)
+		fwrite(matjsp->buf, 1, matjsp->len, matjsp->fp);
+
+	matjsp->len = 0;
+}
+
+
+static void mat_stream_json_write(struct mat_stream_json *matjsp,
+				  const char *s, size_t n)
+{
+	if (matjsp->len + n > matjsp->capacity) {
+		mat_stream_json_drain(matjsp);
+		if (n > matjsp->capacity) {
+			if (matjsp->fp)
+				fwrite(s, 1, n, matjsp->fp);
+			return;
+		}
+	}
+
+	memcpy(matjsp->buf + matjsp->len, s, n);
+	matjsp->len += n;
+}
+
+
+static void mat_stream_json_putc(struct mat_stream_json *matjsp, char c)
+{
+	if (matjsp->len == matjsp->capacity)
+		mat_stream_json_drain(matjsp);
+
+	matjsp->buf[matjsp->len++] = c;
+}
+
+
+static void mat_stream_json_quote(struct mat_stream_json *matjsp,
+				  const char *s)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char *run = s;
+	char esc[6];
+
+	mat_stream_json_putc(matjsp, '"');
+
+	for (; *s; s++) {
+		unsigned char c = (unsigned char)*s;
+
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+
+		mat_stream_json_write(matjsp, run, (size_t)(s - run));
+		run = s + 1;
+
+		esc[0] = '\\';
+		switch (c) {
+		case '"':
+		case '\\':
+			esc[1] = (char)c;
+			mat_stream_json_write(matjsp, esc, 2);
+			break;
+		case '\n':
+			mat_stream_json_write(matjsp, "\\n", 2);
+			break;
+		case '\t':
+			mat_stream_json_write(matjsp, "\\t", 2);
+			break;
+		default:
+			esc[1] = 'u';
+			esc[2] = '0';
+			esc[3] = '0';
+			esc[4] = hex[c >> 4];
+			esc[5] = hex[c & 0xf];
+			mat_stream_json_write(matjsp, esc, sizeof(esc));
+			break;
+		}
+	}
+
+	mat_stream_json_write(matjsp, run, (size_t)(s - run));
+	mat_stream_json_putc(matjsp, '"');
+}
+
+
+/* Separate a value from its predecessor and write its key, if any */
+static void mat_stream_json_member(struct mat_stream_json *matjsp,
+				   const char *key)
+{
+	uint32_t bit = 1U << matjsp->depth;
+
+	if (matjsp->depth) {
+		if (matjsp->started & bit)
+			mat_stream_json_putc(matjsp, ',');
+
+		if (key) {
+			mat_stream_json_quote(matjsp, key);
+			mat_stream_json_putc(matjsp, ':');
+		}
+	}
+
+	matjsp->started |= bit;
+}
+
+
+/* One top-level value per line */
+static void mat_stream_json_record_end(struct mat_stream_json *matjsp)
+{
+	if (!matjsp->depth)
+		mat_stream_json_putc(matjsp, '\n');
+}
+
+
+static void mat_stream_json_flush(struct mat_stream *matsp)
+{
+	struct mat_stream_json *matjsp = (struct mat_stream_json *)matsp;
+
+
+	if (!matsp || !matsp->op || (mat_stream_json_flush != matsp->op->flush))
+		return;
+
+	mat_stream_json_drain(matjsp);
+	if (matjsp->fp)
+		fflush(matjsp->fp);
+}
+
+
+static void mat_stream_json_close(struct mat_stream *matsp)
+{
+	struct mat_stream_json *matjsp = (struct mat_stream_json *)matsp;
+	FILE *fp;
+
+	if (!matsp || !matsp->op || (mat_stream_json_close != matsp->op->close))
+		return;
+
+	mat_stream_json_drain(matjsp);
+
+	fp = matjsp->fp;
+	matjsp->fp = NULL;
+
+	if (fp && (fp != stdout) && (fp != stderr))
+		fclose(fp);
+}
+
+
+static void mat_stream_json_open(struct mat_stream *matsp, const char *name)
+{
+	struct mat_stream_json *matjsp = (struct mat_stream_json *)matsp;
+
+	if (!matsp || !matsp->op || (mat_stream_json_open != matsp->op->open))
+		return;
+
+	matjsp->fp = fopen(name, "w");
+	matjsp->len = 0;
+	matjsp->depth = 0;
+	matjsp->started = 0;
+	matjsp->skipped = 0;
+}
+
+
+static FILE *mat_stream_json_get_fp(struct mat_stream *matsp)
+{
+	struct mat_stream_json *matjsp = (struct mat_stream_json *)matsp;
+
+
+	if (!matsp || !matsp->op || (mat_stream_json_get_fp != matsp->op->get_fp))
+		return NULL;
+
+	return matjsp->fp;
+}
+
+
+static void mat_stream_json_vprintf(struct mat_stream *matsp __unused,
+				    const char *format __unused,
+				    va_list args __unused)
+{
+}
+
+
+static void mat_stream_json_printf(struct mat_stream *matsp __unused,
+				   const char *format __unused, ...)
+{
+}
+
+
+static void mat_stream_json_delete(struct mat_stream *matsp)
+{
+	struct mat_stream_json *matjsp = (struct mat_stream_json *)matsp;
+
+
+	if (!matsp || !matsp->op || (mat_stream_json_delete != matsp->op->delete))
+		return;
+
+	mat_stream_json_drain(matjsp);
+	if (matjsp->fp)
+		fflush(matjsp->fp);
+
+	free(matjsp->buf);
+	free(matjsp);
+}
+
+
+static const struct mat_stream_operations mat_stream_json_ops = {
+	.delete = mat_stream_json_delete,
+	.open = mat_stream_json_open,
+	.close = mat_stream_json_close,
+	.get_fp = mat_stream_json_get_fp,
+	.printf = mat_stream_json_printf,
+	.vprintf = mat_stream_json_vprintf,
+	.flush = mat_stream_json_flush
+};
+
+static struct mat_stream_json *mat_stream_json_new(FILE *fp, size_t bufsize)
+{
+	struct mat_stream_json *matjsp;
+
+	matjsp = calloc(1, sizeof(*matjsp));
+	if (!matjsp)
+		return NULL;
+
+	matjsp->buf = malloc(bufsize);
+	if (!matjsp->buf) {
+		free(matjsp);
+		return NULL;
+	}
+
+	mat_stream_construct(&matjsp->base, &mat_stream_json_ops, NULL);
+
+	matjsp->fp = fp;
+	matjsp->capacity = bufsize;
+
+	return matjsp;
+}
+
+
 static struct mat_stream *mat_stream_create(FILE *fp, int verbose,
 					    size_t logger_bufsize,
 					    struct mat_stream_operations *op __unused,
@@ -424,6 +680,161 @@ struct mat_stream *mat_stream_logger(void)
 	return _matstream_logger;
 }
 
+struct mat_stream *mat_stream_file(FILE *fp)
+{
+	if (!fp)
+		return NULL;
+
+	return mat_stream_create(fp, true, 0, NULL, NULL);
+}
+
+struct mat_stream *mat_stream_json(FILE *fp)
+{
+	struct mat_stream_json *matjsp;
+
+	if (!fp)
+		return NULL;
+
+	matjsp = mat_stream_json_new(fp, MAT_STREAM_JSON_BUFSIZE);
+	if (!matjsp)
+		return NULL;
+
+	return &matjsp->base;
+}
+
+bool mat_stream_is_json(struct mat_stream *matsp)
+{
+	return matsp && matsp->op == &mat_stream_json_ops;
+}
+
+void mat_stream_delete(struct mat_stream *matsp)
+{
+	if (!matsp || !matsp->op || !matsp->op->delete)
+		return;
+
+	matsp->op->delete(matsp);
+}
+
+
+static struct mat_stream_json *mat_json_get(struct mat_stream *matsp)
+{
+	return mat_stream_is_json(matsp) ? (struct mat_stream_json *)matsp : NULL;
+}
+
+static void mat_json_open_scope(struct mat_stream *matsp, const char *key,
+				char c)
+{
+	struct mat_stream_json *matjsp = mat_json_get(matsp);
+
+	if (!matjsp)
+		return;
+
+	/* scopes too deep are dropped with everything in them */
+	if (matjsp->skipped || matjsp->depth + 1 >= MAT_STREAM_JSON_MAX_DEPTH) {
+		if (!matjsp->skipped++)
+			MAT_LOG(ERR, "json nesting deeper than %d\n",
+				MAT_STREAM_JSON_MAX_DEPTH);
+		return;
+	}
+
+	mat_stream_json_member(matjsp, key);
+	mat_stream_json_putc(matjsp, c);
+	matjsp->depth++;
+	matjsp->started &= ~(1U << matjsp->depth);
+}
+
+static void mat_json_close_scope(struct mat_stream *matsp, char c)
+{
+	struct mat_stream_json *matjsp = mat_json_get(matsp);
+
+	if (!matjsp)
+		return;
+
+	/* the close of a dropped scope */
+	if (matjsp->skipped) {
+		matjsp->skipped--;
+		return;
+	}
+
+	if (!matjsp->depth)
+		return;
+
+	matjsp->depth--;
+	mat_stream_json_putc(matjsp, c);
+	mat_stream_json_record_end(matjsp);
+}
+
+void mat_json_object_start(struct mat_stream *matsp, const char *key)
+{
+	mat_json_open_scope(matsp, key, '{');
+}
+
+void mat_json_object_end(struct mat_stream *matsp)
+{
+	mat_json_close_scope(matsp, '}');
+}
+
+void mat_json_array_start(struct mat_stream *matsp, const char *key)
+{
+	mat_json_open_scope(matsp, key, '[');
+}
+
+void mat_json_array_end(struct mat_stream *matsp)
+{
+	mat_json_close_scope(matsp, ']');
+}
+
+void mat_json_string(struct mat_stream *matsp, const char *key,
+		     const char *value)
+{
+	struct mat_stream_json *matjsp = mat_json_get(matsp);
+
+	if (!matjsp || matjsp->skipped)
+		return;
+
+	mat_stream_json_member(matjsp, key);
+	if (value)
+		mat_stream_json_quote(matjsp, value);
+	else
+		mat_stream_json_write(matjsp, "null", 4);
+	mat_stream_json_record_end(matjsp);
+}
+
+void mat_json_uint(struct mat_stream *matsp, const char *key, uint64_t value)
+{
+	struct mat_stream_json *matjsp = mat_json_get(matsp);
+	char digits[20];
+	size_t n = sizeof(digits);
+
+	if (!matjsp || matjsp->skipped)
+		return;
+
+	do {
+		digits[--n] = (char)('0' + value % 10);
+		value /= 10;
+	} while (value);
+
+	mat_stream_json_member(matjsp, key);
+	mat_stream_json_write(matjsp, digits + n, sizeof(digits) - n);
+	mat_stream_json_record_end(matjsp);
+}
+
+void mat_json_bool(struct mat_stream *matsp, const char *key, bool value)
+{
+	struct mat_stream_json *matjsp = mat_json_get(matsp);
+
+	if (!matjsp || matjsp->skipped)
+		return;
+
+	mat_stream_json_member(matjsp, key);
+	if (value)
+		mat_stream_json_write(matjsp, "true", 4);
+	else
+		mat_stream_json_write(matjsp, "false", 5);
+	mat_stream_json_record_end(matjsp);
+}
+
+
 
 void mat_stream_vprintf(struct mat_stream *matsp, const char *format, va_list args)
 {
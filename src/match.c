@@ -35,9 +35,12 @@
 #include <sys/socket.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <time.h>
+#include <pthread.h>
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -53,7 +56,9 @@
 #include "if_match.h"
 #include "matchlib.h"
 #include "matchlib_nl.h"
+#include "matlog.h"
 #include "match_version.h"
+#include "matsnap.h"
 
 #ifdef PRIx64
 #undef PRIx64
@@ -70,8 +75,26 @@
 #define SCNu64	"llu"
 #endif /* SCNu64 */
 
+/* Commands implemented by the CLI on top of several netlink commands */
+enum {
+	MATCH_CMD_SNAPSHOT = NET_MAT_CMD_MAX + 1,
+	MATCH_CMD_BATCH,
+	MATCH_CMD_BENCH,
+	MATCH_CMD_TOP,
+	MATCH_CMD_APPLY,
+};
+
+/* Rules restored per bulk request when loading a snapshot */
+#define MATCH_SNAPSHOT_BATCH 4096
+
+/* Consecutive batch file rules coalesced into one bulk request */
+#define MATCH_BATCH_RULES 1024
+/* Most words accepted on one batch file line */
+#define MATCH_BATCH_MAX_ARGS 512
+
 static struct nl_sock *nsd;
 static char *progname;
+static struct mat_stream *json_stream;
 
 static int
 get_match_arg(int argc, char **argv, bool need_value, bool need_mask_type,
@@ -105,8 +128,38 @@ static int
 match_send_recv(int verbose, uint32_t pid, int family, uint32_t ifindex,
 		uint8_t cmd);
 
+static int
+match_monitor_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
+		   int argc, char **argv);
+
+static int
+match_snapshot_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
+		    int argc, char **argv);
+
+static int
+match_bench_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
+		 int argc, char **argv);
+
+static int
+match_top_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
+	       int argc, char **argv);
+
+static int
+match_apply_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
+		 int argc, char **argv);
+
+static int
+match_flight_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
+		  int argc, char **argv);
+
+static int
+match_stats_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
+		 int argc, char **argv);
+
 static bool is_valid_keyword(char **argv, const char **valid_keyword_list);
 
+static int parse_arg_u32(char *argv, uint32_t *val);
+
 static unsigned long long field_max_value(const struct net_mat_field *field);
 
 static void match_usage(void)
@@ -116,8 +169,11 @@ static void match_usage(void)
 	printf("Options:\n");
 	printf("  -f FAMILY  netlink family\n");
 	printf("  -g         display graphs in DOT format\n");
+	printf("  -b FILE    run the commands in FILE, one per line, - for stdin\n");
 	printf("  -h         display this help message and exit\n");
+	printf("  -j         print rules, tables and ports as JSON, one object per line\n");
 	printf("  -p PID     pid of userspace match daemon\n");
+	printf("  -r BURST[/MS]  log at most BURST errors per call site every MS (default: 5000)\n");
 	printf("  -s         silence verbose printing\n");
 	printf("  --version  display Match interface version and exit\n");
 	printf("\n");
@@ -138,6 +194,13 @@ static void match_usage(void)
 	printf("  phys_port_lookup  display logical port to physical port map\n");
 	printf("  get_ports         display logical port info\n");
 	printf("  set_port          set port attribute\n");
+	printf("  monitor           display rule, table and port change events\n");
+	printf("  snapshot          save or load tables, rules and ports to a file\n");
+	printf("  bench             measure rule install, update, dump and delete rates\n");
+	printf("  top               display the busiest rules and ports\n");
+	printf("  apply             converge tables to the rules listed in a file\n");
+	printf("  flight            display the last operations of the daemon\n");
+	printf("  get_stats         display daemon counters and command latencies\n");
 }
 
 static void create_usage(void)
@@ -230,10 +293,18 @@ static void set_rule_usage(void)
 static void get_rules_usage(void)
 {
 	printf("Usage: %s get_rules table NUM [min NUM] [max NUM]\n", progname);
+	printf("          [match MATCH]... [action ACTION] [min_packets NUM]\n");
+	printf("          [top NUM [by packets|bytes|rate]]\n");
 	printf("Where:\n");
 	printf("  table  is the table id from which to get the rules\n");
 	printf("  min    is the minimum rule id in a range of rule ids\n");
 	printf("  max    is the maximum rule id in a range of rule ids\n");
+	printf("  match  only shows rules with this field value, as in set_rule\n");
+	printf("  action only shows rules applying this action\n");
+	printf("  min_packets only shows rules which matched at least NUM packets\n");
+	printf("  top    only shows the NUM busiest rules, busiest first\n");
+	printf("  by     ranks the rules by packets (default), bytes or packets\n");
+	printf("         per second\n");
 }
 
 static void get_lport_usage(void)
@@ -260,6 +331,83 @@ static void get_port_usage(void)
 	printf(" max	is the last port to print\n");
 }
 
+static void monitor_usage(void)
+{
+	printf("Usage: %s monitor [rules] [tables] [ports]\n", progname);
+	printf("Where:\n");
+	printf(" rules	display rules added to or deleted from tables\n");
+	printf(" tables	display tables created, updated or destroyed\n");
+	printf(" ports	display port state changes\n");
+	printf("Note: all events are displayed when no class is given\n");
+}
+
+static void snapshot_usage(void)
+{
+	printf("Usage: %s snapshot save|load FILE\n", progname);
+	printf("Where:\n");
+	printf(" save	write the tables, rules and ports of the pipeline to FILE\n");
+	printf(" load	create the tables, rules and ports stored in FILE\n");
+}
+
+static void bench_usage(void)
+{
+	printf("Usage: %s bench table ID [rules NUM] [start UID] [batch NUM] "
+	       "[threads NUM] [keys seq|random] [seed NUM] [prio_spread NUM] "
+	       "[ops OP[,OP...]]\n", progname);
+	printf("Where:\n");
+	printf(" table	is the table the synthetic rules are generated for\n");
+	printf(" rules	is the number of rules, default 1000\n");
+	printf(" start	is the uid of the first rule, default 1\n");
+	printf(" batch	is the number of rules per request, default 1\n");
+	printf(" threads	is the number of concurrent clients, default 1\n");
+	printf(" keys	generates sequential or random match values, default seq\n");
+	printf(" seed	seeds random match values, default 1\n");
+	printf(" prio_spread	is the number of distinct priorities, default 1\n");
+	printf(" ops	is a list of set, update, get and del, default all in this order\n");
+}
+
+static void top_usage(void)
+{
+	printf("Usage: %s top [table ID] [interval MSECS] [top NUM] [count NUM] "
+	       "[rules|ports] [sort pps|bps] [format text|csv]\n", progname);
+	printf("Where:\n");
+	printf(" table	only displays rules of this table, default all tables\n");
+	printf(" interval	is the time between two samples, default 1000\n");
+	printf(" top	is the number of rules and ports displayed, default 20\n");
+	printf(" count	stops after this many samples, default never\n");
+	printf(" rules	only displays rules\n");
+	printf(" ports	only displays ports\n");
+	printf(" sort	orders by packets or bytes per second, default pps\n");
+	printf(" format	refreshes a text view or streams CSV rows, default text\n");
+	printf("Note: -j streams one JSON object per rule and port instead\n");
+}
+
+static void apply_usage(void)
+{
+	printf("Usage: %s apply [table ID]... [dry-run] FILE\n", progname);
+	printf("Where:\n");
+	printf(" table	only converges this table, may be repeated, default all tables\n");
+	printf(" dry-run	prints the changes without applying them\n");
+	printf(" FILE	is a snapshot or lists one set_rule per line, - for stdin\n");
+	printf("Note: rules of the converged tables missing from FILE are deleted\n");
+}
+
+static void flight_usage(void)
+{
+	printf("Usage: %s flight [file FILE] [thread NUM] [last NUM] [errors]\n", progname);
+	printf("Where:\n");
+	printf(" file	decodes a dump written by matchd on SIGUSR1 instead of querying it\n");
+	printf(" thread	only displays events recorded by this daemon thread\n");
+	printf(" last	only displays this many of the most recent events\n");
+	printf(" errors	only displays failed operations\n");
+}
+
+static void stats_usage(void)
+{
+	printf("Usage: %s get_stats [prom FILE]\n", progname);
+	printf("Where:\n");
+	printf(" prom	writes the counters in the Prometheus text format to FILE, - for stdout\n");
+}
 
 static void set_port_usage(void)
 {
@@ -469,6 +617,9 @@ static unsigned long long field_max_value(const struct net_mat_field *field)
 	if (field->bitwidth > 64)
 		return 0;
 
+	if (field->bitwidth == 64)
+		return ~0ULL;
+
 	value_max = ((1ULL << field->bitwidth) - 1);
 
 	return value_max;
@@ -1049,8 +1200,24 @@ done:
 
 static void match_set_match_nl_verbose_and_streamer(int verbose)
 {
+	struct mat_stream *streamer = json_stream;
+
+	if (!streamer)
+		streamer = mat_stream_stdout();
+
 	match_nl_set_verbose(verbose);
-	match_nl_set_streamer((verbose > 0) ? mat_stream_stdout() : NULL);
+	match_nl_set_streamer((verbose > 0) ? streamer : NULL);
+}
+
+/*
+ * match_socket_open() - open the generic netlink socket with MATCH api
+ *
+ * The socket is only opened once, batch mode runs every command over it.
+ */
+static void match_socket_open(void)
+{
+	if (!nsd)
+		nsd = match_nl_get_socket();
 }
 
 #define MAX_MATCHES 50
@@ -1113,7 +1280,7 @@ match_destroy_tbl_send(int verbose, uint32_t pid, int family,
 		} else {
 			fprintf(stderr, "Error: unexpected argument `%s`\n", *argv);
 			destroy_usage();
-			exit(-1);
+			return -EINVAL;
 		}
 		argc--; argv++;
 	}
@@ -1121,7 +1288,7 @@ match_destroy_tbl_send(int verbose, uint32_t pid, int family,
 	if (err < 0) {
 		printf("Invalid argument\n");
 		destroy_usage();
-		exit(-1);
+		return -EINVAL;
 	}
 
 	if (!(table.name || table.uid)) {
@@ -1170,8 +1337,7 @@ match_destroy_tbl_send(int verbose, uint32_t pid, int family,
 	pp_table(mat_stream_stdout(), &table);
 
 	/* open generic netlink socket with match table api */
-	nsd = nl_socket_alloc();
-	nl_connect(nsd, NETLINK_GENERIC);
+	match_socket_open();
 
 	match_set_match_nl_verbose_and_streamer(verbose);
 
@@ -1440,7 +1606,7 @@ match_create_tbl_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 				create_usage();
 			else
 				update_usage();
-			exit(-1);
+			return -EINVAL;
 		}
 		argc--; argv++;
 	}
@@ -1448,7 +1614,7 @@ match_create_tbl_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 	if (!table.uid && cmd == NET_MAT_TABLE_CMD_UPDATE_TABLE) {
 		fprintf(stderr, "Error table id is required for update\n");
 		update_usage();
-		exit(-1);
+		return -EINVAL;
 	}
 
 	if (!table.uid) {
@@ -1462,19 +1628,19 @@ match_create_tbl_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 	if (!table.source && cmd == NET_MAT_TABLE_CMD_CREATE_TABLE) {
 		fprintf(stderr, "Error: source is required\n");
 		create_usage();
-		exit(-1);
+		return -EINVAL;
 	}
 
 	if (table.source && cmd == NET_MAT_TABLE_CMD_UPDATE_TABLE) {
 		fprintf(stderr, "Error: source is not a valid argument\n");
 		update_usage();
-		exit(-1);
+		return -EINVAL;
 	}
 
 	if (!table.name && cmd == NET_MAT_TABLE_CMD_CREATE_TABLE) {
 		fprintf(stderr, "Error: name is required\n");
 		create_usage();
-		exit(-1);
+		return -EINVAL;
 	}
 
 	if (!table.name && cmd == NET_MAT_TABLE_CMD_UPDATE_TABLE)
@@ -1483,33 +1649,32 @@ match_create_tbl_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 	if (!table.size && cmd == NET_MAT_TABLE_CMD_CREATE_TABLE) {
 		fprintf(stderr, "Error: size is required\n");
 		create_usage();
-		exit(-1);
+		return -EINVAL;
 	}
 
 	if (table.size && cmd == NET_MAT_TABLE_CMD_UPDATE_TABLE) {
 		fprintf(stderr, "Error: size can not be changed\n");
 		update_usage();
-		exit(-1);
+		return -EINVAL;
 	}
 
 	if (!attrib_count && cmd == NET_MAT_TABLE_CMD_UPDATE_TABLE) {
 		fprintf(stderr, "Error: no attributes specified for update\n");
 		update_usage();
-		exit(-1);
+		return -EINVAL;
 	}
 
 	if (cmd == NET_MAT_TABLE_CMD_CREATE_TABLE &&
 	    get_table_id(table.name)) {
 		fprintf(stderr, "Error: table \"%s\" already exists\n",
 			table.name);
-		exit(-1);
+		return -EINVAL;
 	}
 
 	pp_table(mat_stream_stdout(), &table);
 
 	/* open generic netlink socket with match table api */
-	nsd = nl_socket_alloc();
-	nl_connect(nsd, NETLINK_GENERIC);
+	match_socket_open();
 
 	match_set_match_nl_verbose_and_streamer(verbose);
 
@@ -1534,13 +1699,8 @@ match_create_tbl_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 	return err;
 }
 
-int
-rule_del_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
-	      int argc, char **argv)
+static int rule_del_parse(int argc, char **argv, struct net_mat_rule *rule)
 {
-	struct net_mat_rule rule = {0};
-	int err;
-
 	while (argc > 0) {
 		if (strcmp(*argv, "prio") == 0) {
 			next_arg();
@@ -1549,11 +1709,9 @@ rule_del_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 				return -EINVAL;
 			}
 
-			err = sscanf(*argv, "%u", &rule.priority);
-			if (err < 0) {
-				del_rule_usage();
+			if (sscanf(*argv, "%u", &rule->priority) != 1) {
 				fprintf(stderr, "prio argument invalid\n");
-				exit(-1);
+				return -EINVAL;
 			}
 		} else if (strcmp(*argv, "handle") == 0) {
 			next_arg();
@@ -1562,11 +1720,9 @@ rule_del_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 				return -EINVAL;
 			}
 
-			err = sscanf(*argv, "%u", &rule.uid);
-			if (err < 0) {
-				del_rule_usage();
+			if (sscanf(*argv, "%u", &rule->uid) != 1) {
 				fprintf(stderr, "handle argument invalid\n");
-				exit(-1);
+				return -EINVAL;
 			}
 		} else if (strcmp(*argv, "table") == 0) {
 			next_arg();
@@ -1575,35 +1731,43 @@ rule_del_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 				return -EINVAL;
 			}
 
-			err = sscanf(*argv, "%u", &rule.table_id);
-			if (err < 0) {
-				del_rule_usage();
+			if (sscanf(*argv, "%u", &rule->table_id) != 1) {
 				fprintf(stderr, "table argument invalid\n");
-				exit(-1);
+				return -EINVAL;
 			}
 		} else {
 			fprintf(stderr, "Error: unexpected argument `%s`\n", *argv);
-			del_rule_usage();
-			exit(-1);
+			return -EINVAL;
 		}
 		argc--; argv++;
 	}
 
-	if (!rule.table_id) {
+	if (!rule->table_id) {
 		fprintf(stderr, "Table ID required\n");
-		del_rule_usage();
-		exit(-1);
+		return -EINVAL;
 	}
 
-	if (!rule.uid) {
+	if (!rule->uid) {
 		fprintf(stderr, "Rule ID required\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int
+rule_del_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
+	      int argc, char **argv)
+{
+	struct net_mat_rule rule = {0};
+	int err;
+
+	if (rule_del_parse(argc, argv, &rule)) {
 		del_rule_usage();
-		exit(-1);
+		return -EINVAL;
 	}
 
-	/* open generic netlink socket with MATCH api */
-	nsd = nl_socket_alloc();
-	nl_connect(nsd, NETLINK_GENERIC);
+	match_socket_open();
 
 	match_set_match_nl_verbose_and_streamer(verbose);
 
@@ -1617,18 +1781,184 @@ rule_del_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 }
 
 
+/* Top rules ranked here, highest first, ties go to the lowest uid */
+static int rule_top_packets_cmp(const void *a, const void *b)
+{
+	const struct net_mat_rule *x = a, *y = b;
+
+	if (x->packets != y->packets)
+		return x->packets < y->packets ? 1 : -1;
+	return x->uid < y->uid ? -1 : x->uid > y->uid;
+}
+
+static int rule_top_bytes_cmp(const void *a, const void *b)
+{
+	const struct net_mat_rule *x = a, *y = b;
+
+	if (x->bytes != y->bytes)
+		return x->bytes < y->bytes ? 1 : -1;
+	return x->uid < y->uid ? -1 : x->uid > y->uid;
+}
+
+/*
+ * rule_get_filter_local() - get the rules passing a filter from an older
+ *                           daemon
+ *
+ * A daemon without NET_MAT_FEATURE_RULES_FILTER ignores the filter of a
+ * get rules request and one without NET_MAT_FEATURE_RULES_TOP ignores its
+ * top. The whole range is read, filtered and ranked here instead, only
+ * the rules passing the filter are printed. A rate needs the samples kept
+ * by the daemon, it can not be ranked here.
+ */
+static int
+rule_get_filter_local(int verbose, uint32_t pid, int family, uint32_t ifindex,
+		      uint32_t tableid, uint32_t min, uint32_t max,
+		      struct net_mat_rule_filter *filter)
+{
+	struct net_mat_rule *rules, *pass;
+	unsigned int i, n, count = 0;
+
+	if (filter->top && filter->top_key == NET_MAT_RULES_TOP_RATE) {
+		fprintf(stderr, "Error: daemon can not rank rules by rate\n");
+		return -EOPNOTSUPP;
+	}
+
+	/* the lib prints rules as they are received, print them once filtered */
+	match_nl_set_streamer(NULL);
+	rules = match_nl_get_rules(nsd, pid, ifindex, family, tableid, min, max);
+	if (!rules)
+		return 0;
+
+	for (n = 0; rules[n].uid; n++)
+		;
+
+	pass = calloc(n + 1, sizeof(*pass));
+	if (!pass) {
+		match_free_rules(rules, n);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (match_rule_filter(&rules[i], filter))
+			pass[count++] = rules[i];
+	}
+
+	if (filter->top) {
+		qsort(pass, count, sizeof(*pass),
+		      filter->top_key == NET_MAT_RULES_TOP_BYTES ?
+		      rule_top_bytes_cmp : rule_top_packets_cmp);
+		if (count > filter->top)
+			memset(&pass[filter->top], 0, sizeof(*pass));
+	}
+
+	if (verbose > 0)
+		pp_rules(json_stream ? json_stream : mat_stream_stdout(), pass);
+
+	free(pass);
+	match_free_rules(rules, n);
+	return 0;
+}
+
 int
 rule_get_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 	      int argc, char **argv)
 {
 	unsigned int tableid, min = 0, max = 0;
+	struct net_mat_field_ref matches[MAX_MATCHES + 1];
+	struct net_mat_rule_filter filter;
+	bool filtered = false;
+	uint32_t features = 0;
+	int match_count = 0, advance;
 	char *table = NULL;
 	int err;
 	struct net_mat_rule *rules = NULL;
+	const char *valid_keyword_list[] = {
+		"table", "min", "max", "match", "action", "min_packets",
+		"top", "by", NULL};
+
+	memset(matches, 0, sizeof(matches));
+	memset(&filter, 0, sizeof(filter));
+	filter.matches = matches;
 
 	opterr = 0;
 	while (argc > 0) {
-		if (strcmp(*argv, "table") == 0) {
+		if (strcmp(*argv, "match") == 0) {
+			if (match_count >= MAX_MATCHES) {
+				fprintf(stderr, "Error: too many matches\n");
+				return -EINVAL;
+			}
+			advance = get_match_arg(argc, argv, true, false,
+						&matches[match_count],
+						valid_keyword_list);
+			if (advance < 0) {
+				fprintf(stderr, "Error: invalid match argument\n");
+				get_rules_usage();
+				return -EINVAL;
+			}
+			match_count++;
+			filtered = true;
+			for (; advance; advance--)
+				next_arg();
+		} else if (strcmp(*argv, "action") == 0) {
+			next_arg();
+			if (*argv == NULL) {
+				fprintf(stderr, "Error: missing action\n");
+				return -EINVAL;
+			}
+
+			filter.action = find_action(*argv);
+			if (!filter.action) {
+				fprintf(stderr, "Error: unknown action `%s`\n",
+					*argv);
+				get_rules_usage();
+				return -EINVAL;
+			}
+			filtered = true;
+		} else if (strcmp(*argv, "min_packets") == 0) {
+			next_arg();
+			if (*argv == NULL) {
+				fprintf(stderr, "Error: missing min_packets\n");
+				return -EINVAL;
+			}
+
+			if (sscanf(*argv, "%" SCNu64, &filter.min_packets) != 1) {
+				fprintf(stderr, "invalid min_packets parameter\n");
+				get_rules_usage();
+				return -EINVAL;
+			}
+			filtered = true;
+		} else if (strcmp(*argv, "top") == 0) {
+			next_arg();
+			if (*argv == NULL) {
+				fprintf(stderr, "Error: missing top\n");
+				return -EINVAL;
+			}
+
+			if (sscanf(*argv, "%u", &filter.top) != 1 || !filter.top) {
+				fprintf(stderr, "invalid top parameter\n");
+				get_rules_usage();
+				return -EINVAL;
+			}
+			filtered = true;
+		} else if (strcmp(*argv, "by") == 0) {
+			next_arg();
+			if (*argv == NULL) {
+				fprintf(stderr, "Error: missing by\n");
+				return -EINVAL;
+			}
+
+			if (strcmp(*argv, "packets") == 0) {
+				filter.top_key = NET_MAT_RULES_TOP_PACKETS;
+			} else if (strcmp(*argv, "bytes") == 0) {
+				filter.top_key = NET_MAT_RULES_TOP_BYTES;
+			} else if (strcmp(*argv, "rate") == 0) {
+				filter.top_key = NET_MAT_RULES_TOP_RATE;
+			} else {
+				fprintf(stderr, "invalid by parameter\n");
+				get_rules_usage();
+				return -EINVAL;
+			}
+		} else if (strcmp(*argv, "table") == 0) {
 			next_arg();
 			if (*argv == NULL) {
 				fprintf(stderr, "Error: missing table\n");
@@ -1647,7 +1977,7 @@ rule_get_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 			if (err < 0) {
 				fprintf(stderr, "invalid min parameter\n");
 				get_rules_usage();
-				exit(-1);
+				return -EINVAL;
 			}
 		} else if (strcmp(*argv, "max") == 0) {
 			next_arg();
@@ -1660,12 +1990,12 @@ rule_get_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 			if (err < 0) {
 				fprintf(stderr, "invalid max parameter\n");
 				get_rules_usage();
-				exit(-1);
+				return -EINVAL;
 			}
 		} else {
 			fprintf(stderr, "Error: unexpected argument `%s`\n", *argv);
 			get_rules_usage();
-			exit(-1);
+			return -EINVAL;
 		}
 		argc--; argv++;
 	}
@@ -1673,57 +2003,106 @@ rule_get_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 	if  (!table) {
 		printf("Missing \"table\" argument.\n");
 		get_rules_usage();
-		exit(-1);
+		return -EINVAL;
 	}
 
-	err = sscanf(table, "%u", &tableid);
-	if (err < 0) {
+	if (filter.top_key && !filter.top) {
+		fprintf(stderr, "Error: by requires top\n");
+		get_rules_usage();
+		return -EINVAL;
+	}
+
+	if (sscanf(table, "%u", &tableid) != 1) {
 		tableid = find_table(table);
 		if (!tableid) {
 			printf("Missing \"table\" argument.\n");
 			get_rules_usage();
-			exit(-1);
+			return -EINVAL;
 		}
 	}
 
 	/* open generic netlink socket with MATCH api */
-	nsd = nl_socket_alloc();
-	nl_connect(nsd, NETLINK_GENERIC);
+	match_socket_open();
 
 	match_set_match_nl_verbose_and_streamer(verbose);
 
-	rules = match_nl_get_rules(nsd, pid, ifindex, family,
-				   tableid, min, max);
+	/* a daemon supporting it sends the rules in far fewer messages */
+	err = match_nl_set_rules_encoding(nsd, pid, ifindex, family,
+					  NET_MAT_RULES_ENC_COMPACT);
+	if (err && err != -EOPNOTSUPP) {
+		fprintf(stderr, "Error: match_nl_set_rules_encoding() failed\n");
+		return err;
+	}
+
+	if (filtered) {
+		/* a daemon predating features has none of them */
+		err = match_nl_get_features(nsd, pid, ifindex, family,
+					    &features);
+		if (err && err != -EOPNOTSUPP) {
+			fprintf(stderr, "Error: match_nl_get_features() failed\n");
+			return err;
+		}
+
+		if (!(features & NET_MAT_FEATURE_RULES_FILTER) ||
+		    (filter.top && !(features & NET_MAT_FEATURE_RULES_TOP)))
+			return rule_get_filter_local(verbose, pid, family,
+						     ifindex, tableid, min, max,
+						     &filter);
+	}
+
+	if (filtered)
+		rules = match_nl_get_rules_filter(nsd, pid, ifindex, family,
+						  tableid, min, max, &filter);
+	else
+		rules = match_nl_get_rules(nsd, pid, ifindex, family,
+					   tableid, min, max);
 	/* TODO - Free rules array including matches/actions fields */
 	(void)rules;
 
-	return err;
+	return 0;
 }
 
-int
-rule_set_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
-	int argc, char **argv)
+/* Free the matches and actions allocated by rule_set_parse(), if any */
+static void rule_free(struct net_mat_rule *rule)
 {
-	struct net_mat_field_ref matches[MAX_MATCHES];
-	struct net_mat_action acts[MAX_ACTIONS];
+	int i;
+
+	for (i = 0; rule->actions && rule->actions[i].uid; i++) {
+		match_free_action(&rule->actions[i]);
+		free(rule->actions[i].args);
+	}
+	free(rule->actions);
+	free(rule->matches);
+	rule->actions = NULL;
+	rule->matches = NULL;
+}
+
+static int rule_set_parse(int argc, char **argv, struct net_mat_rule *rule)
+{
+	struct net_mat_field_ref *matches;
+	struct net_mat_action *actions;
 	int match_count = 0, action_count = 0;
 	int advance = 0;
-	int err = 0;
-	struct net_mat_rule rule;
 	const char *valid_keyword_list [] = {
 		"match", "action", "prio", "handle", "table", NULL};
 
-	memset(&rule, 0, sizeof(rule));
-	memset(matches, 0, sizeof(struct net_mat_field_ref) * MAX_MATCHES);
-	memset(acts, 0, sizeof(struct net_mat_action) * MAX_ACTIONS);
-	rule.matches = &matches[0];
-	rule.actions = &acts[0];
+	rule->matches = calloc(MAX_MATCHES + 1, sizeof(*rule->matches));
+	rule->actions = calloc(MAX_ACTIONS + 1, sizeof(*rule->actions));
+	if (!rule->matches || !rule->actions) {
+		fprintf(stderr, "Error: rule calloc failure\n");
+		return -ENOMEM;
+	}
 
 	opterr = 0;
 	while (argc > 0) {
 		if (strcmp(*argv, "match") == 0) {
+			if (match_count >= MAX_MATCHES) {
+				fprintf(stderr, "Error: too many matches\n");
+				return -EINVAL;
+			}
 			advance = get_match_arg(argc, argv, true, false,
-					&matches[match_count], valid_keyword_list);
+					&rule->matches[match_count],
+					valid_keyword_list);
 			if (advance < 0) {
 				fprintf(stderr, "Error: invalid match argument\n");
 				return -EINVAL;
@@ -1732,8 +2111,12 @@ rule_set_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 			for (; advance; advance--)
 				next_arg();
 		} else if (strcmp(*argv, "action") == 0) {
+			if (action_count >= MAX_ACTIONS) {
+				fprintf(stderr, "Error: too many actions\n");
+				return -EINVAL;
+			}
 			advance = get_action_arg(argc, argv, true,
-					&acts[action_count]);
+					&rule->actions[action_count]);
 			if (advance < 0) {
 				fprintf(stderr, "Error: invalid action argument\n");
 				return -EINVAL;
@@ -1748,11 +2131,9 @@ rule_set_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 				return -EINVAL;
 			}
 
-			err = sscanf(*argv, "%u", &rule.priority);
-			if (err < 0) {
-				printf("Invalid prio argument\n");
-				set_rule_usage();
-				exit(-1);
+			if (sscanf(*argv, "%u", &rule->priority) != 1) {
+				fprintf(stderr, "Invalid prio argument\n");
+				return -EINVAL;
 			}
 		} else if (strcmp(*argv, "handle") == 0) {
 			next_arg();
@@ -1761,58 +2142,73 @@ rule_set_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 				return -EINVAL;
 			}
 
-			err = sscanf(*argv, "%u", &rule.uid);
-			if (err < 0) {
-				printf("Invalid handle argument\n");
-				set_rule_usage();
-				exit(-1);
+			if (sscanf(*argv, "%u", &rule->uid) != 1) {
+				fprintf(stderr, "Invalid handle argument\n");
+				return -EINVAL;
 			}
 		} else if (strcmp(*argv, "table") == 0) {
 			next_arg();
-			err = sscanf(*argv, "%u", &rule.table_id);
-			if (err < 0) {
-				printf("Invalid table_id argument\n");
-				set_rule_usage();
-				exit(-1);
+			if (*argv == NULL) {
+				fprintf(stderr, "Error: missing table\n");
+				return -EINVAL;
+			}
+
+			if (sscanf(*argv, "%u", &rule->table_id) != 1) {
+				fprintf(stderr, "Invalid table_id argument\n");
+				return -EINVAL;
 			}
 		} else {
 			fprintf(stderr, "Error: unexpected argument `%s`\n", *argv);
-			set_rule_usage();
-			exit(-1);
+			return -EINVAL;
 		}
 		argc--; argv++;
 	}
 
-	if (err < 0) {
-		printf("Invalid argument\n");
-		set_rule_usage();
-		exit(-1);
-	}
-
-	if (!rule.table_id) {
+	if (!rule->table_id) {
 		fprintf(stderr, "Table ID requried\n");
-		set_rule_usage();
-		exit(-1);
+		return -EINVAL;
 	}
 
-	if (!rule.priority)
-		rule.priority = 1;
+	if (!rule->priority)
+		rule->priority = 1;
 
-	if (!rule.uid) {
+	if (!rule->uid) {
 		fprintf(stderr, "Rule ID required\n");
-		set_rule_usage();
-		exit(-1);
+		return -EINVAL;
 	}
 
-//	pp_rule(mat_stream_stdout(), &rule);
+	/* trim the worst case arrays, batch and apply keep many rules */
+	matches = realloc(rule->matches, (size_t)(match_count + 1) *
+			  sizeof(*rule->matches));
+	if (matches)
+		rule->matches = matches;
+	actions = realloc(rule->actions, (size_t)(action_count + 1) *
+			  sizeof(*rule->actions));
+	if (actions)
+		rule->actions = actions;
 
-	/* open generic netlink socket with MATCH api */
-	nsd = nl_socket_alloc();
-	nl_connect(nsd, NETLINK_GENERIC);
+	return 0;
+}
+
+int
+rule_set_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
+	int argc, char **argv)
+{
+	struct net_mat_rule rule;
+	int err = 0;
+
+	memset(&rule, 0, sizeof(rule));
+	if (rule_set_parse(argc, argv, &rule)) {
+		set_rule_usage();
+		return -EINVAL;
+	}
+
+	match_socket_open();
 
 	match_set_match_nl_verbose_and_streamer(verbose);
 
 	err = match_nl_set_rules(nsd, pid, ifindex, family, &rule);
+	rule_free(&rule);
 	if (err < 0) {
 		fprintf(stderr, "Error: match_nl_set_rules() failed\n");
 		return err;
@@ -1892,7 +2288,7 @@ match_get_port_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 			if (err < 0) {
 				fprintf(stderr, "invalid lport parameter\n");
 				get_port_usage();
-				exit(-1);
+				return -EINVAL;
 			}
 			have_lport_query = true;
 		} else if (strcmp(*argv, "min") == 0) {
@@ -1906,7 +2302,7 @@ match_get_port_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 			if (err < 0) {
 				fprintf(stderr, "invalid min parameter\n");
 				get_port_usage();
-				exit(-1);
+				return -EINVAL;
 			}
 		} else if (strcmp(*argv, "max") == 0) {
 			next_arg();
@@ -1919,7 +2315,7 @@ match_get_port_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 			if (err < 0) {
 				fprintf(stderr, "invalid max parameter\n");
 				get_port_usage();
-				exit(-1);
+				return -EINVAL;
 			}
 		} else {
 			fprintf(stderr, "Error: unexpected argument `%s`\n", *argv);
@@ -1930,7 +2326,7 @@ match_get_port_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 			else
 				get_port_usage();
 
-			exit(-1);
+			return -EINVAL;
 		}
 		argc--; argv++;
 	}
@@ -1952,8 +2348,7 @@ match_get_port_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 	}
 
 	/* open generic netlink socket with MATCH api */
-	nsd = nl_socket_alloc();
-	nl_connect(nsd, NETLINK_GENERIC);
+	match_socket_open();
 
 	match_set_match_nl_verbose_and_streamer(verbose);
 
@@ -2337,7 +2732,8 @@ match_set_port_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 		} else {
 			fprintf(stderr, "Error: unexpected argument `%s`\n", *argv);
 			set_port_usage();
-			exit(-1);
+			free(port_be);
+			return -EINVAL;
 		}
 
 		argc--; argv++;
@@ -2346,7 +2742,8 @@ match_set_port_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 	if (port.port_id == NET_MAT_PORT_ID_UNSPEC) {
 		fprintf(stderr, "Error port id is required\n");
 		set_port_usage();
-		exit(-1);
+		free(port_be);
+		return -EINVAL;
 	}
 
 	/* if vlans are not specified, re-use old vlan membership */
@@ -2356,8 +2753,7 @@ match_set_port_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
 		       sizeof(port.vlan.vlan_membership_bitmask));
 
 	/* open generic netlink socket with MATCH api */
-	nsd = nl_socket_alloc();
-	nl_connect(nsd, NETLINK_GENERIC);
+	match_socket_open();
 
 	match_set_match_nl_verbose_and_streamer(verbose);
 
@@ -2397,8 +2793,7 @@ match_send_recv(int verbose, uint32_t pid, int family, uint32_t ifindex,
 
 
 	/* open generic netlink socket with MATCH api */
-	nsd = nl_socket_alloc();
-	nl_connect(nsd, NETLINK_GENERIC);
+	match_socket_open();
 
 	match_set_match_nl_verbose_and_streamer(verbose);
 
@@ -2501,220 +2896,2554 @@ match_send_recv(int verbose, uint32_t pid, int family, uint32_t ifindex,
 	return err;
 }
 
-static int parse_arg_u32(char *argv, uint32_t *val)
+int
+match_monitor_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
+		   int argc, char **argv)
 {
-	long ret;
-	int base = 10;
-	char *end = NULL;
+	uint32_t mask = 0;
+	int err;
 
-	if (!argv || !val)
-		return -1;
+	while (argc > 0) {
+		if (strcmp(*argv, "rules") == 0) {
+			mask |= NET_MAT_EVENT_F_RULES;
+		} else if (strcmp(*argv, "tables") == 0) {
+			mask |= NET_MAT_EVENT_F_TABLES;
+		} else if (strcmp(*argv, "ports") == 0) {
+			mask |= NET_MAT_EVENT_F_PORTS;
+		} else {
+			fprintf(stderr, "Error: unexpected argument `%s`\n", *argv);
+			monitor_usage();
+			return -EINVAL;
+		}
+		argc--; argv++;
+	}
 
-	if (strlen(argv) >= 2) {
-		if (argv[0] == '0' && (argv[1] == 'x' || argv[1] == 'X'))
-			base = 16;
+	if (!mask)
+		mask = NET_MAT_EVENT_F_ALL;
+
+	/* open generic netlink socket with MATCH api, the daemon sends
+	 * events to this socket once subscribed
+	 */
+	match_socket_open();
+
+	match_set_match_nl_verbose_and_streamer(verbose);
+
+	err = match_nl_subscribe(nsd, pid, ifindex, family, mask);
+	if (err) {
+		fprintf(stderr, "Error: event subscription failed (%s)\n",
+			strerror(-err));
+		return err;
 	}
 
-	ret = strtol(argv, &end, base);
-	if (errno != 0 || ret < 0 || ret > ~((uint32_t)0) || argv == end)
-		return -1;
+	do {
+		err = match_nl_recv_events(nsd, family, NULL, NULL);
+	} while (err >= 0);
 
-	*val = (uint32_t)ret;
+	return err;
+}
+
+/*
+ * match_cmd_lookup() - map a command name to its netlink command
+ * @name: command name given on the command line or in a batch file
+ * @cmd: set to the command
+ * @resolve_names: cleared if the command does not need the pipeline
+ *                 headers, actions and tables to resolve names
+ *
+ * Return: 0 on success or -EINVAL if @name is not a command
+ */
+static int match_cmd_lookup(const char *name, uint8_t *cmd,
+			    bool *resolve_names)
+{
+	if (strcmp(name, "get_tables") == 0) {
+		*cmd = NET_MAT_TABLE_CMD_GET_TABLES;
+	} else if (strcmp(name, "get_headers") == 0) {
+		*resolve_names = false;
+		*cmd = NET_MAT_TABLE_CMD_GET_HEADERS;
+	} else if (strcmp(name, "get_header_graph") == 0) {
+		*cmd = NET_MAT_TABLE_CMD_GET_HDR_GRAPH;
+	} else if (strcmp(name, "get_actions") == 0) {
+		*resolve_names = false;
+		*cmd = NET_MAT_TABLE_CMD_GET_ACTIONS;
+	} else if (strcmp(name, "get_graph") == 0) {
+		*cmd = NET_MAT_TABLE_CMD_GET_TABLE_GRAPH;
+	} else if (strcmp(name, "get_rules") == 0) {
+		*cmd = NET_MAT_TABLE_CMD_GET_RULES;
+	} else if (strcmp(name, "set_rule") == 0) {
+		*cmd = NET_MAT_TABLE_CMD_SET_RULES;
+	} else if (strcmp(name, "del_rule") == 0) {
+		*cmd = NET_MAT_TABLE_CMD_DEL_RULES;
+	} else if (strcmp(name, "create") == 0) {
+		*cmd = NET_MAT_TABLE_CMD_CREATE_TABLE;
+	} else if (strcmp(name, "destroy") == 0) {
+		*cmd = NET_MAT_TABLE_CMD_DESTROY_TABLE;
+	} else if (strcmp(name, "update") == 0) {
+		*cmd = NET_MAT_TABLE_CMD_UPDATE_TABLE;
+	} else if (strcmp(name, "phys_port_lookup") == 0) {
+		*cmd = NET_MAT_PORT_CMD_GET_PHYS_PORT;
+	} else if (strcmp(name, "lport_lookup") == 0) {
+		*cmd = NET_MAT_PORT_CMD_GET_LPORT;
+	} else if (strcmp(name, "get_ports") == 0) {
+		*cmd = NET_MAT_PORT_CMD_GET_PORTS;
+	} else if (strcmp(name, "set_port") == 0) {
+		*cmd = NET_MAT_PORT_CMD_SET_PORTS;
+	} else if (strcmp(name, "monitor") == 0) {
+		*cmd = NET_MAT_EVENT_CMD_SUBSCRIBE;
+	} else if (strcmp(name, "snapshot") == 0) {
+		*resolve_names = false;
+		*cmd = MATCH_CMD_SNAPSHOT;
+	} else if (strcmp(name, "bench") == 0) {
+		*cmd = MATCH_CMD_BENCH;
+	} else if (strcmp(name, "top") == 0) {
+		*cmd = MATCH_CMD_TOP;
+	} else if (strcmp(name, "apply") == 0) {
+		*cmd = MATCH_CMD_APPLY;
+	} else if (strcmp(name, "flight") == 0) {
+		*resolve_names = false;
+		*cmd = NET_MAT_DAEMON_CMD_GET_FLIGHT;
+	} else if (strcmp(name, "get_stats") == 0) {
+		*cmd = NET_MAT_DAEMON_CMD_GET_STATS;
+	} else {
+		return -EINVAL;
+	}
 
 	return 0;
 }
 
-int main(int argc, char **argv)
+/*
+ * match_cmd_send() - run one command against the daemon
+ * @verbose: verbosity level
+ * @pid: pid of the daemon
+ * @family: netlink family of the daemon
+ * @ifindex: interface identifier
+ * @cmd: command returned by match_cmd_lookup()
+ * @argc: number of command arguments
+ * @argv: command arguments following the command name
+ *
+ * Return: 0 on success or a negative error code
+ */
+static int match_cmd_send(int verbose, uint32_t pid, int family,
+			  uint32_t ifindex, uint8_t cmd, int argc, char **argv)
 {
-	uint8_t cmd = NET_MAT_TABLE_CMD_GET_TABLES;
-	int family = NET_MAT_DFLT_FAMILY, err;
-	unsigned int ifindex = 0;
-	uint32_t pid = 0;
-	int verbose = 1;
-	bool help_usage = false;
-	bool resolve_names = true;
-	int opt;
-	int args = 1;
-	int opt_index = 0;
-	static struct option long_options[] = {
-		{ "version", no_argument, NULL, 0 },
-		{ 0, 0, 0, 0}
-	};
-
-	progname = argv[0];
-	if (argc < 2) {
-		match_usage();
-		return 0;
+	switch (cmd) {
+	case NET_MAT_TABLE_CMD_SET_RULES:
+		return rule_set_send(verbose, pid, family, ifindex, argc, argv);
+	case NET_MAT_TABLE_CMD_DEL_RULES:
+		return rule_del_send(verbose, pid, family, ifindex, argc, argv);
+	case NET_MAT_TABLE_CMD_GET_RULES:
+		return rule_get_send(verbose, pid, family, ifindex, argc, argv);
+	case NET_MAT_TABLE_CMD_CREATE_TABLE:
+	case NET_MAT_TABLE_CMD_UPDATE_TABLE:
+		return match_create_tbl_send(verbose, pid, family, ifindex,
+					     argc, argv, cmd);
+	case NET_MAT_TABLE_CMD_DESTROY_TABLE:
+		return match_destroy_tbl_send(verbose, pid, family, ifindex,
+					      argc, argv);
+	case NET_MAT_PORT_CMD_GET_LPORT:
+	case NET_MAT_PORT_CMD_GET_PHYS_PORT:
+	case NET_MAT_PORT_CMD_GET_PORTS:
+		return match_get_port_send(verbose, pid, family, ifindex,
+					   argc, argv, cmd);
+	case NET_MAT_PORT_CMD_SET_PORTS:
+		return match_set_port_send(verbose, pid, family, ifindex,
+					   argc, argv, cmd);
+	case NET_MAT_EVENT_CMD_SUBSCRIBE:
+		return match_monitor_send(verbose, pid, family, ifindex,
+					  argc, argv);
+	case MATCH_CMD_SNAPSHOT:
+		return match_snapshot_send(verbose, pid, family, ifindex,
+					   argc, argv);
+	case MATCH_CMD_BENCH:
+		return match_bench_send(verbose, pid, family, ifindex,
+					argc, argv);
+	case MATCH_CMD_TOP:
+		return match_top_send(verbose, pid, family, ifindex,
+				      argc, argv);
+	case MATCH_CMD_APPLY:
+		return match_apply_send(verbose, pid, family, ifindex,
+					argc, argv);
+	case NET_MAT_DAEMON_CMD_GET_FLIGHT:
+		return match_flight_send(verbose, pid, family, ifindex,
+					 argc, argv);
+	case NET_MAT_DAEMON_CMD_GET_STATS:
+		return match_stats_send(verbose, pid, family, ifindex,
+					argc, argv);
+	default:
+		return match_send_recv(verbose, pid, family, ifindex, cmd);
 	}
+}
 
-	while ((opt = getopt_long(argc, argv, "p:f:hsg", long_options,
-	                          &opt_index)) != -1) {
-		switch (opt) {
-		case 0:
-			if (!strcmp(long_options[opt_index].name, "version")) {
-				printf("Match Version: %s\n", match_version());
-				exit(0);
-			}
-			break;
-		case 'h':
-			match_usage();
-			exit(-1);
-		case 'p':
-			err = parse_arg_u32(optarg, &pid);
-			if (err < 0) {
-				fprintf(stderr, "Error parsing pid\n");
-				match_usage();
-				exit(-1);
-			}
-			args += 2;
-			break;
-		case 'f':
-			family = atoi(optarg);
-			args += 2;
-			break;
-		case 'g':
-			verbose = PRINT_GRAPHVIZ;
-			args++;
-			break;
-		case 's':
-			verbose = 0;
-			args++;
-			break;
-		default:
-			match_usage();
-			exit(-1);
-		}
-	}
+static uint64_t match_now_ns(void)
+{
+	struct timespec ts;
 
-	/*
-	 * At leas one non-option argument is expected "help" or COMMAND
-	 */
-	if (args >= argc) {
-		fprintf(stderr, "Error parsing command\n");
-		match_usage();
-		exit(-1);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int
+match_snapshot_save(uint32_t pid, int family, uint32_t ifindex,
+		    const char *path)
+{
+	struct mat_snap_writer *w = NULL;
+	struct net_mat_tbl *tables;
+	struct net_mat_rule *rules;
+	struct net_mat_port *ports;
+	unsigned int count, total = 0;
+	bool skip_ports = false;
+	int i, err;
+
+	tables = match_nl_get_tables(nsd, pid, ifindex, family);
+	if (!tables) {
+		fprintf(stderr, "Error: match_nl_get_tables() failed\n");
+		return -ECOMM;
 	}
 
-	if (strcmp(argv[args], "help") == 0) {
-		help_usage = true;
-		args++;
-		if (args >= argc) {
-			/*
-			 * "help" without a COMMAND is treated like "-h" option
-			 */
-			match_usage();
-			return 0;
-		}
+	err = mat_snap_writer_open(path, &w);
+	if (err) {
+		free(tables);
+		return err;
 	}
 
-	if (!help_usage) {
-		match_set_match_nl_verbose_and_streamer(verbose);
+	err = mat_snap_write_tables(w, tables);
+	if (err)
+		goto out;
 
-		if (!pid) {
-			pid = match_pid_lookup();
-			if (!pid) {
-				fprintf(stderr, "pid lookup failed and not specified\n");
-				match_usage();
-				exit(-1);
-			}
+	for (i = 0; tables[i].uid; i++) {
+		err = match_nl_read_rules(nsd, pid, ifindex, family,
+					  tables[i].uid, 0, 0, &rules, &count);
+		if (err) {
+			fprintf(stderr, "Error: rules of table %u not read\n",
+				tables[i].uid);
+			goto out;
 		}
+		if (!rules)
+			continue;
+
+		err = mat_snap_write_rules(w, rules, count);
+		match_free_rules(rules, count);
+		if (err)
+			goto out;
+		total += count;
 	}
 
-	if (strcmp(argv[args], "get_tables") == 0) {
-		cmd = NET_MAT_TABLE_CMD_GET_TABLES;
-	} else if (strcmp(argv[args], "get_headers") == 0) {
-		resolve_names = false;
-		cmd = NET_MAT_TABLE_CMD_GET_HEADERS;
-	} else if (strcmp(argv[args], "get_header_graph") == 0) {
-		cmd = NET_MAT_TABLE_CMD_GET_HDR_GRAPH;
-	} else if (strcmp(argv[args], "get_actions") == 0) {
-		resolve_names = false;
-		cmd = NET_MAT_TABLE_CMD_GET_ACTIONS;
-	} else if (strcmp(argv[args], "get_graph") == 0) {
-		cmd = NET_MAT_TABLE_CMD_GET_TABLE_GRAPH;
-	} else if (strcmp(argv[args], "get_rules") == 0) {
-		cmd = NET_MAT_TABLE_CMD_GET_RULES;
-	} else if (strcmp(argv[args], "set_rule") == 0) {
-		cmd = NET_MAT_TABLE_CMD_SET_RULES;
-	} else if (strcmp(argv[args], "del_rule") == 0) {
-		cmd = NET_MAT_TABLE_CMD_DEL_RULES;
-	} else if (strcmp(argv[args], "create") == 0) {
-		cmd = NET_MAT_TABLE_CMD_CREATE_TABLE;
-	} else if (strcmp(argv[args], "destroy") == 0) {
-		cmd = NET_MAT_TABLE_CMD_DESTROY_TABLE;
-	} else if (strcmp(argv[args], "update") == 0) {
-		cmd = NET_MAT_TABLE_CMD_UPDATE_TABLE;
-	} else if (strcmp(argv[args], "phys_port_lookup") == 0) {
-		cmd = NET_MAT_PORT_CMD_GET_PHYS_PORT;
-	} else if (strcmp(argv[args], "lport_lookup") == 0) {
-		cmd = NET_MAT_PORT_CMD_GET_LPORT;
-	} else if (strcmp(argv[args], "get_ports") == 0) {
-		cmd = NET_MAT_PORT_CMD_GET_PORTS;
-	} else if (strcmp(argv[args], "set_port") == 0) {
-		cmd = NET_MAT_PORT_CMD_SET_PORTS;
-	} else {
-		match_usage();
-		err = -EINVAL;
+	/* a backend without ports is saved without them */
+	err = match_nl_read_ports(nsd, pid, ifindex, family, 0, 0, &ports);
+	if (err == -EOPNOTSUPP) {
+		ports = NULL;
+		skip_ports = true;
+	} else if (err) {
+		fprintf(stderr, "Error: ports not read\n");
 		goto out;
 	}
+	if (ports) {
+		err = mat_snap_write_ports(w, ports);
+		free(ports);
+		if (err)
+			goto out;
+	}
 
-	if (help_usage) {
-		switch (cmd) {
-		case NET_MAT_TABLE_CMD_SET_RULES:
-			set_rule_usage();
-			break;
-		case NET_MAT_TABLE_CMD_DEL_RULES:
-			del_rule_usage();
-			break;
-		case NET_MAT_TABLE_CMD_GET_RULES:
-			get_rules_usage();
-			break;
-		case NET_MAT_TABLE_CMD_CREATE_TABLE:
-			create_usage();
-			break;
-		case NET_MAT_TABLE_CMD_DESTROY_TABLE:
-			destroy_usage();
-			break;
-		case NET_MAT_TABLE_CMD_UPDATE_TABLE:
-			update_usage();
-			break;
-		case NET_MAT_PORT_CMD_GET_LPORT:
-			get_lport_usage();
-			break;
-		case NET_MAT_PORT_CMD_GET_PHYS_PORT:
-			get_phys_port_usage();
-			break;
-		case NET_MAT_PORT_CMD_GET_PORTS:
-			get_port_usage();
-			break;
-		case NET_MAT_PORT_CMD_SET_PORTS:
-			set_port_usage();
-			break;
-		default:
-			match_usage();
-			break;
-		}
+	err = mat_snap_writer_close(w);
+	w = NULL;
+	if (!err)
+		printf("saved %i tables, %u rules%s to %s\n", i, total,
+		       skip_ports ? " without ports (not supported)" : "",
+		       path);
+out:
+	if (w)
+		mat_snap_writer_abort(w);
+	free(tables);
+	if (err)
+		fprintf(stderr, "Error: snapshot save failed (%s)\n",
+			strerror(-err));
+	return err;
+}
 
-		return 0;
-	}
+struct match_snapshot_load_args {
+	uint32_t pid;
+	int family;
+	uint32_t ifindex;
+	int *errs;
+	unsigned int nerrs;
+	unsigned int loaded;
+	unsigned int failed;
+};
+
+static int match_snapshot_load_rules(struct net_mat_rule *rules,
+				     unsigned int count, void *arg)
+{
+	struct match_snapshot_load_args *args = arg;
+	unsigned int i;
+	int err;
 
-	/* Get the family */
-	if (family < 0) {
-		struct nl_sock *fd = NULL;
+	if (count > args->nerrs) {
+		int *errs = realloc(args->errs, count * sizeof(*errs));
 
-		fd = nl_socket_alloc();
-		genl_connect(fd);
+		if (!errs)
+			return -ENOMEM;
+		args->errs = errs;
+		args->nerrs = count;
+	}
 
-		family = genl_ctrl_resolve(fd, NET_MAT_GENL_NAME);
-		if (family < 0) {
-			printf("Can not resolve family\n");
-			goto out;
+	err = match_nl_set_rules_bulk(nsd, args->pid, args->ifindex,
+				      args->family, rules, count, args->errs);
+	if (err < 0 && err != -EINVAL) {
+		fprintf(stderr, "Error: match_nl_set_rules_bulk() failed (%s)\n",
+			strerror(-err));
+		return err;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!args->errs[i]) {
+			args->loaded++;
+			continue;
 		}
-		nl_close(fd);
-		nl_socket_free(fd);
+
+		args->failed++;
+		fprintf(stderr, "Error: rule %u table %u not restored (%s)\n",
+			rules[i].uid, rules[i].table_id,
+			strerror(-args->errs[i]));
 	}
 
-	if (resolve_names) {
+	return 0;
+}
+
+static int
+match_snapshot_load(uint32_t pid, int family, uint32_t ifindex,
+		    const char *path)
+{
+	struct match_snapshot_load_args args = {
+		.pid = pid, .family = family, .ifindex = ifindex,
+	};
+	struct net_mat_tbl *tables = NULL, *current;
+	struct net_mat_port *ports = NULL;
+	struct mat_arena *arena = NULL;
+	struct mat_snap *snap;
+	uint64_t start = match_now_ns(), elapsed;
+	int i, j, err;
+
+	err = mat_snap_open(path, &snap);
+	if (err)
+		return err;
+
+	/* only tables missing on the target are created */
+	current = match_nl_get_tables(nsd, pid, ifindex, family);
+	err = mat_snap_get_tables(snap, &tables);
+	if (err)
+		goto out;
+
+	for (i = 0; tables[i].uid; i++) {
+		for (j = 0; current && current[j].uid; j++) {
+			if (current[j].uid == tables[i].uid)
+				break;
+		}
+		if (current && current[j].uid)
+			continue;
+
+		err = match_nl_create_table(nsd, pid, ifindex, family,
+					    &tables[i]);
+		if (err) {
+			fprintf(stderr, "Error: table %u not restored (%s)\n",
+				tables[i].uid, strerror(-err));
+			goto out;
+		}
+	}
+
+	arena = mat_arena_create(0);
+	if (!arena) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	err = mat_snap_get_rules(snap, arena, MATCH_SNAPSHOT_BATCH,
+				 match_snapshot_load_rules, &args);
+	if (err)
+		goto out;
+
+	err = mat_snap_get_ports(snap, &ports);
+	if (err)
+		goto out;
+
+	for (i = 0; ports[i].port_id != NET_MAT_PORT_ID_UNSPEC; i++) {
+		err = match_nl_set_port(nsd, pid, ifindex, family, &ports[i]);
+		if (err) {
+			fprintf(stderr, "Error: port %u not restored\n",
+				ports[i].port_id);
+			goto out;
+		}
+	}
+
+	elapsed = match_now_ns() - start;
+	printf("loaded %i ports, %u rules (%u failed) from %s in %" PRIu64 " ms\n",
+	       i, args.loaded, args.failed, path, elapsed / 1000000);
+	if (args.failed)
+		err = -EINVAL;
+out:
+	free(ports);
+	free(args.errs);
+	mat_arena_destroy(arena);
+	match_free_tables(tables);
+	free(current);
+	mat_snap_close(snap);
+	if (err)
+		fprintf(stderr, "Error: snapshot load failed (%s)\n",
+			strerror(-err));
+	return err;
+}
+
+int
+match_snapshot_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
+		    int argc, char **argv)
+{
+	bool save;
+
+	if (argc != 2) {
+		snapshot_usage();
+		return -EINVAL;
+	}
+
+	if (strcmp(argv[0], "save") == 0) {
+		save = true;
+	} else if (strcmp(argv[0], "load") == 0) {
+		save = false;
+	} else {
+		fprintf(stderr, "Error: unexpected argument `%s`\n", argv[0]);
+		snapshot_usage();
+		return -EINVAL;
+	}
+
+	match_socket_open();
+
+	/* rules and ports are streamed to the file, not to the terminal */
+	match_set_match_nl_verbose_and_streamer(0);
+	(void)verbose;
+
+	if (save)
+		return match_snapshot_save(pid, family, ifindex, argv[1]);
+
+	return match_snapshot_load(pid, family, ifindex, argv[1]);
+}
+
+/* Most tables accepted by one apply command */
+#define MATCH_APPLY_MAX_TABLES 64
+
+struct match_apply {
+	uint32_t pid;
+	int family;
+	uint32_t ifindex;
+	int verbose;
+	unsigned int flags;
+	uint32_t tables[MATCH_APPLY_MAX_TABLES + 1];
+	struct net_mat_rule *rules;	/* desired rules parsed from a file */
+	unsigned int count;
+	unsigned int size;
+};
+
+static void match_apply_result(enum match_nl_apply_op op,
+			       struct net_mat_rule *rule, int err, void *arg)
+{
+	static const char * const ops[] = {
+		[MATCH_NL_APPLY_ADD] = "add",
+		[MATCH_NL_APPLY_UPDATE] = "update",
+		[MATCH_NL_APPLY_DELETE] = "delete",
+	};
+	struct match_apply *a = arg;
+
+	if (err)
+		fprintf(stderr, "Error: %s rule %u table %u failed (%s)\n",
+			ops[op], rule->uid, rule->table_id, strerror(-err));
+	else if (a->verbose || a->flags & MATCH_NL_APPLY_DRY_RUN)
+		printf("%s rule %u table %u\n", ops[op], rule->uid,
+		       rule->table_id);
+}
+
+static int match_apply_rules(struct net_mat_rule *rules, unsigned int count,
+			     void *arg)
+{
+	struct match_apply *a = arg;
+	struct match_nl_apply_stats stats;
+	uint64_t start = match_now_ns(), elapsed;
+	int err;
+
+	err = match_nl_apply_rules(nsd, a->pid, a->ifindex, a->family,
+				   rules, count, a->tables[0] ? a->tables : NULL,
+				   a->flags, match_apply_result, a, &stats);
+	if (err && err != -EINVAL)
+		return err;
+
+	elapsed = match_now_ns() - start;
+	printf("%s%u rules: %u unchanged, %u added, %u updated, %u deleted, "
+	       "%u failed in %" PRIu64 " ms\n",
+	       a->flags & MATCH_NL_APPLY_DRY_RUN ? "dry-run, " : "", count,
+	       stats.unchanged, stats.added, stats.updated, stats.deleted,
+	       stats.failed, elapsed / 1000000);
+	return err;
+}
+
+/* Parse one line of a desired state file into the next desired rule */
+static int match_apply_line(struct match_apply *a, unsigned int line,
+			    char *buf)
+{
+	char *argv[MATCH_BATCH_MAX_ARGS + 1], *tok, *save = NULL;
+	int argc = 0, skip, err;
+
+	tok = strchr(buf, '#');
+	if (tok)
+		*tok = '\0';
+
+	for (tok = strtok_r(buf, " \t\r\n", &save); tok;
+	     tok = strtok_r(NULL, " \t\r\n", &save)) {
+		if (argc == MATCH_BATCH_MAX_ARGS) {
+			fprintf(stderr, "Error: line %u: too many arguments\n",
+				line);
+			return -E2BIG;
+		}
+		argv[argc++] = tok;
+	}
+	argv[argc] = NULL;
+
+	/* set_rule lines of a batch file are accepted as well */
+	skip = argc && strcmp(argv[0], "set_rule") == 0;
+	if (argc == skip)
+		return 0;
+
+	if (a->count == a->size) {
+		struct net_mat_rule *rules;
+		unsigned int size = a->size ? a->size * 2 : 1024;
+
+		rules = realloc(a->rules, (size + 1) * sizeof(*rules));
+		if (!rules)
+			return -ENOMEM;
+		a->rules = rules;
+		a->size = size;
+	}
+
+	memset(&a->rules[a->count], 0, sizeof(*a->rules));
+	err = rule_set_parse(argc - skip, argv + skip, &a->rules[a->count]);
+	if (err) {
+		rule_free(&a->rules[a->count]);
+		fprintf(stderr, "Error: line %u: invalid rule\n", line);
+		return err;
+	}
+
+	a->count++;
+	return 0;
+}
+
+static int match_apply_text(struct match_apply *a, FILE *fp)
+{
+	unsigned int i, line = 0;
+	char *buf = NULL;
+	size_t len = 0;
+	int err = 0;
+
+	while (!err && getline(&buf, &len, fp) >= 0)
+		err = match_apply_line(a, ++line, buf);
+	free(buf);
+
+	if (!err) {
+		if (a->rules)
+			memset(&a->rules[a->count], 0, sizeof(*a->rules));
+		err = match_apply_rules(a->rules, a->count, a);
+	}
+
+	for (i = 0; i < a->count; i++)
+		rule_free(&a->rules[i]);
+	free(a->rules);
+	return err;
+}
+
+static int match_apply_snapshot(struct match_apply *a, const char *path)
+{
+	struct mat_arena *arena;
+	struct mat_snap *snap;
+	unsigned int count;
+	int err;
+
+	err = mat_snap_open(path, &snap);
+	if (err)
+		return err;
+
+	arena = mat_arena_create(0);
+	if (!arena) {
+		mat_snap_close(snap);
+		return -ENOMEM;
+	}
+
+	/* the whole desired set is joined at once, decode it in one batch */
+	count = mat_snap_count(snap, MAT_SNAP_SEC_RULES);
+	if (count)
+		err = mat_snap_get_rules(snap, arena, count,
+					 match_apply_rules, a);
+	else
+		err = match_apply_rules(NULL, 0, a);
+
+	mat_arena_destroy(arena);
+	mat_snap_close(snap);
+	return err;
+}
+
+/*
+ * match_apply_send() - run the apply command
+ *
+ * FILE holds the desired rules, either a snapshot written by `snapshot
+ * save` or one set_rule per line. match_nl_apply_rules() computes and
+ * sends the changes that turn the installed rules into the desired ones.
+ */
+int
+match_apply_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
+		 int argc, char **argv)
+{
+	struct match_apply a = {
+		.pid = pid, .family = family, .ifindex = ifindex,
+		.verbose = verbose,
+	};
+	char magic[sizeof(MAT_SNAP_MAGIC)];
+	unsigned int ntables = 0;
+	const char *path;
+	bool snapshot;
+	FILE *fp;
+	int err;
+
+	while (argc > 1) {
+		if (strcmp(*argv, "dry-run") == 0) {
+			a.flags |= MATCH_NL_APPLY_DRY_RUN;
+		} else if (strcmp(*argv, "table") == 0) {
+			next_arg();
+			if (ntables == MATCH_APPLY_MAX_TABLES) {
+				fprintf(stderr, "Error: too many tables\n");
+				return -EINVAL;
+			}
+			if (parse_arg_u32(*argv, &a.tables[ntables]))
+				a.tables[ntables] = find_table(*argv);
+			if (!a.tables[ntables]) {
+				fprintf(stderr, "Error: invalid table\n");
+				apply_usage();
+				return -EINVAL;
+			}
+			ntables++;
+		} else {
+			fprintf(stderr, "Error: unexpected argument `%s`\n",
+				*argv);
+			apply_usage();
+			return -EINVAL;
+		}
+		argc--; argv++;
+	}
+
+	if (argc != 1) {
+		apply_usage();
+		return -EINVAL;
+	}
+	path = *argv;
+
+	fp = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!fp) {
+		err = -errno;
+		fprintf(stderr, "Error: cannot open %s: %s\n", path,
+			strerror(-err));
+		return err;
+	}
+
+	snapshot = fp != stdin &&
+		   fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+		   memcmp(magic, MAT_SNAP_MAGIC, sizeof(magic)) == 0;
+	if (fp != stdin)
+		rewind(fp);
+
+	match_socket_open();
+	match_set_match_nl_verbose_and_streamer(0);
+
+	if (snapshot)
+		err = match_apply_snapshot(&a, path);
+	else
+		err = match_apply_text(&a, fp);
+
+	if (fp != stdin)
+		fclose(fp);
+	if (err)
+		fprintf(stderr, "Error: apply failed (%s)\n", strerror(-err));
+	return err;
+}
+
+/*
+ * match_flight_print() - print flight recorder events, oldest first
+ * @events: the events, sorted by mat_flight_sort()
+ * @count: number of events
+ * @ref: time displayed as 0, the dump or current time
+ * @last: only print the last events, 0 for all
+ */
+static void match_flight_print(struct mat_flight_event *events,
+			       unsigned int count, uint64_t ref,
+			       unsigned int last)
+{
+	struct mat_flight_event *ev;
+	unsigned int i;
+
+	printf("%12s %3s %-16s %-13s %6s %8s %10s %s\n", "time", "thr",
+	       "command", "hook", "table", "uid", "usecs", "error");
+
+	for (i = last && last < count ? count - last : 0; i < count; i++) {
+		ev = &events[i];
+		printf("%12.6f %3u %-16s %-13s %6u %8u %10.3f %s\n",
+		       -(double)(int64_t)(ref - ev->time) / 1e9,
+		       (unsigned int)ev->thread,
+		       mat_flight_cmd_str(ev->cmd),
+		       mat_flight_hook_str(ev->hook),
+		       ev->table, ev->uid, (double)ev->duration / 1e3,
+		       ev->err ? strerror(-ev->err) : "-");
+	}
+}
+
+/*
+ * match_flight_send() - decode the flight recorder of the daemon
+ *
+ * Events are fetched from the running daemon, or read from a dump
+ * written by matchd on SIGUSR1 when a file is given. Times are printed in
+ * seconds relative to the dump.
+ */
+static int
+match_flight_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
+		  int argc, char **argv)
+{
+	struct mat_flight_event *events, *ev;
+	const char *path = NULL;
+	uint32_t last = 0, thread = UINT32_MAX;
+	unsigned int i, n, count;
+	bool errors = false;
+	uint64_t ref;
+	int err;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "file") == 0) {
+			next_arg();
+			if (!*argv) {
+				flight_usage();
+				return -EINVAL;
+			}
+			path = *argv;
+		} else if (strcmp(*argv, "errors") == 0) {
+			errors = true;
+		} else if (strcmp(*argv, "last") == 0 ||
+			   strcmp(*argv, "thread") == 0) {
+			uint32_t *val = **argv == 'l' ? &last : &thread;
+
+			next_arg();
+			if (!*argv || parse_arg_u32(*argv, val)) {
+				fprintf(stderr, "Error: invalid %s\n",
+					val == &last ? "last" : "thread");
+				flight_usage();
+				return -EINVAL;
+			}
+		} else {
+			fprintf(stderr, "Error: unexpected argument `%s`\n",
+				*argv);
+			flight_usage();
+			return -EINVAL;
+		}
+		argc--; argv++;
+	}
+
+	if (path) {
+		err = mat_flight_read(path, &events, &count, &ref);
+	} else {
+		match_socket_open();
+		match_set_match_nl_verbose_and_streamer(0);
+		err = match_nl_get_flight(nsd, pid, ifindex, family,
+					  &events, &count);
+		ref = match_now_ns();
+	}
+	if (err) {
+		fprintf(stderr, "Error: cannot get flight recorder (%s)\n",
+			strerror(-err));
+		return err;
+	}
+	(void)verbose;
+
+	for (i = 0, n = 0; i < count; i++) {
+		ev = &events[i];
+		if ((errors && !ev->err) ||
+		    (thread != UINT32_MAX && ev->thread != thread))
+			continue;
+		events[n++] = *ev;
+	}
+
+	mat_flight_sort(events, n);
+	match_flight_print(events, n, ref, last);
+	free(events);
+	return 0;
+}
+
+/* Per command counters of the text exposition */
+static const struct {
+	const char *name;
+	const char *help;
+	size_t offset;
+} match_stats_counters[] = {
+	{ "matchd_requests_total", "Requests received.",
+	  offsetof(struct net_mat_cmd_stats, requests) },
+	{ "matchd_errors_total", "Requests answered with an error.",
+	  offsetof(struct net_mat_cmd_stats, errors) },
+	{ "matchd_rx_bytes_total", "Request bytes received.",
+	  offsetof(struct net_mat_cmd_stats, rx_bytes) },
+	{ "matchd_tx_bytes_total", "Reply bytes sent.",
+	  offsetof(struct net_mat_cmd_stats, tx_bytes) },
+	{ "matchd_multipart_replies_total", "Replies sent as multipart messages.",
+	  offsetof(struct net_mat_cmd_stats, multipart) },
+};
+
+/*
+ * match_stats_prom_write() - write the counters in the Prometheus text format
+ * @fp: output
+ * @stats: counters of the daemon
+ */
+static void match_stats_prom_write(FILE *fp, struct net_mat_stats *stats)
+{
+	struct net_mat_table_stats *t;
+	struct net_mat_cmd_stats *c;
+	unsigned long long bound;
+	unsigned int i, j;
+	__u64 value;
+
+	fprintf(fp, "# HELP matchd_rx_drops_total Receive queue overruns.\n");
+	fprintf(fp, "# TYPE matchd_rx_drops_total counter\n");
+	fprintf(fp, "matchd_rx_drops_total %llu\n",
+		(unsigned long long)stats->rx_drops);
+	fprintf(fp, "# HELP matchd_event_drops_total Events not delivered to a subscriber.\n");
+	fprintf(fp, "# TYPE matchd_event_drops_total counter\n");
+	fprintf(fp, "matchd_event_drops_total %llu\n",
+		(unsigned long long)stats->event_drops);
+
+	for (i = 0; i < sizeof(match_stats_counters) /
+			sizeof(match_stats_counters[0]); i++) {
+		fprintf(fp, "# HELP %s %s\n", match_stats_counters[i].name,
+			match_stats_counters[i].help);
+		fprintf(fp, "# TYPE %s counter\n", match_stats_counters[i].name);
+		for (c = stats->cmds; c->requests; c++) {
+			memcpy(&value,
+			       (const char *)c + match_stats_counters[i].offset,
+			       sizeof(value));
+			fprintf(fp, "%s{cmd=\"%s\"} %llu\n",
+				match_stats_counters[i].name,
+				mat_flight_cmd_str((uint8_t)c->cmd),
+				(unsigned long long)value);
+		}
+	}
+
+	fprintf(fp, "# HELP matchd_request_duration_seconds Time from receive to reply.\n");
+	fprintf(fp, "# TYPE matchd_request_duration_seconds histogram\n");
+	for (c = stats->cmds; c->requests; c++) {
+		const char *name = mat_flight_cmd_str((uint8_t)c->cmd);
+
+		/* buckets are cumulative, the last one is +Inf */
+		for (j = 0, value = 0; j < NET_MAT_STATS_LATENCY_BUCKETS; j++) {
+			value += c->latency[j];
+			bound = match_stats_latency_bound(j);
+			if (!bound)
+				break;
+			fprintf(fp, "matchd_request_duration_seconds_bucket{cmd=\"%s\",le=\"%g\"} %llu\n",
+				name, (double)bound / 1e6,
+				(unsigned long long)value);
+		}
+		fprintf(fp, "matchd_request_duration_seconds_bucket{cmd=\"%s\",le=\"+Inf\"} %llu\n",
+			name, (unsigned long long)c->requests);
+		fprintf(fp, "matchd_request_duration_seconds_sum{cmd=\"%s\"} %.9f\n",
+			name, (double)c->latency_ns / 1e9);
+		fprintf(fp, "matchd_request_duration_seconds_count{cmd=\"%s\"} %llu\n",
+			name, (unsigned long long)c->requests);
+	}
+
+	fprintf(fp, "# HELP matchd_table_rules Rules installed in a table.\n");
+	fprintf(fp, "# TYPE matchd_table_rules gauge\n");
+	for (t = stats->tables; t->table_id; t++)
+		fprintf(fp, "matchd_table_rules{table=\"%u\"} %u\n",
+			t->table_id, t->rules);
+
+	fprintf(fp, "# HELP matchd_table_size Rules a table can hold.\n");
+	fprintf(fp, "# TYPE matchd_table_size gauge\n");
+	for (t = stats->tables; t->table_id; t++)
+		fprintf(fp, "matchd_table_size{table=\"%u\"} %u\n",
+			t->table_id, t->size);
+}
+
+/*
+ * match_stats_prom() - write the text exposition file
+ * @stats: counters of the daemon
+ * @path: output file, - for stdout
+ *
+ * The file is written next to @path and renamed over it, so that a
+ * collector never reads a partial file.
+ *
+ * Return: 0 on success or a negative error code
+ */
+static int match_stats_prom(struct net_mat_stats *stats, const char *path)
+{
+	char tmp[PATH_MAX];
+	FILE *fp;
+	int err = 0;
+
+	if (strcmp(path, "-") == 0) {
+		match_stats_prom_write(stdout, stats);
+		return fflush(stdout) ? -errno : 0;
+	}
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+		return -ENAMETOOLONG;
+
+	fp = fopen(tmp, "w");
+	if (!fp)
+		return -errno;
+
+	match_stats_prom_write(fp, stats);
+	if (ferror(fp))
+		err = -EIO;
+	if (fclose(fp) && !err)
+		err = -errno;
+	if (!err && rename(tmp, path))
+		err = -errno;
+	if (err)
+		unlink(tmp);
+	return err;
+}
+
+/*
+ * match_stats_send() - display the counters of the daemon
+ *
+ * The counters are pretty printed, or written to a text exposition file
+ * for a metrics collector when a prom file is given.
+ */
+static int
+match_stats_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
+		 int argc, char **argv)
+{
+	struct mat_stream *matsp = json_stream;
+	struct net_mat_stats stats;
+	const char *prom = NULL;
+	int err;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "prom") == 0) {
+			next_arg();
+			if (!*argv) {
+				stats_usage();
+				return -EINVAL;
+			}
+			prom = *argv;
+		} else {
+			fprintf(stderr, "Error: unexpected argument `%s`\n",
+				*argv);
+			stats_usage();
+			return -EINVAL;
+		}
+		argc--; argv++;
+	}
+
+	match_socket_open();
+	match_set_match_nl_verbose_and_streamer(0);
+	err = match_nl_get_stats(nsd, pid, ifindex, family, &stats);
+	if (err) {
+		fprintf(stderr, "Error: cannot get stats (%s)\n",
+			strerror(-err));
+		return err;
+	}
+	(void)verbose;
+
+	if (prom) {
+		err = match_stats_prom(&stats, prom);
+		if (err)
+			fprintf(stderr, "Error: cannot write %s (%s)\n",
+				prom, strerror(-err));
+	} else {
+		pp_stats(matsp ? matsp : mat_stream_stdout(), &stats);
+	}
+
+	match_free_stats(&stats);
+	return err;
+}
+
+
+struct match_batch {
+	uint32_t pid;
+	int family;
+	uint32_t ifindex;
+	int verbose;
+	FILE *out;			/* per-line results */
+	struct net_mat_tbl *tables;	/* tables names are resolved from */
+	uint8_t cmd;			/* command of the pending rules */
+	struct net_mat_rule *rules;	/* pending set_rule or del_rule lines */
+	unsigned int *lines;		/* line number of each pending rule */
+	int *errs;
+	unsigned int count;
+	unsigned int commands;
+	unsigned int rules_sent;
+	unsigned int requests;
+	unsigned int failed;
+};
+
+static void match_batch_result(struct match_batch *b, unsigned int line,
+			       int err)
+{
+	b->commands++;
+	if (err) {
+		b->failed++;
+		fprintf(b->out, "line %u: failed (%s)\n", line, strerror(-err));
+	} else if (b->verbose) {
+		fprintf(b->out, "line %u: ok\n", line);
+	}
+}
+
+/* Send the pending rules as one bulk request and report each line */
+static void match_batch_flush(struct match_batch *b)
+{
+	unsigned int i;
+	int err;
+
+	if (!b->count)
+		return;
+
+	match_set_match_nl_verbose_and_streamer(0);
+	err = match_nl_set_del_rules_bulk(nsd, b->pid, b->ifindex, b->family,
+					  b->rules, b->count, b->cmd, b->errs);
+	b->requests++;
+	b->rules_sent += b->count;
+
+	for (i = 0; i < b->count; i++) {
+		if (err && err != -EINVAL)
+			b->errs[i] = err;
+		match_batch_result(b, b->lines[i], b->errs[i]);
+		rule_free(&b->rules[i]);
+		memset(&b->rules[i], 0, sizeof(b->rules[i]));
+	}
+	b->count = 0;
+}
+
+/* Parse a set_rule or del_rule line and queue it behind the pending rules */
+static void match_batch_add_rule(struct match_batch *b, uint8_t cmd,
+				 unsigned int line, int argc, char **argv)
+{
+	struct net_mat_rule *rule;
+	int err;
+
+	if (b->count && (b->cmd != cmd || b->count == MATCH_BATCH_RULES))
+		match_batch_flush(b);
+
+	rule = &b->rules[b->count];
+	if (cmd == NET_MAT_TABLE_CMD_SET_RULES)
+		err = rule_set_parse(argc, argv, rule);
+	else
+		err = rule_del_parse(argc, argv, rule);
+	if (err) {
+		rule_free(rule);
+		memset(rule, 0, sizeof(*rule));
+		/* report the lines queued before this one first */
+		match_batch_flush(b);
+		match_batch_result(b, line, err);
+		return;
+	}
+
+	b->cmd = cmd;
+	b->lines[b->count++] = line;
+}
+
+/*
+ * Read the tables again and resolve names from them, so that lines after a
+ * create or destroy see the table added or removed
+ */
+static int match_batch_tables(struct match_batch *b)
+{
+	struct net_mat_tbl *tables;
+
+	match_set_match_nl_verbose_and_streamer(0);
+	tables = match_nl_get_tables(nsd, b->pid, b->ifindex, b->family);
+	if (!tables)
+		return -ECOMM;
+
+	if (b->tables) {
+		match_pop_tables_a(b->tables);
+		match_free_tables(b->tables);
+	}
+	match_push_tables_a(tables);
+	b->tables = tables;
+	return 0;
+}
+
+static void match_batch_line(struct match_batch *b, unsigned int line,
+			     char *buf)
+{
+	char *argv[MATCH_BATCH_MAX_ARGS + 1], *tok, *save = NULL;
+	bool resolve_names = true;
+	uint8_t cmd;
+	int argc = 0, err;
+
+	tok = strchr(buf, '#');
+	if (tok)
+		*tok = '\0';
+
+	for (tok = strtok_r(buf, " \t\r\n", &save); tok;
+	     tok = strtok_r(NULL, " \t\r\n", &save)) {
+		if (argc == MATCH_BATCH_MAX_ARGS) {
+			match_batch_flush(b);
+			fprintf(stderr, "Error: too many arguments\n");
+			match_batch_result(b, line, -E2BIG);
+			return;
+		}
+		argv[argc++] = tok;
+	}
+	argv[argc] = NULL;
+
+	if (!argc)
+		return;
+
+	if (match_cmd_lookup(argv[0], &cmd, &resolve_names) ||
+	    cmd == NET_MAT_EVENT_CMD_SUBSCRIBE || cmd == MATCH_CMD_SNAPSHOT ||
+	    cmd == MATCH_CMD_TOP) {
+		match_batch_flush(b);
+		fprintf(stderr, "Error: `%s` is not a batch command\n", argv[0]);
+		match_batch_result(b, line, -EINVAL);
+		return;
+	}
+
+	if (cmd == NET_MAT_TABLE_CMD_SET_RULES ||
+	    cmd == NET_MAT_TABLE_CMD_DEL_RULES) {
+		match_batch_add_rule(b, cmd, line, argc - 1, argv + 1);
+		return;
+	}
+
+	/* any other command sees the effect of the rules before it */
+	match_batch_flush(b);
+	err = match_cmd_send(b->verbose, b->pid, b->family, b->ifindex, cmd,
+			     argc - 1, argv + 1);
+	if (!err && (cmd == NET_MAT_TABLE_CMD_CREATE_TABLE ||
+		     cmd == NET_MAT_TABLE_CMD_DESTROY_TABLE ||
+		     cmd == NET_MAT_TABLE_CMD_UPDATE_TABLE)) {
+		err = match_batch_tables(b);
+		if (err)
+			fprintf(stderr, "Error: cannot read the tables again\n");
+	}
+	match_batch_result(b, line, err);
+}
+
+/*
+ * match_batch_send() - run the commands of a batch file
+ * @verbose: verbosity level
+ * @pid: pid of the daemon
+ * @family: netlink family of the daemon
+ * @ifindex: interface identifier
+ * @path: batch file, one command per line, or "-" for stdin
+ *
+ * Every command runs over the same socket and reuses the names resolved
+ * at startup, except for the tables which are read again after each line
+ * creating, destroying or updating one. Runs of set_rule or del_rule lines
+ * are sent as bulk requests of up to MATCH_BATCH_RULES rules. A result is
+ * reported for each line and a summary with the rule throughput at the end.
+ *
+ * Return: 0 if every line succeeded, -EINVAL otherwise
+ */
+static int
+match_batch_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
+		 const char *path)
+{
+	struct match_batch b = {
+		.pid = pid, .family = family, .ifindex = ifindex,
+		.verbose = verbose,
+	};
+	uint64_t start, elapsed;
+	unsigned int line = 0;
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *fp;
+	int err = 0;
+
+	fp = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!fp) {
+		err = -errno;
+		fprintf(stderr, "Error: cannot open %s: %s\n", path,
+			strerror(-err));
+		return err;
+	}
+
+	/* keep stdout to the command output when printing JSON */
+	b.out = json_stream ? stderr : stdout;
+	b.rules = calloc(MATCH_BATCH_RULES + 1, sizeof(*b.rules));
+	b.lines = calloc(MATCH_BATCH_RULES, sizeof(*b.lines));
+	b.errs = calloc(MATCH_BATCH_RULES, sizeof(*b.errs));
+	if (!b.rules || !b.lines || !b.errs) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	match_socket_open();
+
+	/* own the registered tables to replace them after a create */
+	err = match_batch_tables(&b);
+	if (err) {
+		fprintf(stderr, "Error: match_nl_get_tables() failed\n");
+		goto out;
+	}
+
+	start = match_now_ns();
+	while (getline(&buf, &len, fp) >= 0)
+		match_batch_line(&b, ++line, buf);
+	match_batch_flush(&b);
+	elapsed = match_now_ns() - start;
+
+	fprintf(b.out, "%u commands, %u failed, %u rules in %u requests, "
+		"%" PRIu64 ".%03" PRIu64 " s",
+		b.commands, b.failed, b.rules_sent, b.requests,
+		elapsed / 1000000000, elapsed / 1000000 % 1000);
+	if (elapsed)
+		fprintf(b.out, ", %" PRIu64 " rules/s",
+			(uint64_t)b.rules_sent * 1000000000 / elapsed);
+	fprintf(b.out, "\n");
+
+	if (b.failed)
+		err = -EINVAL;
+out:
+	if (b.tables) {
+		match_pop_tables_a(b.tables);
+		match_free_tables(b.tables);
+	}
+	free(buf);
+	free(b.errs);
+	free(b.lines);
+	free(b.rules);
+	if (fp != stdin)
+		fclose(fp);
+	return err;
+}
+
+enum match_bench_op {
+	MATCH_BENCH_SET,
+	MATCH_BENCH_UPDATE,
+	MATCH_BENCH_GET,
+	MATCH_BENCH_DEL,
+	__MATCH_BENCH_MAX,
+};
+
+static const char *match_bench_op_str[__MATCH_BENCH_MAX] = {
+	"set", "update", "get", "del",
+};
+
+struct match_bench {
+	uint32_t pid;
+	int family;
+	uint32_t ifindex;
+	struct net_mat_tbl *table;
+	uint32_t rules;
+	uint32_t start;
+	uint32_t batch;
+	uint32_t threads;
+	bool random;
+	uint32_t seed;
+	uint32_t prio_spread;
+	unsigned int ops;		/* bitmask of enum match_bench_op */
+};
+
+/* One concurrent client, it owns a socket and a slice of the rules */
+struct match_bench_worker {
+	struct match_bench *bench;
+	pthread_t thread;
+	struct nl_sock *nsd;
+	enum match_bench_op op;
+	struct net_mat_rule *rules;	/* rules installed by set */
+	struct net_mat_rule *alt;	/* same uids with new keys for update */
+	unsigned int count;
+	int *errs;
+	uint64_t *lat;			/* nanoseconds per request */
+	unsigned int nlat;
+	unsigned int errors;
+	unsigned int done;		/* rules set, deleted or dumped */
+};
+
+static uint64_t match_bench_key(struct match_bench *b, uint64_t n)
+{
+	uint64_t x;
+
+	if (!b->random)
+		return n;
+
+	/* splitmix64, so keys only depend on the seed and the rule */
+	x = n + (uint64_t)b->seed * 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+static void match_bench_rule_free(struct net_mat_rule *rule)
+{
+	int i;
+
+	for (i = 0; rule->actions && rule->actions[i].uid; i++)
+		free(rule->actions[i].args);
+	free(rule->actions);
+	free(rule->matches);
+}
+
+/* Build a rule matching every field of the table with its first action */
+static int match_bench_rule(struct match_bench *b, struct net_mat_rule *rule,
+			    uint32_t uid, uint64_t key)
+{
+	struct net_mat_tbl *t = b->table;
+	struct net_mat_field_ref *ref;
+	struct net_mat_field *field;
+	struct net_mat_action *a;
+	unsigned int i, n;
+
+	memset(rule, 0, sizeof(*rule));
+	rule->table_id = t->uid;
+	rule->uid = uid;
+	rule->priority = b->prio_spread ? 1 + uid % b->prio_spread : 1;
+
+	for (n = 0; t->matches && t->matches[n].header; n++)
+		;
+	rule->matches = calloc(n + 1, sizeof(*rule->matches));
+	rule->actions = calloc(2, sizeof(*rule->actions));
+	if (!rule->matches || !rule->actions)
+		return -ENOMEM;
+
+	for (i = 0; i < n; i++) {
+		ref = &rule->matches[i];
+		field = get_fields(t->matches[i].header, t->matches[i].field);
+
+		ref->instance = t->matches[i].instance;
+		ref->header = t->matches[i].header;
+		ref->field = t->matches[i].field;
+		ref->mask_type = t->matches[i].mask_type;
+		if (ref->mask_type == NET_MAT_MASK_TYPE_UNSPEC)
+			ref->mask_type = NET_MAT_MASK_TYPE_MASK;
+		ref->type = field_get_attr_type(field);
+
+		if (ref->type == NET_MAT_FIELD_REF_ATTR_TYPE_IN6) {
+			memcpy(&ref->v.in6.value_in6.s6_addr[8], &key,
+			       sizeof(key));
+		} else if (match_set_value_ll(ref, (key + i) &
+					      field_max_value(field))) {
+			return -EINVAL;
+		}
+		if (match_set_exact_mask(ref, field))
+			return -EINVAL;
+	}
+
+	if (!t->actions || !t->actions[0])
+		return 0;
+
+	a = get_actions(t->actions[0]);
+	if (!a)
+		return -EINVAL;
+
+	rule->actions[0].uid = a->uid;
+	rule->actions[0].name = a->name;
+
+	for (n = 0; a->args && a->args[n].type; n++)
+		;
+	if (!n)
+		return 0;
+
+	rule->actions[0].args = calloc(n + 1, sizeof(*a->args));
+	if (!rule->actions[0].args)
+		return -ENOMEM;
+
+	for (i = 0; i < n; i++) {
+		struct net_mat_action_arg *arg = &rule->actions[0].args[i];
+
+		arg->name = a->args[i].name;
+		arg->type = a->args[i].type;
+		switch (arg->type) {
+		case NET_MAT_ACTION_ARG_TYPE_U8:
+			arg->v.value_u8 = (__u8)(1 + key % 0xff);
+			break;
+		case NET_MAT_ACTION_ARG_TYPE_U16:
+			arg->v.value_u16 = (__u16)(1 + key % 0xffff);
+			break;
+		case NET_MAT_ACTION_ARG_TYPE_U32:
+			arg->v.value_u32 = (__u32)(1 + key % 0xffff);
+			break;
+		case NET_MAT_ACTION_ARG_TYPE_U64:
+			arg->v.value_u64 = key;
+			break;
+		case NET_MAT_ACTION_ARG_TYPE_VARIADIC:
+			/* no optional arguments */
+			arg->type = NET_MAT_ACTION_ARG_TYPE_UNSPEC;
+			arg->name = NULL;
+			return 0;
+		default:
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static int match_bench_worker_init(struct match_bench_worker *w,
+				   struct match_bench *b, uint32_t first,
+				   unsigned int count)
+{
+	unsigned int i, nreq = (count + b->batch - 1) / b->batch;
+	int err;
+
+	w->bench = b;
+	w->count = count;
+	w->nsd = match_nl_get_socket();
+	w->rules = calloc(count + 1, sizeof(*w->rules));
+	w->alt = calloc(count + 1, sizeof(*w->alt));
+	w->errs = calloc(b->batch, sizeof(*w->errs));
+	w->lat = calloc(nreq + 1, sizeof(*w->lat));
+	if (!w->nsd || !w->rules || !w->alt || !w->errs || !w->lat)
+		return -ENOMEM;
+
+	for (i = 0; i < count; i++) {
+		err = match_bench_rule(b, &w->rules[i], first + i,
+				       match_bench_key(b, first + i));
+		if (!err)
+			err = match_bench_rule(b, &w->alt[i], first + i,
+					       match_bench_key(b, first + i +
+							       b->rules));
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+static void match_bench_worker_free(struct match_bench_worker *w)
+{
+	unsigned int i;
+
+	for (i = 0; w->rules && i < w->count; i++)
+		match_bench_rule_free(&w->rules[i]);
+	for (i = 0; w->alt && i < w->count; i++)
+		match_bench_rule_free(&w->alt[i]);
+	free(w->rules);
+	free(w->alt);
+	free(w->errs);
+	free(w->lat);
+	if (w->nsd)
+		nl_socket_free(w->nsd);
+}
+
+static void match_bench_count(struct match_bench_worker *w, unsigned int n,
+			      int err)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		if (w->errs[i] || (err && err != -EINVAL))
+			w->errors++;
+		else
+			w->done++;
+	}
+}
+
+static void *match_bench_worker_run(void *arg)
+{
+	struct match_bench_worker *w = arg;
+	struct match_bench *b = w->bench;
+	struct net_mat_rule *rules, *dump;
+	unsigned int i, n;
+	uint64_t start;
+	int err;
+
+	w->nlat = 0;
+	w->errors = 0;
+	w->done = 0;
+
+	for (i = 0; i < w->count; i += n) {
+		n = w->count - i < b->batch ? w->count - i : b->batch;
+		rules = &w->rules[i];
+
+		start = match_now_ns();
+		switch (w->op) {
+		case MATCH_BENCH_SET:
+		case MATCH_BENCH_DEL:
+			err = match_nl_set_del_rules_bulk(w->nsd, b->pid,
+					b->ifindex, b->family, rules, n,
+					w->op == MATCH_BENCH_SET ?
+					NET_MAT_TABLE_CMD_SET_RULES :
+					NET_MAT_TABLE_CMD_DEL_RULES, w->errs);
+			w->lat[w->nlat++] = match_now_ns() - start;
+			match_bench_count(w, n, err);
+			break;
+		case MATCH_BENCH_UPDATE:
+			/* rules can not be replaced, delete and set again */
+			err = match_nl_del_rules_bulk(w->nsd, b->pid, b->ifindex,
+						      b->family, rules, n,
+						      w->errs);
+			if (!err || err == -EINVAL)
+				err = match_nl_set_rules_bulk(w->nsd, b->pid,
+						b->ifindex, b->family,
+						&w->alt[i], n, w->errs);
+			w->lat[w->nlat++] = match_now_ns() - start;
+			match_bench_count(w, n, err);
+			break;
+		case MATCH_BENCH_GET:
+			dump = match_nl_get_rules(w->nsd, b->pid, b->ifindex,
+						  b->family, b->table->uid,
+						  rules[0].uid,
+						  rules[n - 1].uid);
+			w->lat[w->nlat++] = match_now_ns() - start;
+			if (!dump) {
+				w->errors += n;
+				break;
+			}
+			for (err = 0; dump[err].uid; err++)
+				;
+			w->done += (unsigned int)err;
+			match_free_rules(dump, (unsigned int)err);
+			break;
+		default:
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static int match_bench_cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest rank percentile of sorted latencies, in microseconds */
+static double match_bench_pct(uint64_t *lat, unsigned int n, double pct)
+{
+	unsigned int rank;
+
+	if (!n)
+		return 0;
+
+	rank = (unsigned int)(pct * n + 0.999999);
+	if (rank < 1)
+		rank = 1;
+	if (rank > n)
+		rank = n;
+	return (double)lat[rank - 1] / 1000.0;
+}
+
+static int match_bench_op(struct match_bench *b, struct match_bench_worker *w,
+			  enum match_bench_op op)
+{
+	unsigned int i, nlat = 0, done = 0, errors = 0, pos = 0;
+	uint64_t start, elapsed, *lat;
+	int err = 0;
+
+	start = match_now_ns();
+	for (i = 0; i < b->threads; i++) {
+		w[i].op = op;
+		err = pthread_create(&w[i].thread, NULL,
+				     match_bench_worker_run, &w[i]);
+		if (err) {
+			fprintf(stderr, "Error: pthread_create() failed (%s)\n",
+				strerror(err));
+			break;
+		}
+	}
+	while (i--)
+		pthread_join(w[i].thread, NULL);
+	elapsed = match_now_ns() - start;
+	if (err)
+		return -err;
+
+	for (i = 0; i < b->threads; i++) {
+		nlat += w[i].nlat;
+		done += w[i].done;
+		errors += w[i].errors;
+	}
+
+	lat = calloc(nlat + 1, sizeof(*lat));
+	if (!lat)
+		return -ENOMEM;
+	for (i = 0; i < b->threads; i++) {
+		memcpy(&lat[pos], w[i].lat, w[i].nlat * sizeof(*lat));
+		pos += w[i].nlat;
+	}
+	qsort(lat, nlat, sizeof(*lat), match_bench_cmp_u64);
+
+	printf("%-8s %8u %8u %10.3f %12.0f %10.1f %10.1f %10.1f\n",
+	       match_bench_op_str[op], done, errors,
+	       (double)elapsed / 1e9,
+	       elapsed ? (double)done * 1e9 / (double)elapsed : 0.0,
+	       match_bench_pct(lat, nlat, 0.50),
+	       match_bench_pct(lat, nlat, 0.99),
+	       match_bench_pct(lat, nlat, 0.999));
+
+	free(lat);
+	return 0;
+}
+
+static int match_bench_parse_ops(char *list, unsigned int *ops)
+{
+	char *tok, *save = NULL;
+	unsigned int i;
+
+	*ops = 0;
+	for (tok = strtok_r(list, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		for (i = 0; i < __MATCH_BENCH_MAX; i++) {
+			if (strcmp(tok, match_bench_op_str[i]) == 0)
+				break;
+		}
+		if (i == __MATCH_BENCH_MAX)
+			return -EINVAL;
+		*ops |= 1U << i;
+	}
+
+	return *ops ? 0 : -EINVAL;
+}
+
+/*
+ * match_bench_send() - run the bench command
+ *
+ * Synthetic rules are generated from the match fields and the first
+ * action of a table and split between the client threads, each with its
+ * own socket. Every enabled operation runs over all rules before the
+ * next one starts; latency is measured per request of up to batch rules.
+ */
+int
+match_bench_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
+		 int argc, char **argv)
+{
+	struct match_bench b = {
+		.pid = pid, .family = family, .ifindex = ifindex,
+		.rules = 1000, .start = 1, .batch = 1, .threads = 1,
+		.seed = 1, .prio_spread = 1,
+		.ops = (1U << __MATCH_BENCH_MAX) - 1,
+	};
+	struct {
+		const char *name;
+		uint32_t *val;
+	} nums[] = {
+		{ "rules", &b.rules },
+		{ "start", &b.start },
+		{ "batch", &b.batch },
+		{ "threads", &b.threads },
+		{ "seed", &b.seed },
+		{ "prio_spread", &b.prio_spread },
+	};
+	struct match_bench_worker *w;
+	unsigned int i, first, share;
+	uint32_t table = 0;
+	int err = 0;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "keys") == 0) {
+			next_arg();
+			if (*argv && strcmp(*argv, "random") == 0) {
+				b.random = true;
+			} else if (!*argv || strcmp(*argv, "seq") != 0) {
+				fprintf(stderr, "Error: keys must be seq or random\n");
+				bench_usage();
+				return -EINVAL;
+			}
+		} else if (strcmp(*argv, "ops") == 0) {
+			next_arg();
+			if (!*argv || match_bench_parse_ops(*argv, &b.ops)) {
+				fprintf(stderr, "Error: invalid ops list\n");
+				bench_usage();
+				return -EINVAL;
+			}
+		} else if (strcmp(*argv, "table") == 0) {
+			next_arg();
+			if (*argv && parse_arg_u32(*argv, &table))
+				table = find_table(*argv);
+		} else {
+			for (i = 0; i < sizeof(nums) / sizeof(nums[0]); i++) {
+				if (strcmp(*argv, nums[i].name) == 0)
+					break;
+			}
+			if (i == sizeof(nums) / sizeof(nums[0])) {
+				fprintf(stderr, "Error: unexpected argument `%s`\n",
+					*argv);
+				bench_usage();
+				return -EINVAL;
+			}
+
+			next_arg();
+			if (!*argv || parse_arg_u32(*argv, nums[i].val)) {
+				fprintf(stderr, "Error: invalid %s\n",
+					nums[i].name);
+				bench_usage();
+				return -EINVAL;
+			}
+		}
+		argc--; argv++;
+	}
+
+	b.table = table ? get_tables(table) : NULL;
+	if (!b.table) {
+		fprintf(stderr, "Error: table required\n");
+		bench_usage();
+		return -EINVAL;
+	}
+
+	if (!b.rules || !b.batch || !b.threads || b.threads > b.rules ||
+	    b.start > UINT32_MAX - b.rules) {
+		fprintf(stderr, "Error: invalid rules, start, batch or threads\n");
+		bench_usage();
+		return -EINVAL;
+	}
+
+	match_set_match_nl_verbose_and_streamer(0);
+	(void)verbose;
+
+	w = calloc(b.threads, sizeof(*w));
+	if (!w)
+		return -ENOMEM;
+
+	share = b.rules / b.threads;
+	for (i = 0, first = b.start; i < b.threads; i++) {
+		unsigned int count = share + (i < b.rules % b.threads);
+
+		err = match_bench_worker_init(&w[i], &b, first, count);
+		if (err) {
+			fprintf(stderr, "Error: unable to generate rules for table %u (%s)\n",
+				b.table->uid, strerror(-err));
+			goto out;
+		}
+		first += count;
+	}
+
+	printf("table %u: %u rules, batch %u, %u threads, %s keys\n",
+	       b.table->uid, b.rules, b.batch, b.threads,
+	       b.random ? "random" : "sequential");
+	printf("%-8s %8s %8s %10s %12s %10s %10s %10s\n", "op", "rules",
+	       "errors", "secs", "rules/s", "p50(us)", "p99(us)", "p999(us)");
+
+	for (i = 0; i < __MATCH_BENCH_MAX; i++) {
+		if (!(b.ops & (1U << i)))
+			continue;
+		err = match_bench_op(&b, w, i);
+		if (err)
+			break;
+	}
+out:
+	for (i = 0; i < b.threads; i++)
+		match_bench_worker_free(&w[i]);
+	free(w);
+	return err;
+}
+
+/* Counters of one rule or port at the previous sample */
+struct match_top_entry {
+	uint64_t key;		/* table << 32 | uid, port_id for ports */
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t tx_packets;
+	uint64_t tx_bytes;
+	unsigned int sample;	/* sample the counters were read in */
+};
+
+/* Open addressing map from rule or port to its previous counters */
+struct match_top_map {
+	struct match_top_entry *slots;
+	unsigned int size;	/* power of two */
+	unsigned int used;
+};
+
+struct match_top_rate {
+	uint64_t key;
+	double pps;
+	double bps;
+	double tx_pps;
+	double tx_bps;
+};
+
+/* Min-heap keeping the busiest N entries of a sample */
+struct match_top_heap {
+	struct match_top_rate *rates;
+	unsigned int count;
+	unsigned int max;
+	bool by_bytes;
+};
+
+struct match_top {
+	uint32_t table;
+	uint32_t interval;	/* milliseconds */
+	uint32_t top;
+	uint32_t count;
+	bool rules;
+	bool ports;
+	bool by_bytes;
+	bool csv;
+	unsigned int sample;
+	uint64_t last;		/* time of the previous sample */
+	struct match_top_map rule_map;
+	struct match_top_map port_map;
+	struct match_top_heap rule_heap;
+	struct match_top_heap port_heap;
+	unsigned int nrules;
+};
+
+static unsigned int match_top_hash(uint64_t key, unsigned int size)
+{
+	return (unsigned int)((key * 0x9e3779b97f4a7c15ULL) >> 32) & (size - 1);
+}
+
+static struct match_top_entry *
+match_top_map_slot(struct match_top_map *m, uint64_t key)
+{
+	unsigned int i = match_top_hash(key, m->size);
+
+	while (m->slots[i].sample && m->slots[i].key != key)
+		i = (i + 1) & (m->size - 1);
+	return &m->slots[i];
+}
+
+/*
+ * Rehash the map, dropping the entries not seen in the current or previous
+ * sample. The map only doubles when the remaining entries would still fill
+ * half of it, so that rules replaced over time do not keep it growing.
+ */
+static int match_top_map_rehash(struct match_top_map *m, unsigned int sample)
+{
+	struct match_top_entry *old = m->slots, *e;
+	unsigned int i, size = m->size, live = 0;
+
+	for (i = 0; i < size; i++)
+		live += old[i].sample && old[i].sample + 1 >= sample;
+
+	if (!size)
+		m->size = 1024;
+	else if (live * 2 >= m->used)
+		m->size = size * 2;
+	m->slots = calloc(m->size, sizeof(*m->slots));
+	if (!m->slots) {
+		m->slots = old;
+		m->size = size;
+		return -ENOMEM;
+	}
+
+	m->used = 0;
+	for (i = 0; i < size; i++) {
+		if (!old[i].sample || old[i].sample + 1 < sample)
+			continue;
+		e = match_top_map_slot(m, old[i].key);
+		*e = old[i];
+		m->used++;
+	}
+	free(old);
+	return 0;
+}
+
+static struct match_top_entry *
+match_top_map_get(struct match_top_map *m, uint64_t key, unsigned int sample)
+{
+	struct match_top_entry *e;
+
+	if (m->used * 2 >= m->size && match_top_map_rehash(m, sample))
+		return NULL;
+
+	e = match_top_map_slot(m, key);
+	if (!e->sample) {
+		e->key = key;
+		m->used++;
+	}
+	return e;
+}
+
+static double match_top_rate_val(struct match_top_heap *h,
+				 struct match_top_rate *r)
+{
+	return h->by_bytes ? r->bps + r->tx_bps : r->pps + r->tx_pps;
+}
+
+static void match_top_heap_push(struct match_top_heap *h,
+				struct match_top_rate *r)
+{
+	struct match_top_rate tmp;
+	unsigned int i, c;
+
+	if (h->count < h->max) {
+		/* sift up */
+		i = h->count++;
+		h->rates[i] = *r;
+		while (i && match_top_rate_val(h, &h->rates[(i - 1) / 2]) >
+			    match_top_rate_val(h, &h->rates[i])) {
+			tmp = h->rates[i];
+			h->rates[i] = h->rates[(i - 1) / 2];
+			h->rates[(i - 1) / 2] = tmp;
+			i = (i - 1) / 2;
+		}
+		return;
+	}
+
+	if (!h->count ||
+	    match_top_rate_val(h, r) <= match_top_rate_val(h, &h->rates[0]))
+		return;
+
+	/* replace the smallest entry and sift down */
+	h->rates[0] = *r;
+	for (i = 0; (c = 2 * i + 1) < h->count; i = c) {
+		if (c + 1 < h->count &&
+		    match_top_rate_val(h, &h->rates[c + 1]) <
+		    match_top_rate_val(h, &h->rates[c]))
+			c++;
+		if (match_top_rate_val(h, &h->rates[i]) <=
+		    match_top_rate_val(h, &h->rates[c]))
+			break;
+		tmp = h->rates[i];
+		h->rates[i] = h->rates[c];
+		h->rates[c] = tmp;
+	}
+}
+
+static int match_top_cmp_pps(const void *a, const void *b)
+{
+	const struct match_top_rate *x = a, *y = b;
+	double vx = x->pps + x->tx_pps, vy = y->pps + y->tx_pps;
+
+	return vx < vy ? 1 : vx > vy ? -1 : 0;
+}
+
+static int match_top_cmp_bps(const void *a, const void *b)
+{
+	const struct match_top_rate *x = a, *y = b;
+	double vx = x->bps + x->tx_bps, vy = y->bps + y->tx_bps;
+
+	return vx < vy ? 1 : vx > vy ? -1 : 0;
+}
+
+/* Sort the heap from the busiest entry down */
+static void match_top_heap_sort(struct match_top_heap *h)
+{
+	qsort(h->rates, h->count, sizeof(*h->rates),
+	      h->by_bytes ? match_top_cmp_bps : match_top_cmp_pps);
+}
+
+static double match_top_delta(uint64_t now, uint64_t prev, double secs)
+{
+	/* counters that went backwards were reset */
+	return now >= prev ? (double)(now - prev) / secs : 0;
+}
+
+static int match_top_sample_rules(struct match_top *t, struct net_mat_rule *rules,
+				  double secs)
+{
+	struct match_top_entry *e;
+	struct match_top_rate r;
+	unsigned int i;
+
+	for (i = 0; rules[i].uid; i++) {
+		e = match_top_map_get(&t->rule_map,
+				      (uint64_t)rules[i].table_id << 32 |
+				      rules[i].uid, t->sample);
+		if (!e)
+			return -ENOMEM;
+
+		if (e->sample && secs > 0) {
+			memset(&r, 0, sizeof(r));
+			r.key = e->key;
+			r.pps = match_top_delta(rules[i].packets, e->packets,
+						secs);
+			r.bps = match_top_delta(rules[i].bytes, e->bytes,
+						secs) * 8;
+			match_top_heap_push(&t->rule_heap, &r);
+		}
+
+		e->packets = rules[i].packets;
+		e->bytes = rules[i].bytes;
+		e->sample = t->sample;
+		t->nrules++;
+	}
+
+	return 0;
+}
+
+static int match_top_sample_ports(struct match_top *t, struct net_mat_port *ports,
+				  double secs)
+{
+	struct net_mat_port_stats *st;
+	struct match_top_entry *e;
+	struct match_top_rate r;
+	unsigned int i;
+
+	for (i = 0; ports[i].port_id != NET_MAT_PORT_ID_UNSPEC; i++) {
+		st = &ports[i].stats;
+		e = match_top_map_get(&t->port_map, ports[i].port_id,
+				      t->sample);
+		if (!e)
+			return -ENOMEM;
+
+		if (e->sample && secs > 0) {
+			r.key = e->key;
+			r.pps = match_top_delta(st->rx_packets, e->packets, secs);
+			r.bps = match_top_delta(st->rx_bytes, e->bytes, secs) * 8;
+			r.tx_pps = match_top_delta(st->tx_packets, e->tx_packets,
+						   secs);
+			r.tx_bps = match_top_delta(st->tx_bytes, e->tx_bytes,
+						   secs) * 8;
+			match_top_heap_push(&t->port_heap, &r);
+		}
+
+		e->packets = st->rx_packets;
+		e->bytes = st->rx_bytes;
+		e->tx_packets = st->tx_packets;
+		e->tx_bytes = st->tx_bytes;
+		e->sample = t->sample;
+	}
+
+	return 0;
+}
+
+static void match_top_json(const char *kind, uint64_t time_ms, uint32_t table,
+			   uint32_t id, struct match_top_rate *r)
+{
+	mat_json_object_start(json_stream, NULL);
+	mat_json_uint(json_stream, "time_ms", time_ms);
+	mat_json_string(json_stream, "kind", kind);
+	if (table)
+		mat_json_uint(json_stream, "table", table);
+	mat_json_uint(json_stream, "id", id);
+	mat_json_uint(json_stream, "pps", (uint64_t)(r->pps + 0.5));
+	mat_json_uint(json_stream, "bps", (uint64_t)(r->bps + 0.5));
+	if (!table) {
+		mat_json_uint(json_stream, "tx_pps", (uint64_t)(r->tx_pps + 0.5));
+		mat_json_uint(json_stream, "tx_bps", (uint64_t)(r->tx_bps + 0.5));
+	}
+	mat_json_object_end(json_stream);
+}
+
+static void match_top_print(struct match_top *t, uint64_t time_ms)
+{
+	struct match_top_rate *r;
+	unsigned int i;
+
+	match_top_heap_sort(&t->rule_heap);
+	match_top_heap_sort(&t->port_heap);
+
+	if (json_stream) {
+		for (i = 0; i < t->rule_heap.count; i++) {
+			r = &t->rule_heap.rates[i];
+			match_top_json("rule", time_ms, (uint32_t)(r->key >> 32),
+				       (uint32_t)r->key, r);
+		}
+		for (i = 0; i < t->port_heap.count; i++) {
+			r = &t->port_heap.rates[i];
+			match_top_json("port", time_ms, 0, (uint32_t)r->key, r);
+		}
+		mat_stream_flush(json_stream);
+		return;
+	}
+
+	if (t->csv) {
+		for (i = 0; i < t->rule_heap.count; i++) {
+			r = &t->rule_heap.rates[i];
+			printf("%" PRIu64 ",rule,%u,%u,%.0f,%.0f,,\n", time_ms,
+			       (uint32_t)(r->key >> 32), (uint32_t)r->key,
+			       r->pps, r->bps);
+		}
+		for (i = 0; i < t->port_heap.count; i++) {
+			r = &t->port_heap.rates[i];
+			printf("%" PRIu64 ",port,,%u,%.0f,%.0f,%.0f,%.0f\n",
+			       time_ms, (uint32_t)r->key, r->pps, r->bps,
+			       r->tx_pps, r->tx_bps);
+		}
+		fflush(stdout);
+		return;
+	}
+
+	/* home the cursor and clear the screen before redrawing */
+	printf("\033[H\033[J");
+	printf("match top - %u rules, every %u ms, sorted by %s\n\n",
+	       t->nrules, t->interval, t->by_bytes ? "bps" : "pps");
+
+	if (t->rules) {
+		printf("%-16s %10s %14s %16s\n", "TABLE", "RULE", "PPS", "BPS");
+		for (i = 0; i < t->rule_heap.count; i++) {
+			r = &t->rule_heap.rates[i];
+			printf("%-16s %10u %14.0f %16.0f\n",
+			       table_names((uint32_t)(r->key >> 32)),
+			       (uint32_t)r->key, r->pps, r->bps);
+		}
+		printf("\n");
+	}
+
+	if (t->ports) {
+		printf("%-10s %14s %16s %14s %16s\n", "PORT", "RX PPS",
+		       "RX BPS", "TX PPS", "TX BPS");
+		for (i = 0; i < t->port_heap.count; i++) {
+			r = &t->port_heap.rates[i];
+			printf("%-10u %14.0f %16.0f %14.0f %16.0f\n",
+			       (uint32_t)r->key, r->pps, r->bps,
+			       r->tx_pps, r->tx_bps);
+		}
+	}
+	fflush(stdout);
+}
+
+static int match_top_poll(struct match_top *t, uint32_t pid, int family,
+			  uint32_t ifindex, struct net_mat_tbl *tables)
+{
+	struct net_mat_rule *rules;
+	struct net_mat_port *ports;
+	uint64_t now = match_now_ns();
+	double secs = t->last ? (double)(now - t->last) / 1e9 : 0;
+	unsigned int i, n;
+	int err = 0;
+
+	t->sample++;
+	t->last = now;
+	t->nrules = 0;
+	t->rule_heap.count = 0;
+	t->port_heap.count = 0;
+
+	for (i = 0; t->rules && tables[i].uid; i++) {
+		if (t->table && tables[i].uid != t->table)
+			continue;
+
+		rules = match_nl_get_rules(nsd, pid, ifindex, family,
+					   tables[i].uid, 0, 0);
+		if (!rules)
+			continue;
+
+		err = match_top_sample_rules(t, rules, secs);
+		for (n = 0; rules[n].uid; n++)
+			;
+		match_free_rules(rules, n);
+		if (err)
+			return err;
+	}
+
+	if (t->ports) {
+		ports = match_nl_get_ports(nsd, pid, ifindex, family, 0, 0);
+		if (ports) {
+			err = match_top_sample_ports(t, ports, secs);
+			free(ports);
+		}
+	}
+
+	return err;
+}
+
+/*
+ * match_top_send() - run the top command
+ *
+ * Rules and ports are polled over one socket. Counters of the previous
+ * sample are kept in hash maps so each sample is a single pass over the
+ * rules, and a bounded heap selects the busiest entries.
+ */
+int
+match_top_send(int verbose, uint32_t pid, int family, uint32_t ifindex,
+	       int argc, char **argv)
+{
+	struct match_top t = {
+		.interval = 1000, .top = 20, .rules = true, .ports = true,
+	};
+	struct {
+		const char *name;
+		uint32_t *val;
+	} nums[] = {
+		{ "interval", &t.interval },
+		{ "top", &t.top },
+		{ "count", &t.count },
+	};
+	struct net_mat_tbl *tables;
+	struct timespec ts;
+	uint64_t start, elapsed;
+	unsigned int i;
+	int err = 0;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "rules") == 0) {
+			t.ports = false;
+		} else if (strcmp(*argv, "ports") == 0) {
+			t.rules = false;
+		} else if (strcmp(*argv, "sort") == 0) {
+			next_arg();
+			if (*argv && strcmp(*argv, "bps") == 0) {
+				t.by_bytes = true;
+			} else if (!*argv || strcmp(*argv, "pps") != 0) {
+				fprintf(stderr, "Error: sort must be pps or bps\n");
+				top_usage();
+				return -EINVAL;
+			}
+		} else if (strcmp(*argv, "table") == 0) {
+			next_arg();
+			if (*argv && parse_arg_u32(*argv, &t.table))
+				t.table = find_table(*argv);
+			if (!t.table) {
+				fprintf(stderr, "Error: invalid table\n");
+				top_usage();
+				return -EINVAL;
+			}
+		} else if (strcmp(*argv, "format") == 0) {
+			next_arg();
+			if (*argv && strcmp(*argv, "csv") == 0) {
+				t.csv = true;
+			} else if (!*argv || strcmp(*argv, "text") != 0) {
+				fprintf(stderr, "Error: format must be text or csv\n");
+				top_usage();
+				return -EINVAL;
+			}
+		} else {
+			for (i = 0; i < sizeof(nums) / sizeof(nums[0]); i++) {
+				if (strcmp(*argv, nums[i].name) == 0)
+					break;
+			}
+			if (i == sizeof(nums) / sizeof(nums[0])) {
+				fprintf(stderr, "Error: unexpected argument `%s`\n",
+					*argv);
+				top_usage();
+				return -EINVAL;
+			}
+
+			next_arg();
+			if (!*argv || parse_arg_u32(*argv, nums[i].val)) {
+				fprintf(stderr, "Error: invalid %s\n",
+					nums[i].name);
+				top_usage();
+				return -EINVAL;
+			}
+		}
+		argc--; argv++;
+	}
+
+	if (!t.top || !t.interval || (!t.rules && !t.ports)) {
+		top_usage();
+		return -EINVAL;
+	}
+
+	match_socket_open();
+	match_set_match_nl_verbose_and_streamer(0);
+	(void)verbose;
+
+	tables = match_nl_get_tables(nsd, pid, ifindex, family);
+	if (!tables) {
+		fprintf(stderr, "Error: match_nl_get_tables() failed\n");
+		return -ECOMM;
+	}
+
+	t.rule_heap.max = t.top;
+	t.rule_heap.by_bytes = t.by_bytes;
+	t.rule_heap.rates = calloc(t.top, sizeof(*t.rule_heap.rates));
+	t.port_heap.max = t.top;
+	t.port_heap.by_bytes = t.by_bytes;
+	t.port_heap.rates = calloc(t.top, sizeof(*t.port_heap.rates));
+	if (!t.rule_heap.rates || !t.port_heap.rates ||
+	    match_top_map_rehash(&t.rule_map, 0) ||
+	    match_top_map_rehash(&t.port_map, 0)) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	if (t.csv && !json_stream)
+		printf("time_ms,kind,table,id,pps,bps,tx_pps,tx_bps\n");
+
+	start = match_now_ns();
+	for (i = 0; !t.count || i <= t.count; i++) {
+		err = match_top_poll(&t, pid, family, ifindex, tables);
+		if (err)
+			break;
+
+		/* the first sample only primes the counters */
+		if (i)
+			match_top_print(&t, (t.last - start) / 1000000);
+
+		if (t.count && i == t.count)
+			break;
+
+		elapsed = match_now_ns() - t.last;
+		if (elapsed < (uint64_t)t.interval * 1000000) {
+			elapsed = (uint64_t)t.interval * 1000000 - elapsed;
+			ts.tv_sec = (time_t)(elapsed / 1000000000);
+			ts.tv_nsec = (long)(elapsed % 1000000000);
+			nanosleep(&ts, NULL);
+		}
+	}
+
+out:
+	free(t.rule_map.slots);
+	free(t.port_map.slots);
+	free(t.rule_heap.rates);
+	free(t.port_heap.rates);
+	free(tables);
+	return err;
+}
+
+static int parse_arg_u32(char *argv, uint32_t *val)
+{
+	long ret;
+	int base = 10;
+	char *end = NULL;
+
+	if (!argv || !val)
+		return -1;
+
+	if (strlen(argv) >= 2) {
+		if (argv[0] == '0' && (argv[1] == 'x' || argv[1] == 'X'))
+			base = 16;
+	}
+
+	errno = 0;
+	ret = strtol(argv, &end, base);
+	if (errno != 0 || ret < 0 || ret > ~((uint32_t)0) || argv == end)
+		return -1;
+
+	*val = (uint32_t)ret;
+
+	return 0;
+}
+
+/* A flight recorder dump is decoded without a running daemon */
+static bool match_cmd_is_offline(int argc, char **argv)
+{
+	int i;
+
+	if (argc < 1 || strcmp(argv[0], "flight"))
+		return false;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "file") == 0)
+			return true;
+	}
+
+	return false;
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t cmd = NET_MAT_TABLE_CMD_GET_TABLES;
+	int family = NET_MAT_DFLT_FAMILY, err;
+	unsigned int ifindex = 0;
+	uint32_t pid = 0;
+	int verbose = 1;
+	unsigned int burst, interval_ms;
+	bool help_usage = false;
+	bool resolve_names = true;
+	bool json = false;
+	char *batch = NULL;
+	int status = 0;
+	int opt;
+	int args = 1;
+	int opt_index = 0;
+	static struct option long_options[] = {
+		{ "version", no_argument, NULL, 0 },
+		{ 0, 0, 0, 0}
+	};
+
+	progname = argv[0];
+	if (argc < 2) {
+		match_usage();
+		return 0;
+	}
+
+	while ((opt = getopt_long(argc, argv, "p:f:hsgjb:r:", long_options,
+	                          &opt_index)) != -1) {
+		switch (opt) {
+		case 0:
+			if (!strcmp(long_options[opt_index].name, "version")) {
+				printf("Match Version: %s\n", match_version());
+				exit(0);
+			}
+			break;
+		case 'h':
+			match_usage();
+			exit(-1);
+		case 'p':
+			err = parse_arg_u32(optarg, &pid);
+			if (err < 0) {
+				fprintf(stderr, "Error parsing pid\n");
+				match_usage();
+				exit(-1);
+			}
+			args += 2;
+			break;
+		case 'f':
+			family = atoi(optarg);
+			args += 2;
+			break;
+		case 'g':
+			verbose = PRINT_GRAPHVIZ;
+			args++;
+			break;
+		case 's':
+			verbose = 0;
+			args++;
+			break;
+		case 'j':
+			json = true;
+			args++;
+			break;
+		case 'b':
+			batch = optarg;
+			args += 2;
+			break;
+		case 'r':
+			interval_ms = 5000;
+			if (sscanf(optarg, "%u/%u", &burst, &interval_ms) < 1 ||
+			    !interval_ms) {
+				fprintf(stderr, "Error parsing log rate limit\n");
+				match_usage();
+				exit(-1);
+			}
+			mat_log_set_ratelimit(burst, interval_ms);
+			args += 2;
+			break;
+		default:
+			match_usage();
+			exit(-1);
+		}
+	}
+
+	if (json) {
+		json_stream = mat_stream_json(stdout);
+		if (!json_stream) {
+			fprintf(stderr, "Error: unable to allocate JSON stream\n");
+			exit(-1);
+		}
+	}
+
+	/*
+	 * At leas one non-option argument is expected "help" or COMMAND,
+	 * commands are read from the batch file instead with -b
+	 */
+	if (batch && args < argc) {
+		fprintf(stderr, "Error: unexpected command `%s` with -b\n",
+			argv[args]);
+		match_usage();
+		exit(-1);
+	}
+
+	if (!batch && args >= argc) {
+		fprintf(stderr, "Error parsing command\n");
+		match_usage();
+		exit(-1);
+	}
+
+	if (!batch && strcmp(argv[args], "help") == 0) {
+		help_usage = true;
+		args++;
+		if (args >= argc) {
+			/*
+			 * "help" without a COMMAND is treated like "-h" option
+			 */
+			match_usage();
+			return 0;
+		}
+	}
+
+	if (!help_usage) {
+		match_set_match_nl_verbose_and_streamer(verbose);
+
+		if (!pid && (batch || !match_cmd_is_offline(argc - args,
+							      argv + args))) {
+			pid = match_pid_lookup();
+			if (!pid) {
+				fprintf(stderr, "pid lookup failed and not specified\n");
+				match_usage();
+				exit(-1);
+			}
+		}
+	}
+
+	if (batch) {
+		cmd = MATCH_CMD_BATCH;
+	} else if (match_cmd_lookup(argv[args], &cmd, &resolve_names)) {
+		match_usage();
+		err = -EINVAL;
+		goto out;
+	}
+
+	if (help_usage) {
+		switch (cmd) {
+		case NET_MAT_TABLE_CMD_SET_RULES:
+			set_rule_usage();
+			break;
+		case NET_MAT_TABLE_CMD_DEL_RULES:
+			del_rule_usage();
+			break;
+		case NET_MAT_TABLE_CMD_GET_RULES:
+			get_rules_usage();
+			break;
+		case NET_MAT_TABLE_CMD_CREATE_TABLE:
+			create_usage();
+			break;
+		case NET_MAT_TABLE_CMD_DESTROY_TABLE:
+			destroy_usage();
+			break;
+		case NET_MAT_TABLE_CMD_UPDATE_TABLE:
+			update_usage();
+			break;
+		case NET_MAT_PORT_CMD_GET_LPORT:
+			get_lport_usage();
+			break;
+		case NET_MAT_PORT_CMD_GET_PHYS_PORT:
+			get_phys_port_usage();
+			break;
+		case NET_MAT_PORT_CMD_GET_PORTS:
+			get_port_usage();
+			break;
+		case NET_MAT_PORT_CMD_SET_PORTS:
+			set_port_usage();
+			break;
+		case NET_MAT_EVENT_CMD_SUBSCRIBE:
+			monitor_usage();
+			break;
+		case MATCH_CMD_SNAPSHOT:
+			snapshot_usage();
+			break;
+		case MATCH_CMD_BENCH:
+			bench_usage();
+			break;
+		case MATCH_CMD_TOP:
+			top_usage();
+			break;
+		case MATCH_CMD_APPLY:
+			apply_usage();
+			break;
+		case NET_MAT_DAEMON_CMD_GET_FLIGHT:
+			flight_usage();
+			break;
+		case NET_MAT_DAEMON_CMD_GET_STATS:
+			stats_usage();
+			break;
+		default:
+			match_usage();
+			break;
+		}
+
+		return 0;
+	}
+
+	switch (cmd) {
+	case NET_MAT_TABLE_CMD_GET_RULES:
+	case NET_MAT_TABLE_CMD_GET_TABLES:
+	case NET_MAT_PORT_CMD_GET_PORTS:
+	case MATCH_CMD_BATCH:
+	case MATCH_CMD_TOP:
+	case NET_MAT_DAEMON_CMD_GET_STATS:
+		break;
+	default:
+		if (json) {
+			fprintf(stderr, "Error: -j is not supported by %s\n",
+				argv[args]);
+			exit(-1);
+		}
+		break;
+	}
+
+	/* Get the family */
+	if (family < 0) {
+		struct nl_sock *fd = NULL;
+
+		fd = nl_socket_alloc();
+		genl_connect(fd);
+
+		family = genl_ctrl_resolve(fd, NET_MAT_GENL_NAME);
+		if (family < 0) {
+			printf("Can not resolve family\n");
+			goto out;
+		}
+		nl_close(fd);
+		nl_socket_free(fd);
+	}
+
+	if (resolve_names) {
+		/* Pipeline metadata is replayed from the cache file as long
+		 * as the daemon reports the same pipeline generation.
+		 */
+		match_nl_cache_enable(MATCHLIB_CACHE_FILE);
+
 		err = match_send_recv(0, pid, family, ifindex,
 				NET_MAT_TABLE_CMD_GET_HEADERS);
 		if (err < 0)
@@ -2737,42 +5466,17 @@ int main(int argc, char **argv)
 	argc = argc - args - 1;
 	argv = argv + args + 1;
 
-	switch (cmd) {
-	case NET_MAT_TABLE_CMD_SET_RULES:
-		rule_set_send(verbose, pid, family, ifindex, argc, argv);
-		break;
-	case NET_MAT_TABLE_CMD_DEL_RULES:
-		rule_del_send(verbose, pid, family, ifindex, argc, argv);
-		break;
-	case NET_MAT_TABLE_CMD_GET_RULES:
-		rule_get_send(verbose, pid, family, ifindex, argc, argv);
-		break;
-	case NET_MAT_TABLE_CMD_CREATE_TABLE:
-		match_create_tbl_send(verbose, pid, family, ifindex, argc, argv, cmd);
-		break;
-	case NET_MAT_TABLE_CMD_DESTROY_TABLE:
-		match_destroy_tbl_send(verbose, pid, family, ifindex,
-				argc, argv);
-		break;
-	case NET_MAT_TABLE_CMD_UPDATE_TABLE:
-		match_create_tbl_send(verbose, pid, family, ifindex, argc, argv, cmd);
-		break;
-	case NET_MAT_PORT_CMD_GET_LPORT:
-		match_get_port_send(verbose, pid, family, ifindex, argc, argv, cmd);
-		break;
-	case NET_MAT_PORT_CMD_GET_PHYS_PORT:
-		match_get_port_send(verbose, pid, family, ifindex, argc, argv, cmd);
-		break;
-	case NET_MAT_PORT_CMD_GET_PORTS:
-		match_get_port_send(verbose, pid, family, ifindex, argc, argv, cmd);
-		break;
-	case NET_MAT_PORT_CMD_SET_PORTS:
-		match_set_port_send(verbose, pid, family, ifindex, argc, argv, cmd);
-		break;
-	default:
-		match_send_recv(verbose, pid, family, ifindex, cmd);
-		break;
+	if (cmd == MATCH_CMD_BATCH) {
+		err = match_batch_send(verbose, pid, family, ifindex, batch);
+		if (err)
+			status = -1;
+	} else {
+		err = match_cmd_send(verbose, pid, family, ifindex, cmd,
+				     argc, argv);
+		if (err < 0)
+			status = -1;
 	}
 out:
-	return 0;
+	mat_stream_flush(json_stream);
+	return status;
 }
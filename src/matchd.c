@@ -54,19 +54,27 @@
 #include "matchd_lib.h"
 #include "backend.h"
 #include "matlog.h"
+#include "matflight.h"
+#include "matshm.h"
 #include "match_version.h"
 
 #define DEFAULT_BACKEND_NAME "ies_pipeline"
 
+/* Counter refresh period of the state published with -m */
+#define MATCHD_SHM_INTERVAL_MS 1000
+
 static void matchd_usage(void)
 {
-	MAT_LOG(ERR, "matchd [-b backend] [-f family_id] [-h] [-l] [-s] [-v[v]]\n");
+	MAT_LOG(ERR, "matchd [-a] [-b backend] [-f family_id] [-h] [-l] [-r burst[/ms]] [-s] [-v[v]]\n");
 	MAT_LOG(ERR, "Options:\n");
+	MAT_LOG(ERR, "  -a            log from a background thread\n");
 	MAT_LOG(ERR, "  -b backend    name of backend to load (default: %s)\n", DEFAULT_BACKEND_NAME);
 	MAT_LOG(ERR, "  -d            run as a daemon\n");
 	MAT_LOG(ERR, "  -f family_id  netlink family id\n");
 	MAT_LOG(ERR, "  -h            display this help and exit\n");
 	MAT_LOG(ERR, "  -l            list available backends and exit\n");
+	MAT_LOG(ERR, "  -m            publish the daemon state in %s\n", MAT_SHM_FILE);
+	MAT_LOG(ERR, "  -r burst[/ms] log at most burst errors per call site every ms (default: 5000)\n");
 	MAT_LOG(ERR, "  -s            add all ports to default vlan (ies_pipeline only)\n");
 	MAT_LOG(ERR, "  -v            be verbose (enable info messages)\n");
 	MAT_LOG(ERR, "  -vv           be very verbose (enable info+debug messages)\n");
@@ -121,6 +129,22 @@ static int matchd_create_pid(void)
 	return 0;
 }
 
+/* Dump the flight recorder, only async-signal-safe calls are made */
+static void matchd_flight_handler(int sig __unused)
+{
+	int saved_errno = errno;
+	int fd;
+
+	fd = open(MAT_FLIGHT_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		  S_IRUSR | S_IWUSR);
+	if (fd >= 0) {
+		mat_flight_dump_fd(fd);
+		close(fd);
+	}
+
+	errno = saved_errno;
+}
+
 static void matchd_int_handler(int sig __unused)
 {
 	MAT_LOG(DEBUG, "\nmatchd exiting...\n");
@@ -145,6 +169,9 @@ int main(int argc, char **argv)
 	struct switch_args sw_args;
 	struct sigaction sig_act;
 	int verbose = 0;
+	unsigned int burst, interval_ms;
+	bool async_log = false;
+	bool shm = false;
 	int opt_index = 0;
 	static struct option long_options[] = {
 		{ "version", no_argument, NULL, 0 },
@@ -153,9 +180,12 @@ int main(int argc, char **argv)
 
 	memset(&sw_args, 0, sizeof(sw_args));
 
-	while ((opt = getopt_long(argc, argv, "b:f:vhls", long_options,
+	while ((opt = getopt_long(argc, argv, "ab:f:vhlmr:s", long_options,
 	                          &opt_index)) != -1) {
 		switch (opt) {
+		case 'a':
+			async_log = true;
+			break;
 		case 0:
 			if (!strcmp(long_options[opt_index].name, "version")) {
 				printf("Match Version: %s\n", match_version());
@@ -174,6 +204,18 @@ int main(int argc, char **argv)
 		case 'l':
 			match_backend_list_all();
 			exit(0);
+		case 'm':
+			shm = true;
+			break;
+		case 'r':
+			interval_ms = 5000;
+			if (sscanf(optarg, "%u/%u", &burst, &interval_ms) < 1 ||
+			    !interval_ms) {
+				matchd_usage();
+				exit(-1);
+			}
+			mat_log_set_ratelimit(burst, interval_ms);
+			break;
 		case 's':
 			sw_args.single_vlan = true;
 			break;
@@ -193,6 +235,9 @@ int main(int argc, char **argv)
 	else
 		mat_setlogmask(MAT_LOG_UPTO(MAT_LOG_ERR));
 
+	if (async_log && mat_log_async_start(0))
+		MAT_LOG(ERR, "Warning: cannot start asynchronous logging\n");
+
 	nsd = nl_socket_alloc();
 	nl_socket_set_local_port(nsd, (uint32_t)getpid());
 	nl_connect(nsd, NETLINK_GENERIC);
@@ -200,12 +245,21 @@ int main(int argc, char **argv)
 	if (backend == NULL)
 		backend = DEFAULT_BACKEND_NAME;
 
+	matchd_set_verbose(verbose);
+
 	rc = matchd_init(nsd, family, backend, &sw_args);
 	if (rc) {
 		MAT_LOG(ERR, "Error: cannot init matchd\n");
 		exit(-1);
 	}
 
+	if (shm) {
+		err = matchd_shm_enable(MAT_SHM_FILE, MATCHD_SHM_INTERVAL_MS);
+		if (err)
+			MAT_LOG(ERR, "Warning: cannot publish state in %s: %s\n",
+				MAT_SHM_FILE, strerror(-err));
+	}
+
 	err = matchd_create_pid();
 	if (err) {
 		MAT_LOG(ERR, "matchd create pid failed\n");
@@ -216,6 +270,11 @@ int main(int argc, char **argv)
 	sigaction(SIGINT, &sig_act, NULL);
 	sigaction(SIGTERM, &sig_act, NULL);
 
+	memset(&sig_act, 0, sizeof(sig_act));
+	sig_act.sa_handler = matchd_flight_handler;
+	sig_act.sa_flags = SA_RESTART;
+	sigaction(SIGUSR1, &sig_act, NULL);
+
 	err = matchd_receive_loop(nsd);
 	if (err) {
 		MAT_LOG(ERR, "Error in matchd_receive_loop()\n");
@@ -226,5 +285,6 @@ int main(int argc, char **argv)
 
 	nl_close(nsd);
 	nl_socket_free(nsd);
+	mat_log_async_stop();
 	return rc;
 }
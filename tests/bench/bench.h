@@ -0,0 +1,191 @@
+/*******************************************************************************
+
+  MATCH Library - Options, timing and result output shared by the benchmarks
+  Copyright (c) <2015>, Intel Corporation
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_DEFAULT_MSECS	200
+
+struct bench_opts {
+	bool json;
+	unsigned int batches;	/* fixed batch count, 0 to run for msecs */
+	unsigned int msecs;
+	const char *filter;
+};
+
+/* A column of the results, named key in JSON and title in the text table */
+struct bench_metric {
+	const char *key;
+	const char *title;
+	int width;
+	int precision;
+	double value;
+};
+
+static inline uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline void bench_usage(const char *prog, const char *filter)
+{
+	printf("Usage: %s [-j] [-n BATCHES] [-t MSECS] [FILTER]\n", prog);
+	printf(" -j          one JSON object per result\n");
+	printf(" -n BATCHES  run a fixed number of batches per benchmark\n");
+	printf(" -t MSECS    minimum run time per benchmark (default %u)\n",
+	       BENCH_DEFAULT_MSECS);
+	printf(" FILTER      run benchmarks whose %s contains FILTER\n", filter);
+}
+
+/*
+ * bench_parse_opts() - parse the options common to the benchmarks
+ * @argc: argument count of main()
+ * @argv: arguments of main()
+ * @prog: program name printed by the usage
+ * @filter: what FILTER is matched against, printed by the usage
+ * @opts: filled in with the options
+ *
+ * Return: 0 to run the benchmarks, 1 if only the usage was asked for or a
+ *         negative errno on an invalid option
+ */
+static inline int bench_parse_opts(int argc, char **argv, const char *prog,
+				   const char *filter, struct bench_opts *opts)
+{
+	int opt;
+
+	opts->json = false;
+	opts->batches = 0;
+	opts->msecs = BENCH_DEFAULT_MSECS;
+	opts->filter = NULL;
+
+	while ((opt = getopt(argc, argv, "jn:t:h")) != -1) {
+		switch (opt) {
+		case 'j':
+			opts->json = true;
+			break;
+		case 'n':
+			opts->batches = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			opts->msecs = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			bench_usage(prog, filter);
+			return 1;
+		default:
+			bench_usage(prog, filter);
+			return -EINVAL;
+		}
+	}
+	if (optind < argc)
+		opts->filter = argv[optind];
+
+	return 0;
+}
+
+/* Deadline of a benchmark started at start, see bench_more() */
+static inline uint64_t bench_deadline(const struct bench_opts *opts,
+				      uint64_t start)
+{
+	return start + (uint64_t)opts->msecs * 1000000ULL;
+}
+
+/* Whether another batch is due after the first batches ones */
+static inline bool bench_more(const struct bench_opts *opts,
+			      unsigned int batches, uint64_t deadline)
+{
+	return opts->batches ? batches < opts->batches : bench_now() < deadline;
+}
+
+/* Print the titles of the text table, nothing for JSON results */
+static inline void bench_print_header(const struct bench_opts *opts,
+				      bool shape,
+				      const struct bench_metric *metrics,
+				      unsigned int count)
+{
+	unsigned int i;
+
+	if (opts->json)
+		return;
+
+	printf("%-18s", "bench");
+	if (shape)
+		printf(" %-14s", "shape");
+	for (i = 0; i < count; i++)
+		printf(" %*s", metrics[i].width, metrics[i].title);
+	printf(" %10s\n", "ops");
+}
+
+/*
+ * bench_print_result() - print the result of one benchmark
+ * @opts: command line options, selecting JSON or text output
+ * @name: name of the benchmark
+ * @shape: shape the benchmark ran on, NULL if it has none
+ * @metrics: the measured values
+ * @count: number of entries in @metrics
+ * @ops: number of operations timed
+ */
+static inline void bench_print_result(const struct bench_opts *opts,
+				      const char *name, const char *shape,
+				      const struct bench_metric *metrics,
+				      unsigned int count, uint64_t ops)
+{
+	unsigned int i;
+
+	if (opts->json) {
+		printf("{\"bench\":\"%s\"", name);
+		if (shape)
+			printf(",\"shape\":\"%s\"", shape);
+		for (i = 0; i < count; i++)
+			printf(",\"%s\":%.*f", metrics[i].key,
+			       metrics[i].precision, metrics[i].value);
+		printf(",\"iterations\":%llu}\n", (unsigned long long)ops);
+	} else {
+		printf("%-18s", name);
+		if (shape)
+			printf(" %-14s", shape);
+		for (i = 0; i < count; i++)
+			printf(" %*.*f", metrics[i].width,
+			       metrics[i].precision, metrics[i].value);
+		printf(" %10llu\n", (unsigned long long)ops);
+	}
+	fflush(stdout);
+}
+
+#endif /* _BENCH_H */
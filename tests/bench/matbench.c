@@ -0,0 +1,776 @@
+/*******************************************************************************
+
+  MATCH Library - Microbenchmarks of the encode, decode and print paths
+  Copyright (c) <2015>, Intel Corporation
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <libnl3/netlink/netlink.h>
+#include <libnl3/netlink/attr.h>
+#include <libnl3/netlink/msg.h>
+
+#include "if_match.h"
+#include "matchlib.h"
+#include "matarena.h"
+#include "matstream.h"
+#include "bench.h"
+
+/*
+ * Microbenchmarks for the libmatch encode, decode and print paths.
+ *
+ * Every benchmark works on a batch of objects built from a synthetic shape
+ * and reports the mean cost per object: wall time, bytes produced (netlink
+ * attribute bytes for the encoders, printed bytes for the pp_* printers)
+ * and heap allocations.
+ */
+
+#define BENCH_MAX_FIELDS	16
+#define BENCH_MAX_ACTIONS	4
+#define BENCH_MAX_ARGS		4
+
+/* A NET_MAT_RULES nest is limited to 64KiB, keep a batch well below it */
+#define BENCH_RULES		200
+#define BENCH_NEST_BYTES	60000
+#define BENCH_TABLES		32
+#define BENCH_PORTS		64
+#define BENCH_MSG_SIZE		(256 * 1024)
+
+struct bench_shape {
+	const char *name;
+	unsigned int fields;	/* matches per rule */
+	unsigned int width;	/* bit width of every matched field */
+	unsigned int actions;	/* actions per rule */
+	unsigned int args;	/* arguments per action */
+};
+
+static const struct bench_shape bench_shapes[] = {
+	{ "f1_u32_a1x1",   1, 32, 1, 1 },
+	{ "f4_u16_a1x1",   4, 16, 1, 1 },
+	{ "f4_u32_a2x2",   4, 32, 2, 2 },
+	{ "f8_u64_a2x2",   8, 64, 2, 2 },
+	{ "f16_u8_a4x1",  16,  8, 4, 1 },
+	{ "f16_u64_a4x4", 16, 64, 4, 4 },
+};
+
+struct bench_ctx {
+	const struct bench_shape *shape;
+
+	/* synthetic header and actions registered for the printers */
+	char hdr_name[8];
+	char field_names[BENCH_MAX_FIELDS][8];
+	char action_names[BENCH_MAX_ACTIONS][8];
+	char arg_names[BENCH_MAX_ARGS][8];
+	struct net_mat_field fields[BENCH_MAX_FIELDS + 1];
+	struct net_mat_hdr hdr;
+	struct net_mat_hdr *hdrs[2];
+	struct net_mat_action_arg args[BENCH_MAX_ACTIONS][BENCH_MAX_ARGS + 1];
+	struct net_mat_action actions[BENCH_MAX_ACTIONS + 1];
+	struct net_mat_action *action_list[BENCH_MAX_ACTIONS + 1];
+
+	/* uid terminated batches */
+	struct net_mat_rule *rules;
+	struct net_mat_field_ref *rule_matches;
+	unsigned int nrules;
+	char table_names[BENCH_TABLES][16];
+	__u32 table_actions[BENCH_MAX_ACTIONS + 1];
+	struct net_mat_tbl tables[BENCH_TABLES + 1];
+	struct net_mat_port ports[BENCH_PORTS + 1];
+
+	/* scratch message for the encoders and pre-encoded input for the
+	 * decoders
+	 */
+	struct nl_msg *msg;
+	uint32_t msg_base;
+	struct nl_msg *rules_nla;
+	struct nl_msg *rules_compact;
+	struct nl_msg *tables_msg;
+	struct nl_msg *ports_msg;
+	struct mat_arena *arena;
+
+	FILE *sink;
+	uint64_t sink_bytes;
+	struct mat_stream *text;
+	struct mat_stream *json;
+};
+
+struct bench {
+	const char *name;
+	bool per_shape;		/* false if the shape does not apply */
+	/* run one batch, return the number of objects handled or -errno */
+	int (*run)(struct bench_ctx *ctx, uint64_t *bytes);
+};
+
+/*
+ * Count heap allocations by interposing the allocator entry points. Calls
+ * from libmatch, libnl and libc itself resolve to these definitions, the
+ * real allocator is reached through its glibc internal names.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static uint64_t bench_allocs;
+
+void *malloc(size_t size)
+{
+	bench_allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	bench_allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	bench_allocs++;
+	return __libc_realloc(ptr, size);
+}
+
+static ssize_t bench_sink_write(void *cookie, const char *buf __attribute__((unused)),
+				size_t size)
+{
+	uint64_t *bytes = cookie;
+
+	*bytes += size;
+	return (ssize_t)size;
+}
+
+static void bench_set_value(struct net_mat_field_ref *ref, unsigned int width,
+			    uint64_t value)
+{
+	switch (width) {
+	case 8:
+		ref->type = NET_MAT_FIELD_REF_ATTR_TYPE_U8;
+		ref->v.u8.value_u8 = (__u8)value;
+		ref->v.u8.mask_u8 = 0xff;
+		break;
+	case 16:
+		ref->type = NET_MAT_FIELD_REF_ATTR_TYPE_U16;
+		ref->v.u16.value_u16 = (__u16)value;
+		ref->v.u16.mask_u16 = 0xffff;
+		break;
+	case 32:
+		ref->type = NET_MAT_FIELD_REF_ATTR_TYPE_U32;
+		ref->v.u32.value_u32 = (__u32)value;
+		ref->v.u32.mask_u32 = 0xffffffff;
+		break;
+	default:
+		ref->type = NET_MAT_FIELD_REF_ATTR_TYPE_U64;
+		ref->v.u64.value_u64 = value;
+		ref->v.u64.mask_u64 = ~0ULL;
+		break;
+	}
+}
+
+/* Reset the scratch message to an empty payload */
+static void bench_msg_reset(struct bench_ctx *ctx)
+{
+	nlmsg_hdr(ctx->msg)->nlmsg_len = ctx->msg_base;
+}
+
+static uint32_t bench_msg_len(struct bench_ctx *ctx)
+{
+	return nlmsg_hdr(ctx->msg)->nlmsg_len - ctx->msg_base;
+}
+
+static struct nl_msg *bench_msg_alloc(void)
+{
+	struct nl_msg *msg;
+
+	msg = nlmsg_alloc_size(BENCH_MSG_SIZE);
+	if (!msg)
+		return NULL;
+
+	if (!nlmsg_put(msg, 0, 0, NLMSG_MIN_TYPE, 0, 0)) {
+		nlmsg_free(msg);
+		return NULL;
+	}
+	return msg;
+}
+
+static struct nlattr *bench_msg_attr(struct nl_msg *msg, int type)
+{
+	return nlmsg_find_attr(nlmsg_hdr(msg), 0, type);
+}
+
+static void bench_shape_teardown(struct bench_ctx *ctx)
+{
+	nlmsg_free(ctx->rules_nla);
+	nlmsg_free(ctx->rules_compact);
+	nlmsg_free(ctx->tables_msg);
+	ctx->rules_nla = NULL;
+	ctx->rules_compact = NULL;
+	ctx->tables_msg = NULL;
+	free(ctx->rules);
+	free(ctx->rule_matches);
+	ctx->rules = NULL;
+	ctx->rule_matches = NULL;
+}
+
+static void bench_build_rule(struct bench_ctx *ctx, unsigned int n)
+{
+	const struct bench_shape *shape = ctx->shape;
+	struct net_mat_field_ref *matches;
+	struct net_mat_rule *rule = &ctx->rules[n];
+	unsigned int i;
+
+	matches = &ctx->rule_matches[n * (BENCH_MAX_FIELDS + 1)];
+	for (i = 0; i < shape->fields; i++) {
+		matches[i].instance = 1;
+		matches[i].header = 1;
+		matches[i].field = i + 1;
+		matches[i].mask_type = NET_MAT_MASK_TYPE_MASK;
+		bench_set_value(&matches[i], shape->width,
+				0x0011223344550000ULL + n * 31 + i);
+	}
+
+	rule->table_id = 1;
+	rule->uid = n + 1;
+	rule->priority = 10;
+	rule->matches = matches;
+	rule->actions = ctx->actions;
+}
+
+/*
+ * bench_shape_setup() - build the objects and messages for one shape
+ * @ctx: benchmark context
+ * @shape: shape of the synthetic rules and tables
+ *
+ * Return: 0 on success, negative errno otherwise
+ */
+static int bench_shape_setup(struct bench_ctx *ctx,
+			     const struct bench_shape *shape)
+{
+	struct nlattr *nest;
+	unsigned int i, j;
+	uint32_t size;
+
+	ctx->shape = shape;
+
+	memset(ctx->fields, 0, sizeof(ctx->fields));
+	for (i = 0; i < shape->fields; i++) {
+		ctx->fields[i].name = ctx->field_names[i];
+		ctx->fields[i].uid = i + 1;
+		ctx->fields[i].bitwidth = shape->width;
+	}
+	ctx->hdr.name = ctx->hdr_name;
+	ctx->hdr.uid = 1;
+	ctx->hdr.field_sz = shape->fields;
+	ctx->hdr.fields = ctx->fields;
+	ctx->hdrs[0] = &ctx->hdr;
+	ctx->hdrs[1] = NULL;
+	match_push_headers(ctx->hdrs);
+
+	memset(ctx->args, 0, sizeof(ctx->args));
+	memset(ctx->actions, 0, sizeof(ctx->actions));
+	memset(ctx->table_actions, 0, sizeof(ctx->table_actions));
+	for (i = 0; i < shape->actions; i++) {
+		for (j = 0; j < shape->args; j++) {
+			ctx->args[i][j].name = ctx->arg_names[j];
+			ctx->args[i][j].type = NET_MAT_ACTION_ARG_TYPE_U32;
+			ctx->args[i][j].v.value_u32 = i * 16 + j;
+		}
+		ctx->actions[i].name = ctx->action_names[i];
+		ctx->actions[i].uid = i + 1;
+		ctx->actions[i].args = ctx->args[i];
+		ctx->action_list[i] = &ctx->actions[i];
+		ctx->table_actions[i] = i + 1;
+	}
+	ctx->action_list[i] = NULL;
+	match_push_actions(ctx->action_list);
+
+	ctx->rules = calloc(BENCH_RULES + 1, sizeof(*ctx->rules));
+	ctx->rule_matches = calloc(BENCH_RULES * (BENCH_MAX_FIELDS + 1),
+				   sizeof(*ctx->rule_matches));
+	if (!ctx->rules || !ctx->rule_matches)
+		goto err;
+
+	/* size the batch from the encoded size of a single rule */
+	ctx->nrules = 1;
+	bench_build_rule(ctx, 0);
+	bench_msg_reset(ctx);
+	if (match_put_rule(ctx->msg, &ctx->rules[0]))
+		goto err;
+	size = bench_msg_len(ctx);
+	ctx->nrules = BENCH_NEST_BYTES / size;
+	if (ctx->nrules > BENCH_RULES)
+		ctx->nrules = BENCH_RULES;
+
+	for (i = 0; i < ctx->nrules; i++)
+		bench_build_rule(ctx, i);
+
+	for (i = 0; i < BENCH_TABLES; i++) {
+		ctx->tables[i].name = ctx->table_names[i];
+		ctx->tables[i].uid = i + 1;
+		ctx->tables[i].source = 1;
+		ctx->tables[i].size = 4096;
+		ctx->tables[i].matches = ctx->rule_matches;
+		ctx->tables[i].actions = ctx->table_actions;
+	}
+
+	ctx->rules_nla = bench_msg_alloc();
+	ctx->rules_compact = bench_msg_alloc();
+	ctx->tables_msg = bench_msg_alloc();
+	if (!ctx->rules_nla || !ctx->rules_compact || !ctx->tables_msg)
+		goto err;
+
+	if (match_put_rules(ctx->rules_nla, ctx->rules) ||
+	    match_put_tables(ctx->tables_msg, ctx->tables))
+		goto err;
+
+	nest = match_put_rules_compact_start(ctx->rules_compact);
+	if (!nest)
+		goto err;
+	for (i = 0; i < ctx->nrules; i++) {
+		if (match_put_rule_compact(ctx->rules_compact, nest,
+					   &ctx->rules[i]))
+			goto err;
+	}
+	match_put_rules_compact_end(ctx->rules_compact, nest);
+
+	return 0;
+err:
+	bench_shape_teardown(ctx);
+	return -ENOMEM;
+}
+
+static int bench_ports_setup(struct bench_ctx *ctx)
+{
+	unsigned int i;
+
+	memset(ctx->ports, 0, sizeof(ctx->ports));
+	for (i = 0; i < BENCH_PORTS; i++) {
+		ctx->ports[i].port_id = i + 1;
+		ctx->ports[i].port_phys_id = i + 1;
+		ctx->ports[i].type = (enum port_type)NET_MAT_PORT_T_TYPE_NETWORK;
+		ctx->ports[i].state = NET_MAT_PORT_T_STATE_UP;
+		ctx->ports[i].speed = NET_MAT_PORT_T_SPEED_10G;
+		ctx->ports[i].max_frame_size = 9000;
+		ctx->ports[i].mac_addr = 0x001122334400ULL + i;
+		ctx->ports[i].pci.bus = 1;
+		ctx->ports[i].pci.device = (__u8)(i / 8);
+		ctx->ports[i].pci.function = (__u8)(i % 8);
+		ctx->ports[i].vlan.def_vlan = 1;
+		ctx->ports[i].glort = 0x100 + i;
+	}
+	ctx->ports[i].port_id = NET_MAT_PORT_ID_UNSPEC;
+
+	ctx->ports_msg = bench_msg_alloc();
+	if (!ctx->ports_msg)
+		return -ENOMEM;
+
+	return match_put_ports(ctx->ports_msg, ctx->ports);
+}
+
+static int bench_put_rule(struct bench_ctx *ctx, uint64_t *bytes)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctx->nrules; i++) {
+		bench_msg_reset(ctx);
+		if (match_put_rule(ctx->msg, &ctx->rules[i]))
+			return -EMSGSIZE;
+		*bytes += bench_msg_len(ctx);
+	}
+	return (int)ctx->nrules;
+}
+
+static int bench_put_rules(struct bench_ctx *ctx, uint64_t *bytes)
+{
+	bench_msg_reset(ctx);
+	if (match_put_rules(ctx->msg, ctx->rules))
+		return -EMSGSIZE;
+	*bytes += bench_msg_len(ctx);
+	return (int)ctx->nrules;
+}
+
+static int bench_put_rules_compact(struct bench_ctx *ctx, uint64_t *bytes)
+{
+	bench_msg_reset(ctx);
+	if (match_put_rules_compact(ctx->msg, ctx->rules))
+		return -EMSGSIZE;
+	*bytes += bench_msg_len(ctx);
+	return (int)ctx->nrules;
+}
+
+static int bench_get_rules_common(struct bench_ctx *ctx, struct nl_msg *msg,
+				  int type, uint64_t *bytes)
+{
+	struct net_mat_rule *rules;
+	struct nlattr *attr;
+	int err;
+
+	attr = bench_msg_attr(msg, type);
+	if (!attr)
+		return -EINVAL;
+
+	err = match_get_rules(NULL, attr, &rules);
+	if (err)
+		return err;
+	match_free_rules(rules, ctx->nrules);
+
+	*bytes += (uint64_t)nla_total_size(nla_len(attr));
+	return (int)ctx->nrules;
+}
+
+static int bench_get_rules(struct bench_ctx *ctx, uint64_t *bytes)
+{
+	return bench_get_rules_common(ctx, ctx->rules_nla, NET_MAT_RULES,
+				      bytes);
+}
+
+static int bench_get_rules_compact(struct bench_ctx *ctx, uint64_t *bytes)
+{
+	return bench_get_rules_common(ctx, ctx->rules_compact,
+				      NET_MAT_RULES_COMPACT, bytes);
+}
+
+static int bench_get_rules_arena(struct bench_ctx *ctx, uint64_t *bytes)
+{
+	struct net_mat_rule *rules;
+	struct nlattr *attr;
+	int err;
+
+	attr = bench_msg_attr(ctx->rules_nla, NET_MAT_RULES);
+	if (!attr)
+		return -EINVAL;
+
+	err = match_get_rules_arena(NULL, attr, ctx->arena, &rules, NULL);
+	mat_arena_reset(ctx->arena);
+	if (err)
+		return err;
+
+	*bytes += (uint64_t)nla_total_size(nla_len(attr));
+	return (int)ctx->nrules;
+}
+
+static int bench_put_tables(struct bench_ctx *ctx, uint64_t *bytes)
+{
+	bench_msg_reset(ctx);
+	if (match_put_tables(ctx->msg, ctx->tables))
+		return -EMSGSIZE;
+	*bytes += bench_msg_len(ctx);
+	return BENCH_TABLES;
+}
+
+static int bench_get_tables(struct bench_ctx *ctx, uint64_t *bytes)
+{
+	struct net_mat_tbl *tables;
+	struct nlattr *attr;
+	unsigned int i;
+	int err;
+
+	attr = bench_msg_attr(ctx->tables_msg, NET_MAT_TABLES);
+	if (!attr)
+		return -EINVAL;
+
+	err = match_get_tables(NULL, attr, &tables);
+	if (err)
+		return err;
+
+	for (i = 0; tables[i].uid; i++) {
+		free(tables[i].name);
+		free(tables[i].matches);
+		free(tables[i].actions);
+		free(tables[i].attribs);
+	}
+	free(tables);
+
+	*bytes += (uint64_t)nla_total_size(nla_len(attr));
+	return BENCH_TABLES;
+}
+
+static int bench_put_ports(struct bench_ctx *ctx, uint64_t *bytes)
+{
+	bench_msg_reset(ctx);
+	if (match_put_ports(ctx->msg, ctx->ports))
+		return -EMSGSIZE;
+	*bytes += bench_msg_len(ctx);
+	return BENCH_PORTS;
+}
+
+static int bench_get_ports(struct bench_ctx *ctx, uint64_t *bytes)
+{
+	struct net_mat_port *ports;
+	struct nlattr *attr;
+	int err;
+
+	attr = bench_msg_attr(ctx->ports_msg, NET_MAT_PORTS);
+	if (!attr)
+		return -EINVAL;
+
+	err = match_get_ports(NULL, attr, &ports);
+	if (err)
+		return err;
+	free(ports);
+
+	*bytes += (uint64_t)nla_total_size(nla_len(attr));
+	return BENCH_PORTS;
+}
+
+/* The printers report the bytes written to the counting sink */
+static int bench_pp_rule_common(struct bench_ctx *ctx,
+				struct mat_stream *matsp, uint64_t *bytes)
+{
+	uint64_t start = ctx->sink_bytes;
+	unsigned int i;
+
+	for (i = 0; i < ctx->nrules; i++)
+		pp_rule(matsp, &ctx->rules[i]);
+	fflush(ctx->sink);
+
+	*bytes += ctx->sink_bytes - start;
+	return (int)ctx->nrules;
+}
+
+static int bench_pp_rule(struct bench_ctx *ctx, uint64_t *bytes)
+{
+	return bench_pp_rule_common(ctx, ctx->text, bytes);
+}
+
+static int bench_pp_rule_json(struct bench_ctx *ctx, uint64_t *bytes)
+{
+	int ret;
+
+	mat_json_array_start(ctx->json, NULL);
+	ret = bench_pp_rule_common(ctx, ctx->json, bytes);
+	mat_json_array_end(ctx->json);
+	return ret;
+}
+
+static int bench_pp_table(struct bench_ctx *ctx, uint64_t *bytes)
+{
+	uint64_t start = ctx->sink_bytes;
+	unsigned int i;
+
+	for (i = 0; i < BENCH_TABLES; i++)
+		pp_table(ctx->text, &ctx->tables[i]);
+	fflush(ctx->sink);
+
+	*bytes += ctx->sink_bytes - start;
+	return BENCH_TABLES;
+}
+
+static int bench_pp_port(struct bench_ctx *ctx, uint64_t *bytes)
+{
+	uint64_t start = ctx->sink_bytes;
+	unsigned int i;
+
+	for (i = 0; i < BENCH_PORTS; i++)
+		pp_port(ctx->text, &ctx->ports[i]);
+	fflush(ctx->sink);
+
+	*bytes += ctx->sink_bytes - start;
+	return BENCH_PORTS;
+}
+
+static const struct bench benches[] = {
+	{ "put_rule",		true,	bench_put_rule },
+	{ "put_rules",		true,	bench_put_rules },
+	{ "put_rules_compact",	true,	bench_put_rules_compact },
+	{ "get_rules",		true,	bench_get_rules },
+	{ "get_rules_compact",	true,	bench_get_rules_compact },
+	{ "get_rules_arena",	true,	bench_get_rules_arena },
+	{ "pp_rule",		true,	bench_pp_rule },
+	{ "pp_rule_json",	true,	bench_pp_rule_json },
+	{ "put_tables",		true,	bench_put_tables },
+	{ "get_tables",		true,	bench_get_tables },
+	{ "pp_table",		true,	bench_pp_table },
+	{ "put_ports",		false,	bench_put_ports },
+	{ "get_ports",		false,	bench_get_ports },
+	{ "pp_port",		false,	bench_pp_port },
+};
+
+static bool bench_selected(const struct bench_opts *opts, const char *name,
+			   const char *shape)
+{
+	if (!opts->filter)
+		return true;
+	return strstr(name, opts->filter) || strstr(shape, opts->filter);
+}
+
+static const struct bench_metric bench_columns[] = {
+	{ "ns_per_op",		"ns/op",	10, 1, 0 },
+	{ "bytes_per_op",	"bytes/op",	10, 1, 0 },
+	{ "allocs_per_op",	"allocs/op",	10, 2, 0 },
+};
+
+#define BENCH_COLUMNS	(sizeof(bench_columns) / sizeof(bench_columns[0]))
+
+/*
+ * bench_run() - time one benchmark and print its result
+ * @ctx: benchmark context set up for the shape
+ * @opts: command line options
+ * @b: benchmark to run
+ * @shape: name reported for the shape
+ *
+ * A warm up batch is run first, then batches are repeated until either the
+ * requested batch count or the minimum run time is reached.
+ *
+ * Return: 0 on success, negative errno otherwise
+ */
+static int bench_run(struct bench_ctx *ctx, const struct bench_opts *opts,
+		     const struct bench *b, const char *shape)
+{
+	uint64_t bytes = 0, ops = 0, allocs, start, elapsed, deadline;
+	struct bench_metric metrics[BENCH_COLUMNS];
+	unsigned int batches = 0;
+	int ret;
+
+	ret = b->run(ctx, &bytes);
+	if (ret < 0)
+		goto err;
+
+	bytes = 0;
+	allocs = bench_allocs;
+	start = bench_now();
+	deadline = bench_deadline(opts, start);
+	do {
+		ret = b->run(ctx, &bytes);
+		if (ret < 0)
+			goto err;
+		ops += (uint64_t)ret;
+		batches++;
+	} while (bench_more(opts, batches, deadline));
+	elapsed = bench_now() - start;
+	allocs = bench_allocs - allocs;
+
+	memcpy(metrics, bench_columns, sizeof(metrics));
+	metrics[0].value = (double)elapsed / (double)ops;
+	metrics[1].value = (double)bytes / (double)ops;
+	metrics[2].value = (double)allocs / (double)ops;
+	bench_print_result(opts, b->name, shape, metrics, BENCH_COLUMNS, ops);
+	return 0;
+err:
+	fprintf(stderr, "Error: %s/%s failed: %s\n", b->name, shape,
+		strerror(-ret));
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	cookie_io_functions_t sink_io = { .write = bench_sink_write };
+	struct bench_opts opts;
+	struct bench_ctx *ctx;
+	unsigned int i, s;
+	int err = 0;
+
+	err = bench_parse_opts(argc, argv, "matbench", "name or shape", &opts);
+	if (err)
+		return err < 0 ? err : 0;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return -ENOMEM;
+
+	snprintf(ctx->hdr_name, sizeof(ctx->hdr_name), "bench");
+	for (i = 0; i < BENCH_MAX_FIELDS; i++)
+		snprintf(ctx->field_names[i], sizeof(ctx->field_names[i]),
+			 "f%u", i);
+	for (i = 0; i < BENCH_MAX_ACTIONS; i++)
+		snprintf(ctx->action_names[i], sizeof(ctx->action_names[i]),
+			 "act%u", i);
+	for (i = 0; i < BENCH_MAX_ARGS; i++)
+		snprintf(ctx->arg_names[i], sizeof(ctx->arg_names[i]),
+			 "arg%u", i);
+	for (i = 0; i < BENCH_TABLES; i++)
+		snprintf(ctx->table_names[i], sizeof(ctx->table_names[i]),
+			 "table%u", i);
+
+	ctx->sink = fopencookie(&ctx->sink_bytes, "w", sink_io);
+	ctx->text = ctx->sink ? mat_stream_file(ctx->sink) : NULL;
+	ctx->json = ctx->sink ? mat_stream_json(ctx->sink) : NULL;
+	ctx->msg = bench_msg_alloc();
+	ctx->arena = mat_arena_create(0);
+	if (!ctx->text || !ctx->json || !ctx->msg || !ctx->arena) {
+		fprintf(stderr, "Error: unable to set up benchmarks\n");
+		err = -ENOMEM;
+		goto out;
+	}
+	ctx->msg_base = nlmsg_hdr(ctx->msg)->nlmsg_len;
+
+	err = bench_ports_setup(ctx);
+	if (err) {
+		fprintf(stderr, "Error: unable to build ports message\n");
+		goto out;
+	}
+
+	bench_print_header(&opts, true, bench_columns, BENCH_COLUMNS);
+
+	for (s = 0; s < sizeof(bench_shapes) / sizeof(bench_shapes[0]); s++) {
+		const struct bench_shape *shape = &bench_shapes[s];
+
+		err = bench_shape_setup(ctx, shape);
+		if (err) {
+			fprintf(stderr, "Error: unable to build shape %s\n",
+				shape->name);
+			goto out;
+		}
+
+		for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+			if (!benches[i].per_shape ||
+			    !bench_selected(&opts, benches[i].name, shape->name))
+				continue;
+			err = bench_run(ctx, &opts, &benches[i], shape->name);
+			if (err)
+				break;
+		}
+		bench_shape_teardown(ctx);
+		if (err)
+			goto out;
+	}
+
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		if (benches[i].per_shape ||
+		    !bench_selected(&opts, benches[i].name, "ports"))
+			continue;
+		err = bench_run(ctx, &opts, &benches[i], "ports");
+		if (err)
+			goto out;
+	}
+
+out:
+	/* the text stream owns the sink and closes it */
+	mat_stream_delete(ctx->json);
+	if (ctx->text)
+		mat_stream_delete(ctx->text);
+	else if (ctx->sink)
+		fclose(ctx->sink);
+	nlmsg_free(ctx->ports_msg);
+	nlmsg_free(ctx->msg);
+	mat_arena_destroy(ctx->arena);
+	free(ctx);
+	return err;
+}
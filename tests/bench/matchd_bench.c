@@ -0,0 +1,1361 @@
+/*******************************************************************************
+
+  MATCH Library - In-process benchmark of the matchd command path
+  Copyright (c) <2015>, Intel Corporation
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libnl3/netlink/netlink.h>
+#include <libnl3/netlink/attr.h>
+#include <libnl3/netlink/msg.h>
+#include <libnl3/netlink/genl/genl.h>
+
+#include "if_match.h"
+#include "matchlib.h"
+#include "matchlib_nl.h"
+#include "matchd_lib.h"
+#include "matflight.h"
+#include "matshm.h"
+#include "backend.h"
+#include "bench.h"
+
+/*
+ * In-process benchmark of the matchd command path.
+ *
+ * Prebuilt requests are fed straight into matchd_rx_process() and the
+ * replies are captured by a send hook, so no generic netlink family, daemon
+ * or client process is involved. The "bench" backend below keeps nothing
+ * but counters, the measured cost is the daemon's own: request parse and
+ * validation, the rule cache, the backend call and the reply encode.
+ *
+ * Besides the wall time per request the flight recorder is used to report
+ * the time spent inside matchd_rx_process() and inside the backend hooks.
+ * The benchmarks only run once the behavioural checks of bench_check()
+ * passed.
+ */
+
+#define BENCH_FAMILY		0x20
+#define BENCH_PID		4242
+#define BENCH_TABLE		1
+#define BENCH_TABLE_SIZE	4096
+#define BENCH_RULES		256	/* single rule requests per batch */
+#define BENCH_BULK_RULES	64	/* rules in one bulk request */
+#define BENCH_GET_RULES		1024	/* rules installed for get_rules */
+#define BENCH_PORTS		64
+
+/* Software backend, a single table matching four fields of one header */
+enum {
+	BENCH_FIELD_DST = 1,
+	BENCH_FIELD_SRC,
+	BENCH_FIELD_PROTO,
+	BENCH_FIELD_PORT,
+};
+
+static char bench_str[] = "bench";
+static char dst_str[] = "dst";
+static char src_str[] = "src";
+static char proto_str[] = "proto";
+static char port_str[] = "port";
+static char forward_str[] = "forward_to_port";
+
+static struct net_mat_field bench_fields[] = {
+	{ .name = dst_str, .uid = BENCH_FIELD_DST, .bitwidth = 32 },
+	{ .name = src_str, .uid = BENCH_FIELD_SRC, .bitwidth = 32 },
+	{ .name = proto_str, .uid = BENCH_FIELD_PROTO, .bitwidth = 8 },
+	{ .name = port_str, .uid = BENCH_FIELD_PORT, .bitwidth = 16 },
+};
+
+static struct net_mat_hdr bench_hdr = {
+	.name = bench_str,
+	.uid = 1,
+	.field_sz = sizeof(bench_fields) / sizeof(bench_fields[0]),
+	.fields = bench_fields,
+};
+
+static struct net_mat_hdr *bench_hdrs[] = { &bench_hdr, NULL };
+
+static struct net_mat_action_arg forward_args[] = {
+	{ .name = port_str, .type = NET_MAT_ACTION_ARG_TYPE_U32 },
+	{ .name = NULL, .type = NET_MAT_ACTION_ARG_TYPE_UNSPEC },
+};
+
+static struct net_mat_action bench_forward = {
+	.name = forward_str,
+	.uid = 1,
+	.args = forward_args,
+};
+
+static struct net_mat_action *bench_actions[] = { &bench_forward, NULL };
+
+static struct net_mat_field_ref bench_matches[] = {
+	{ .instance = 1, .header = 1, .field = BENCH_FIELD_DST,
+	  .mask_type = NET_MAT_MASK_TYPE_MASK },
+	{ .instance = 1, .header = 1, .field = BENCH_FIELD_SRC,
+	  .mask_type = NET_MAT_MASK_TYPE_MASK },
+	{ .instance = 1, .header = 1, .field = BENCH_FIELD_PROTO,
+	  .mask_type = NET_MAT_MASK_TYPE_EXACT },
+	{ .instance = 1, .header = 1, .field = BENCH_FIELD_PORT,
+	  .mask_type = NET_MAT_MASK_TYPE_MASK },
+	{ .instance = 0, .field = 0 },
+};
+
+static __u32 bench_table_actions[] = { 1, 0 };
+
+static struct net_mat_tbl bench_table = {
+	.name = bench_str,
+	.uid = BENCH_TABLE,
+	.source = 1,
+	.size = BENCH_TABLE_SIZE,
+	.matches = bench_matches,
+	.actions = bench_table_actions,
+};
+
+static struct net_mat_tbl *bench_tables[] = { &bench_table, NULL };
+
+static __u32 bench_node_hdrs[] = { 1, 0 };
+
+/* a single header and a single table, both terminal */
+static struct net_mat_jump_table bench_terminal[] = {
+	{ .field = {0}, .node = 0 },
+};
+
+static struct net_mat_hdr_node bench_hdr_node = {
+	.name = bench_str,
+	.uid = 1,
+	.hdrs = bench_node_hdrs,
+	.jump = bench_terminal,
+};
+
+static struct net_mat_hdr_node *bench_hdr_nodes[] = { &bench_hdr_node, NULL };
+
+static struct net_mat_tbl_node bench_tbl_node = {
+	.uid = BENCH_TABLE,
+	.jump = bench_terminal,
+};
+
+static struct net_mat_tbl_node *bench_tbl_nodes[] = { &bench_tbl_node, NULL };
+
+static struct net_mat_port bench_ports[BENCH_PORTS + 1];
+
+static int bench_backend_open(void *arg __attribute__((unused)))
+{
+	unsigned int i;
+
+	for (i = 0; i < BENCH_PORTS; i++) {
+		bench_ports[i].port_id = i + 1;
+		bench_ports[i].port_phys_id = i + 1;
+		bench_ports[i].state = NET_MAT_PORT_T_STATE_UP;
+		bench_ports[i].speed = NET_MAT_PORT_T_SPEED_10G;
+		bench_ports[i].max_frame_size = 9000;
+		bench_ports[i].mac_addr = 0x001122334400ULL + i;
+		bench_ports[i].glort = 0x100 + i;
+	}
+	bench_ports[i].port_id = NET_MAT_PORT_ID_UNSPEC;
+	return 0;
+}
+
+static int bench_backend_rules(struct net_mat_rule *rule __attribute__((unused)))
+{
+	return 0;
+}
+
+static int bench_backend_get_ports(struct net_mat_port **ports)
+{
+	/* the caller frees the list, as with a hardware backend */
+	*ports = malloc(sizeof(bench_ports));
+	if (!*ports)
+		return -ENOMEM;
+
+	memcpy(*ports, bench_ports, sizeof(bench_ports));
+	return 0;
+}
+
+static struct match_backend bench_backend = {
+	.name = bench_str,
+	.hdrs = bench_hdrs,
+	.actions = bench_actions,
+	.tbls = bench_tables,
+	.hdr_nodes = bench_hdr_nodes,
+	.tbl_nodes = bench_tbl_nodes,
+	.open = bench_backend_open,
+	.set_rules = bench_backend_rules,
+	.del_rules = bench_backend_rules,
+	.get_ports = bench_backend_get_ports,
+};
+
+MATCH_BACKEND_REGISTER(bench_backend)
+
+/* Replies captured by the send hook */
+struct bench_replies {
+	uint64_t msgs;
+	uint64_t bytes;
+	int error;		/* first error reply as -errno, 0 if none */
+};
+
+static int bench_send(struct nl_msg *msg, void *arg)
+{
+	struct bench_replies *replies = arg;
+	struct nlmsghdr *nlh = nlmsg_hdr(msg);
+	struct nlmsgerr *e;
+
+	replies->msgs++;
+	replies->bytes += nlh->nlmsg_len;
+
+	if (nlh->nlmsg_type == NLMSG_ERROR && !replies->error) {
+		/* matchd reports a positive errno */
+		e = nlmsg_data(nlh);
+		replies->error = e->error > 0 ? -e->error : e->error;
+	}
+	return (int)nlh->nlmsg_len;
+}
+
+struct bench_ctx {
+	struct bench_replies replies;
+	struct nl_msg *get_headers;
+	struct nl_msg *get_actions;
+	struct nl_msg *get_tables;
+	struct nl_msg *get_hdr_graph;
+	struct nl_msg *get_tbl_graph;
+	struct nl_msg *get_generation;
+	struct nl_msg *get_ports;
+	struct nl_msg *get_stats;
+	struct nl_msg *get_rules;
+	struct nl_msg *get_rules_compact;
+	struct nl_msg *set_rule[BENCH_GET_RULES];
+	struct nl_msg *del_rule[BENCH_GET_RULES];
+	struct nl_msg *set_bulk;
+	struct nl_msg *del_bulk;
+};
+
+struct bench {
+	const char *name;
+	uint8_t cmd;		/* command recorded by the flight recorder */
+	/* untimed, before and after the benchmark */
+	int (*setup)(struct bench_ctx *ctx);
+	int (*teardown)(struct bench_ctx *ctx);
+	/* timed, return the number of requests processed or -errno */
+	int (*run)(struct bench_ctx *ctx);
+	/* untimed, restores the state after each run */
+	int (*reset)(struct bench_ctx *ctx);
+};
+
+static struct nl_msg *bench_request(uint8_t cmd, size_t size)
+{
+	struct nl_msg *msg;
+
+	msg = size ? nlmsg_alloc_size(size) : nlmsg_alloc();
+	if (!msg)
+		return NULL;
+
+	if (!genlmsg_put(msg, BENCH_PID, 0, BENCH_FAMILY, 0, 0, cmd,
+			 NET_MAT_GENL_VERSION))
+		goto nla_put_failure;
+
+	NLA_PUT_U32(msg, NET_MAT_IDENTIFIER_TYPE, NET_MAT_IDENTIFIER_IFINDEX);
+	NLA_PUT_U32(msg, NET_MAT_IDENTIFIER, 0);
+	return msg;
+
+nla_put_failure:
+	nlmsg_free(msg);
+	return NULL;
+}
+
+static struct nl_msg *bench_get_rules_request(unsigned int encoding)
+{
+	struct nlattr *nest;
+	struct nl_msg *msg;
+
+	msg = bench_request(NET_MAT_TABLE_CMD_GET_RULES, 0);
+	if (!msg)
+		return NULL;
+
+	nest = nla_nest_start(msg, NET_MAT_RULES);
+	if (!nest)
+		goto nla_put_failure;
+	NLA_PUT_U32(msg, NET_MAT_TABLE_RULES_TABLE, BENCH_TABLE);
+	if (encoding != NET_MAT_RULES_ENC_NLA)
+		NLA_PUT_U32(msg, NET_MAT_TABLE_RULES_ENCODING, encoding);
+	nla_nest_end(msg, nest);
+	return msg;
+
+nla_put_failure:
+	nlmsg_free(msg);
+	return NULL;
+}
+
+/*
+ * bench_rules_request() - build a set or delete request
+ * @cmd: NET_MAT_TABLE_CMD_SET_RULES or NET_MAT_TABLE_CMD_DEL_RULES
+ * @first: uid of the first rule
+ * @count: number of rules in the request
+ *
+ * Return: the request, or NULL on failure
+ */
+static struct nl_msg *bench_rules_request(uint8_t cmd, unsigned int first,
+					  unsigned int count)
+{
+	struct net_mat_field_ref matches[5];
+	struct net_mat_action_arg args[2];
+	struct net_mat_action actions[2];
+	struct net_mat_rule *rules;
+	struct nl_msg *msg;
+	unsigned int i;
+
+	rules = calloc(count + 1, sizeof(*rules));
+	if (!rules)
+		return NULL;
+
+	memset(matches, 0, sizeof(matches));
+	memset(args, 0, sizeof(args));
+	memset(actions, 0, sizeof(actions));
+	memcpy(matches, bench_matches, sizeof(matches));
+
+	matches[0].type = NET_MAT_FIELD_REF_ATTR_TYPE_U32;
+	matches[0].v.u32.mask_u32 = 0xffffff00;
+	matches[1].type = NET_MAT_FIELD_REF_ATTR_TYPE_U32;
+	matches[1].v.u32.value_u32 = 0x0a000001;
+	matches[1].v.u32.mask_u32 = 0xffffffff;
+	matches[2].type = NET_MAT_FIELD_REF_ATTR_TYPE_U8;
+	matches[2].v.u8.value_u8 = 6;
+	matches[2].v.u8.mask_u8 = 0xff;
+	matches[3].type = NET_MAT_FIELD_REF_ATTR_TYPE_U16;
+	matches[3].v.u16.value_u16 = 80;
+	matches[3].v.u16.mask_u16 = 0xffff;
+
+	args[0].name = port_str;
+	args[0].type = NET_MAT_ACTION_ARG_TYPE_U32;
+	args[0].v.value_u32 = 1;
+	actions[0].name = forward_str;
+	actions[0].uid = 1;
+	actions[0].args = args;
+
+	for (i = 0; i < count; i++) {
+		rules[i].table_id = BENCH_TABLE;
+		rules[i].uid = first + i;
+		rules[i].priority = 10;
+		rules[i].matches = matches;
+		rules[i].actions = actions;
+	}
+
+	msg = bench_request(cmd, (count + 1) * 512);
+	if (msg && match_put_rules(msg, rules)) {
+		nlmsg_free(msg);
+		msg = NULL;
+	}
+
+	/* the matches are shared, only the value is per rule in real use */
+	free(rules);
+	return msg;
+}
+
+static int bench_process(struct bench_ctx *ctx, struct nl_msg *msg)
+{
+	int err;
+
+	err = matchd_rx_process(nlmsg_hdr(msg));
+	if (err < 0)
+		return err;
+	if (ctx->replies.error)
+		return ctx->replies.error;
+	return 0;
+}
+
+static int bench_process_n(struct bench_ctx *ctx, struct nl_msg **msgs,
+			   unsigned int count)
+{
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < count; i++) {
+		err = bench_process(ctx, msgs[i]);
+		if (err)
+			return err;
+	}
+	return (int)count;
+}
+
+#define BENCH_GET(fn, field)					\
+static int fn(struct bench_ctx *ctx)				\
+{								\
+	int err = bench_process(ctx, ctx->field);		\
+								\
+	return err ? err : 1;					\
+}
+
+BENCH_GET(bench_get_headers, get_headers)
+BENCH_GET(bench_get_actions, get_actions)
+BENCH_GET(bench_get_tables, get_tables)
+BENCH_GET(bench_get_hdr_graph, get_hdr_graph)
+BENCH_GET(bench_get_tbl_graph, get_tbl_graph)
+BENCH_GET(bench_get_generation, get_generation)
+BENCH_GET(bench_get_ports, get_ports)
+BENCH_GET(bench_get_stats, get_stats)
+BENCH_GET(bench_get_rules, get_rules)
+BENCH_GET(bench_get_rules_compact, get_rules_compact)
+BENCH_GET(bench_set_bulk, set_bulk)
+BENCH_GET(bench_del_bulk, del_bulk)
+
+static int bench_set_rules(struct bench_ctx *ctx)
+{
+	return bench_process_n(ctx, ctx->set_rule, BENCH_RULES);
+}
+
+static int bench_del_rules(struct bench_ctx *ctx)
+{
+	return bench_process_n(ctx, ctx->del_rule, BENCH_RULES);
+}
+
+static int bench_fill(struct bench_ctx *ctx)
+{
+	return bench_process_n(ctx, ctx->set_rule, BENCH_GET_RULES);
+}
+
+static int bench_flush(struct bench_ctx *ctx)
+{
+	return bench_process_n(ctx, ctx->del_rule, BENCH_GET_RULES);
+}
+
+static const struct bench benches[] = {
+	{ "get_headers", NET_MAT_TABLE_CMD_GET_HEADERS,
+	  NULL, NULL, bench_get_headers, NULL },
+	{ "get_actions", NET_MAT_TABLE_CMD_GET_ACTIONS,
+	  NULL, NULL, bench_get_actions, NULL },
+	{ "get_tables", NET_MAT_TABLE_CMD_GET_TABLES,
+	  NULL, NULL, bench_get_tables, NULL },
+	{ "get_hdr_graph", NET_MAT_TABLE_CMD_GET_HDR_GRAPH,
+	  NULL, NULL, bench_get_hdr_graph, NULL },
+	{ "get_tbl_graph", NET_MAT_TABLE_CMD_GET_TABLE_GRAPH,
+	  NULL, NULL, bench_get_tbl_graph, NULL },
+	{ "get_generation", NET_MAT_TABLE_CMD_GET_GENERATION,
+	  NULL, NULL, bench_get_generation, NULL },
+	{ "get_ports", NET_MAT_PORT_CMD_GET_PORTS,
+	  NULL, NULL, bench_get_ports, NULL },
+	{ "get_stats", NET_MAT_DAEMON_CMD_GET_STATS,
+	  NULL, NULL, bench_get_stats, NULL },
+	{ "set_rule", NET_MAT_TABLE_CMD_SET_RULES,
+	  NULL, NULL, bench_set_rules, bench_del_rules },
+	{ "del_rule", NET_MAT_TABLE_CMD_DEL_RULES,
+	  bench_set_rules, bench_del_rules, bench_del_rules, bench_set_rules },
+	{ "set_rules_bulk", NET_MAT_TABLE_CMD_SET_RULES,
+	  NULL, NULL, bench_set_bulk, bench_del_bulk },
+	{ "get_rules", NET_MAT_TABLE_CMD_GET_RULES,
+	  bench_fill, bench_flush, bench_get_rules, NULL },
+	{ "get_rules_compact", NET_MAT_TABLE_CMD_GET_RULES,
+	  bench_fill, bench_flush, bench_get_rules_compact, NULL },
+};
+
+/*
+ * bench_flight() - daemon and backend time per request from the recorder
+ * @cmd: command of the benchmark
+ * @since: start of the timed runs
+ * @daemon: set to the mean matchd_rx_process() time per request
+ * @hooks: set to the mean backend hook time per request
+ *
+ * Only the most recent events are kept by the recorder, the means are taken
+ * over the requests still in the ring. The reset requests of a benchmark
+ * use a different command and are not counted.
+ */
+static void bench_flight(uint8_t cmd, uint64_t since, double *daemon,
+			 double *hooks)
+{
+	uint64_t daemon_ns = 0, hook_ns = 0, cmds = 0;
+	struct mat_flight_event *events;
+	unsigned int i, count;
+
+	*daemon = 0;
+	*hooks = 0;
+
+	if (mat_flight_snapshot(&events, &count))
+		return;
+
+	for (i = 0; i < count; i++) {
+		if (events[i].cmd != cmd || events[i].time < since)
+			continue;
+		if (events[i].hook == MAT_FLIGHT_HOOK_NONE) {
+			daemon_ns += events[i].duration;
+			cmds++;
+		} else {
+			hook_ns += events[i].duration;
+		}
+	}
+	free(events);
+
+	if (cmds) {
+		*daemon = (double)daemon_ns / (double)cmds;
+		*hooks = (double)hook_ns / (double)cmds;
+	}
+}
+
+static const struct bench_metric bench_columns[] = {
+	{ "ns_per_op",		"ns/op",	10, 1, 0 },
+	{ "daemon_ns_per_op",	"daemon/op",	10, 1, 0 },
+	{ "backend_ns_per_op",	"backend/op",	10, 1, 0 },
+	{ "reply_bytes_per_op",	"bytes/op",	10, 1, 0 },
+	{ "replies_per_op",	"replies",	 8, 2, 0 },
+};
+
+#define BENCH_COLUMNS	(sizeof(bench_columns) / sizeof(bench_columns[0]))
+
+/*
+ * bench_run() - time one benchmark and print its result
+ * @ctx: benchmark context
+ * @opts: command line options
+ * @b: benchmark to run
+ *
+ * Return: 0 on success, negative errno otherwise
+ */
+static int bench_run(struct bench_ctx *ctx, const struct bench_opts *opts,
+		     const struct bench *b)
+{
+	uint64_t ops = 0, elapsed = 0, msgs = 0, bytes = 0;
+	uint64_t since, start, deadline, m, n;
+	struct bench_metric metrics[BENCH_COLUMNS];
+	unsigned int batches = 0;
+	double daemon, hooks;
+	int ret;
+
+	ctx->replies.error = 0;
+	if (b->setup) {
+		ret = b->setup(ctx);
+		if (ret < 0)
+			goto err;
+	}
+
+	since = bench_now();
+	deadline = bench_deadline(opts, since);
+	do {
+		m = ctx->replies.msgs;
+		n = ctx->replies.bytes;
+		start = bench_now();
+		ret = b->run(ctx);
+		elapsed += bench_now() - start;
+		if (ret < 0)
+			goto err;
+		ops += (uint64_t)ret;
+		msgs += ctx->replies.msgs - m;
+		bytes += ctx->replies.bytes - n;
+		batches++;
+
+		if (b->reset) {
+			ret = b->reset(ctx);
+			if (ret < 0)
+				goto err;
+		}
+	} while (bench_more(opts, batches, deadline));
+
+	bench_flight(b->cmd, since, &daemon, &hooks);
+
+	if (b->teardown) {
+		ret = b->teardown(ctx);
+		if (ret < 0)
+			goto err;
+	}
+
+	memcpy(metrics, bench_columns, sizeof(metrics));
+	metrics[0].value = (double)elapsed / (double)ops;
+	metrics[1].value = daemon;
+	metrics[2].value = hooks;
+	metrics[3].value = (double)bytes / (double)ops;
+	metrics[4].value = (double)msgs / (double)ops;
+	bench_print_result(opts, b->name, NULL, metrics, BENCH_COLUMNS, ops);
+	return 0;
+err:
+	fprintf(stderr, "Error: %s failed: %s\n", b->name, strerror(-ret));
+	return ret;
+}
+
+/*
+ * Behavioural checks, run before the benchmarks so that none of them times
+ * a daemon answering wrongly. The libmatch client talks to the daemon over
+ * an unconnected socket whose send and receive are replaced: a request is
+ * handed to matchd_rx_process() as it is sent and the replies queued by the
+ * send hook are received one message at a time, as from the kernel.
+ */
+#define CHECK_RULES		200
+#define CHECK_SRCS		7	/* distinct source addresses */
+#define CHECK_SHM_RULES		16
+#define CHECK_SHM_WRITES	2000000
+#define CHECK_SHM_READS		100000
+
+struct check_reply {
+	unsigned char *buf;
+	int len;
+};
+
+struct check_queue {
+	struct check_reply *replies;
+	unsigned int head;
+	unsigned int count;
+	unsigned int size;
+};
+
+static struct check_queue check_queue;
+
+static int check_send(struct nl_msg *msg, void *arg)
+{
+	struct nlmsghdr *nlh = nlmsg_hdr(msg);
+	struct check_queue *q = arg;
+	struct check_reply *r;
+
+	if (q->count == q->size) {
+		r = realloc(q->replies, (q->size * 2 + 16) * sizeof(*r));
+		if (!r)
+			return -ENOMEM;
+		q->replies = r;
+		q->size = q->size * 2 + 16;
+	}
+
+	r = &q->replies[q->count];
+	r->buf = malloc(nlh->nlmsg_len);
+	if (!r->buf)
+		return -ENOMEM;
+	memcpy(r->buf, nlh, nlh->nlmsg_len);
+	r->len = (int)nlh->nlmsg_len;
+	q->count++;
+	return r->len;
+}
+
+static int check_sock_send(struct nl_sock *sk __attribute__((unused)),
+			   struct nl_msg *msg)
+{
+	matchd_rx_process(nlmsg_hdr(msg));
+	return (int)nlmsg_hdr(msg)->nlmsg_len;
+}
+
+/* Hand over the oldest reply, libnl frees it */
+static int check_sock_recv(struct nl_sock *sk __attribute__((unused)),
+			   struct sockaddr_nl *nla, unsigned char **buf,
+			   struct ucred **creds __attribute__((unused)))
+{
+	struct check_queue *q = &check_queue;
+	struct check_reply *r;
+
+	if (q->head == q->count) {
+		q->head = 0;
+		q->count = 0;
+		return 0;
+	}
+
+	r = &q->replies[q->head++];
+	memset(nla, 0, sizeof(*nla));
+	nla->nl_family = AF_NETLINK;
+	*buf = r->buf;
+	return r->len;
+}
+
+static struct nl_sock *check_socket(void)
+{
+	struct nl_sock *sk;
+	struct nl_cb *cb;
+
+	sk = nl_socket_alloc();
+	if (!sk)
+		return NULL;
+
+	cb = nl_socket_get_cb(sk);
+	nl_cb_overwrite_send(cb, check_sock_send);
+	nl_cb_overwrite_recv(cb, check_sock_recv);
+	nl_cb_put(cb);
+	return sk;
+}
+
+struct check_ctx {
+	struct nl_sock *sk;
+	struct net_mat_rule rules[CHECK_RULES];
+	struct net_mat_field_ref matches[CHECK_RULES][5];
+	struct net_mat_action actions[CHECK_RULES][2];
+	struct net_mat_action_arg args[CHECK_RULES][2];
+};
+
+static uint32_t check_src(unsigned int n)
+{
+	/* bit 0 is clear so a filter may leave it out of its mask */
+	return 0x0a000000 | (n << 1);
+}
+
+/* Rule uid i + 1, with CHECK_SRCS sources, two protocols and four ports */
+static void check_rule(struct check_ctx *c, unsigned int i)
+{
+	struct net_mat_field_ref *m = c->matches[i];
+	struct net_mat_rule *r = &c->rules[i];
+	uint32_t uid = i + 1;
+
+	memcpy(m, bench_matches, sizeof(c->matches[i]));
+	m[0].type = NET_MAT_FIELD_REF_ATTR_TYPE_U32;
+	m[0].v.u32.value_u32 = 0xc0a80000 | (uid << 8);
+	m[0].v.u32.mask_u32 = 0xffffff00;
+	m[1].type = NET_MAT_FIELD_REF_ATTR_TYPE_U32;
+	m[1].v.u32.value_u32 = check_src(uid % CHECK_SRCS);
+	m[1].v.u32.mask_u32 = 0xffffffff;
+	m[2].type = NET_MAT_FIELD_REF_ATTR_TYPE_U8;
+	m[2].v.u8.value_u8 = uid % 3 ? 6 : 17;
+	m[2].v.u8.mask_u8 = 0xff;
+	m[3].type = NET_MAT_FIELD_REF_ATTR_TYPE_U16;
+	m[3].v.u16.value_u16 = 80;
+	m[3].v.u16.mask_u16 = 0xffff;
+
+	memset(c->args[i], 0, sizeof(c->args[i]));
+	memset(c->actions[i], 0, sizeof(c->actions[i]));
+	c->args[i][0].name = port_str;
+	c->args[i][0].type = NET_MAT_ACTION_ARG_TYPE_U32;
+	c->args[i][0].v.value_u32 = uid % 4 + 1;
+	c->actions[i][0].name = forward_str;
+	c->actions[i][0].uid = 1;
+	c->actions[i][0].args = c->args[i];
+
+	memset(r, 0, sizeof(*r));
+	r->table_id = BENCH_TABLE;
+	r->uid = uid;
+	r->priority = 10;
+	r->matches = m;
+	r->actions = c->actions[i];
+}
+
+/* Compare the uids of a reply, NULL if empty, to the expected ones */
+static int check_uids(const char *what, struct net_mat_rule *got,
+		      const uint32_t *want, unsigned int count)
+{
+	unsigned int n;
+
+	for (n = 0; got && got[n].uid; n++) {
+		if (n >= count || got[n].uid != want[n]) {
+			fprintf(stderr, "Error: check %s: rule %u is %u, "
+				"expected %u\n", what, n, got[n].uid,
+				n < count ? want[n] : 0);
+			return -EPROTO;
+		}
+	}
+
+	if (n != count) {
+		fprintf(stderr, "Error: check %s: %u rules, expected %u\n",
+			what, n, count);
+		return -EPROTO;
+	}
+	return 0;
+}
+
+static struct net_mat_rule *check_get(struct check_ctx *c, uint32_t min,
+				      uint32_t max,
+				      struct net_mat_rule_filter *filter)
+{
+	return match_nl_get_rules_filter(c->sk, BENCH_PID, 0, BENCH_FAMILY,
+					 BENCH_TABLE, min, max, filter);
+}
+
+static void check_put(struct net_mat_rule *rules)
+{
+	unsigned int n;
+
+	for (n = 0; rules && rules[n].uid; n++)
+		;
+	if (rules)
+		match_free_rules(rules, n);
+}
+
+/*
+ * A filter with an exact field is served from the index of the table and
+ * one without from a scan, both must find the rules match_rule_filter()
+ * passes. Sources have bit 0 clear, so masking it out selects the same
+ * rules without an exact field.
+ */
+static int check_filter_index(struct check_ctx *c)
+{
+	struct net_mat_field_ref exact[3], masked[3];
+	struct net_mat_rule_filter filter;
+	struct net_mat_rule *indexed, *scanned;
+	uint32_t want[CHECK_RULES], min, max;
+	unsigned int s, proto, i, n;
+	int err = 0;
+
+	for (s = 0; s < CHECK_SRCS && !err; s++) {
+		for (proto = 0; proto < 2 && !err; proto++) {
+			memset(exact, 0, sizeof(exact));
+			exact[0] = c->matches[0][1];
+			exact[0].instance = 0;
+			exact[0].v.u32.value_u32 = check_src(s);
+			if (proto) {
+				/* not exact, checked on each candidate */
+				exact[1] = c->matches[0][2];
+				exact[1].instance = 0;
+				exact[1].v.u8.value_u8 = 17;
+				exact[1].v.u8.mask_u8 = 0x1f;
+			}
+			memcpy(masked, exact, sizeof(masked));
+			masked[0].v.u32.mask_u32 = 0xfffffffe;
+
+			min = s * 10 + 1;
+			max = CHECK_RULES - s * 10;
+
+			memset(&filter, 0, sizeof(filter));
+			filter.matches = exact;
+			for (i = 0, n = 0; i < CHECK_RULES; i++) {
+				if (c->rules[i].uid >= min &&
+				    c->rules[i].uid <= max &&
+				    match_rule_filter(&c->rules[i], &filter))
+					want[n++] = c->rules[i].uid;
+			}
+			if (!n) {
+				fprintf(stderr, "Error: check filter: no rule "
+					"with source %u\n", s);
+				return -EPROTO;
+			}
+
+			indexed = check_get(c, min, max, &filter);
+			filter.matches = masked;
+			scanned = check_get(c, min, max, &filter);
+
+			err = check_uids("indexed filter", indexed, want, n);
+			if (!err)
+				err = check_uids("scanned filter", scanned,
+						 want, n);
+			check_put(indexed);
+			check_put(scanned);
+		}
+	}
+
+	return err;
+}
+
+/* Few distinct values so that the ranking has ties to break */
+static void check_counters(struct net_mat_rule *rule)
+{
+	rule->packets = (rule->uid * 7) % 13;
+	rule->bytes = (rule->uid % 5) * 100;
+}
+
+static struct check_ctx *check_rank_ctx;
+static uint32_t check_rank_key;
+
+/* Highest key first, ties in uid order */
+static int check_rank_cmp(const void *a, const void *b)
+{
+	struct net_mat_rule *x, *y;
+	uint64_t kx, ky;
+
+	x = &check_rank_ctx->rules[*(const uint32_t *)a - 1];
+	y = &check_rank_ctx->rules[*(const uint32_t *)b - 1];
+	kx = check_rank_key == NET_MAT_RULES_TOP_BYTES ? x->bytes : x->packets;
+	ky = check_rank_key == NET_MAT_RULES_TOP_BYTES ? y->bytes : y->packets;
+
+	if (kx != ky)
+		return kx > ky ? -1 : 1;
+	return x->uid < y->uid ? -1 : x->uid > y->uid;
+}
+
+static int check_top(struct check_ctx *c)
+{
+	static const struct {
+		uint32_t key;
+		uint32_t top;
+		bool udp;
+	} cases[] = {
+		{ NET_MAT_RULES_TOP_PACKETS, 10, false },
+		{ NET_MAT_RULES_TOP_PACKETS, CHECK_RULES + 5, false },
+		{ NET_MAT_RULES_TOP_BYTES, 7, true },
+		{ NET_MAT_RULES_TOP_BYTES, 1, false },
+	};
+	struct net_mat_field_ref udp[2];
+	struct net_mat_rule_filter filter;
+	struct net_mat_rule *got;
+	uint32_t want[CHECK_RULES];
+	unsigned int i, k, n;
+	int err = 0;
+
+	bench_backend.get_rule_counters = check_counters;
+	for (i = 0; i < CHECK_RULES; i++)
+		check_counters(&c->rules[i]);
+
+	memset(udp, 0, sizeof(udp));
+	udp[0] = c->matches[0][2];
+	udp[0].instance = 0;
+	udp[0].v.u8.value_u8 = 17;
+	udp[0].v.u8.mask_u8 = 0x1f;
+
+	check_rank_ctx = c;
+	for (k = 0; k < sizeof(cases) / sizeof(cases[0]) && !err; k++) {
+		memset(&filter, 0, sizeof(filter));
+		filter.matches = cases[k].udp ? udp : NULL;
+		filter.top = cases[k].top;
+		filter.top_key = cases[k].key;
+
+		for (i = 0, n = 0; i < CHECK_RULES; i++) {
+			if (match_rule_filter(&c->rules[i], &filter))
+				want[n++] = c->rules[i].uid;
+		}
+		check_rank_key = cases[k].key;
+		qsort(want, n, sizeof(want[0]), check_rank_cmp);
+		if (n > cases[k].top)
+			n = cases[k].top;
+
+		got = check_get(c, 0, 0, &filter);
+		err = check_uids("top", got, want, n);
+		check_put(got);
+	}
+
+	bench_backend.get_rule_counters = NULL;
+	for (i = 0; i < CHECK_RULES; i++) {
+		c->rules[i].packets = 0;
+		c->rules[i].bytes = 0;
+	}
+	return err;
+}
+
+static int check_rule_cmp(struct check_ctx *c)
+{
+	struct net_mat_field_ref m[5];
+	struct net_mat_action_arg arg[2];
+	struct net_mat_action act[2];
+	struct net_mat_rule r;
+	char other[] = "other";
+
+	r = c->rules[0];
+	if (match_rule_cmp(&c->rules[0], &r))
+		goto err;
+
+	/* argument names, uid and counters are not compared */
+	memcpy(arg, c->args[0], sizeof(arg));
+	memcpy(act, c->actions[0], sizeof(act));
+	arg[0].name = other;
+	act[0].args = arg;
+	r.actions = act;
+	r.uid = 2;
+	r.packets = 1;
+	if (match_rule_cmp(&c->rules[0], &r))
+		goto err;
+
+	arg[0].v.value_u32++;
+	if (!match_rule_cmp(&c->rules[0], &r))
+		goto err;
+	arg[0].v.value_u32--;
+
+	r.priority++;
+	if (!match_rule_cmp(&c->rules[0], &r))
+		goto err;
+	r.priority--;
+
+	memcpy(m, c->matches[0], sizeof(m));
+	r.matches = m;
+	m[3].v.u16.mask_u16 = 0xff00;
+	if (!match_rule_cmp(&c->rules[0], &r))
+		goto err;
+	m[3].v.u16.mask_u16 = 0xffff;
+
+	m[3].header = 0;
+	if (!match_rule_cmp(&c->rules[0], &r) ||
+	    !match_rule_cmp(&r, &c->rules[0]))
+		goto err;
+
+	return 0;
+err:
+	fprintf(stderr, "Error: check rule_cmp: unexpected result\n");
+	return -EPROTO;
+}
+
+struct check_apply {
+	enum match_nl_apply_op ops[CHECK_RULES * 2];
+	unsigned int changes;
+	int err;
+};
+
+static void check_apply_cb(enum match_nl_apply_op op, struct net_mat_rule *rule,
+			   int err, void *arg)
+{
+	struct check_apply *a = arg;
+
+	a->changes++;
+	if (rule->uid >= CHECK_RULES * 2 || a->ops[rule->uid] != op || err)
+		a->err = -EPROTO;
+}
+
+/*
+ * Converge the table from the installed rules to a set where ten rules
+ * change priority, ten change an argument, ten are gone and fifteen are
+ * new, first as a dry run, then for real and once more to find nothing
+ * left to do.
+ */
+static int check_apply(struct check_ctx *c)
+{
+	static const uint32_t tables[] = { BENCH_TABLE, 0 };
+	static struct net_mat_rule desired[CHECK_RULES + 15];
+	static struct net_mat_action_arg args[10][2];
+	static struct net_mat_action actions[10][2];
+	struct match_nl_apply_stats stats;
+	struct check_apply a;
+	struct net_mat_rule *got = NULL;
+	unsigned int i, k, n = 0, count = 0, pass;
+	int err;
+
+	memset(&a, 0, sizeof(a));
+	memset(&stats, 0, sizeof(stats));
+	for (i = 0; i < CHECK_RULES; i++) {
+		if (i >= 20 && i < 30) {
+			a.ops[i + 1] = MATCH_NL_APPLY_DELETE;
+			continue;
+		}
+		desired[n] = c->rules[i];
+		if (i < 10) {
+			desired[n].priority = 20;
+			a.ops[i + 1] = MATCH_NL_APPLY_UPDATE;
+		} else if (i < 20) {
+			memcpy(args[i - 10], c->args[i], sizeof(args[0]));
+			memcpy(actions[i - 10], c->actions[i],
+			       sizeof(actions[0]));
+			args[i - 10][0].v.value_u32 += 10;
+			actions[i - 10][0].args = args[i - 10];
+			desired[n].actions = actions[i - 10];
+			a.ops[i + 1] = MATCH_NL_APPLY_UPDATE;
+		}
+		n++;
+	}
+	for (i = 0; i < 15; i++) {
+		desired[n] = c->rules[i];
+		desired[n].uid = CHECK_RULES + 1 + i;
+		a.ops[desired[n].uid] = MATCH_NL_APPLY_ADD;
+		n++;
+	}
+
+	for (pass = 0; pass < 3; pass++) {
+		a.changes = 0;
+		err = match_nl_apply_rules(c->sk, BENCH_PID, 0, BENCH_FAMILY,
+					   desired, n, tables,
+					   pass ? 0 : MATCH_NL_APPLY_DRY_RUN,
+					   check_apply_cb, &a, &stats);
+		if (err || a.err)
+			goto err;
+
+		if (pass == 2) {
+			if (a.changes || stats.unchanged != n)
+				goto err;
+			break;
+		}
+		if (a.changes != 45 || stats.unchanged != CHECK_RULES - 30 ||
+		    stats.updated != 20 || stats.deleted != 10 ||
+		    stats.added != 15 || stats.failed)
+			goto err;
+	}
+
+	/* the daemon now holds the desired rules */
+	err = match_nl_read_rules(c->sk, BENCH_PID, 0, BENCH_FAMILY,
+				  BENCH_TABLE, 0, 0, &got, &count);
+	if (err || count != n)
+		goto err;
+	for (i = 0; i < count; i++) {
+		for (k = 0; k < n && desired[k].uid != got[i].uid; k++)
+			;
+		if (k == n || match_rule_cmp(&got[i], &desired[k]))
+			goto err;
+	}
+	match_free_rules(got, count);
+	got = NULL;
+
+	/* an empty set flushes the table for the benchmarks */
+	err = match_nl_apply_rules(c->sk, BENCH_PID, 0, BENCH_FAMILY,
+				   NULL, 0, tables, 0, NULL, NULL, &stats);
+	if (err || stats.deleted != n)
+		goto err;
+
+	return 0;
+err:
+	if (got)
+		match_free_rules(got, count);
+	fprintf(stderr, "Error: check apply: %d, %u changes, %u unchanged "
+		"%u added %u updated %u deleted %u failed\n", err ? err : a.err,
+		a.changes, stats.unchanged, stats.added, stats.updated,
+		stats.deleted, stats.failed);
+	return -EPROTO;
+}
+
+struct check_shm_reader {
+	struct mat_shm *shm;
+	int stop;
+	uint64_t reads;
+	uint64_t torn;
+};
+
+/* Every field of a record written by check_shm() holds the same count */
+static void *check_shm_read(void *arg)
+{
+	struct check_shm_reader *rd = arg;
+	struct mat_shm_rule rule;
+	uint32_t uid;
+
+	while (!__atomic_load_n(&rd->stop, __ATOMIC_ACQUIRE)) {
+		for (uid = 1; uid <= CHECK_SHM_RULES; uid++) {
+			if (mat_shm_read_rule(rd->shm, 1, uid, &rule))
+				continue;
+			__atomic_add_fetch(&rd->reads, 1, __ATOMIC_RELAXED);
+			if (rule.hw_ruleid != rule.priority ||
+			    rule.packets != rule.priority ||
+			    rule.bytes != (uint64_t)rule.priority * 64)
+				rd->torn++;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Rules are rewritten, deleted and moved by table resizes while another
+ * thread reads them, each record read must be one that was written.
+ */
+static int check_shm(void)
+{
+	struct check_shm_reader rd = { .stop = 0 };
+	struct mat_shm *shm = NULL;
+	struct net_mat_tbl table;
+	struct net_mat_rule rule;
+	char path[64], name[] = "check";
+	pthread_t reader;
+	uint32_t i;
+	int err;
+
+	snprintf(path, sizeof(path), "/dev/shm/matchd_bench.%d", (int)getpid());
+	err = mat_shm_create(path, 4, 1024, 1, &shm);
+	if (err) {
+		fprintf(stderr, "Error: check shm: cannot create %s\n", path);
+		return err;
+	}
+
+	memset(&table, 0, sizeof(table));
+	table.uid = 1;
+	table.name = name;
+	table.size = 64;
+	mat_shm_set_table(shm, &table);
+
+	err = mat_shm_open(path, &rd.shm);
+	if (err)
+		goto out;
+
+	err = -pthread_create(&reader, NULL, check_shm_read, &rd);
+	if (err)
+		goto out;
+
+	memset(&rule, 0, sizeof(rule));
+	rule.table_id = 1;
+	/* keep writing until the reader, which may start late, read enough */
+	for (i = 0; i < CHECK_SHM_WRITES ||
+		    __atomic_load_n(&rd.reads, __ATOMIC_RELAXED) < CHECK_SHM_READS;
+	     i++) {
+		rule.uid = i % CHECK_SHM_RULES + 1;
+		rule.priority = i;
+		rule.hw_ruleid = i;
+		rule.packets = i;
+		rule.bytes = (uint64_t)i * 64;
+		mat_shm_set_rule(shm, &rule);
+
+		if (i % 97 == 0)
+			mat_shm_del_rule(shm, 1, rule.uid);
+		if (i % 1000 == 999) {
+			/* grow and shrink, moving the rules between blocks */
+			table.size = table.size == 64 ? 512 : 64;
+			mat_shm_set_table(shm, &table);
+		}
+	}
+
+	__atomic_store_n(&rd.stop, 1, __ATOMIC_RELEASE);
+	pthread_join(reader, NULL);
+
+	if (rd.torn || !rd.reads) {
+		fprintf(stderr, "Error: check shm: %llu torn records out of "
+			"%llu\n", (unsigned long long)rd.torn,
+			(unsigned long long)rd.reads);
+		err = -EPROTO;
+	}
+out:
+	mat_shm_close(rd.shm);
+	mat_shm_destroy(shm);
+	return err;
+}
+
+/*
+ * bench_check() - check the daemon answers before timing it
+ * @ctx: benchmark context, its send hook is restored
+ *
+ * Return: 0 if every check passed, negative errno otherwise
+ */
+static int bench_check(struct bench_ctx *ctx)
+{
+	struct check_ctx *c;
+	unsigned int i;
+	int err;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return -ENOMEM;
+
+	c->sk = check_socket();
+	if (!c->sk) {
+		free(c);
+		return -ENOMEM;
+	}
+
+	matchd_set_send(check_send, &check_queue);
+
+	for (i = 0; i < CHECK_RULES; i++)
+		check_rule(c, i);
+	err = match_nl_set_del_rules_bulk(c->sk, BENCH_PID, 0, BENCH_FAMILY,
+					  c->rules, CHECK_RULES,
+					  NET_MAT_TABLE_CMD_SET_RULES, NULL);
+	if (err)
+		fprintf(stderr, "Error: check: cannot install rules\n");
+
+	if (!err)
+		err = check_filter_index(c);
+	if (!err)
+		err = check_top(c);
+	if (!err)
+		err = check_rule_cmp(c);
+	if (!err)
+		err = check_apply(c);
+	if (!err)
+		err = check_shm();
+
+	matchd_set_send(bench_send, &ctx->replies);
+	for (i = check_queue.head; i < check_queue.count; i++)
+		free(check_queue.replies[i].buf);
+	free(check_queue.replies);
+	memset(&check_queue, 0, sizeof(check_queue));
+	nl_socket_free(c->sk);
+	free(c);
+	return err;
+}
+
+static int bench_ctx_init(struct bench_ctx *ctx)
+{
+	unsigned int i;
+
+	ctx->get_headers = bench_request(NET_MAT_TABLE_CMD_GET_HEADERS, 0);
+	ctx->get_actions = bench_request(NET_MAT_TABLE_CMD_GET_ACTIONS, 0);
+	ctx->get_tables = bench_request(NET_MAT_TABLE_CMD_GET_TABLES, 0);
+	ctx->get_hdr_graph = bench_request(NET_MAT_TABLE_CMD_GET_HDR_GRAPH, 0);
+	ctx->get_tbl_graph = bench_request(NET_MAT_TABLE_CMD_GET_TABLE_GRAPH, 0);
+	ctx->get_generation = bench_request(NET_MAT_TABLE_CMD_GET_GENERATION, 0);
+	ctx->get_ports = bench_request(NET_MAT_PORT_CMD_GET_PORTS, 0);
+	ctx->get_stats = bench_request(NET_MAT_DAEMON_CMD_GET_STATS, 0);
+	ctx->get_rules = bench_get_rules_request(NET_MAT_RULES_ENC_NLA);
+	ctx->get_rules_compact =
+		bench_get_rules_request(NET_MAT_RULES_ENC_COMPACT);
+	ctx->set_bulk = bench_rules_request(NET_MAT_TABLE_CMD_SET_RULES, 1,
+					    BENCH_BULK_RULES);
+	ctx->del_bulk = bench_rules_request(NET_MAT_TABLE_CMD_DEL_RULES, 1,
+					    BENCH_BULK_RULES);
+	if (!ctx->get_headers || !ctx->get_actions || !ctx->get_tables ||
+	    !ctx->get_hdr_graph || !ctx->get_tbl_graph ||
+	    !ctx->get_generation || !ctx->get_ports || !ctx->get_stats ||
+	    !ctx->get_rules || !ctx->get_rules_compact || !ctx->set_bulk ||
+	    !ctx->del_bulk)
+		return -ENOMEM;
+
+	for (i = 0; i < BENCH_GET_RULES; i++) {
+		ctx->set_rule[i] = bench_rules_request(NET_MAT_TABLE_CMD_SET_RULES,
+						       i + 1, 1);
+		ctx->del_rule[i] = bench_rules_request(NET_MAT_TABLE_CMD_DEL_RULES,
+						       i + 1, 1);
+		if (!ctx->set_rule[i] || !ctx->del_rule[i])
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+static void bench_ctx_free(struct bench_ctx *ctx)
+{
+	unsigned int i;
+
+	nlmsg_free(ctx->get_headers);
+	nlmsg_free(ctx->get_actions);
+	nlmsg_free(ctx->get_tables);
+	nlmsg_free(ctx->get_hdr_graph);
+	nlmsg_free(ctx->get_tbl_graph);
+	nlmsg_free(ctx->get_generation);
+	nlmsg_free(ctx->get_ports);
+	nlmsg_free(ctx->get_stats);
+	nlmsg_free(ctx->get_rules);
+	nlmsg_free(ctx->get_rules_compact);
+	nlmsg_free(ctx->set_bulk);
+	nlmsg_free(ctx->del_bulk);
+	for (i = 0; i < BENCH_GET_RULES; i++) {
+		nlmsg_free(ctx->set_rule[i]);
+		nlmsg_free(ctx->del_rule[i]);
+	}
+	free(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_opts opts;
+	struct bench_ctx *ctx;
+	unsigned int i;
+	int err;
+
+	err = bench_parse_opts(argc, argv, "matchd_bench", "name", &opts);
+	if (err)
+		return err < 0 ? err : 0;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return -ENOMEM;
+
+	/* no socket, every reply goes through the send hook */
+	matchd_set_send(bench_send, &ctx->replies);
+	err = matchd_init(NULL, BENCH_FAMILY, bench_str, NULL);
+	if (err) {
+		fprintf(stderr, "Error: unable to start the bench backend\n");
+		goto out;
+	}
+
+	err = bench_ctx_init(ctx);
+	if (err) {
+		fprintf(stderr, "Error: unable to build requests\n");
+		goto out_uninit;
+	}
+
+	err = bench_check(ctx);
+	if (err)
+		goto out_uninit;
+
+	bench_print_header(&opts, false, bench_columns, BENCH_COLUMNS);
+
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		if (opts.filter && !strstr(benches[i].name, opts.filter))
+			continue;
+		err = bench_run(ctx, &opts, &benches[i]);
+		if (err)
+			break;
+	}
+
+out_uninit:
+	matchd_uninit();
+out:
+	matchd_set_send(NULL, NULL);
+	bench_ctx_free(ctx);
+	return err;
+}
@@ -0,0 +1,219 @@
+/*******************************************************************************
+
+  MATCH Library - Benchmark of the rule decoders
+  Copyright (c) <2015>, Intel Corporation
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libnl3/netlink/netlink.h>
+#include <libnl3/netlink/attr.h>
+#include <libnl3/netlink/msg.h>
+
+#include "if_match.h"
+#include "matchlib.h"
+#include "matstream.h"
+#include "bench.h"
+
+/* A NET_MAT_RULES nest is limited to 64KiB, keep a batch well below it */
+#define BENCH_RULES 200
+#define BENCH_ITERATIONS 200
+
+static struct nl_msg *bench_build_rules(unsigned int encoding)
+{
+	struct net_mat_field_ref matches[3];
+	struct net_mat_action_arg args[2];
+	struct net_mat_action actions[2];
+	struct net_mat_rule rule;
+	char arg_name[] = "port";
+	char act_name[] = "forward_to_port";
+	struct nl_msg *msg;
+	struct nlattr *nest;
+	unsigned int i;
+
+	memset(matches, 0, sizeof(matches));
+	memset(args, 0, sizeof(args));
+	memset(actions, 0, sizeof(actions));
+
+	matches[0].instance = 1;
+	matches[0].header = 1;
+	matches[0].field = 1;
+	matches[0].mask_type = NET_MAT_MASK_TYPE_MASK;
+	matches[0].type = NET_MAT_FIELD_REF_ATTR_TYPE_U64;
+	matches[0].v.u64.mask_u64 = 0xffffffffffffULL;
+
+	matches[1].instance = 1;
+	matches[1].header = 1;
+	matches[1].field = 2;
+	matches[1].mask_type = NET_MAT_MASK_TYPE_MASK;
+	matches[1].type = NET_MAT_FIELD_REF_ATTR_TYPE_U16;
+	matches[1].v.u16.value_u16 = 0x0800;
+	matches[1].v.u16.mask_u16 = 0xffff;
+
+	args[0].name = arg_name;
+	args[0].type = NET_MAT_ACTION_ARG_TYPE_U32;
+	args[0].v.value_u32 = 1;
+
+	actions[0].uid = 1;
+	actions[0].name = act_name;
+	actions[0].args = args;
+
+	msg = nlmsg_alloc_size(128 * 1024);
+	if (!msg)
+		return NULL;
+
+	if (!nlmsg_put(msg, 0, 0, NLMSG_MIN_TYPE, 0, 0))
+		goto nla_put_failure;
+
+	if (encoding == NET_MAT_RULES_ENC_COMPACT)
+		nest = match_put_rules_compact_start(msg);
+	else
+		nest = nla_nest_start(msg, NET_MAT_RULES);
+	if (!nest)
+		goto nla_put_failure;
+
+	for (i = 1; i <= BENCH_RULES; i++) {
+		memset(&rule, 0, sizeof(rule));
+		rule.table_id = 1;
+		rule.uid = i;
+		rule.priority = 10;
+		rule.matches = matches;
+		rule.actions = actions;
+		matches[0].v.u64.value_u64 = 0x001122334400ULL + i;
+
+		if (encoding == NET_MAT_RULES_ENC_COMPACT) {
+			if (match_put_rule_compact(msg, nest, &rule))
+				goto nla_put_failure;
+		} else if (match_put_rule(msg, &rule)) {
+			goto nla_put_failure;
+		}
+	}
+
+	if (encoding == NET_MAT_RULES_ENC_COMPACT)
+		match_put_rules_compact_end(msg, nest);
+	else
+		nla_nest_end(msg, nest);
+
+	return msg;
+
+nla_put_failure:
+	nlmsg_free(msg);
+	return NULL;
+}
+
+/*
+ * bench_decode() - time decoding a batch of rules
+ * @matsp: stream the decoded rules are printed to, NULL for a quiet decode
+ * @attr: the NET_MAT_RULES or NET_MAT_RULES_COMPACT attribute to decode
+ *
+ * Return: average decode time per rule in nanoseconds
+ */
+static uint64_t bench_decode(struct mat_stream *matsp, struct nlattr *attr)
+{
+	struct mat_arena *arena;
+	struct net_mat_rule *rules;
+	uint64_t start, total = 0;
+	unsigned int i;
+
+	arena = mat_arena_create(0);
+	if (!arena)
+		return 0;
+
+	for (i = 0; i < BENCH_ITERATIONS; i++) {
+		start = bench_now();
+		if (match_get_rules_arena(matsp, attr, arena, &rules, NULL)) {
+			fprintf(stderr, "Error: match_get_rules_arena() failed\n");
+			break;
+		}
+		total += bench_now() - start;
+		mat_arena_reset(arena);
+	}
+
+	mat_arena_destroy(arena);
+	return total / ((uint64_t)BENCH_ITERATIONS * BENCH_RULES);
+}
+
+static int bench_encoding(const char *name, unsigned int encoding,
+			  struct mat_stream *devnull)
+{
+	uint64_t quiet, verbose;
+	struct nl_msg *msg;
+	struct nlattr *attr;
+
+	msg = bench_build_rules(encoding);
+	if (!msg) {
+		fprintf(stderr, "Error: unable to build %s rules message\n", name);
+		return -ENOMEM;
+	}
+
+	attr = nlmsg_find_attr(nlmsg_hdr(msg), 0,
+			       encoding == NET_MAT_RULES_ENC_COMPACT ?
+			       NET_MAT_RULES_COMPACT : NET_MAT_RULES);
+	if (!attr) {
+		nlmsg_free(msg);
+		return -EINVAL;
+	}
+
+	quiet = bench_decode(NULL, attr);
+	verbose = bench_decode(devnull, attr);
+
+	printf("%s encoding\n", name);
+	printf("  size:     %8u bytes/rule\n", (unsigned int)nla_len(attr) / BENCH_RULES);
+	printf("  quiet:    %8llu ns/rule\n", (unsigned long long)quiet);
+	printf("  printing: %8llu ns/rule\n", (unsigned long long)verbose);
+
+	nlmsg_free(msg);
+	return 0;
+}
+
+int main(void)
+{
+	struct mat_stream *devnull;
+	FILE *fp;
+	int err;
+
+	fp = fopen("/dev/null", "w");
+	devnull = fp ? mat_stream_file(fp) : NULL;
+	if (!devnull) {
+		fprintf(stderr, "Error: unable to open /dev/null stream\n");
+		return -ENOMEM;
+	}
+
+	printf("rule decode, %u rules x %u iterations\n",
+	       BENCH_RULES, BENCH_ITERATIONS);
+
+	err = bench_encoding("netlink", NET_MAT_RULES_ENC_NLA, devnull);
+	if (!err)
+		err = bench_encoding("compact", NET_MAT_RULES_ENC_COMPACT,
+				     devnull);
+
+	fclose(fp);
+	return err;
+}